@@ -0,0 +1,134 @@
+#include "bench_util.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define BENCH_MAX_COUNT 100000000.0 // The largest HIBP counts are in the tens of millions
+
+int bench_parse_format(const char *name, BenchFormat *format) {
+    if (strcmp(name, "csv") == 0) {
+        *format = BENCH_FORMAT_CSV;
+    } else if (strcmp(name, "json") == 0) {
+        *format = BENCH_FORMAT_JSON;
+    } else {
+        return -1;
+    }
+    return 0;
+}
+
+FILE *bench_open_output(const char *path) {
+    if (path == NULL || strcmp(path, "-") == 0) {
+        return stdout;
+    }
+    FILE *out = fopen(path, "w");
+    if (out == NULL) {
+        fprintf(stderr, "Could not open %s for writing\n", path);
+    }
+    return out;
+}
+
+void bench_report_open(BenchReport *report, FILE *out, BenchFormat format,
+                       const char *const *columns, int column_count) {
+    memset(report, 0, sizeof(*report));
+    report->out = out;
+    report->format = format;
+    report->columns = columns;
+    report->column_count = column_count;
+
+    if (format == BENCH_FORMAT_CSV) {
+        for (int c = 0; c < column_count; c++) {
+            fprintf(report->out, "%s%s", c ? "," : "", columns[c]);
+        }
+        fputc('\n', report->out);
+    } else {
+        fputc('[', report->out);
+    }
+}
+
+// Numbers stay unquoted in JSON so the results load as numeric fields
+static int is_number(const char *value) {
+    char *end;
+    if (*value == '\0') {
+        return 0;
+    }
+    strtod(value, &end);
+    return *end == '\0';
+}
+
+void bench_report_row(BenchReport *report, const char *const *values) {
+    if (report->format == BENCH_FORMAT_CSV) {
+        for (int c = 0; c < report->column_count; c++) {
+            fprintf(report->out, "%s%s", c ? "," : "", values[c]);
+        }
+        fputc('\n', report->out);
+    } else {
+        fprintf(report->out, "%s\n  {", report->rows ? "," : "");
+        for (int c = 0; c < report->column_count; c++) {
+            const char *quote = is_number(values[c]) ? "" : "\"";
+            fprintf(report->out, "%s\"%s\": %s%s%s", c ? ", " : "", report->columns[c], quote, values[c], quote);
+        }
+        fputc('}', report->out);
+    }
+    report->rows++;
+    fflush(report->out);
+}
+
+void bench_report_close(BenchReport *report) {
+    if (report->format == BENCH_FORMAT_JSON) {
+        fputs(report->rows ? "\n]\n" : "]\n", report->out);
+    }
+    if (report->out != stdout) {
+        fclose(report->out);
+    }
+    report->out = NULL;
+}
+
+uint64_t bench_now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+uint64_t bench_percentile(const uint64_t *sorted, size_t count, double percent) {
+    if (count == 0) {
+        return 0;
+    }
+    size_t rank = (size_t)(percent / 100.0 * count + 0.999999);
+    if (rank < 1) {
+        rank = 1;
+    }
+    if (rank > count) {
+        rank = count;
+    }
+    return sorted[rank - 1];
+}
+
+int bench_compare_u64(const void *a, const void *b) {
+    uint64_t x = *(const uint64_t *)a;
+    uint64_t y = *(const uint64_t *)b;
+    return (x > y) - (x < y);
+}
+
+uint64_t bench_random(uint64_t *state) {
+    uint64_t z = (*state += 0x9E3779B97F4A7C15ULL);
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+    return z ^ (z >> 31);
+}
+
+// Hits and misses use different prefixes, so no miss can collide with a generated password
+int bench_password(uint64_t seed, uint64_t index, char *out, size_t size) {
+    return snprintf(out, size, "pwned-%llu-%llu", (unsigned long long)seed, (unsigned long long)index);
+}
+
+int bench_miss_password(uint64_t seed, uint64_t index, char *out, size_t size) {
+    return snprintf(out, size, "fresh-%llu-%llu", (unsigned long long)seed, (unsigned long long)index);
+}
+
+uint32_t bench_count(uint64_t seed, uint64_t index) {
+    uint64_t state = seed * 0xD1B54A32D192ED03ULL ^ index;
+    double u = (bench_random(&state) >> 11) * (1.0 / 9007199254740992.0); // [0, 1)
+    double count = 1.0 / (1.0 - u);                                      // (1, inf)
+    return (uint32_t)(count < BENCH_MAX_COUNT ? count : BENCH_MAX_COUNT);
+}
@@ -0,0 +1,76 @@
+#ifndef BENCH_UTIL_H
+#define BENCH_UTIL_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stddef.h>
+
+// Defaults shared by the generator and the benchmarks so their datasets line up
+#define BENCH_DEFAULT_SEED 1
+#define BENCH_PASSWORD_MAX 48
+
+// Output formats for benchmark results
+typedef enum {
+    BENCH_FORMAT_CSV,
+    BENCH_FORMAT_JSON
+} BenchFormat;
+
+/**
+ * Writer for a table of benchmark results.
+ *
+ * Every row carries one value per column, already formatted as text. CSV output
+ * starts with a header line; JSON output is an array with one object per row, where
+ * values that parse as numbers are written unquoted.
+ *
+ * Components:
+ * - out (FILE*): Destination, stdout or the file named with --output.
+ * - format (BenchFormat): CSV or JSON.
+ * - columns (const char* const*): Column names, column_count of them.
+ * - rows (int): Rows written so far.
+ */
+typedef struct {
+    FILE *out;
+    BenchFormat format;
+    const char *const *columns;
+    int column_count;
+    int rows;
+} BenchReport;
+
+// Parses "csv" or "json"; returns 0 on success, -1 for anything else
+int bench_parse_format(const char *name, BenchFormat *format);
+
+// Opens path for results, or returns stdout when path is NULL or "-"; NULL on failure
+FILE *bench_open_output(const char *path);
+
+// Starts a report on out and writes the CSV header or opening bracket
+void bench_report_open(BenchReport *report, FILE *out, BenchFormat format,
+                       const char *const *columns, int column_count);
+
+// Writes one row of column_count values
+void bench_report_row(BenchReport *report, const char *const *values);
+
+// Finishes the document and closes the file unless it is stdout
+void bench_report_close(BenchReport *report);
+
+// Monotonic clock in nanoseconds
+uint64_t bench_now_ns(void);
+
+// Nearest-rank percentile (0-100) of an ascending array of samples
+uint64_t bench_percentile(const uint64_t *sorted, size_t count, double percent);
+
+// qsort comparator for uint64_t samples
+int bench_compare_u64(const void *a, const void *b);
+
+// SplitMix64 step: the single source of randomness for generated datasets
+uint64_t bench_random(uint64_t *state);
+
+// Writes the i-th synthetic password of a dataset; these are the hits of the dump
+int bench_password(uint64_t seed, uint64_t index, char *out, size_t size);
+
+// Writes the i-th password that is guaranteed not to be in the dump
+int bench_miss_password(uint64_t seed, uint64_t index, char *out, size_t size);
+
+// Heavy-tailed breach count for the i-th password (P(count >= c) is about 1/c)
+uint32_t bench_count(uint64_t seed, uint64_t index);
+
+#endif // BENCH_UTIL_H
@@ -0,0 +1,120 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "deep_check.h"
+
+/*
+ * Compares lookup throughput with and without the fuse filter pre-check.
+ *
+ * Usage: filter_bench <database_path> [lookups]
+ *
+ * Misses are random 20-byte hashes (absent with overwhelming probability), hits
+ * are hashes sampled from the store itself. Each mix is timed through
+ * lookup_hash() with the filter enabled and then with it switched off.
+ */
+
+#define DEFAULT_LOOKUPS 1000000
+
+// xorshift64: cheap, reproducible key material for the benchmark
+static uint64_t next_random(uint64_t *state) {
+    *state ^= *state << 13;
+    *state ^= *state >> 7;
+    *state ^= *state << 17;
+    return *state;
+}
+
+// Keeps the first record of a prefix as a known hit
+typedef struct {
+    unsigned char *slot;
+    int found;
+} Sample;
+
+static int take_first(const unsigned char *binary_hash, int count, void *ctx) {
+    (void)count;
+    Sample *sample = ctx;
+    memcpy(sample->slot, binary_hash, SHA_DIGEST_LENGTH);
+    sample->found = 1;
+    return 1;
+}
+
+static double now_seconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// Runs every lookup once and prints the throughput for one configuration
+static void run(PwnedDB *db, const unsigned char *hashes, int lookups, const char *label) {
+    int found = 0, count;
+    double start = now_seconds();
+    for (int i = 0; i < lookups; i++) {
+        found += lookup_hash(db, hashes + (size_t)i * SHA_DIGEST_LENGTH, &count) == 1;
+    }
+    double elapsed = now_seconds() - start;
+    printf("%-24s %10.0f lookups/s  %8.3f us/lookup  (%d found)\n",
+           label, lookups / elapsed, elapsed * 1e6 / lookups, found);
+}
+
+int main(int argc, char *argv[]) {
+    if (argc < 2) {
+        fprintf(stderr, "Usage: %s <database_path> [lookups]\n", argv[0]);
+        return 1;
+    }
+    int lookups = argc > 2 ? atoi(argv[2]) : DEFAULT_LOOKUPS;
+    if (lookups <= 0) {
+        lookups = DEFAULT_LOOKUPS;
+    }
+
+    PwnedDB db;
+    if (init_db(&db, argv[1]) != 0) {
+        return 1;
+    }
+    if (!db.has_filter) {
+        fprintf(stderr, "No %s%s found; build one with create_database --filter\n", argv[1], FUSE_FILE_SUFFIX);
+        close_db(&db);
+        return 1;
+    }
+
+    unsigned char *misses = malloc((size_t)lookups * SHA_DIGEST_LENGTH);
+    unsigned char *hits = malloc((size_t)lookups * SHA_DIGEST_LENGTH);
+    if (misses == NULL || hits == NULL) {
+        fprintf(stderr, "Out of memory\n");
+        return 1;
+    }
+
+    uint64_t state = 0x9E3779B97F4A7C15ULL;
+    for (size_t i = 0; i < (size_t)lookups * SHA_DIGEST_LENGTH; i += 4) {
+        uint32_t word = (uint32_t)next_random(&state);
+        memcpy(misses + i, &word, 4);
+    }
+
+    // Hits are sampled through range scans, which a packed store cannot answer
+    int sampled = 0;
+    for (int attempts = 0; db.backend != DB_BACKEND_PACKED && sampled < lookups && attempts < lookups * 4; attempts++) {
+        uint32_t prefix = next_random(&state) & ((1u << RANGE_PREFIX_BITS) - 1);
+        Sample sample = {hits + (size_t)sampled * SHA_DIGEST_LENGTH, 0};
+        if (lookup_range(&db, prefix, take_first, &sample) == 0 && sample.found) {
+            sampled++;
+        }
+    }
+
+    printf("Backend: %s, filter: %llu keys\n", db.backend == DB_BACKEND_FLAT ? "flat" : db.backend == DB_BACKEND_PACKED ? "packed" : "sqlite",
+           (unsigned long long)db.filter.key_count);
+    run(&db, misses, lookups, "miss, filter");
+    db.has_filter = 0;
+    run(&db, misses, lookups, "miss, no filter");
+    if (sampled > 0) {
+        db.has_filter = 1;
+        run(&db, hits, sampled, "hit, filter");
+        db.has_filter = 0;
+        run(&db, hits, sampled, "hit, no filter");
+    }
+    db.has_filter = 1;
+
+    free(misses);
+    free(hits);
+    close_db(&db);
+    return 0;
+}
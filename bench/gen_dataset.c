@@ -0,0 +1,82 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <openssl/sha.h>
+
+#include "bench_util.h"
+#include "flat_store.h"
+#include "hex.h"
+
+/*
+ * Writes a reproducible synthetic dump in the HIBP "HASH:COUNT" format.
+ *
+ * Usage: gen_dataset <output.txt> <records> [--seed N]
+ *
+ * Record i is the SHA-1 of bench_password(seed, i) with count bench_count(seed, i),
+ * so the lookup benchmark can regenerate any hit from the seed alone. Lines are
+ * sorted by hash like the published files. The same seed and size always produce
+ * a byte-identical file.
+ */
+
+static int compare_records(const void *a, const void *b) {
+    return memcmp(((const FlatRecord *)a)->hash, ((const FlatRecord *)b)->hash, FLAT_HASH_SIZE);
+}
+
+int main(int argc, char *argv[]) {
+    if (argc < 3) {
+        fprintf(stderr, "Usage: %s <output.txt> <records> [--seed N]\n", argv[0]);
+        return 1;
+    }
+    const char *out_path = argv[1];
+    char *end;
+    unsigned long long records = strtoull(argv[2], &end, 10);
+    if (*end != '\0' || records == 0) {
+        fprintf(stderr, "Invalid record count: %s\n", argv[2]);
+        return 1;
+    }
+    uint64_t seed = BENCH_DEFAULT_SEED;
+    for (int i = 3; i < argc; i++) {
+        if (strcmp(argv[i], "--seed") == 0 && i + 1 < argc) {
+            seed = strtoull(argv[++i], NULL, 10);
+        } else {
+            fprintf(stderr, "Unknown option: %s\n", argv[i]);
+            return 1;
+        }
+    }
+
+    FlatRecord *table = malloc(records * sizeof(FlatRecord));
+    if (table == NULL) {
+        fprintf(stderr, "Out of memory for %llu records\n", records);
+        return 1;
+    }
+    char password[BENCH_PASSWORD_MAX];
+    for (uint64_t i = 0; i < records; i++) {
+        int length = bench_password(seed, i, password, sizeof(password));
+        SHA1((const unsigned char *)password, (size_t)length, table[i].hash);
+        table[i].count = bench_count(seed, i);
+    }
+    qsort(table, records, sizeof(FlatRecord), compare_records);
+
+    FILE *out = fopen(out_path, "w");
+    if (out == NULL) {
+        fprintf(stderr, "Could not open %s for writing\n", out_path);
+        free(table);
+        return 1;
+    }
+    char line[FLAT_HASH_SIZE * 2 + 16];
+    for (uint64_t i = 0; i < records; i++) {
+        hex_encode(table[i].hash, FLAT_HASH_SIZE, line);
+        int length = FLAT_HASH_SIZE * 2;
+        length += snprintf(line + length, sizeof(line) - length, ":%u\n", table[i].count);
+        fwrite(line, 1, (size_t)length, out);
+    }
+    int rc = ferror(out) | (fclose(out) != 0);
+    free(table);
+    if (rc) {
+        fprintf(stderr, "Write to %s failed\n", out_path);
+        return 1;
+    }
+
+    fprintf(stderr, "Wrote %llu records to %s (seed %llu)\n", records, out_path, (unsigned long long)seed);
+    return 0;
+}
@@ -0,0 +1,203 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "bench_util.h"
+#include "create_database.h"
+#include "parallel_import.h"
+
+/*
+ * Times every way create_database can load a dump.
+ *
+ * Usage: import_bench <pwned_file.txt> [--workdir dir] [--threads N] [--keep]
+ *                     [--format csv|json] [--output path]
+ *
+ * Runs the single-threaded SQLite import (create_pwned_db), the parallel SQLite
+ * and flat imports, the single-threaded flat import, packing the flat store and
+ * building its filter, each into a fresh file under workdir. The progress lines
+ * the importers print are sent to stderr so stdout carries only the results.
+ * Outputs are deleted afterwards unless --keep is given.
+ */
+
+static const char *const COLUMNS[] = {
+    "step", "backend", "threads", "records", "input_bytes", "output_bytes",
+    "seconds", "records_per_sec", "input_mb_per_sec"
+};
+#define COLUMN_COUNT (int)(sizeof(COLUMNS) / sizeof(COLUMNS[0]))
+
+typedef enum {
+    STEP_SQLITE,
+    STEP_SQLITE_PARALLEL,
+    STEP_FLAT,
+    STEP_FLAT_PARALLEL,
+    STEP_PACKED,
+    STEP_FILTER
+} StepKind;
+
+// One import step: what it runs, what it reads and what it writes
+typedef struct {
+    StepKind kind;
+    const char *name;
+    const char *backend;
+    const char *output; // File name under workdir
+    const char *input;  // File name under workdir, or NULL for the dump
+} Step;
+
+static const Step STEPS[] = {
+    {STEP_SQLITE, "import", "sqlite", "bench.db", NULL},
+    {STEP_SQLITE_PARALLEL, "import_parallel", "sqlite", "bench_parallel.db", NULL},
+    {STEP_FLAT, "import", "flat", "bench.flat", NULL},
+    {STEP_FLAT_PARALLEL, "import_parallel", "flat", "bench_parallel.flat", NULL},
+    {STEP_PACKED, "pack", "packed", "bench.pack", "bench.flat"},
+    {STEP_FILTER, "filter", "flat", "bench.flat" FUSE_FILE_SUFFIX, "bench.flat"},
+};
+
+static long long file_size(const char *path) {
+    struct stat st;
+    return stat(path, &st) == 0 ? (long long)st.st_size : -1;
+}
+
+// Counts the "HASH:COUNT" lines of the dump
+static size_t count_records(const char *path) {
+    FILE *file = fopen(path, "r");
+    if (file == NULL) {
+        return 0;
+    }
+    char line[128];
+    size_t records = 0;
+    while (fgets(line, sizeof(line), file)) {
+        records += strchr(line, ':') != NULL;
+    }
+    fclose(file);
+    return records;
+}
+
+static int run_step(const Step *step, const char *dump, const char *out_path, const char *in_path, int threads) {
+    switch (step->kind) {
+    case STEP_SQLITE:
+        return create_pwned_db(out_path, dump) != SQLITE_OK;
+    case STEP_SQLITE_PARALLEL:
+        return import_parallel(out_path, dump, IMPORT_TARGET_SQLITE, threads);
+    case STEP_FLAT:
+        return create_flat_db(out_path, dump);
+    case STEP_FLAT_PARALLEL:
+        return import_parallel(out_path, dump, IMPORT_TARGET_FLAT, threads);
+    case STEP_PACKED:
+        return create_packed_db(out_path, in_path);
+    case STEP_FILTER:
+        return create_filter(in_path);
+    }
+    return 1;
+}
+
+int main(int argc, char *argv[]) {
+    const char *dump = NULL;
+    const char *workdir = ".";
+    const char *output = NULL;
+    BenchFormat format = BENCH_FORMAT_CSV;
+    int threads = 0;
+    int keep = 0;
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--workdir") == 0 && i + 1 < argc) {
+            workdir = argv[++i];
+        } else if (strcmp(argv[i], "--threads") == 0 && i + 1 < argc) {
+            threads = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--keep") == 0) {
+            keep = 1;
+        } else if (strcmp(argv[i], "--format") == 0 && i + 1 < argc) {
+            if (bench_parse_format(argv[++i], &format) != 0) {
+                fprintf(stderr, "Unknown format: %s (expected csv or json)\n", argv[i]);
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--output") == 0 && i + 1 < argc) {
+            output = argv[++i];
+        } else if (argv[i][0] != '-' && dump == NULL) {
+            dump = argv[i];
+        } else {
+            fprintf(stderr, "Unknown option: %s\n", argv[i]);
+            return 1;
+        }
+    }
+    if (dump == NULL) {
+        fprintf(stderr, "Usage: %s <pwned_file.txt> [--workdir dir] [--threads N] [--keep]\n"
+                        "       [--format csv|json] [--output path]\n", argv[0]);
+        return 1;
+    }
+
+    long long input_bytes = file_size(dump);
+    size_t records = count_records(dump);
+    if (input_bytes < 0 || records == 0) {
+        fprintf(stderr, "No records found in %s\n", dump);
+        return 1;
+    }
+    long cores = sysconf(_SC_NPROCESSORS_ONLN);
+    int effective_threads = threads > 0 ? threads : (int)(cores > 0 ? cores : 1);
+
+    // Results keep the real stdout; everything the importers print goes to stderr
+    FILE *out;
+    if (output == NULL || strcmp(output, "-") == 0) {
+        fflush(stdout);
+        out = fdopen(dup(STDOUT_FILENO), "w");
+        dup2(STDERR_FILENO, STDOUT_FILENO);
+    } else {
+        out = bench_open_output(output);
+    }
+    if (out == NULL) {
+        return 1;
+    }
+    BenchReport report;
+    bench_report_open(&report, out, format, COLUMNS, COLUMN_COUNT);
+
+    size_t step_count = sizeof(STEPS) / sizeof(STEPS[0]);
+    char paths[sizeof(STEPS) / sizeof(STEPS[0])][4096] = {{0}};
+    int rc = 0;
+    for (size_t s = 0; rc == 0 && s < step_count; s++) {
+        const Step *step = &STEPS[s];
+        char in_path[4096];
+        snprintf(paths[s], sizeof(paths[s]), "%s/%s", workdir, step->output);
+        unlink(paths[s]);
+        if (step->input != NULL) {
+            snprintf(in_path, sizeof(in_path), "%s/%s", workdir, step->input);
+        } else {
+            snprintf(in_path, sizeof(in_path), "%s", dump);
+        }
+
+        uint64_t start = bench_now_ns();
+        rc = run_step(step, dump, paths[s], in_path, threads);
+        double seconds = (bench_now_ns() - start) / 1e9;
+        fflush(stdout);
+        if (rc != 0) {
+            fprintf(stderr, "Step %s (%s) failed\n", step->name, step->backend);
+            break;
+        }
+
+        int parallel = step->kind == STEP_SQLITE_PARALLEL || step->kind == STEP_FLAT_PARALLEL;
+        long long step_input = step->input != NULL ? file_size(in_path) : input_bytes;
+        char fields[COLUMN_COUNT][32];
+        snprintf(fields[0], 32, "%s", step->name);
+        snprintf(fields[1], 32, "%s", step->backend);
+        snprintf(fields[2], 32, "%d", parallel ? effective_threads : 1);
+        snprintf(fields[3], 32, "%zu", records);
+        snprintf(fields[4], 32, "%lld", step_input);
+        snprintf(fields[5], 32, "%lld", file_size(paths[s]));
+        snprintf(fields[6], 32, "%.3f", seconds);
+        snprintf(fields[7], 32, "%.0f", records / seconds);
+        snprintf(fields[8], 32, "%.1f", step_input / seconds / 1e6);
+        const char *values[COLUMN_COUNT];
+        for (int c = 0; c < COLUMN_COUNT; c++) {
+            values[c] = fields[c];
+        }
+        bench_report_row(&report, values);
+    }
+    bench_report_close(&report);
+
+    if (!keep) {
+        for (size_t s = 0; s < step_count && paths[s][0] != '\0'; s++) {
+            unlink(paths[s]);
+        }
+    }
+    return rc;
+}
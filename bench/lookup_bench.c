@@ -0,0 +1,262 @@
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "bench_util.h"
+#include "deep_check.h"
+
+/*
+ * Measures per-password lookup latency on a database built from gen_dataset output.
+ *
+ * Usage: lookup_bench <database_path> --records N [--seed N] [--lookups N]
+ *                     [--cold-lookups N] [--no-filter] [--format csv|json] [--output path]
+ *
+ * Each timed operation is what the checker does per password: SHA-1 of the text
+ * followed by the lookup behind deep_check_password(), without the console message.
+ * Hits are regenerated from the dataset seed; misses are passwords the generator
+ * never emits. Three mixes are run (all misses, half and half, all hits):
+ *
+ * - hot: the database stays open and every probe is run once untimed first, so
+ *   the pages it touches are resident.
+ * - cold: before every probe the database is closed, its files are dropped from
+ *   the page cache with POSIX_FADV_DONTNEED and it is reopened; only the lookup
+ *   is timed. This is what a one-shot checker run sees after the cache was
+ *   evicted. Pages still mapped by another process cannot be dropped.
+ */
+
+#define DEFAULT_LOOKUPS 1000000
+#define DEFAULT_COLD_LOOKUPS 200
+
+static const char *const COLUMNS[] = {
+    "backend", "filter", "deltas", "cache", "mix", "hit_ratio", "lookups", "found", "errors",
+    "mean_ns", "p50_ns", "p90_ns", "p99_ns", "p999_ns", "max_ns", "lookups_per_sec"
+};
+#define COLUMN_COUNT (int)(sizeof(COLUMNS) / sizeof(COLUMNS[0]))
+
+// A lookup mix and the probes generated for it
+typedef struct {
+    const char *name;
+    double hit_ratio;
+} Mix;
+
+static const Mix MIXES[] = {{"miss", 0.0}, {"mixed", 0.5}, {"hit", 1.0}};
+
+typedef struct {
+    const char *db_path;
+    uint64_t records;
+    uint64_t seed;
+    size_t lookups;
+    size_t cold_lookups;
+    int use_filter;
+} Options;
+
+static const char *backend_name(DbBackend backend) {
+    return backend == DB_BACKEND_FLAT ? "flat" : backend == DB_BACKEND_PACKED ? "packed"
+         : backend == DB_BACKEND_SHARDED ? "sharded" : "sqlite";
+}
+
+// Fills count probe passwords; a probe is a hit with probability hit_ratio
+static void make_probes(char (*probes)[BENCH_PASSWORD_MAX], size_t count, const Options *options,
+                        double hit_ratio, uint64_t stream) {
+    uint64_t state = options->seed ^ (stream << 32);
+    for (size_t i = 0; i < count; i++) {
+        uint64_t draw = bench_random(&state);
+        if ((double)(draw >> 11) < hit_ratio * 9007199254740992.0) {
+            bench_password(options->seed, bench_random(&state) % options->records, probes[i], BENCH_PASSWORD_MAX);
+        } else {
+            bench_miss_password(options->seed, stream * count + i, probes[i], BENCH_PASSWORD_MAX);
+        }
+    }
+}
+
+// Hashes and looks up one password, the per-password work of deep_check_password()
+static int check_password(PwnedDB *db, const char *password) {
+    unsigned char hash[SHA_DIGEST_LENGTH];
+    int count;
+    SHA1((const unsigned char *)password, strlen(password), hash);
+    return lookup_hash(db, hash, &count);
+}
+
+// Drops the cached pages of one file; missing files are fine
+static void evict_file(const char *path) {
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        return;
+    }
+    posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+    close(fd);
+}
+
+// Evicts the store and every file init_db() may open next to it
+static void evict_database(const char *db_path) {
+    char path[4096];
+    evict_file(db_path);
+    snprintf(path, sizeof(path), "%s%s", db_path, FUSE_FILE_SUFFIX);
+    evict_file(path);
+    snprintf(path, sizeof(path), "%s%s", db_path, MPHF_FILE_SUFFIX);
+    evict_file(path);
+    for (int n = 1; n <= DELTA_MAX_SEGMENTS; n++) {
+        snprintf(path, sizeof(path), "%s%s.%d", db_path, DELTA_FILE_SUFFIX, n);
+        evict_file(path);
+    }
+
+    // Every shard is a database of its own, with its own filter and deltas
+    ShardHeader header;
+    if (shard_is_store(db_path) && shard_read_header(db_path, &header) == 0) {
+        for (uint32_t i = 0; i < (uint32_t)1 << header.shard_bits; i++) {
+            shard_path(path, sizeof(path), db_path, i, header.shard_bits);
+            evict_database(path);
+        }
+    }
+}
+
+static void report_run(BenchReport *report, const PwnedDB *db, const char *cache, const Mix *mix,
+                       uint64_t *samples, size_t count, size_t found, size_t errors) {
+    qsort(samples, count, sizeof(uint64_t), bench_compare_u64);
+    uint64_t total = 0;
+    for (size_t i = 0; i < count; i++) {
+        total += samples[i];
+    }
+    double mean = count ? (double)total / count : 0.0;
+
+    char fields[COLUMN_COUNT][32];
+    snprintf(fields[0], 32, "%s", backend_name(db->backend));
+    snprintf(fields[1], 32, "%s", db->has_filter ? "on" : "off");
+    snprintf(fields[2], 32, "%d", db->delta_count);
+    snprintf(fields[3], 32, "%s", cache);
+    snprintf(fields[4], 32, "%s", mix->name);
+    snprintf(fields[5], 32, "%.2f", mix->hit_ratio);
+    snprintf(fields[6], 32, "%zu", count);
+    snprintf(fields[7], 32, "%zu", found);
+    snprintf(fields[8], 32, "%zu", errors);
+    snprintf(fields[9], 32, "%.1f", mean);
+    snprintf(fields[10], 32, "%llu", (unsigned long long)bench_percentile(samples, count, 50));
+    snprintf(fields[11], 32, "%llu", (unsigned long long)bench_percentile(samples, count, 90));
+    snprintf(fields[12], 32, "%llu", (unsigned long long)bench_percentile(samples, count, 99));
+    snprintf(fields[13], 32, "%llu", (unsigned long long)bench_percentile(samples, count, 99.9));
+    snprintf(fields[14], 32, "%llu", (unsigned long long)(count ? samples[count - 1] : 0));
+    snprintf(fields[15], 32, "%.0f", mean > 0 ? 1e9 / mean : 0.0);
+
+    const char *values[COLUMN_COUNT];
+    for (int c = 0; c < COLUMN_COUNT; c++) {
+        values[c] = fields[c];
+    }
+    bench_report_row(report, values);
+}
+
+static void run_hot(PwnedDB *db, BenchReport *report, const Mix *mix, char (*probes)[BENCH_PASSWORD_MAX],
+                    size_t count, uint64_t *samples) {
+    for (size_t i = 0; i < count; i++) {
+        check_password(db, probes[i]); // Warm-up pass
+    }
+    size_t found = 0, errors = 0;
+    for (size_t i = 0; i < count; i++) {
+        uint64_t start = bench_now_ns();
+        int rc = check_password(db, probes[i]);
+        samples[i] = bench_now_ns() - start;
+        found += rc == 1;
+        errors += rc < 0;
+    }
+    report_run(report, db, "hot", mix, samples, count, found, errors);
+}
+
+static int run_cold(PwnedDB *db, const Options *options, BenchReport *report, const Mix *mix,
+                    char (*probes)[BENCH_PASSWORD_MAX], size_t count, uint64_t *samples) {
+    size_t found = 0, errors = 0;
+    for (size_t i = 0; i < count; i++) {
+        close_db(db);
+        evict_database(options->db_path);
+        if (init_db(db, options->db_path) != 0) {
+            return 1;
+        }
+        db->has_filter &= options->use_filter;
+
+        uint64_t start = bench_now_ns();
+        int rc = check_password(db, probes[i]);
+        samples[i] = bench_now_ns() - start;
+        found += rc == 1;
+        errors += rc < 0;
+    }
+    report_run(report, db, "cold", mix, samples, count, found, errors);
+    return 0;
+}
+
+int main(int argc, char *argv[]) {
+    Options options = {NULL, 0, BENCH_DEFAULT_SEED, DEFAULT_LOOKUPS, DEFAULT_COLD_LOOKUPS, 1};
+    BenchFormat format = BENCH_FORMAT_CSV;
+    const char *output = NULL;
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--records") == 0 && i + 1 < argc) {
+            options.records = strtoull(argv[++i], NULL, 10);
+        } else if (strcmp(argv[i], "--seed") == 0 && i + 1 < argc) {
+            options.seed = strtoull(argv[++i], NULL, 10);
+        } else if (strcmp(argv[i], "--lookups") == 0 && i + 1 < argc) {
+            options.lookups = strtoull(argv[++i], NULL, 10);
+        } else if (strcmp(argv[i], "--cold-lookups") == 0 && i + 1 < argc) {
+            options.cold_lookups = strtoull(argv[++i], NULL, 10);
+        } else if (strcmp(argv[i], "--no-filter") == 0) {
+            options.use_filter = 0;
+        } else if (strcmp(argv[i], "--format") == 0 && i + 1 < argc) {
+            if (bench_parse_format(argv[++i], &format) != 0) {
+                fprintf(stderr, "Unknown format: %s (expected csv or json)\n", argv[i]);
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--output") == 0 && i + 1 < argc) {
+            output = argv[++i];
+        } else if (argv[i][0] != '-' && options.db_path == NULL) {
+            options.db_path = argv[i];
+        } else {
+            fprintf(stderr, "Unknown option: %s\n", argv[i]);
+            return 1;
+        }
+    }
+    if (options.db_path == NULL || options.records == 0) {
+        fprintf(stderr, "Usage: %s <database_path> --records N [--seed N] [--lookups N] [--cold-lookups N]\n"
+                        "       [--no-filter] [--format csv|json] [--output path]\n", argv[0]);
+        return 1;
+    }
+
+    size_t capacity = options.lookups > options.cold_lookups ? options.lookups : options.cold_lookups;
+    char (*probes)[BENCH_PASSWORD_MAX] = malloc(capacity * BENCH_PASSWORD_MAX);
+    uint64_t *samples = malloc(capacity * sizeof(uint64_t));
+    if (probes == NULL || samples == NULL) {
+        fprintf(stderr, "Out of memory for %zu probes\n", capacity);
+        return 1;
+    }
+
+    PwnedDB db;
+    if (init_db(&db, options.db_path) != 0) {
+        return 1;
+    }
+    db.has_filter &= options.use_filter;
+
+    FILE *out = bench_open_output(output);
+    if (out == NULL) {
+        close_db(&db);
+        return 1;
+    }
+    BenchReport report;
+    bench_report_open(&report, out, format, COLUMNS, COLUMN_COUNT);
+
+    int rc = 0;
+    size_t mix_count = sizeof(MIXES) / sizeof(MIXES[0]);
+    for (size_t m = 0; m < mix_count; m++) {
+        make_probes(probes, options.lookups, &options, MIXES[m].hit_ratio, 2 * m);
+        run_hot(&db, &report, &MIXES[m], probes, options.lookups, samples);
+    }
+    for (size_t m = 0; rc == 0 && options.cold_lookups > 0 && m < mix_count; m++) {
+        make_probes(probes, options.cold_lookups, &options, MIXES[m].hit_ratio, 2 * m + 1);
+        rc = run_cold(&db, &options, &report, &MIXES[m], probes, options.cold_lookups, samples);
+    }
+
+    bench_report_close(&report);
+    if (rc == 0) {
+        close_db(&db);
+    }
+    free(probes);
+    free(samples);
+    return rc;
+}
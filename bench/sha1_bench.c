@@ -0,0 +1,141 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <openssl/sha.h>
+
+#include "sha1_multi.h"
+
+/*
+ * Checks every SHA-1 kernel the CPU supports against OpenSSL and measures its throughput.
+ *
+ * Usage: sha1_bench [messages] [--max-length N]
+ *
+ * Messages are random bytes with random lengths up to max-length (default 16,
+ * a typical password). Each kernel hashes the whole set in batches of 4096, as the
+ * batch pipeline does, and every digest is compared with SHA1(). The check also
+ * runs once over every length from 0 to 300 bytes, so multi-block messages and
+ * the lane kernels' fallback are covered whatever max-length is.
+ */
+
+#define DEFAULT_MESSAGES 4000000
+#define BATCH 4096
+#define CHECK_MAX_LENGTH 300
+
+// xorshift64: cheap, reproducible message bytes
+static uint64_t next_random(uint64_t *state) {
+    *state ^= *state << 13;
+    *state ^= *state >> 7;
+    *state ^= *state << 17;
+    return *state;
+}
+
+static double now_seconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// Messages back to back in one buffer, described the way sha1_multi() takes them
+typedef struct {
+    unsigned char *text;
+    uint32_t *offsets;
+    uint32_t *lengths;
+    size_t n;
+} MessageSet;
+
+static int make_messages(MessageSet *set, size_t n, uint32_t max_length, int every_length, uint64_t *rng) {
+    set->n = n;
+    set->text = malloc(n * (size_t)(max_length + 1) + 1);
+    set->offsets = malloc(n * sizeof(uint32_t));
+    set->lengths = malloc(n * sizeof(uint32_t));
+    if (set->text == NULL || set->offsets == NULL || set->lengths == NULL) {
+        return -1;
+    }
+    size_t used = 0;
+    for (size_t i = 0; i < n; i++) {
+        uint32_t length = every_length ? (uint32_t)i : (uint32_t)(next_random(rng) % (max_length + 1));
+        set->offsets[i] = (uint32_t)used;
+        set->lengths[i] = length;
+        for (uint32_t b = 0; b < length; b++) {
+            set->text[used++] = (unsigned char)next_random(rng);
+        }
+    }
+    return 0;
+}
+
+static void free_messages(MessageSet *set) {
+    free(set->text);
+    free(set->offsets);
+    free(set->lengths);
+}
+
+// Hashes the set in pipeline-sized batches with one kernel
+static void hash_set(Sha1Kernel kernel, const MessageSet *set, unsigned char (*digests)[SHA1_DIGEST_SIZE]) {
+    for (size_t start = 0; start < set->n; start += BATCH) {
+        size_t n = set->n - start < BATCH ? set->n - start : BATCH;
+        sha1_multi(kernel, set->text, set->offsets + start, set->lengths + start, n, digests + start);
+    }
+}
+
+// Number of digests that differ from OpenSSL's
+static size_t count_mismatches(const MessageSet *set, unsigned char (*digests)[SHA1_DIGEST_SIZE]) {
+    size_t bad = 0;
+    unsigned char expected[SHA1_DIGEST_SIZE];
+    for (size_t i = 0; i < set->n; i++) {
+        SHA1(set->text + set->offsets[i], set->lengths[i], expected);
+        bad += memcmp(expected, digests[i], SHA1_DIGEST_SIZE) != 0;
+    }
+    return bad;
+}
+
+int main(int argc, char *argv[]) {
+    size_t messages = DEFAULT_MESSAGES;
+    uint32_t max_length = 16;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--max-length") == 0 && i + 1 < argc) {
+            max_length = (uint32_t)atoi(argv[++i]);
+        } else if (argv[i][0] != '-' && atol(argv[i]) > 0) {
+            messages = (size_t)atol(argv[i]);
+        } else {
+            fprintf(stderr, "Usage: %s [messages] [--max-length N]\n", argv[0]);
+            return 1;
+        }
+    }
+
+    uint64_t rng = 0x9E3779B97F4A7C15ULL;
+    MessageSet lengths_set, timed_set;
+    unsigned char (*digests)[SHA1_DIGEST_SIZE] = malloc(messages * SHA1_DIGEST_SIZE);
+    if (digests == NULL || messages < CHECK_MAX_LENGTH + 1 ||
+        make_messages(&lengths_set, CHECK_MAX_LENGTH + 1, CHECK_MAX_LENGTH, 1, &rng) != 0 ||
+        make_messages(&timed_set, messages, max_length, 0, &rng) != 0) {
+        fprintf(stderr, "Memory allocation failed!\n");
+        return 1;
+    }
+
+    static const Sha1Kernel kernels[] = {SHA1_KERNEL_SCALAR, SHA1_KERNEL_SHANI, SHA1_KERNEL_AVX2, SHA1_KERNEL_AVX512};
+    printf("%zu messages of 0-%u bytes; auto selects %s\n", messages, max_length, sha1_kernel_name(sha1_kernel_best()));
+    int failed = 0;
+    for (size_t k = 0; k < sizeof(kernels) / sizeof(kernels[0]); k++) {
+        if (!sha1_kernel_supported(kernels[k])) {
+            printf("%-8s not supported on this CPU\n", sha1_kernel_name(kernels[k]));
+            continue;
+        }
+        hash_set(kernels[k], &lengths_set, digests);
+        size_t bad = count_mismatches(&lengths_set, digests);
+
+        double start = now_seconds();
+        hash_set(kernels[k], &timed_set, digests);
+        double elapsed = now_seconds() - start;
+        bad += count_mismatches(&timed_set, digests);
+
+        printf("%-8s %8.2f M hashes/s  %6.1f ns/hash  %s\n", sha1_kernel_name(kernels[k]),
+               messages / elapsed / 1e6, elapsed * 1e9 / messages, bad ? "MISMATCH" : "matches OpenSSL");
+        failed |= bad != 0;
+    }
+
+    free_messages(&lengths_set);
+    free_messages(&timed_set);
+    free(digests);
+    return failed;
+}
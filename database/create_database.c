@@ -1,16 +1,222 @@
 #include "create_database.h"
 
-// Utility function to convert a hex string to a binary array
-void hex_to_bin_sql(const char *hex, unsigned char *bin) {
-    for (int i = 0; i < 20; ++i) {
-        sscanf(hex + 2*i, "%2hhx", &bin[i]);  // Read 2 characters (1 byte)
+#include <unistd.h>
+#include <sys/stat.h>
+
+/**
+ * Parses one "HASH:COUNT" line of a pwned passwords dump.
+ *
+ * The width of the hex hash says which dataset the line is from, so SHA-1 and
+ * NTLM dumps need no flag. Counts that overflow 32 bits are clamped.
+ *
+ * Parameters:
+ * - line (const char*): The line without its newline, NUL-terminated.
+ * - length (size_t): Length of the line.
+ * - dump (DumpKind*): Kind of the dump so far; fixed by the first line that parses.
+ * - hash (unsigned char*): Receives the binary hash, HASH_MAX_SIZE bytes of room.
+ * - count (uint32_t*): Receives the breach count.
+ *
+ * Returns:
+ * - int: 0 on success, -1 for a malformed line, 1 for a line of the other kind.
+ */
+int parse_pwned_line(const char *line, size_t length, DumpKind *dump, unsigned char *hash, uint32_t *count) {
+    const char *colon = memchr(line, ':', length);
+    HashKind kind;
+    if (colon == NULL || hash_kind_of_hex_length((size_t)(colon - line), &kind) != 0 ||
+        colon[1] < '0' || colon[1] > '9') {
+        return -1;
+    }
+    if (dump->known && kind != dump->kind) {
+        return 1;
+    }
+    if (hex_decode(line, hash, (int)hash_kind_size(kind)) != 0) {
+        return -1;
+    }
+    uint64_t value = 0;
+    for (const char *p = colon + 1; *p >= '0' && *p <= '9'; p++) {
+        value = value * 10 + (uint64_t)(*p - '0');
+        if (value > UINT32_MAX) {
+            value = UINT32_MAX;
+        }
+    }
+    *count = (uint32_t)value;
+    dump->kind = kind;
+    dump->known = 1;
+    return 0;
+}
+
+int dump_kind(const char *pwned_file_path, HashKind *kind) {
+    StreamReader reader;
+    if (stream_open(&reader, pwned_file_path, 0) != 0) {
+        return -1;
+    }
+    DumpKind dump = {HASH_KIND_SHA1, 0};
+    unsigned char hash[HASH_MAX_SIZE];
+    uint32_t count;
+    const char *line;
+    size_t length;
+    while (!dump.known && (line = stream_read_line(&reader, &length)) != NULL) {
+        parse_pwned_line(line, length, &dump, hash, &count);
     }
+    stream_close(&reader);
+    *kind = dump.kind;
+    return dump.known ? 0 : -1;
+}
+
+// Creates the pwned_passwords table if it doesn't exist yet
+int create_pwned_schema(sqlite3 *db) {
+    char *err_msg = 0;
+
+    // The hash is the clustered key: rows live in the primary-key B-tree itself, so a
+    // lookup is one descent and no separate index is needed
+    const char *sql_create_table = "CREATE TABLE IF NOT EXISTS pwned_passwords("
+                                   "full_hash BLOB PRIMARY KEY,"
+                                   "count INTEGER) WITHOUT ROWID;";
+                                   
+    int rc = sqlite3_exec(db, sql_create_table, 0, 0, &err_msg);
+    if (rc != SQLITE_OK) {
+        fprintf(stderr, "SQL error: %s\n", err_msg);
+        sqlite3_free(err_msg);
+        return rc;
+    }
+    return SQLITE_OK;
+}
+
+/**
+ * Migrates a database created with the original schema to the lean one.
+ *
+ * Older databases store rows in a rowid table with an automatic index on the
+ * full_hash primary key plus a second, identical idx_full_hash index. The rows
+ * are copied in hash order into a WITHOUT ROWID table clustered on full_hash,
+ * the old table and both indexes are dropped, and the file is vacuumed so the
+ * freed pages are returned. A database that is already clustered only loses
+ * idx_full_hash if it still has it.
+ *
+ * Parameters:
+ * - db_path (const char*): Path to the SQLite database to migrate in place.
+ *
+ * Returns:
+ * - int: SQLITE_OK on success, or the SQLite error code of the failed step.
+ *
+ * Note:
+ * - The copy needs free disk space for a second copy of the table until the vacuum.
+ */
+int migrate_pwned_db(const char *db_path) {
+    sqlite3 *db;
+    int rc = sqlite3_open_v2(db_path, &db, SQLITE_OPEN_READWRITE, NULL);
+    if (rc != SQLITE_OK) {
+        fprintf(stderr, "Cannot open database: %s\n", sqlite3_errmsg(db));
+        sqlite3_close(db);
+        return rc;
+    }
+
+    // WITHOUT ROWID tables keep their declaration in sqlite_master
+    sqlite3_stmt *stmt;
+    int clustered = 0;
+    rc = sqlite3_prepare_v2(db, "SELECT sql FROM sqlite_master WHERE type = 'table' AND name = 'pwned_passwords'",
+                            -1, &stmt, NULL);
+    if (rc == SQLITE_OK && sqlite3_step(stmt) == SQLITE_ROW) {
+        const char *sql = (const char *)sqlite3_column_text(stmt, 0);
+        clustered = sql != NULL && strstr(sql, "WITHOUT ROWID") != NULL;
+    } else {
+        fprintf(stderr, "No pwned_passwords table in %s\n", db_path);
+        rc = SQLITE_ERROR;
+    }
+    sqlite3_finalize(stmt);
+    if (rc != SQLITE_OK) {
+        sqlite3_close(db);
+        return rc;
+    }
+
+    const char *sql_migrate = clustered
+        ? "DROP INDEX IF EXISTS idx_full_hash;"
+        : "PRAGMA temp_store=MEMORY;"
+          "BEGIN;"
+          "CREATE TABLE pwned_passwords_clustered("
+          "full_hash BLOB PRIMARY KEY,"
+          "count INTEGER) WITHOUT ROWID;"
+          "INSERT INTO pwned_passwords_clustered(full_hash, count) "
+          "SELECT full_hash, count FROM pwned_passwords ORDER BY full_hash;"
+          "DROP TABLE pwned_passwords;"
+          "ALTER TABLE pwned_passwords_clustered RENAME TO pwned_passwords;"
+          "COMMIT;";
+    char *err_msg = 0;
+    rc = sqlite3_exec(db, sql_migrate, NULL, NULL, &err_msg);
+    if (rc == SQLITE_OK) {
+        rc = sqlite3_exec(db, "VACUUM;", NULL, NULL, &err_msg);
+    }
+    if (rc != SQLITE_OK) {
+        fprintf(stderr, "Failed to migrate database: %s\n", err_msg);
+        sqlite3_free(err_msg);
+        sqlite3_exec(db, "ROLLBACK;", NULL, NULL, NULL);
+    } else {
+        printf("%s\n", clustered ? "Schema already clustered; dropped any duplicate index."
+                                  : "Migrated pwned_passwords to a WITHOUT ROWID table.");
+    }
+    sqlite3_close(db);
+    return rc;
+}
+
+// Records where a committed import stands, inside the transaction being committed
+static int save_checkpoint(sqlite3_stmt *stmt, const char *input, uint64_t input_size, uint64_t offset, uint64_t rows) {
+    sqlite3_bind_text(stmt, 1, input, -1, SQLITE_STATIC);
+    sqlite3_bind_int64(stmt, 2, (sqlite3_int64)input_size);
+    sqlite3_bind_int64(stmt, 3, (sqlite3_int64)offset);
+    sqlite3_bind_int64(stmt, 4, (sqlite3_int64)rows);
+    int rc = sqlite3_step(stmt) == SQLITE_DONE ? SQLITE_OK : SQLITE_ERROR;
+    sqlite3_reset(stmt);
+    return rc;
+}
+
+// Reads the checkpoint of an interrupted import of the same input, if there is one
+static void load_checkpoint(sqlite3 *db, const char *input, uint64_t input_size, uint64_t *offset, uint64_t *rows) {
+    *offset = 0;
+    *rows = 0;
+    sqlite3_stmt *stmt;
+    if (sqlite3_prepare_v2(db, "SELECT input, input_size, input_offset, row_count FROM import_checkpoint", -1, &stmt,
+                           NULL) != SQLITE_OK) {
+        return;
+    }
+    if (sqlite3_step(stmt) == SQLITE_ROW) {
+        const char *saved = (const char *)sqlite3_column_text(stmt, 0);
+        if (saved != NULL && strcmp(saved, input) == 0 && (uint64_t)sqlite3_column_int64(stmt, 1) == input_size) {
+            *offset = (uint64_t)sqlite3_column_int64(stmt, 2);
+            *rows = (uint64_t)sqlite3_column_int64(stmt, 3);
+            printf("Resuming the import of %s at byte %llu, after %llu committed rows\n", input,
+                   (unsigned long long)*offset, (unsigned long long)*rows);
+        } else {
+            printf("Ignoring the checkpoint of an interrupted import of %s; importing %s from the start\n",
+                   saved != NULL ? saved : "another file", input);
+        }
+    }
+    sqlite3_finalize(stmt);
 }
 
-// Function to create SQLite DB and load data from the pwned passwords file
+/**
+ * Loads a pwned passwords file into an SQLite database.
+ *
+ * The input may be plain text or gzip or zstd compressed; a reader thread
+ * decompresses it while this thread parses and inserts. Rows are committed
+ * every IMPORT_COMMIT_ROWS, and each commit records the input offset and the
+ * rows written so far in an import_checkpoint table, in the same transaction.
+ * If the import is killed, running it again with the same input (same path
+ * and size) continues after the last commit instead of starting over; the
+ * table is dropped once the whole file is in. Inserts are UPSERTs, so loading
+ * a newer file into an existing database refreshes stale counts. The dump may
+ * hold SHA-1 or NTLM hashes; a database holds one kind, so a dump of the other
+ * kind than the rows already in it is refused.
+ *
+ * Parameters:
+ * - db_path (const char*): The database to create or add to.
+ * - pwned_file_path (const char*): "HASH:COUNT" lines, plain, .gz or .zst.
+ *
+ * Returns:
+ * - int: SQLITE_OK on success, an SQLite error code or 1 otherwise.
+ */
 int create_pwned_db(const char *db_path, const char *pwned_file_path) {
     sqlite3 *db;
     sqlite3_stmt *stmt;
+    sqlite3_stmt *checkpoint_stmt;
     char *err_msg = 0;
 
     // Open the database
@@ -21,87 +227,747 @@ int create_pwned_db(const char *db_path, const char *pwned_file_path) {
         return rc;
     }
 
-    // Create the pwned passwords table if it doesn't exist
-    const char *sql_create_table = "CREATE TABLE IF NOT EXISTS pwned_passwords("
-                                   "full_hash BLOB PRIMARY KEY,"
-                                   "count INTEGER);";
-                                   
-    rc = sqlite3_exec(db, sql_create_table, 0, 0, &err_msg);
+    rc = create_pwned_schema(db);
     if (rc != SQLITE_OK) {
-        fprintf(stderr, "SQL error: %s\n", err_msg);
-        sqlite3_free(err_msg);
         sqlite3_close(db);
         return rc;
     }
 
-    // Create an index on the full_hash column for faster lookups
-    const char *sql_create_index = "CREATE INDEX IF NOT EXISTS idx_full_hash ON pwned_passwords(full_hash);";
-    
-    rc = sqlite3_exec(db, sql_create_index, 0, 0, &err_msg);
+    // A single row saying how far a committed import got, so a killed one can resume
+    const char *sql_checkpoint_table = "CREATE TABLE IF NOT EXISTS import_checkpoint("
+                                       "id INTEGER PRIMARY KEY CHECK (id = 1), input TEXT NOT NULL, "
+                                       "input_size INTEGER NOT NULL, input_offset INTEGER NOT NULL, "
+                                       "row_count INTEGER NOT NULL)";
+    rc = sqlite3_exec(db, sql_checkpoint_table, NULL, NULL, &err_msg);
     if (rc != SQLITE_OK) {
-        fprintf(stderr, "SQL error (creating index): %s\n", err_msg);
+        fprintf(stderr, "Failed to create the checkpoint table: %s\n", err_msg);
         sqlite3_free(err_msg);
         sqlite3_close(db);
         return rc;
     }
+    struct stat input_stat;
+    if (stat(pwned_file_path, &input_stat) != 0) {
+        fprintf(stderr, "Could not open pwned password file: %s\n", pwned_file_path);
+        sqlite3_close(db);
+        return 1;
+    }
+    uint64_t input_size = (uint64_t)input_stat.st_size;
+    uint64_t offset, rows;
+    load_checkpoint(db, pwned_file_path, input_size, &offset, &rows);
+    DumpKind dump = {HASH_KIND_SHA1, 0};
+    int existing = sqlite_hash_kind(db, &dump.kind);
+    if (existing < 0) {
+        sqlite3_close(db);
+        return 1;
+    }
+    dump.known = existing; // Rows already there fix the kind of everything added
 
     // Prepare the SQL insert statement
-    const char *sql_insert = "INSERT OR IGNORE INTO pwned_passwords(full_hash, count) VALUES(?, ?)";
+    const char *sql_insert = "INSERT INTO pwned_passwords(full_hash, count) VALUES(?, ?) "
+                             "ON CONFLICT(full_hash) DO UPDATE SET count = excluded.count";
+    const char *sql_checkpoint = "INSERT OR REPLACE INTO import_checkpoint(id, input, input_size, input_offset, row_count) "
+                                 "VALUES(1, ?, ?, ?, ?)";
     rc = sqlite3_prepare_v2(db, sql_insert, -1, &stmt, 0);
+    if (rc == SQLITE_OK) {
+        rc = sqlite3_prepare_v2(db, sql_checkpoint, -1, &checkpoint_stmt, 0);
+        if (rc != SQLITE_OK) {
+            sqlite3_finalize(stmt);
+        }
+    }
     if (rc != SQLITE_OK) {
         fprintf(stderr, "Failed to prepare statement: %s\n", sqlite3_errmsg(db));
         sqlite3_close(db);
         return rc;
     }
 
+    // Open the pwned passwords file, decompressing it on its own thread
+    StreamReader reader;
+    if (stream_open(&reader, pwned_file_path, offset) != 0) {
+        sqlite3_finalize(stmt);
+        sqlite3_finalize(checkpoint_stmt);
+        sqlite3_close(db);
+        return 1;
+    }
+
     // Begin transaction for faster inserts
     rc = sqlite3_exec(db, "BEGIN TRANSACTION;", NULL, NULL, &err_msg);
     if (rc != SQLITE_OK) {
         fprintf(stderr, "Failed to begin transaction: %s\n", err_msg);
         sqlite3_free(err_msg);
-        sqlite3_close(db);
-        return rc;
-    }
-
-    // Open the pwned passwords file
-    FILE *pwned_file = fopen(pwned_file_path, "r");
-    if (!pwned_file) {
-        fprintf(stderr, "Could not open pwned password file: %s\n", pwned_file_path);
-        sqlite3_finalize(stmt);
-        sqlite3_close(db);
-        return 1;
     }
 
-    // Read the file and insert into SQLite
-    char line[128];
-    char hash[41]; // 40 characters for SHA1 hash + 1 for null-terminator
-    int count;
-    unsigned char binary_hash[20];  // Binary storage for the 20-byte SHA1 hash
-    while (fgets(line, sizeof(line), pwned_file)) {
-        sscanf(line, "%40[^:]:%d", hash, &count); // Parse the hash and count
+    // Read the file and insert into SQLite, committing every IMPORT_COMMIT_ROWS rows
+    const char *line;
+    size_t length;
+    uint32_t count;
+    unsigned char binary_hash[HASH_MAX_SIZE];  // 20 bytes for a SHA-1 hash, 16 for NTLM
+    uint64_t pending = 0;
+    int progress = 0;
+    while (rc == SQLITE_OK && (line = stream_read_line(&reader, &length)) != NULL) {
+        int parsed = parse_pwned_line(line, length, &dump, binary_hash, &count);
+        if (parsed > 0) {
+            fprintf(stderr, "%s is not a %s dump like the hashes before it (a database holds one kind)\n",
+                    pwned_file_path, hash_kind_name(dump.kind));
+            rc = SQLITE_ERROR;
+            break;
+        }
+        if (parsed < 0) {
+            continue; // Skip blank or malformed lines
+        }
 
-        // Convert the hex hash to binary
-        hex_to_bin_sql(hash, binary_hash);
-    
         // Bind the binary hash (BLOB) to the SQL statement
-        sqlite3_bind_blob(stmt, 1, binary_hash, 20, SQLITE_STATIC);  // 20 bytes for the hash
-        sqlite3_bind_int(stmt, 2, count);
+        sqlite3_bind_blob(stmt, 1, binary_hash, (int)hash_kind_size(dump.kind), SQLITE_STATIC);
+        sqlite3_bind_int64(stmt, 2, count);
 
         // Execute the SQL statement
-        sqlite3_step(stmt);
+        if (sqlite3_step(stmt) != SQLITE_DONE) {
+            fprintf(stderr, "Failed to insert: %s\n", sqlite3_errmsg(db));
+            rc = SQLITE_ERROR;
+        }
         sqlite3_reset(stmt);  // Reset the statement to reuse it
+        rows++;
+
+        if (rc == SQLITE_OK && ++pending == IMPORT_COMMIT_ROWS) {
+            rc = save_checkpoint(checkpoint_stmt, pwned_file_path, input_size, stream_offset(&reader), rows);
+            if (rc == SQLITE_OK) {
+                rc = sqlite3_exec(db, "COMMIT; BEGIN TRANSACTION;", NULL, NULL, NULL);
+            }
+            pending = 0;
+            progress = 1;
+            printf("\rCommitted %llu rows", (unsigned long long)rows);
+            fflush(stdout);
+        }
+    }
+    if (stream_close(&reader) != 0 && rc == SQLITE_OK) {
+        rc = 1; // The input is damaged or unreadable: keep the last checkpoint and drop the partial chunk
+    }
+    if (progress) {
+        printf("\n");
     }
 
-    // Commit transaction
-    rc = sqlite3_exec(db, "COMMIT;", NULL, NULL, &err_msg);
+    // The last partial chunk and the end of the checkpoint go in together
+    if (rc == SQLITE_OK) {
+        rc = sqlite3_exec(db, "DROP TABLE import_checkpoint; COMMIT;", NULL, NULL, &err_msg);
+        if (rc != SQLITE_OK) {
+            fprintf(stderr, "Failed to commit transaction: %s\n", err_msg);
+            sqlite3_free(err_msg);
+        }
+    }
     if (rc != SQLITE_OK) {
-        fprintf(stderr, "Failed to commit transaction: %s\n", err_msg);
-        sqlite3_free(err_msg);
+        sqlite3_exec(db, "ROLLBACK;", NULL, NULL, NULL);
+        fprintf(stderr, "Import stopped; run the same command again to resume from the last commit\n");
     }
 
-    fclose(pwned_file);
     sqlite3_finalize(stmt);
+    sqlite3_finalize(checkpoint_stmt);
     sqlite3_close(db);
-    
-    return SQLITE_OK;
-}
\ No newline at end of file
+    return rc;
+}
+
+// Function to write the pwned passwords file as a sorted, memory-mappable flat store
+// of the dump's kind; the writer is opened once the first line says which one
+int create_flat_db(const char *flat_path, const char *pwned_file_path) {
+    // Open the pwned passwords file, decompressing it on its own thread
+    StreamReader reader;
+    if (stream_open(&reader, pwned_file_path, 0) != 0) {
+        return 1;
+    }
+
+    // Read the file and append fixed-width records
+    FlatWriter writer;
+    DumpKind dump = {HASH_KIND_SHA1, 0};
+    const char *line;
+    size_t length;
+    uint32_t count;
+    unsigned char binary_hash[HASH_MAX_SIZE];  // 20 bytes for a SHA-1 hash, 16 for NTLM
+    int rc = 0;
+    while (rc == 0 && (line = stream_read_line(&reader, &length)) != NULL) {
+        int known = dump.known;
+        int parsed = parse_pwned_line(line, length, &dump, binary_hash, &count);
+        if (parsed > 0) {
+            fprintf(stderr, "%s is not a %s dump like the hashes before it\n", pwned_file_path,
+                    hash_kind_name(dump.kind));
+            rc = 1;
+            break;
+        }
+        if (parsed < 0) {
+            continue; // Skip blank or malformed lines
+        }
+        if (!known && flat_writer_open_kind(&writer, flat_path, dump.kind) != 0) {
+            stream_close(&reader);
+            return 1;
+        }
+        rc = flat_writer_add(&writer, binary_hash, count);
+    }
+    if (stream_close(&reader) != 0) {
+        rc = 1;
+    }
+    if (!dump.known && flat_writer_open(&writer, flat_path) != 0) {
+        return 1; // No records at all: an empty SHA-1 store
+    }
+
+    // Sort if needed and write the prefix index and header
+    if (flat_writer_finish(&writer) != 0) {
+        return 1;
+    }
+    if (rc != 0) {
+        remove(flat_path);
+    }
+    return rc;
+}
+
+// Function to encode an existing flat store as a compressed packed store
+int create_packed_db(const char *pack_path, const char *flat_path) {
+    FlatStore source;
+    if (flat_open(&source, flat_path) != 0) {
+        return 1;
+    }
+    // A packed store does not record its kind, so lookups take every packed store for SHA-1
+    if (source.kind != HASH_KIND_SHA1) {
+        fprintf(stderr, "Packed stores hold SHA-1 hashes only; %s holds %s hashes\n", flat_path,
+                hash_kind_name(source.kind));
+        flat_close(&source);
+        return 1;
+    }
+    int rc = packed_write(&source, pack_path);
+    flat_close(&source);
+    return rc;
+}
+
+// Growable list of filter keys collected while scanning the store
+typedef struct {
+    uint64_t *keys;
+    size_t count;
+    size_t capacity;
+} KeyList;
+
+static int append_filter_key(KeyList *list, uint64_t key) {
+    if (list->count == list->capacity) {
+        size_t capacity = list->capacity ? list->capacity * 2 : 1 << 20;
+        uint64_t *grown = realloc(list->keys, capacity * sizeof(uint64_t));
+        if (grown == NULL) {
+            return -1;
+        }
+        list->keys = grown;
+        list->capacity = capacity;
+    }
+    list->keys[list->count++] = key;
+    return 0;
+}
+
+// A packed store already holds exactly the 64-bit keys the filter is built from
+static int collect_packed_key(uint64_t key, uint32_t count, void *ctx) {
+    (void)count;
+    return append_filter_key(ctx, key);
+}
+
+// A sharded database gets one filter per shard, each next to its shard
+static int create_shard_filters(const char *db_path) {
+    ShardHeader header;
+    if (shard_read_header(db_path, &header) != 0) {
+        return 1;
+    }
+    char path[4096];
+    for (uint32_t i = 0; i < (uint32_t)1 << header.shard_bits; i++) {
+        shard_path(path, sizeof(path), db_path, i, header.shard_bits);
+        if (create_filter(path) != 0) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/**
+ * Builds the fuse filter pre-check file for an existing database.
+ *
+ * Every hash in the store (SQLite, flat or packed) is reduced to its 64-bit filter key,
+ * a binary fuse filter is constructed over them, and a false-positive report is
+ * printed by probing random keys. The result is written to "<db_path>.filter",
+ * where init_db() picks it up automatically. For a sharded database this is done
+ * for each shard in turn.
+ *
+ * Parameters:
+ * - db_path (const char*): Path to the SQLite database, flat store, packed store or shard manifest.
+ *
+ * Returns:
+ * - int: 0 on success, 1 if the store cannot be read or the filter cannot be built or written.
+ */
+int create_filter(const char *db_path) {
+    if (shard_is_store(db_path)) {
+        return create_shard_filters(db_path);
+    }
+    PwnedDB db;
+    if (init_db(&db, db_path) != 0) {
+        return 1;
+    }
+
+    // Keys are sorted and deduplicated by fuse_build, so any scan order works
+    KeyList list = {NULL, 0, 0};
+    int rc = 0;
+    if (db.backend == DB_BACKEND_FLAT) {
+        uint64_t records = db.flat.header->record_count;
+        list.keys = malloc((records ? records : 1) * sizeof(uint64_t));
+        if (list.keys == NULL) {
+            rc = 1;
+        }
+        for (uint64_t i = 0; rc == 0 && i < records; i++) {
+            list.keys[list.count++] = fuse_key(flat_record_hash(&db.flat, i));
+        }
+    } else if (db.backend == DB_BACKEND_PACKED) {
+        rc = packed_for_each(&db.packed, collect_packed_key, &list);
+    } else {
+        // One pass over the table is far cheaper than a range query per prefix
+        sqlite3_stmt *stmt;
+        rc = sqlite3_prepare_v2(db.sqlite, "SELECT full_hash FROM pwned_passwords", -1, &stmt, NULL);
+        if (rc == SQLITE_OK) {
+            while ((rc = sqlite3_step(stmt)) == SQLITE_ROW) {
+                if (sqlite3_column_bytes(stmt, 0) == (int)db.hash_size &&
+                    append_filter_key(&list, fuse_key(sqlite3_column_blob(stmt, 0))) != 0) {
+                    break;
+                }
+            }
+            sqlite3_finalize(stmt);
+        }
+        rc = rc == SQLITE_DONE ? 0 : 1;
+    }
+    close_db(&db);
+    if (rc != 0) {
+        fprintf(stderr, "Failed to collect filter keys\n");
+        free(list.keys);
+        return 1;
+    }
+
+    FuseFilter filter;
+    size_t keys = list.count;
+    clock_t start = clock();
+    if (fuse_build(&filter, list.keys, list.count) != 0) {
+        free(list.keys);
+        return 1;
+    }
+    free(list.keys);
+    printf("Built filter over %zu keys in %.1f s: %.1f MB, %.2f bits per key\n",
+           keys, (double)(clock() - start) / CLOCKS_PER_SEC,
+           filter.array_length / 1e6, keys ? 8.0 * filter.array_length / (double)keys : 0.0);
+
+    // Random 64-bit keys are absent with overwhelming probability, so every hit is a false positive
+    // Capped by the filter's size, so the report does not dwarf building a small (per-shard) filter
+    const int probes = keys < 1000000 ? (int)keys * 10 + 100000 : 10000000;
+    uint64_t state = 0x2545F4914F6CDD1DULL;
+    int hits = 0;
+    for (int i = 0; i < probes; i++) {
+        state ^= state << 13;
+        state ^= state >> 7;
+        state ^= state << 17;
+        hits += fuse_contains(&filter, state);
+    }
+    printf("False-positive rate: %.4f%% over %d random probes (%.4f%% expected)\n",
+           100.0 * hits / probes, probes, 100.0 / 256);
+
+    char filter_path[4096];
+    snprintf(filter_path, sizeof(filter_path), "%s%s", db_path, FUSE_FILE_SUFFIX);
+    rc = fuse_save(&filter, filter_path) == 0 ? 0 : 1;
+    fuse_free(&filter);
+    return rc;
+}
+
+// Min-heap by count of the most breached entries seen so far, at most capacity of them
+typedef struct {
+    HotEntry *entries;
+    size_t count;
+    size_t capacity;
+} HotHeap;
+
+static void hot_heap_sift_down(HotHeap *heap, size_t i) {
+    for (;;) {
+        size_t smallest = i;
+        size_t left = 2 * i + 1, right = 2 * i + 2;
+        if (left < heap->count && heap->entries[left].count < heap->entries[smallest].count) {
+            smallest = left;
+        }
+        if (right < heap->count && heap->entries[right].count < heap->entries[smallest].count) {
+            smallest = right;
+        }
+        if (smallest == i) {
+            return;
+        }
+        HotEntry swap = heap->entries[i];
+        heap->entries[i] = heap->entries[smallest];
+        heap->entries[smallest] = swap;
+        i = smallest;
+    }
+}
+
+// Keeps the entry if it beats the least breached one held; almost every record fails the first comparison
+static void hot_heap_offer(HotHeap *heap, const unsigned char *hash, size_t hash_bytes, uint32_t count) {
+    if (count == 0 || (heap->count == heap->capacity && count <= heap->entries[0].count)) {
+        return;
+    }
+    HotEntry entry;
+    memset(&entry, 0, sizeof(entry));
+    memcpy(entry.hash, hash, hash_bytes);
+    entry.count = count;
+    if (heap->count < heap->capacity) {
+        size_t i = heap->count++;
+        heap->entries[i] = entry;
+        while (i > 0 && heap->entries[(i - 1) / 2].count > heap->entries[i].count) {
+            HotEntry swap = heap->entries[i];
+            heap->entries[i] = heap->entries[(i - 1) / 2];
+            heap->entries[(i - 1) / 2] = swap;
+            i = (i - 1) / 2;
+        }
+    } else {
+        heap->entries[0] = entry;
+        hot_heap_sift_down(heap, 0);
+    }
+}
+
+// A packed key is the first 8 hash bytes, big-endian
+static int offer_packed_key(uint64_t key, uint32_t count, void *ctx) {
+    unsigned char prefix[HOT_PACKED_KEY_BYTES];
+    for (int i = 0; i < HOT_PACKED_KEY_BYTES; i++) {
+        prefix[i] = (unsigned char)(key >> (56 - 8 * i));
+    }
+    hot_heap_offer(ctx, prefix, sizeof(prefix), count);
+    return 0;
+}
+
+// A sharded database gets a hot set per shard; hashes are uniform, so each holds an equal share
+static int create_shard_hot_sets(const char *db_path, uint64_t entries) {
+    ShardHeader header;
+    if (shard_read_header(db_path, &header) != 0) {
+        return 1;
+    }
+    uint64_t per_shard = (entries + ((uint64_t)1 << header.shard_bits) - 1) >> header.shard_bits;
+    char path[4096];
+    for (uint32_t i = 0; i < (uint32_t)1 << header.shard_bits; i++) {
+        shard_path(path, sizeof(path), db_path, i, header.shard_bits);
+        if (create_hot_set(path, per_shard) != 0) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/**
+ * Builds the "<db_path>.hot" hot set of an existing database.
+ *
+ * One pass over the base store (SQLite, flat or packed) keeps the entries hashes
+ * with the highest counts in a min-heap; they are then laid out in a cuckoo hash
+ * table that init_db() loads into memory. Delta segments are left out: lookups
+ * check them first anyway. With 0 entries the hot set is removed instead. For a
+ * sharded database every shard gets an equal share of the entries.
+ *
+ * Parameters:
+ * - db_path (const char*): Path to the SQLite database, flat store, packed store or shard manifest.
+ * - entries (uint64_t): How many of the most breached hashes to keep.
+ *
+ * Returns:
+ * - int: 0 on success, 1 if the store cannot be read or the table cannot be built or written.
+ */
+int create_hot_set(const char *db_path, uint64_t entries) {
+    if (shard_is_store(db_path)) {
+        return create_shard_hot_sets(db_path, entries);
+    }
+    char hot_path[4096];
+    snprintf(hot_path, sizeof(hot_path), "%s%s", db_path, HOT_FILE_SUFFIX);
+    if (entries == 0) {
+        remove(hot_path);
+        return 0;
+    }
+
+    PwnedDB db;
+    if (init_db(&db, db_path) != 0) {
+        return 1;
+    }
+    uint64_t records = db.backend == DB_BACKEND_FLAT ? db.flat.header->record_count
+                     : db.backend == DB_BACKEND_PACKED ? db.packed.header->key_count
+                     : entries;
+    HotHeap heap = {NULL, 0, entries < records ? entries : records};
+    uint32_t key_bytes = db.kind == HASH_KIND_NTLM ? HOT_NTLM_KEY_BYTES : HOT_HASH_SIZE;
+    heap.entries = malloc((heap.capacity ? heap.capacity : 1) * sizeof(HotEntry));
+    if (heap.entries == NULL) {
+        fprintf(stderr, "Memory allocation failed for the hot set!\n");
+        close_db(&db);
+        return 1;
+    }
+
+    clock_t start = clock();
+    int rc = 0;
+    if (db.backend == DB_BACKEND_FLAT) {
+        for (uint64_t i = 0; i < records; i++) {
+            hot_heap_offer(&heap, flat_record_hash(&db.flat, i), key_bytes, flat_record_count(&db.flat, i));
+        }
+    } else if (db.backend == DB_BACKEND_PACKED) {
+        key_bytes = HOT_PACKED_KEY_BYTES; // A packed store keeps only the first 8 bytes of every hash
+        rc = packed_for_each(&db.packed, offer_packed_key, &heap);
+    } else {
+        sqlite3_stmt *stmt;
+        rc = sqlite3_prepare_v2(db.sqlite, "SELECT full_hash, count FROM pwned_passwords", -1, &stmt, NULL);
+        if (rc == SQLITE_OK) {
+            while ((rc = sqlite3_step(stmt)) == SQLITE_ROW) {
+                if (sqlite3_column_bytes(stmt, 0) == (int)key_bytes) {
+                    int count = sqlite3_column_int(stmt, 1);
+                    hot_heap_offer(&heap, sqlite3_column_blob(stmt, 0), key_bytes, count > 0 ? (uint32_t)count : 0);
+                }
+            }
+            sqlite3_finalize(stmt);
+        }
+        rc = rc == SQLITE_DONE ? 0 : 1;
+    }
+    close_db(&db);
+    if (rc != 0) {
+        fprintf(stderr, "Failed to collect the hot set\n");
+        free(heap.entries);
+        return 1;
+    }
+
+    HotSet set;
+    if (hot_build(&set, heap.entries, heap.count, key_bytes) != 0) {
+        free(heap.entries);
+        return 1;
+    }
+    free(heap.entries);
+    printf("Built hot set of %llu hashes (counts of %u and up) in %.1f s: %.2f MB, %.1f bytes per hash\n",
+           (unsigned long long)set.entry_count, set.min_count, (double)(clock() - start) / CLOCKS_PER_SEC,
+           (double)set.bucket_count * sizeof(HotBucket) / 1e6,
+           set.entry_count ? (double)set.bucket_count * sizeof(HotBucket) / (double)set.entry_count : 0.0);
+
+    rc = hot_save(&set, hot_path) == 0 ? 0 : 1;
+    hot_free(&set);
+    return rc;
+}
+
+// Shards are flat stores of their own, so each gets its own index
+static int create_shard_mphf_indexes(const char *db_path, int threads) {
+    ShardHeader header;
+    if (shard_read_header(db_path, &header) != 0) {
+        return 1;
+    }
+    char path[4096];
+    for (uint32_t i = 0; i < (uint32_t)1 << header.shard_bits; i++) {
+        shard_path(path, sizeof(path), db_path, i, header.shard_bits);
+        if (create_mphf_index(path, threads) != 0) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/**
+ * Builds the "<db_path>.mphf" minimal perfect hash index of an existing flat store.
+ *
+ * The index maps every stored hash to its own slot holding a fingerprint and
+ * the count, so init_db() can answer a flat lookup with one slot read instead of
+ * a binary search over the records. Only flat stores are indexed: a packed store
+ * already finds a key with one bucket read, and SQLite has its own B-tree. For a
+ * sharded database every shard is indexed in turn.
+ *
+ * Parameters:
+ * - db_path (const char*): Path to the flat store or shard manifest.
+ * - threads (int): Partitions built in parallel; 0 for one thread per core.
+ *
+ * Returns:
+ * - int: 0 on success, 1 if the store is not flat or the index cannot be built or written.
+ */
+int create_mphf_index(const char *db_path, int threads) {
+    if (shard_is_store(db_path)) {
+        return create_shard_mphf_indexes(db_path, threads);
+    }
+    if (!flat_is_store(db_path)) {
+        fprintf(stderr, "A minimal perfect hash index can only be built for a flat store: %s\n", db_path);
+        return 1;
+    }
+    FlatStore store;
+    if (flat_open(&store, db_path) != 0) {
+        return 1;
+    }
+    if (store.kind != HASH_KIND_SHA1) {
+        fprintf(stderr, "A minimal perfect hash index can only be built over SHA-1 hashes; %s holds %s hashes\n",
+                db_path, hash_kind_name(store.kind));
+        flat_close(&store);
+        return 1;
+    }
+    char mphf_path[4096];
+    snprintf(mphf_path, sizeof(mphf_path), "%s%s", db_path, MPHF_FILE_SUFFIX);
+    int rc = mphf_build(&store, mphf_path, threads);
+    flat_close(&store);
+    return rc;
+}
+
+// Called for every file of a database in turn; returns non-zero to stop
+typedef int (*StoreFileCallback)(const char *path, void *ctx);
+
+/**
+ * Visits every file a database's lookups read: the store, or the shard manifest
+ * and every shard, each followed by its delta segments. Filters, hot sets and
+ * indexes are derived from the store and can be rebuilt, so they are not visited.
+ */
+static int for_each_store_file(const char *db_path, StoreFileCallback callback, void *ctx) {
+    if (callback(db_path, ctx) != 0) {
+        return 1;
+    }
+    if (shard_is_store(db_path)) {
+        ShardHeader header;
+        if (shard_read_header(db_path, &header) != 0) {
+            return 1;
+        }
+        char path[4096];
+        for (uint32_t i = 0; i < (uint32_t)1 << header.shard_bits; i++) {
+            shard_path(path, sizeof(path), db_path, i, header.shard_bits);
+            if (for_each_store_file(path, callback, ctx) != 0) {
+                return 1;
+            }
+        }
+    }
+    char delta_path[4096];
+    for (int i = 0; i < DELTA_MAX_SEGMENTS; i++) {
+        snprintf(delta_path, sizeof(delta_path), "%s%s.%d", db_path, DELTA_FILE_SUFFIX, i + 1);
+        if (!flat_is_store(delta_path)) {
+            break;
+        }
+        if (callback(delta_path, ctx) != 0) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+static int write_file_checksums(const char *path, void *ctx) {
+    return checksum_write(path, *(const int *)ctx);
+}
+
+/**
+ * Builds the "<path>.xxh" checksum manifest of every file of a database.
+ *
+ * Each manifest holds one XXH3 checksum per block of its file, so "--verify"
+ * can check the whole database on every core, and checkers started with block
+ * checks verify each block of a flat store the first time they read it.
+ *
+ * Parameters:
+ * - db_path (const char*): Path to the SQLite database, flat store, packed store or shard manifest.
+ * - threads (int): Hashing threads; 0 for one per core.
+ *
+ * Returns:
+ * - int: 0 on success, 1 if a file cannot be read or a manifest cannot be written.
+ */
+int create_checksums(const char *db_path, int threads) {
+    return for_each_store_file(db_path, write_file_checksums, &threads);
+}
+
+int refresh_checksums(const char *path) {
+    char sums_path[4096];
+    snprintf(sums_path, sizeof(sums_path), "%s%s", path, CHECKSUM_FILE_SUFFIX);
+    if (access(sums_path, F_OK) != 0) {
+        return 0;
+    }
+    return checksum_write(path, 0);
+}
+
+// Removes one file if it exists; counts the ones that did
+static void remove_if_present(const char *path, int *removed) {
+    if (remove(path) == 0) {
+        (*removed)++;
+    }
+}
+
+// The side files of one store, or of every shard of a manifest
+static void remove_store_side_files(const char *db_path, int *removed) {
+    char path[4096];
+    if (shard_is_store(db_path)) {
+        ShardHeader header;
+        if (shard_read_header(db_path, &header) == 0) {
+            for (uint32_t i = 0; i < (uint32_t)1 << header.shard_bits; i++) {
+                shard_path(path, sizeof(path), db_path, i, header.shard_bits);
+                remove_store_side_files(path, removed);
+            }
+        }
+    }
+    const char *suffixes[] = {FUSE_FILE_SUFFIX, HOT_FILE_SUFFIX, MPHF_FILE_SUFFIX};
+    for (size_t i = 0; i < sizeof(suffixes) / sizeof(suffixes[0]); i++) {
+        snprintf(path, sizeof(path), "%s%s", db_path, suffixes[i]);
+        remove_if_present(path, removed);
+    }
+    // Every slot, not only up to the first gap
+    for (int i = 1; i <= DELTA_MAX_SEGMENTS; i++) {
+        snprintf(path, sizeof(path), "%s%s.%d", db_path, DELTA_FILE_SUFFIX, i);
+        remove_if_present(path, removed);
+        snprintf(path, sizeof(path), "%s%s.%d%s", db_path, DELTA_FILE_SUFFIX, i, CHECKSUM_FILE_SUFFIX);
+        remove(path);
+    }
+}
+
+/**
+ * Removes what a database kept next to a base store that was just rebuilt
+ * from a full dump: its filter, hot set, index and delta segments, and those
+ * of every shard.
+ *
+ * init_db() loads these files without knowing which base they were built
+ * from, so after a re-import a stale filter would rule out the hashes the new
+ * dump added, a stale hot set or delta segment would override its counts, and
+ * an index would describe other records. The caller rebuilds whichever of them
+ * were asked for.
+ *
+ * Parameters:
+ * - db_path (const char*): Path to the new SQLite database, flat store, packed store or shard manifest.
+ */
+void remove_side_files(const char *db_path) {
+    int removed = 0;
+    remove_store_side_files(db_path, &removed);
+    if (removed > 0) {
+        printf("Removed %d filter, hot set, index or delta file(s) left from the previous database\n", removed);
+    }
+}
+
+// Tally of a verification across every file of a database
+typedef struct {
+    int threads;
+    uint64_t files;
+    uint64_t bytes;
+    uint64_t damaged;
+    uint64_t unchecked;
+} VerifyTally;
+
+static int verify_file(const char *path, void *ctx) {
+    VerifyTally *tally = ctx;
+    uint64_t bytes;
+    int rc = checksum_verify(path, tally->threads, &bytes);
+    tally->files++;
+    tally->bytes += bytes;
+    tally->damaged += rc == 1;
+    tally->unchecked += rc < 0;
+    return 0; // Keep going, so one run reports every damaged file
+}
+
+/**
+ * Checks every file of a database against its checksum manifest.
+ *
+ * Files are verified one after another, each by all threads at once, so the
+ * check runs at the speed the device (or, for a cached file, memory) can
+ * deliver. Damaged blocks are reported as they are found, and a summary is
+ * printed at the end.
+ *
+ * Parameters:
+ * - db_path (const char*): Path to the SQLite database, flat store, packed store or shard manifest.
+ * - threads (int): Hashing threads; 0 for one per core.
+ *
+ * Returns:
+ * - int: 0 if every file matches its checksums, 1 if any is damaged, unreadable or has none.
+ */
+int verify_pwned_db(const char *db_path, int threads) {
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    VerifyTally tally = {threads, 0, 0, 0, 0};
+    int rc = for_each_store_file(db_path, verify_file, &tally);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    double seconds = (double)(end.tv_sec - start.tv_sec) + (double)(end.tv_nsec - start.tv_nsec) / 1e9;
+
+    printf("Checked %llu file(s), %.2f GB in %.2f s (%.2f GB/s): ", (unsigned long long)tally.files,
+           tally.bytes / 1e9, seconds, seconds > 0 ? tally.bytes / 1e9 / seconds : 0.0);
+    if (rc != 0 || tally.damaged + tally.unchecked > 0) {
+        printf("%llu damaged, %llu without checksums\n", (unsigned long long)tally.damaged,
+               (unsigned long long)tally.unchecked);
+        return 1;
+    }
+    printf("every block matches\n");
+    return 0;
+}
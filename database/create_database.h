@@ -4,10 +4,76 @@
 #include <stdio.h>
 #include <sqlite3.h>
 #include <string.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <time.h>
 
+#include "block_checksum.h"
+#include "deep_check.h"
+#include "flat_store.h"
+#include "fuse_filter.h"
+#include "hash_kind.h"
+#include "hex.h"
+#include "hot_set.h"
+#include "mphf_index.h"
+#include "packed_store.h"
+#include "stream_input.h"
+
+// Rows an SQLite import commits at a time; each commit records where to resume
+#define IMPORT_COMMIT_ROWS 1000000
+
+// Loads a plain, gzip or zstd dump of SHA-1 or NTLM hashes into SQLite in resumable chunks
 int create_pwned_db(const char *db_path, const char *pwned_file_path);
 
-// Utility function to convert a hex string to a binary array
-void hex_to_bin_sql(const char *hex, unsigned char *bin);
+// Creates the clustered (WITHOUT ROWID) pwned_passwords table on an open connection
+int create_pwned_schema(sqlite3 *db);
+
+// Rewrites an older database in place to the clustered schema without the duplicate index
+int migrate_pwned_db(const char *db_path);
+
+// Writes the same data as a sorted fixed-width flat store of the dump's kind for memory-mapped lookups
+int create_flat_db(const char *flat_path, const char *pwned_file_path);
+
+// Re-encodes a flat store as a bucketed Elias-Fano packed store
+int create_packed_db(const char *pack_path, const char *flat_path);
+
+// Builds the "<db_path>.filter" pre-check filter from an existing database
+int create_filter(const char *db_path);
+
+// Builds the "<db_path>.hot" table of the most breached hashes; 0 entries removes it
+int create_hot_set(const char *db_path, uint64_t entries);
+
+// Builds the "<db_path>.mphf" minimal perfect hash index of a flat store
+int create_mphf_index(const char *db_path, int threads);
+
+// Builds the "<path>.xxh" block checksums of the store, its shards and its delta segments
+int create_checksums(const char *db_path, int threads);
+
+// Rewrites "<path>.xxh" after the file changed, if it has one
+int refresh_checksums(const char *path);
+
+// Removes the filter, hot set, index and delta segments left next to a rebuilt base store
+void remove_side_files(const char *db_path);
+
+// Checks every file of a database against its block checksums; 0 if all of them match
+int verify_pwned_db(const char *db_path, int threads);
+
+/**
+ * Dataset of a dump being parsed. It is unknown until the first well-formed
+ * line, whose hash width fixes it: 40 hex digits for SHA-1, 32 for NTLM.
+ * Callers that already know the kind (say, of the database a dump updates)
+ * set it up front.
+ */
+typedef struct {
+    HashKind kind;
+    int known;
+} DumpKind;
+
+// Parses a "HASH:COUNT" line into a binary hash of the dump's width and a count;
+// 0 on success, -1 if malformed, 1 if well-formed but of another kind than the dump
+int parse_pwned_line(const char *line, size_t length, DumpKind *dump, unsigned char *hash, uint32_t *count);
+
+// Kind of a dump from its first well-formed line; 0 on success, -1 if unreadable or without one
+int dump_kind(const char *pwned_file_path, HashKind *kind);
 
 #endif // CREATE_DATABASE_H
\ No newline at end of file
@@ -1,19 +1,217 @@
 #include "create_database.h"
+#include "parallel_import.h"
+#include "delta_update.h"
+
+static void usage(const char *program) {
+    fprintf(stderr, "Usage: %s [--flat | --packed] [--parallel] [--threads N] [--shards N] [--filter] [--hot N | --hot-memory MB]\n"
+                    "          [--mphf] <database_path> <pwned_passwords_file>\n"
+                    "       %s [--filter] [--hot N | --hot-memory MB] [--mphf] [--checksums] [--threads N] <database_path>\n"
+                    "       %s --verify [--threads N] <database_path>\n"
+                    "       %s --migrate <database_path>\n"
+                    "       %s --update <database_path> <new_pwned_passwords_file>\n"
+                    "       %s --compact <database_path>\n", program, program, program, program, program, program);
+}
 
 int main(int argc, char *argv[]) {
-    if (argc != 3) {
-        fprintf(stderr, "Usage: %s <database_path> <pwned_passwords_file>\n", argv[0]);
+    int flat = 0;
+    int packed = 0;
+    int parallel = 0;
+    int threads = 0;
+    unsigned shard_bits = 0;
+    int filter = 0;
+    int hot = 0;
+    uint64_t hot_entries = 0;
+    int mphf = 0;
+    int checksums = 0;
+    int verify = 0;
+    int migrate = 0;
+    int update = 0;
+    int compact = 0;
+    int arg = 1;
+    for (; arg < argc && strncmp(argv[arg], "--", 2) == 0; arg++) {
+        if (strcmp(argv[arg], "--flat") == 0) {
+            flat = 1;
+        } else if (strcmp(argv[arg], "--packed") == 0) {
+            packed = 1;
+        } else if (strcmp(argv[arg], "--parallel") == 0) {
+            parallel = 1;
+        } else if (strcmp(argv[arg], "--migrate") == 0) {
+            migrate = 1;
+        } else if (strcmp(argv[arg], "--update") == 0) {
+            update = 1;
+        } else if (strcmp(argv[arg], "--compact") == 0) {
+            compact = 1;
+        } else if (strcmp(argv[arg], "--filter") == 0) {
+            filter = 1;
+        } else if (strcmp(argv[arg], "--mphf") == 0) {
+            mphf = 1;
+        } else if (strcmp(argv[arg], "--checksums") == 0) {
+            checksums = 1;
+        } else if (strcmp(argv[arg], "--verify") == 0) {
+            verify = 1;
+        } else if (strcmp(argv[arg], "--threads") == 0 && arg + 1 < argc) {
+            threads = atoi(argv[++arg]);
+            parallel = 1;
+        } else if (strcmp(argv[arg], "--hot") == 0 && arg + 1 < argc) {
+            hot = 1;
+            hot_entries = strtoull(argv[++arg], NULL, 10);
+        } else if (strcmp(argv[arg], "--hot-memory") == 0 && arg + 1 < argc) {
+            // The largest hot set whose table fits the budget
+            hot = 1;
+            hot_entries = hot_entries_for_bytes((size_t)(atof(argv[++arg]) * 1024 * 1024));
+        } else if (strcmp(argv[arg], "--shards") == 0 && arg + 1 < argc) {
+            // A power of two, so the shard is simply the leading bits of the hash
+            long shards = atol(argv[++arg]);
+            while (shard_bits <= SHARD_MAX_BITS && (1L << shard_bits) < shards) {
+                shard_bits++;
+            }
+            if (shards < 2 || shard_bits > SHARD_MAX_BITS || (1L << shard_bits) != shards) {
+                fprintf(stderr, "Shard count must be a power of two between 2 and %u\n", 1u << SHARD_MAX_BITS);
+                return 1;
+            }
+        } else {
+            usage(argv[0]);
+            return 1;
+        }
+    }
+
+    // Schema migration works on an existing SQLite database only
+    if (migrate) {
+        if (argc - arg != 1) {
+            usage(argv[0]);
+            return 1;
+        }
+        return migrate_pwned_db(argv[arg]) == SQLITE_OK && refresh_checksums(argv[arg]) == 0 ? 0 : 1;
+    }
+
+    // Verification reads every block of every store file against its checksums
+    if (verify) {
+        if (argc - arg != 1) {
+            usage(argv[0]);
+            return 1;
+        }
+        return verify_pwned_db(argv[arg], threads);
+    }
+
+    // Refreshes go into a delta segment; compaction folds the segments into the base
+    if (update) {
+        if (argc - arg != 2) {
+            usage(argv[0]);
+            return 1;
+        }
+        return update_pwned_db(argv[arg], argv[arg + 1]) == 0 ? 0 : 1;
+    }
+    if (compact) {
+        if (argc - arg != 1) {
+            usage(argv[0]);
+            return 1;
+        }
+        return compact_pwned_db(argv[arg]) == 0 ? 0 : 1;
+    }
+
+    // With --filter, --hot, --mphf or --checksums alone, build them for an existing database
+    if ((filter || hot || mphf || checksums) && argc - arg == 1) {
+        if (filter && create_filter(argv[arg]) != 0) {
+            printf("Failed to create the filter.\n");
+            return 1;
+        }
+        if (hot && create_hot_set(argv[arg], hot_entries) != 0) {
+            printf("Failed to create the hot set.\n");
+            return 1;
+        }
+        if (mphf && create_mphf_index(argv[arg], threads) != 0) {
+            printf("Failed to create the index.\n");
+            return 1;
+        }
+        if (checksums && create_checksums(argv[arg], threads) != 0) {
+            printf("Failed to create the checksums.\n");
+            return 1;
+        }
+        if (filter || hot || mphf) {
+            printf("%s%s%s created successfully.\n", filter ? "Filter" : "",
+                   hot ? (filter ? (mphf ? ", hot set" : " and hot set") : "Hot set") : "",
+                   mphf ? (filter || hot ? " and index" : "Index") : "");
+        }
+        if (checksums) {
+            printf("Checksums created successfully.\n");
+        }
+        return 0;
+    }
+
+    if (argc - arg != 2) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    const char *db_path = argv[arg];
+    const char *pwned_file_path = argv[arg + 1];
+
+    // Every shard is built by its own thread straight from the parsed input
+    if (shard_bits > 0 && packed) {
+        fprintf(stderr, "Shards are SQLite databases or flat stores; --packed is not supported with --shards\n");
         return 1;
     }
 
-    const char *db_path = argv[1];
-    const char *pwned_file_path = argv[2];
+    // The parallel and sharded importers parse 40-digit SHA-1 lines only, and packed stores hold SHA-1 keys
+    HashKind kind;
+    if ((packed || parallel || shard_bits > 0) && !flat_is_store(pwned_file_path) &&
+        dump_kind(pwned_file_path, &kind) == 0 && kind != HASH_KIND_SHA1) {
+        fprintf(stderr, "%s is an %s dump; import it into an SQLite database or a flat store, "
+                        "without --packed, --parallel or --shards\n", pwned_file_path, hash_kind_name(kind));
+        return 1;
+    }
 
-    if (create_pwned_db(db_path, pwned_file_path) == SQLITE_OK) {
+    // A packed store is encoded from a sorted flat store: either the input itself
+    // or a temporary one imported next to the output
+    char flat_tmp_path[4096];
+    const char *import_path = db_path;
+    if (packed) {
+        snprintf(flat_tmp_path, sizeof(flat_tmp_path), "%s.tmp", db_path);
+        import_path = flat_tmp_path;
+        flat = 1;
+    }
+
+    int rc = SQLITE_OK;
+    if (packed && flat_is_store(pwned_file_path)) {
+        import_path = pwned_file_path;
+    } else if (shard_bits > 0) {
+        rc = import_sharded(db_path, pwned_file_path, flat ? IMPORT_TARGET_FLAT : IMPORT_TARGET_SQLITE, threads, shard_bits);
+    } else if (parallel) {
+        rc = import_parallel(import_path, pwned_file_path, flat ? IMPORT_TARGET_FLAT : IMPORT_TARGET_SQLITE, threads);
+    } else {
+        rc = flat ? create_flat_db(import_path, pwned_file_path)
+                  : create_pwned_db(import_path, pwned_file_path);
+    }
+    if (packed) {
+        if (rc == SQLITE_OK) {
+            rc = create_packed_db(db_path, import_path);
+        }
+        if (import_path == flat_tmp_path) {
+            remove(flat_tmp_path);
+        }
+    }
+    // Side files of the previous base would answer for the new one; only the requested ones are rebuilt
+    if (rc == SQLITE_OK) {
+        remove_side_files(db_path);
+    }
+    if (rc == SQLITE_OK && filter) {
+        rc = create_filter(db_path);
+    }
+    if (rc == SQLITE_OK && hot) {
+        rc = create_hot_set(db_path, hot_entries);
+    }
+    if (rc == SQLITE_OK && mphf) {
+        rc = create_mphf_index(db_path, threads);
+    }
+    // Every new store gets its block checksums, so it can be verified after any copy
+    if (rc == SQLITE_OK) {
+        rc = create_checksums(db_path, threads);
+    }
+    if (rc == SQLITE_OK) {
         printf("Database created and populated successfully.\n");
     } else {
         printf("Failed to create or populate the database.\n");
     }
 
-    return 0;
-}
\ No newline at end of file
+    return rc == SQLITE_OK ? 0 : 1;
+}
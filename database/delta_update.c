@@ -0,0 +1,455 @@
+#include "delta_update.h"
+#include "create_database.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+static double elapsed_seconds(const struct timespec *start) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (double)(now.tv_sec - start->tv_sec) + (double)(now.tv_nsec - start->tv_nsec) / 1e9;
+}
+
+static void delta_path(char *out, size_t size, const char *db_path, int number) {
+    snprintf(out, size, "%s%s.%d", db_path, DELTA_FILE_SUFFIX, number);
+}
+
+/**
+ * Applies a new HIBP dump to an existing database as a delta segment.
+ *
+ * Every line of the dump is looked up in the current view of the database (the
+ * base store plus any earlier deltas). Hashes that are missing, or whose count
+ * changed, are written to a new sorted flat store, "<db_path>.delta.N". The
+ * segment is built under a temporary name and renamed into place, so checkers
+ * never see a half-written delta; each process picks it up the next time it
+ * opens the database. The base store is not modified, and checkers keep running
+ * throughout. When DELTA_MAX_SEGMENTS segments already exist they are compacted
+ * first.
+ *
+ * Parameters:
+ * - db_path (const char*): Path to the SQLite database, flat store, packed store or shard manifest.
+ * - pwned_file_path (const char*): The new dump, "HASH:COUNT" per line in any order; plain, .gz or .zst.
+ *   Its hashes must be of the kind the database holds, SHA-1 or NTLM.
+ *
+ * Returns:
+ * - int: 0 on success (including when nothing changed), 1 on failure.
+ */
+int update_pwned_db(const char *db_path, const char *pwned_file_path) {
+    PwnedDB db;
+    if (init_db(&db, db_path) != 0) {
+        return 1;
+    }
+    if (db.delta_count == DELTA_MAX_SEGMENTS) {
+        close_db(&db);
+        if (compact_pwned_db(db_path) != 0 || init_db(&db, db_path) != 0) {
+            return 1;
+        }
+    }
+    int number = db.delta_count + 1;
+
+    // Plain, gzip or zstd input; a reader thread decompresses it alongside the lookups
+    StreamReader reader;
+    if (stream_open(&reader, pwned_file_path, 0) != 0) {
+        close_db(&db);
+        return 1;
+    }
+
+    char tmp_path[4096];
+    snprintf(tmp_path, sizeof(tmp_path), "%s%s.tmp", db_path, DELTA_FILE_SUFFIX);
+    FlatWriter writer;
+    if (flat_writer_open_kind(&writer, tmp_path, db.kind) != 0) {
+        stream_close(&reader);
+        close_db(&db);
+        return 1;
+    }
+
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    uint64_t lines = 0, added = 0, changed = 0, skipped = 0;
+    const char *line;
+    size_t length;
+    unsigned char hash[HASH_MAX_SIZE];
+    uint32_t count;
+    DumpKind dump = {db.kind, 1}; // The dump must hold the kind of hashes the database does
+    int rc = 0;
+    while (rc == 0 && (line = stream_read_line(&reader, &length)) != NULL) {
+        lines++;
+        int parsed = parse_pwned_line(line, length, &dump, hash, &count);
+        if (parsed > 0) {
+            fprintf(stderr, "%s holds %s hashes; %s has hashes of another kind\n", db_path, hash_kind_name(db.kind),
+                    pwned_file_path);
+            rc = 1;
+            break;
+        }
+        if (parsed < 0) {
+            skipped++;
+            continue;
+        }
+
+        int current = 0;
+        int found = lookup_hash(&db, hash, &current);
+        if (found < 0) {
+            rc = 1;
+        } else if (!found) {
+            added++;
+            rc = flat_writer_add(&writer, hash, count);
+        } else if ((uint32_t)current != count) {
+            changed++;
+            rc = flat_writer_add(&writer, hash, count);
+        }
+    }
+    if (stream_close(&reader) != 0) {
+        rc = 1;
+    }
+    close_db(&db);
+
+    if (flat_writer_finish(&writer) != 0 || rc != 0) {
+        remove(tmp_path);
+        return 1;
+    }
+    printf("Scanned %llu lines in %.1f s: %llu new, %llu changed, %llu skipped\n",
+           (unsigned long long)lines, elapsed_seconds(&start), (unsigned long long)added,
+           (unsigned long long)changed, (unsigned long long)skipped);
+
+    if (added + changed == 0) {
+        remove(tmp_path);
+        printf("Database is already up to date.\n");
+        return 0;
+    }
+
+    char final_path[4096];
+    delta_path(final_path, sizeof(final_path), db_path, number);
+    if (rename(tmp_path, final_path) != 0) {
+        fprintf(stderr, "Failed to install delta segment: %s\n", final_path);
+        remove(tmp_path);
+        return 1;
+    }
+    // The segment is read by every lookup, so it gets checksums like the store it extends
+    if (checksum_write(final_path, 0) != 0) {
+        return 1;
+    }
+    printf("Wrote delta segment %s\n", final_path);
+    return 0;
+}
+
+/**
+ * Merge state for folding delta segments into a rewritten base.
+ *
+ * Base records are pushed in order; before each one, every delta record that
+ * sorts before it is emitted, and a delta record with the same key replaces it.
+ * key_bytes is the hash width (20 for SHA-1, 16 for NTLM) for a flat base and 8
+ * for a packed base, which only knows the leading 64 bits of each hash. Each segment is read from positions[i] up to ends[i].
+ */
+typedef struct {
+    FlatWriter writer;
+    const FlatStore *deltas;
+    int delta_count;
+    uint64_t positions[DELTA_MAX_SEGMENTS];
+    uint64_t ends[DELTA_MAX_SEGMENTS];
+    size_t key_bytes;
+    int failed;
+} CompactMerge;
+
+// Emits delta records below hash (or all remaining when hash is NULL); returns 1 if one equal to hash replaced it
+static int merge_deltas_until(CompactMerge *merge, const unsigned char *hash) {
+    for (;;) {
+        int winner = -1;
+        for (int i = 0; i < merge->delta_count; i++) {
+            const FlatStore *delta = &merge->deltas[i];
+            if (merge->positions[i] < merge->ends[i] &&
+                (winner < 0 || memcmp(flat_record_hash(delta, merge->positions[i]),
+                                      flat_record_hash(&merge->deltas[winner], merge->positions[winner]),
+                                      merge->key_bytes) <= 0)) {
+                winner = i; // Later segments win ties
+            }
+        }
+        if (winner < 0) {
+            return 0;
+        }
+
+        const FlatStore *source = &merge->deltas[winner];
+        const unsigned char *record = flat_record_hash(source, merge->positions[winner]);
+        uint32_t count = flat_record_count(source, merge->positions[winner]);
+        int cmp = hash == NULL ? -1 : memcmp(record, hash, merge->key_bytes);
+        if (cmp > 0) {
+            return 0;
+        }
+        for (int i = 0; i < merge->delta_count; i++) {
+            const FlatStore *delta = &merge->deltas[i];
+            if (i != winner && merge->positions[i] < merge->ends[i] &&
+                memcmp(flat_record_hash(delta, merge->positions[i]), record, merge->key_bytes) == 0) {
+                merge->positions[i]++;
+            }
+        }
+        merge->positions[winner]++;
+        if (flat_writer_add(&merge->writer, record, count) != 0) {
+            merge->failed = 1;
+        }
+        if (cmp == 0) {
+            return 1;
+        }
+    }
+}
+
+static void merge_base_record(CompactMerge *merge, const unsigned char *hash, uint32_t count) {
+    if (!merge_deltas_until(merge, hash) && flat_writer_add(&merge->writer, hash, count) != 0) {
+        merge->failed = 1;
+    }
+}
+
+static int merge_packed_record(uint64_t key, uint32_t count, void *ctx) {
+    unsigned char hash[FLAT_HASH_SIZE] = {0};
+    for (int i = 0; i < 8; i++) {
+        hash[i] = (unsigned char)(key >> (56 - 8 * i));
+    }
+    merge_base_record(ctx, hash, count);
+    return 0;
+}
+
+// Applies the deltas to an SQLite base in place; UPSERT replaces stale counts
+static int compact_sqlite(const char *db_path, const PwnedDB *db) {
+    sqlite3 *sqlite;
+    if (sqlite3_open_v2(db_path, &sqlite, SQLITE_OPEN_READWRITE, NULL) != SQLITE_OK) {
+        fprintf(stderr, "Cannot open database: %s\n", sqlite3_errmsg(sqlite));
+        sqlite3_close(sqlite);
+        return 1;
+    }
+    sqlite3_busy_timeout(sqlite, SQLITE_LOOKUP_BUSY_MS);
+
+    sqlite3_stmt *stmt = NULL;
+    const char *sql_upsert = "INSERT INTO pwned_passwords(full_hash, count) VALUES(?, ?) "
+                             "ON CONFLICT(full_hash) DO UPDATE SET count = excluded.count";
+    int rc = sqlite3_exec(sqlite, "BEGIN IMMEDIATE;", NULL, NULL, NULL);
+    if (rc == SQLITE_OK) {
+        rc = sqlite3_prepare_v2(sqlite, sql_upsert, -1, &stmt, NULL);
+    }
+
+    // Oldest segment first, so newer counts overwrite older ones
+    for (int i = 0; rc == SQLITE_OK && i < db->delta_count; i++) {
+        const FlatStore *delta = &db->deltas[i];
+        for (uint64_t r = 0; rc == SQLITE_OK && r < delta->header->record_count; r++) {
+            sqlite3_bind_blob(stmt, 1, flat_record_hash(delta, r), (int)delta->hash_size, SQLITE_STATIC);
+            sqlite3_bind_int64(stmt, 2, flat_record_count(delta, r));
+            rc = sqlite3_step(stmt) == SQLITE_DONE ? SQLITE_OK : SQLITE_ERROR;
+            sqlite3_reset(stmt);
+        }
+    }
+    sqlite3_finalize(stmt);
+
+    if (rc == SQLITE_OK) {
+        rc = sqlite3_exec(sqlite, "COMMIT;", NULL, NULL, NULL);
+    }
+    if (rc != SQLITE_OK) {
+        fprintf(stderr, "Failed to apply deltas: %s\n", sqlite3_errmsg(sqlite));
+        sqlite3_exec(sqlite, "ROLLBACK;", NULL, NULL, NULL);
+    }
+    sqlite3_close(sqlite);
+    return rc == SQLITE_OK ? 0 : 1;
+}
+
+// Rewrites a flat or packed base with the deltas merged in, then swaps it into place
+static int compact_mapped(const char *db_path, const PwnedDB *db) {
+    char flat_tmp[4096], packed_tmp[4096], filter_path[4096];
+    char filter_tmp[sizeof(packed_tmp) + sizeof(FUSE_FILE_SUFFIX)];
+    char hot_path[4096], hot_tmp[sizeof(packed_tmp) + sizeof(HOT_FILE_SUFFIX)];
+    char mphf_path[4096], mphf_tmp[sizeof(flat_tmp) + sizeof(MPHF_FILE_SUFFIX)];
+    snprintf(flat_tmp, sizeof(flat_tmp), "%s.compact", db_path);
+    snprintf(packed_tmp, sizeof(packed_tmp), "%s.compact.pack", db_path);
+
+    CompactMerge merge;
+    memset(&merge, 0, sizeof(merge));
+    merge.deltas = db->deltas;
+    merge.delta_count = db->delta_count;
+    merge.key_bytes = db->backend == DB_BACKEND_PACKED ? 8 : db->hash_size;
+    for (int i = 0; i < db->delta_count; i++) {
+        merge.ends[i] = db->deltas[i].header->record_count;
+    }
+    if (flat_writer_open_kind(&merge.writer, flat_tmp, db->kind) != 0) {
+        return 1;
+    }
+
+    if (db->backend == DB_BACKEND_PACKED) {
+        packed_for_each(&db->packed, merge_packed_record, &merge);
+    } else {
+        for (uint64_t i = 0; i < db->flat.header->record_count; i++) {
+            merge_base_record(&merge, flat_record_hash(&db->flat, i), flat_record_count(&db->flat, i));
+        }
+    }
+    merge_deltas_until(&merge, NULL);
+    if (flat_writer_finish(&merge.writer) != 0 || merge.failed) {
+        remove(flat_tmp);
+        return 1;
+    }
+
+    const char *new_base = flat_tmp;
+    if (db->backend == DB_BACKEND_PACKED) {
+        int rc = create_packed_db(packed_tmp, flat_tmp);
+        remove(flat_tmp);
+        if (rc != 0) {
+            remove(packed_tmp);
+            return 1;
+        }
+        new_base = packed_tmp;
+    }
+
+    // Install the new filter before the new base: a filter that knows extra keys is
+    // harmless to readers of the old base, one that misses keys is not
+    snprintf(filter_path, sizeof(filter_path), "%s%s", db_path, FUSE_FILE_SUFFIX);
+    snprintf(filter_tmp, sizeof(filter_tmp), "%s%s", new_base, FUSE_FILE_SUFFIX);
+    if (db->has_filter && (create_filter(new_base) != 0 || rename(filter_tmp, filter_path) != 0)) {
+        fprintf(stderr, "Failed to rebuild the filter for the compacted store\n");
+        remove(filter_tmp);
+        remove(new_base);
+        return 1;
+    }
+    // The hot set goes in before the base too: while the deltas remain they override
+    // it, and its counts already match what the compacted base will hold
+    snprintf(hot_path, sizeof(hot_path), "%s%s", db_path, HOT_FILE_SUFFIX);
+    snprintf(hot_tmp, sizeof(hot_tmp), "%s%s", new_base, HOT_FILE_SUFFIX);
+    if (db->has_hot && (create_hot_set(new_base, db->hot.entry_count) != 0 || rename(hot_tmp, hot_path) != 0)) {
+        fprintf(stderr, "Failed to rebuild the hot set for the compacted store\n");
+        remove(hot_tmp);
+        remove(new_base);
+        return 1;
+    }
+    // An index only serves the key set it was built over; init_db() ignores one whose
+    // key count disagrees with the base, so a checker opening in between falls back to search
+    snprintf(mphf_path, sizeof(mphf_path), "%s%s", db_path, MPHF_FILE_SUFFIX);
+    snprintf(mphf_tmp, sizeof(mphf_tmp), "%s%s", new_base, MPHF_FILE_SUFFIX);
+    if (db->has_mphf && (create_mphf_index(new_base, 0) != 0 || rename(mphf_tmp, mphf_path) != 0)) {
+        fprintf(stderr, "Failed to rebuild the index for the compacted store\n");
+        remove(mphf_tmp);
+        remove(new_base);
+        return 1;
+    }
+    if (rename(new_base, db_path) != 0) {
+        fprintf(stderr, "Failed to install compacted store: %s\n", db_path);
+        remove(new_base);
+        return 1;
+    }
+    return 0;
+}
+
+/**
+ * Hands the deltas of a sharded database down to its shards and compacts each.
+ *
+ * For every shard, the records of all top-level segments that fall in it are
+ * merged (newest copy winning) into one new segment of that shard, which is then
+ * compacted like any other database. The top-level segments are removed by the
+ * caller afterwards; until then a reader finds the same counts either way.
+ */
+static int compact_sharded(const char *db_path, const PwnedDB *db) {
+    char shard[4096];
+    char tmp_path[sizeof(shard) + sizeof(DELTA_FILE_SUFFIX) + 16], final_path[sizeof(tmp_path)];
+    for (uint32_t s = 0; s < (uint32_t)1 << db->shard_bits; s++) {
+        CompactMerge merge;
+        memset(&merge, 0, sizeof(merge));
+        merge.deltas = db->deltas;
+        merge.delta_count = db->delta_count;
+        merge.key_bytes = db->hash_size;
+        uint64_t records = 0;
+        for (int i = 0; i < db->delta_count; i++) {
+            flat_prefix_range(&db->deltas[i], s, db->shard_bits, &merge.positions[i], &merge.ends[i]);
+            records += merge.ends[i] - merge.positions[i];
+        }
+        const PwnedDB *shard_db = &db->shards[s];
+        if (records == 0 && shard_db->delta_count == 0) {
+            continue;
+        }
+
+        shard_path(shard, sizeof(shard), db_path, s, db->shard_bits);
+        int number = shard_db->delta_count + 1;
+        if (records > 0) {
+            if (number > DELTA_MAX_SEGMENTS) {
+                if (compact_pwned_db(shard) != 0) {
+                    return 1;
+                }
+                number = 1;
+            }
+            snprintf(tmp_path, sizeof(tmp_path), "%s%s.tmp", shard, DELTA_FILE_SUFFIX);
+            if (flat_writer_open_kind(&merge.writer, tmp_path, db->kind) != 0) {
+                return 1;
+            }
+            merge_deltas_until(&merge, NULL);
+            delta_path(final_path, sizeof(final_path), shard, number);
+            if (flat_writer_finish(&merge.writer) != 0 || merge.failed || rename(tmp_path, final_path) != 0) {
+                fprintf(stderr, "Failed to write delta segment for shard %s\n", shard);
+                remove(tmp_path);
+                return 1;
+            }
+        }
+        if (compact_pwned_db(shard) != 0) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/**
+ * Folds every delta segment into the base store.
+ *
+ * An SQLite base is updated in place with UPSERTs inside one transaction, so
+ * readers wait at most for the commit; its filter and hot set, if any, are then
+ * rebuilt. A flat or packed base is rewritten by a single merge pass over the
+ * base and the segments, and the result is renamed over the old file. Processes that already have the old file mapped keep using
+ * it until they reopen. A sharded database passes its segments down to the
+ * shards and compacts each one. The segments are deleted only after the base holds
+ * their contents, so a reader never loses a record in the process.
+ *
+ * Parameters:
+ * - db_path (const char*): Path to the SQLite database, flat store, packed store or shard manifest.
+ *
+ * Returns:
+ * - int: 0 on success (including when there was nothing to compact), 1 on failure.
+ */
+int compact_pwned_db(const char *db_path) {
+    PwnedDB db;
+    if (init_db(&db, db_path) != 0) {
+        return 1;
+    }
+    int segments = db.delta_count;
+    if (segments == 0) {
+        close_db(&db);
+        printf("No delta segments to compact.\n");
+        return 0;
+    }
+
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    int in_place = db.backend == DB_BACKEND_SQLITE;
+    int sharded = db.backend == DB_BACKEND_SHARDED;
+    int had_filter = db.has_filter;
+    uint64_t hot_entries = db.has_hot ? db.hot.entry_count : 0;
+    int rc = in_place ? compact_sqlite(db_path, &db)
+           : db.backend == DB_BACKEND_SHARDED ? compact_sharded(db_path, &db)
+           : compact_mapped(db_path, &db);
+    close_db(&db);
+
+    // The filter covers the base only, so it must learn the merged keys before the deltas go
+    if (rc == 0 && in_place && had_filter) {
+        rc = create_filter(db_path);
+    }
+    // So must the hot set, whose counts would otherwise go stale with the deltas gone
+    if (rc == 0 && in_place && hot_entries > 0) {
+        rc = create_hot_set(db_path, hot_entries);
+    }
+    // A rewritten or updated base invalidates its checksums; each shard refreshed its own
+    if (rc == 0 && !sharded) {
+        rc = refresh_checksums(db_path);
+    }
+    if (rc != 0) {
+        return 1;
+    }
+
+    // Newest first, so a reader opening meanwhile never sees a later segment without an earlier one
+    char path[4096], sums_path[4096 + sizeof(CHECKSUM_FILE_SUFFIX)];
+    for (int i = segments; i >= 1; i--) {
+        delta_path(path, sizeof(path), db_path, i);
+        remove(path);
+        snprintf(sums_path, sizeof(sums_path), "%s%s", path, CHECKSUM_FILE_SUFFIX);
+        remove(sums_path);
+    }
+    printf("Compacted %d delta segment(s) in %.1f s\n", segments, elapsed_seconds(&start));
+    return 0;
+}
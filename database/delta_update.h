@@ -0,0 +1,17 @@
+#ifndef DELTA_UPDATE_H
+#define DELTA_UPDATE_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <sqlite3.h>
+
+#include "deep_check.h"
+#include "flat_store.h"
+
+// Applies a new or changed pwned passwords dump as a delta segment next to the store
+int update_pwned_db(const char *db_path, const char *pwned_file_path);
+
+// Folds every delta segment into the base store and removes the segments
+int compact_pwned_db(const char *db_path);
+
+#endif // DELTA_UPDATE_H
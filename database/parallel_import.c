@@ -0,0 +1,603 @@
+#include "parallel_import.h"
+#include "create_database.h"
+#include "stream_input.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+// Where merged records go: a flat store writer or a prepared SQLite insert
+typedef struct {
+    ImportTarget target;
+    FlatWriter flat;
+    sqlite3 *db;
+    sqlite3_stmt *insert;
+} ImportSink;
+
+static double elapsed_seconds(const struct timespec *start) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (double)(now.tv_sec - start->tv_sec) + (double)(now.tv_nsec - start->tv_nsec) / 1e9;
+}
+
+/**
+ * Parses one chunk of the mapped input into binary records.
+ *
+ * Each line is expected to be 40 hex digits, a colon and a decimal count,
+ * optionally followed by "\r". Hashes go through the table-driven hex_decode()
+ * and counts are accumulated by hand, so no stdio parsing is involved.
+ * Records are sorted before the worker returns if the chunk was not already
+ * in hash order, which lets the caller merge chunks without another pass. The
+ * sort is stable, so duplicates of a hash stay in input order.
+ *
+ * Parameters:
+ * - arg (void*): The ImportChunk to fill in.
+ *
+ * Returns:
+ * - void*: Always NULL; errors are reported through chunk->failed.
+ */
+void *import_parse_chunk(void *arg) {
+    ImportChunk *chunk = arg;
+    int sorted = 1;
+
+    // Lines are at least 43 bytes, so this rarely needs to grow
+    chunk->capacity = (size_t)(chunk->end - chunk->begin) / 43 + 16;
+    chunk->records = malloc(chunk->capacity * sizeof(FlatRecord));
+    if (chunk->records == NULL) {
+        chunk->failed = 1;
+        return NULL;
+    }
+
+    const char *p = chunk->begin;
+    while (p < chunk->end) {
+        const char *eol = memchr(p, '\n', (size_t)(chunk->end - p));
+        const char *line_end = eol ? eol : chunk->end;
+
+        if (line_end - p < 2 * FLAT_HASH_SIZE + 2 || p[2 * FLAT_HASH_SIZE] != ':') {
+            if (line_end - p > 1 || (line_end > p && *p != '\r')) {
+                chunk->skipped++;
+            }
+            p = line_end + 1;
+            continue;
+        }
+
+        if (chunk->count == chunk->capacity) {
+            size_t capacity = chunk->capacity * 2;
+            FlatRecord *grown = realloc(chunk->records, capacity * sizeof(FlatRecord));
+            if (grown == NULL) {
+                chunk->failed = 1;
+                return NULL;
+            }
+            chunk->records = grown;
+            chunk->capacity = capacity;
+        }
+
+        FlatRecord *record = &chunk->records[chunk->count];
+        const char *digit = p + 2 * FLAT_HASH_SIZE + 1;
+        uint64_t count = 0;
+        while (digit < line_end && *digit >= '0' && *digit <= '9') {
+            count = count * 10 + (uint64_t)(*digit - '0');
+            if (count > UINT32_MAX) {
+                count = UINT32_MAX;
+            }
+            digit++;
+        }
+
+        if (hex_decode(p, record->hash, FLAT_HASH_SIZE) != 0 || digit == p + 2 * FLAT_HASH_SIZE + 1) {
+            chunk->skipped++;
+        } else {
+            record->count = (uint32_t)count;
+            if (chunk->count > 0 && sorted &&
+                memcmp(chunk->records[chunk->count - 1].hash, record->hash, FLAT_HASH_SIZE) > 0) {
+                sorted = 0;
+            }
+            chunk->count++;
+        }
+        p = line_end + 1;
+    }
+
+    if (!sorted && flat_sort_records(chunk->records, NULL, chunk->count, HASH_KIND_SHA1) != 0) {
+        chunk->failed = 1;
+    }
+    return NULL;
+}
+
+// Opens the output for bulk loading; SQLite durability is traded for speed since a failed import is rerun
+static int sink_open(ImportSink *sink, ImportTarget target, const char *out_path) {
+    memset(sink, 0, sizeof(*sink));
+    sink->target = target;
+
+    if (target == IMPORT_TARGET_FLAT) {
+        return flat_writer_open(&sink->flat, out_path);
+    }
+
+    int rc = sqlite3_open(out_path, &sink->db);
+    if (rc != SQLITE_OK) {
+        fprintf(stderr, "Cannot open database: %s\n", sqlite3_errmsg(sink->db));
+        sqlite3_close(sink->db);
+        return 1;
+    }
+
+    const char *sql_bulk = "PRAGMA journal_mode=OFF;"
+                           "PRAGMA synchronous=OFF;"
+                           "PRAGMA locking_mode=EXCLUSIVE;"
+                           "PRAGMA temp_store=MEMORY;"
+                           "PRAGMA cache_size=-1048576;";
+    char *err_msg = 0;
+    rc = sqlite3_exec(sink->db, sql_bulk, NULL, NULL, &err_msg);
+    if (rc != SQLITE_OK) {
+        fprintf(stderr, "Failed to configure bulk load: %s\n", err_msg);
+        sqlite3_free(err_msg);
+        sqlite3_close(sink->db);
+        return 1;
+    }
+
+    if (create_pwned_schema(sink->db) != SQLITE_OK) {
+        sqlite3_close(sink->db);
+        return 1;
+    }
+
+    const char *sql_insert = "INSERT INTO pwned_passwords(full_hash, count) VALUES(?, ?) "
+                             "ON CONFLICT(full_hash) DO UPDATE SET count = excluded.count";
+    if (sqlite3_prepare_v2(sink->db, sql_insert, -1, &sink->insert, 0) != SQLITE_OK ||
+        sqlite3_exec(sink->db, "BEGIN TRANSACTION;", NULL, NULL, NULL) != SQLITE_OK) {
+        fprintf(stderr, "Failed to prepare bulk load: %s\n", sqlite3_errmsg(sink->db));
+        sqlite3_finalize(sink->insert);
+        sqlite3_close(sink->db);
+        return 1;
+    }
+    return 0;
+}
+
+static int sink_add(ImportSink *sink, const FlatRecord *record) {
+    if (sink->target == IMPORT_TARGET_FLAT) {
+        return flat_writer_add(&sink->flat, record->hash, record->count);
+    }
+
+    sqlite3_bind_blob(sink->insert, 1, record->hash, FLAT_HASH_SIZE, SQLITE_STATIC);
+    sqlite3_bind_int64(sink->insert, 2, record->count);
+    int rc = sqlite3_step(sink->insert);
+    sqlite3_reset(sink->insert);
+    if (rc != SQLITE_DONE) {
+        fprintf(stderr, "Failed to insert row: %s\n", sqlite3_errmsg(sink->db));
+        return 1;
+    }
+    return 0;
+}
+
+// Commits (or abandons, when failed is set) the output and releases it
+static int sink_close(ImportSink *sink, int failed) {
+    if (sink->target == IMPORT_TARGET_FLAT) {
+        return flat_writer_finish(&sink->flat) != 0 || failed;
+    }
+
+    sqlite3_finalize(sink->insert);
+    int rc = sqlite3_exec(sink->db, failed ? "ROLLBACK;" : "COMMIT;", NULL, NULL, NULL);
+    if (rc != SQLITE_OK) {
+        fprintf(stderr, "Failed to commit transaction: %s\n", sqlite3_errmsg(sink->db));
+        failed = 1;
+    }
+    sqlite3_close(sink->db);
+    return failed;
+}
+
+// Sift-down for the merge heap, ordered by each chunk's current record and then by chunk
+static void heap_sift(size_t *heap, size_t size, size_t i, ImportChunk *chunks, const size_t *pos) {
+    for (;;) {
+        size_t smallest = i;
+        size_t children[2] = {2 * i + 1, 2 * i + 2};
+        for (int c = 0; c < 2; c++) {
+            size_t child = children[c];
+            if (child >= size) {
+                continue;
+            }
+            int cmp = memcmp(chunks[heap[child]].records[pos[heap[child]]].hash,
+                             chunks[heap[smallest]].records[pos[heap[smallest]]].hash, FLAT_HASH_SIZE);
+            if (cmp < 0 || (cmp == 0 && heap[child] < heap[smallest])) {
+                smallest = child;
+            }
+        }
+        if (smallest == i) {
+            return;
+        }
+        size_t tmp = heap[i];
+        heap[i] = heap[smallest];
+        heap[smallest] = tmp;
+        i = smallest;
+    }
+}
+
+/**
+ * Streams the sorted chunks into the sink in global hash order.
+ *
+ * The HIBP dump is already sorted, so in the common case the chunks simply follow
+ * one another and are emitted back to back. Otherwise a k-way heap merge is used.
+ * Duplicates of a hash leave in input order, earlier chunks first, so the sink
+ * keeps the last count as a sequential import would.
+ *
+ * Returns:
+ * - int: 0 on success, 1 if the sink reported an error.
+ */
+static int merge_chunks(ImportChunk *chunks, int nchunks, ImportSink *sink) {
+    int in_order = 1;
+    const FlatRecord *last = NULL;
+    for (int i = 0; i < nchunks; i++) {
+        if (chunks[i].count == 0) {
+            continue;
+        }
+        if (last != NULL && memcmp(last->hash, chunks[i].records[0].hash, FLAT_HASH_SIZE) > 0) {
+            in_order = 0;
+            break;
+        }
+        last = &chunks[i].records[chunks[i].count - 1];
+    }
+
+    if (in_order) {
+        for (int i = 0; i < nchunks; i++) {
+            for (size_t r = 0; r < chunks[i].count; r++) {
+                if (sink_add(sink, &chunks[i].records[r]) != 0) {
+                    return 1;
+                }
+            }
+        }
+        return 0;
+    }
+
+    size_t *heap = malloc((size_t)nchunks * sizeof(size_t));
+    size_t *pos = calloc((size_t)nchunks, sizeof(size_t));
+    if (heap == NULL || pos == NULL) {
+        fprintf(stderr, "Memory allocation failed for merge heap!\n");
+        free(heap);
+        free(pos);
+        return 1;
+    }
+
+    size_t size = 0;
+    for (int i = 0; i < nchunks; i++) {
+        if (chunks[i].count > 0) {
+            heap[size++] = (size_t)i;
+        }
+    }
+    for (size_t i = size; i-- > 0;) {
+        heap_sift(heap, size, i, chunks, pos);
+    }
+
+    int rc = 0;
+    while (size > 0 && rc == 0) {
+        size_t top = heap[0];
+        rc = sink_add(sink, &chunks[top].records[pos[top]]);
+        if (++pos[top] == chunks[top].count) {
+            heap[0] = heap[--size];
+        }
+        heap_sift(heap, size, 0, chunks, pos);
+    }
+
+    free(heap);
+    free(pos);
+    return rc;
+}
+
+// The mapped input file and the chunks its workers parsed
+typedef struct {
+    int fd;
+    const char *data;
+    size_t size;
+    ImportChunk *chunks;
+    int nchunks;
+    size_t lines;
+    size_t skipped;
+} ImportInput;
+
+static void input_release(ImportInput *input) {
+    for (int i = 0; input->chunks != NULL && i < input->nchunks; i++) {
+        free(input->chunks[i].records);
+    }
+    free(input->chunks);
+    if (input->data != NULL) {
+        munmap((void *)input->data, input->size);
+    }
+    if (input->fd >= 0) {
+        close(input->fd);
+    }
+}
+
+/**
+ * Maps the input file and parses it into sorted chunks, one worker per chunk.
+ *
+ * Parameters:
+ * - input (ImportInput*): Filled in; release with input_release() whatever the result.
+ * - pwned_file_path (const char*): HIBP "HASH:COUNT" text file.
+ * - threads (int): Worker count; values <= 0 use one thread per online core.
+ *
+ * Returns:
+ * - int: 0 on success, 1 on any failure.
+ */
+static int input_parse(ImportInput *input, const char *pwned_file_path, int threads) {
+    memset(input, 0, sizeof(*input));
+    input->fd = open(pwned_file_path, O_RDONLY);
+    if (input->fd < 0) {
+        fprintf(stderr, "Could not open pwned password file: %s\n", pwned_file_path);
+        return 1;
+    }
+    struct stat st;
+    if (fstat(input->fd, &st) != 0) {
+        fprintf(stderr, "Could not stat pwned password file: %s\n", pwned_file_path);
+        return 1;
+    }
+    size_t size = (size_t)st.st_size;
+
+    const char *data = NULL;
+    if (size > 0) {
+        void *map = mmap(NULL, size, PROT_READ, MAP_PRIVATE, input->fd, 0);
+        if (map == MAP_FAILED) {
+            fprintf(stderr, "Could not map pwned password file: %s\n", pwned_file_path);
+            return 1;
+        }
+        data = map;
+        input->data = data;
+        input->size = size;
+        madvise(map, size, MADV_SEQUENTIAL);
+    }
+
+    // Workers split the mapped text at line boundaries, which a compressed file does not have
+    StreamFormat format = stream_format_of((const unsigned char *)data, size);
+    if (format != STREAM_PLAIN) {
+        fprintf(stderr, "%s is %s-compressed; --parallel and --shards need plain text, so import it without them "
+                        "or decompress it first\n", pwned_file_path, stream_format_name(format));
+        return 1;
+    }
+
+    if (threads <= 0) {
+        long cores = sysconf(_SC_NPROCESSORS_ONLN);
+        threads = cores > 0 ? (int)cores : 1;
+    }
+    if ((size_t)threads > size / IMPORT_MIN_CHUNK + 1) {
+        threads = (int)(size / IMPORT_MIN_CHUNK + 1);
+    }
+
+    input->chunks = calloc((size_t)threads, sizeof(ImportChunk));
+    pthread_t *workers = calloc((size_t)threads, sizeof(pthread_t));
+    if (input->chunks == NULL || workers == NULL) {
+        fprintf(stderr, "Memory allocation failed for import workers!\n");
+        free(workers);
+        return 1;
+    }
+    input->nchunks = threads;
+    ImportChunk *chunks = input->chunks;
+
+    // Cut the input at the first newline after each even split point
+    const char *cursor = data;
+    for (int i = 0; i < threads; i++) {
+        const char *end = data + size * (size_t)(i + 1) / (size_t)threads;
+        if (i == threads - 1) {
+            end = data + size;
+        } else if (end < cursor) {
+            end = cursor;
+        } else {
+            const char *eol = memchr(end, '\n', (size_t)(data + size - end));
+            end = eol ? eol + 1 : data + size;
+        }
+        chunks[i].begin = cursor;
+        chunks[i].end = end;
+        cursor = end;
+    }
+
+    int started = 0;
+    for (; started < threads; started++) {
+        if (pthread_create(&workers[started], NULL, import_parse_chunk, &chunks[started]) != 0) {
+            fprintf(stderr, "Failed to start import worker %d\n", started);
+            break;
+        }
+    }
+    int failed = started < threads;
+    for (int i = 0; i < started; i++) {
+        pthread_join(workers[i], NULL);
+        failed |= chunks[i].failed;
+        input->lines += chunks[i].count;
+        input->skipped += chunks[i].skipped;
+    }
+    free(workers);
+    if (failed) {
+        fprintf(stderr, "Failed to parse pwned password file: %s\n", pwned_file_path);
+    }
+    return failed;
+}
+
+/**
+ * Imports a pwned passwords text file using every core.
+ *
+ * The input is memory-mapped and cut into line-aligned chunks, one per worker.
+ * Workers decode and sort their chunks in parallel; the main thread then
+ * streams the merged, sorted result into either a flat store or an SQLite
+ * database. Sorted inserts only ever append to the B-tree, so the SQLite load
+ * is a single pass inside one transaction with journaling disabled.
+ *
+ * Parameters:
+ * - out_path (const char*): Database or flat store to create.
+ * - pwned_file_path (const char*): HIBP "HASH:COUNT" text file.
+ * - target (ImportTarget): Output format.
+ * - threads (int): Worker count; values <= 0 use one thread per online core.
+ *
+ * Returns:
+ * - int: 0 on success, 1 on any failure.
+ *
+ * Note:
+ * - All decoded records (24 bytes per line) are held in memory until the merge.
+ */
+int import_parallel(const char *out_path, const char *pwned_file_path, ImportTarget target, int threads) {
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    ImportInput input;
+    int failed = input_parse(&input, pwned_file_path, threads);
+    if (!failed) {
+        double parse_time = elapsed_seconds(&start);
+        printf("Parsed %zu lines (%zu skipped) with %d threads in %.2f s (%.0f lines/s)\n",
+               input.lines, input.skipped, input.nchunks, parse_time,
+               parse_time > 0 ? (double)input.lines / parse_time : 0.0);
+
+        ImportSink sink;
+        if (sink_open(&sink, target, out_path) != 0) {
+            failed = 1;
+        } else {
+            failed = merge_chunks(input.chunks, input.nchunks, &sink);
+            failed = sink_close(&sink, failed);
+        }
+    }
+
+    if (!failed) {
+        double total_time = elapsed_seconds(&start);
+        printf("Imported %zu lines in %.2f s (%.0f lines/s)\n",
+               input.lines, total_time, total_time > 0 ? (double)input.lines / total_time : 0.0);
+    }
+    input_release(&input);
+    return failed;
+}
+
+// Work shared by the shard builders; each claims the next unbuilt shard
+typedef struct {
+    const ImportInput *input;
+    const char *out_path;
+    ImportTarget target;
+    unsigned shard_bits;
+    atomic_uint next_shard;
+    atomic_int failed;
+} ShardBuild;
+
+// First record in a sorted chunk whose shard is at least shard
+static size_t shard_lower_bound(const ImportChunk *chunk, uint32_t shard, unsigned shard_bits) {
+    size_t low = 0, high = chunk->count;
+    while (low < high) {
+        size_t mid = low + (high - low) / 2;
+        if (shard_of(chunk->records[mid].hash, shard_bits) < shard) {
+            low = mid + 1;
+        } else {
+            high = mid;
+        }
+    }
+    return low;
+}
+
+// Builder thread: writes whole shards, each from its slice of every parsed chunk
+static void *shard_worker(void *arg) {
+    ShardBuild *build = arg;
+    const ImportInput *input = build->input;
+    uint32_t shard_count = (uint32_t)1 << build->shard_bits;
+    ImportChunk *views = calloc((size_t)input->nchunks, sizeof(ImportChunk));
+    if (views == NULL) {
+        atomic_store(&build->failed, 1);
+        return NULL;
+    }
+
+    char path[4096];
+    uint32_t shard;
+    while (!atomic_load(&build->failed) && (shard = atomic_fetch_add(&build->next_shard, 1)) < shard_count) {
+        for (int i = 0; i < input->nchunks; i++) {
+            const ImportChunk *chunk = &input->chunks[i];
+            size_t begin = shard_lower_bound(chunk, shard, build->shard_bits);
+            size_t end = shard + 1 < shard_count ? shard_lower_bound(chunk, shard + 1, build->shard_bits) : chunk->count;
+            views[i].records = chunk->records + begin;
+            views[i].count = end - begin;
+        }
+
+        shard_path(path, sizeof(path), build->out_path, shard, build->shard_bits);
+        ImportSink sink;
+        int failed = sink_open(&sink, build->target, path) != 0;
+        if (!failed) {
+            failed = merge_chunks(views, input->nchunks, &sink);
+            failed = sink_close(&sink, failed);
+        }
+        if (failed) {
+            fprintf(stderr, "Failed to build shard %s\n", path);
+            atomic_store(&build->failed, 1);
+        }
+    }
+    free(views);
+    return NULL;
+}
+
+/**
+ * Imports a pwned passwords text file as a set of shards keyed by leading hash bits.
+ *
+ * Parsing is the same as import_parallel(). Since every chunk comes out sorted,
+ * the records of one shard form a contiguous slice of each chunk, found by binary
+ * search. Builder threads then claim shards one at a time and merge that shard's
+ * slices into its own store, so shards are written fully in parallel with no
+ * shared output. The manifest at out_path is written once every shard is in place.
+ *
+ * Parameters:
+ * - out_path (const char*): Path of the manifest; shards go to "<out_path>.shard.<i>".
+ * - pwned_file_path (const char*): HIBP "HASH:COUNT" text file.
+ * - target (ImportTarget): Format of every shard.
+ * - threads (int): Worker count for both stages; values <= 0 use one thread per online core.
+ * - shard_bits (unsigned): Leading hash bits that select a shard, 1 to SHARD_MAX_BITS.
+ *
+ * Returns:
+ * - int: 0 on success, 1 on any failure.
+ */
+int import_sharded(const char *out_path, const char *pwned_file_path, ImportTarget target, int threads,
+                   unsigned shard_bits) {
+    if (shard_bits == 0 || shard_bits > SHARD_MAX_BITS) {
+        fprintf(stderr, "Shard count must be a power of two between 2 and %u\n", 1u << SHARD_MAX_BITS);
+        return 1;
+    }
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    ImportInput input;
+    int failed = input_parse(&input, pwned_file_path, threads);
+    if (failed) {
+        input_release(&input);
+        return 1;
+    }
+    double parse_time = elapsed_seconds(&start);
+    printf("Parsed %zu lines (%zu skipped) with %d threads in %.2f s (%.0f lines/s)\n",
+           input.lines, input.skipped, input.nchunks, parse_time,
+           parse_time > 0 ? (double)input.lines / parse_time : 0.0);
+
+    // The parse stage may have used fewer threads than asked for on a small file; building does not
+    if (threads <= 0) {
+        long cores = sysconf(_SC_NPROCESSORS_ONLN);
+        threads = cores > 0 ? (int)cores : 1;
+    }
+    uint32_t shard_count = (uint32_t)1 << shard_bits;
+    int builders = (uint32_t)threads < shard_count ? threads : (int)shard_count;
+
+    ShardBuild build;
+    build.input = &input;
+    build.out_path = out_path;
+    build.target = target;
+    build.shard_bits = shard_bits;
+    atomic_init(&build.next_shard, 0);
+    atomic_init(&build.failed, 0);
+
+    pthread_t *workers = calloc((size_t)builders, sizeof(pthread_t));
+    int started = 0;
+    for (; workers != NULL && started < builders; started++) {
+        if (pthread_create(&workers[started], NULL, shard_worker, &build) != 0) {
+            fprintf(stderr, "Failed to start shard builder %d\n", started);
+            atomic_store(&build.failed, 1);
+            break;
+        }
+    }
+    for (int i = 0; i < started; i++) {
+        pthread_join(workers[i], NULL);
+    }
+    free(workers);
+    failed = started == 0 || atomic_load(&build.failed) || shard_write_header(out_path, shard_bits) != 0;
+
+    if (!failed) {
+        double total_time = elapsed_seconds(&start);
+        printf("Imported %zu lines into %u shards with %d builder(s) in %.2f s (%.0f lines/s)\n",
+               input.lines, shard_count, builders, total_time,
+               total_time > 0 ? (double)input.lines / total_time : 0.0);
+    }
+    input_release(&input);
+    return failed;
+}
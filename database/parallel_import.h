@@ -0,0 +1,51 @@
+#ifndef PARALLEL_IMPORT_H
+#define PARALLEL_IMPORT_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <sqlite3.h>
+
+#include "flat_store.h"
+#include "shard_store.h"
+
+// Input below this size per thread is not worth splitting further
+#define IMPORT_MIN_CHUNK (1 << 20)
+
+// Output formats the parallel importer can bulk-load into
+typedef enum {
+    IMPORT_TARGET_SQLITE,
+    IMPORT_TARGET_FLAT
+} ImportTarget;
+
+/**
+ * Parsed records for one line-aligned slice of the input file.
+ *
+ * Components:
+ * - begin, end (const char*): The slice of the mapped input this chunk covers.
+ * - records (FlatRecord*): Decoded hashes and counts, sorted once parsing finishes.
+ * - count, capacity (size_t): Number of records parsed and allocated.
+ * - skipped (size_t): Lines that were not valid "HASH:COUNT" entries.
+ * - failed (int): Non-zero if the worker ran out of memory.
+ */
+typedef struct {
+    const char *begin;
+    const char *end;
+    FlatRecord *records;
+    size_t count;
+    size_t capacity;
+    size_t skipped;
+    int failed;
+} ImportChunk;
+
+// Imports a pwned passwords file using all worker threads; threads <= 0 means one per core
+int import_parallel(const char *out_path, const char *pwned_file_path, ImportTarget target, int threads);
+
+// Imports a pwned passwords file as 2^shard_bits shards, each written by its own builder thread
+int import_sharded(const char *out_path, const char *pwned_file_path, ImportTarget target, int threads,
+                   unsigned shard_bits);
+
+// Parses one chunk of "HASH:COUNT" lines into sorted records (worker thread entry point)
+void *import_parse_chunk(void *arg);
+
+#endif // PARALLEL_IMPORT_H
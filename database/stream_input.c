@@ -0,0 +1,349 @@
+#include "stream_input.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <zlib.h>
+#include <zstd.h>
+
+#define STREAM_READ_SIZE (1u << 20) // Compressed bytes read from the file at a time
+
+const char *stream_format_name(StreamFormat format) {
+    switch (format) {
+        case STREAM_GZIP: return "gzip";
+        case STREAM_ZSTD: return "zstd";
+        default: return "plain";
+    }
+}
+
+StreamFormat stream_format_of(const unsigned char *start, size_t length) {
+    if (length >= 2 && start[0] == 0x1f && start[1] == 0x8b) {
+        return STREAM_GZIP;
+    }
+    if (length >= 4 && start[0] == 0x28 && start[1] == 0xb5 && start[2] == 0x2f && start[3] == 0xfd) {
+        return STREAM_ZSTD;
+    }
+    return STREAM_PLAIN;
+}
+
+// Takes a block to fill, or NULL once the parser has asked the reader to stop
+static StreamBlock *take_empty(StreamReader *reader) {
+    StreamBlock *block = ring_queue_pop(&reader->empty);
+    if (atomic_load(&reader->stop)) {
+        return NULL;
+    }
+    block->length = 0;
+    return block;
+}
+
+static int read_plain(StreamReader *reader) {
+    for (;;) {
+        StreamBlock *block = take_empty(reader);
+        if (block == NULL) {
+            return 0;
+        }
+        block->length = fread(block->data, 1, STREAM_BLOCK_SIZE, reader->file);
+        if (block->length == 0) {
+            ring_queue_push(&reader->empty, block);
+            return ferror(reader->file) ? -1 : 0;
+        }
+        ring_queue_push(&reader->filled, block);
+    }
+}
+
+// Inflates every gzip member of the file in turn; concatenated members are one stream, as for gunzip
+static int read_gzip(StreamReader *reader, unsigned char *in) {
+    z_stream z;
+    memset(&z, 0, sizeof(z));
+    if (inflateInit2(&z, 15 + 16) != Z_OK) {
+        fprintf(stderr, "Can't set up gzip decompression\n");
+        return -1;
+    }
+    StreamBlock *block = take_empty(reader);
+    int member_done = 0, rc = 0;
+    while (block != NULL) {
+        if (z.avail_in == 0) {
+            size_t n = fread(in, 1, STREAM_READ_SIZE, reader->file);
+            if (n == 0) {
+                if (ferror(reader->file)) {
+                    rc = -1;
+                } else if (!member_done) {
+                    fprintf(stderr, "gzip input ends in the middle of a member: %s\n", reader->path);
+                    rc = -1;
+                }
+                break;
+            }
+            z.next_in = in;
+            z.avail_in = (uInt)n;
+        }
+        if (member_done) {
+            inflateReset(&z);
+            member_done = 0;
+        }
+        z.next_out = (Bytef *)block->data + block->length;
+        z.avail_out = (uInt)(STREAM_BLOCK_SIZE - block->length);
+        int ret = inflate(&z, Z_NO_FLUSH);
+        block->length = STREAM_BLOCK_SIZE - z.avail_out;
+        if (ret == Z_STREAM_END) {
+            member_done = 1;
+        } else if (ret != Z_OK && ret != Z_BUF_ERROR) {
+            fprintf(stderr, "Corrupt gzip input in %s: %s\n", reader->path, z.msg ? z.msg : "inflate failed");
+            rc = -1;
+            break;
+        }
+        if (block->length == STREAM_BLOCK_SIZE) {
+            ring_queue_push(&reader->filled, block);
+            block = take_empty(reader);
+        }
+    }
+    if (block != NULL && block->length > 0 && rc == 0) {
+        ring_queue_push(&reader->filled, block);
+    } else if (block != NULL) {
+        ring_queue_push(&reader->empty, block);
+    }
+    inflateEnd(&z);
+    return rc;
+}
+
+// Decompresses every zstd frame of the file in turn
+static int read_zstd(StreamReader *reader, unsigned char *in) {
+    ZSTD_DCtx *dctx = ZSTD_createDCtx();
+    if (dctx == NULL) {
+        fprintf(stderr, "Can't set up zstd decompression\n");
+        return -1;
+    }
+    StreamBlock *block = take_empty(reader);
+    ZSTD_inBuffer input = {in, 0, 0};
+    size_t pending = 0; // Non-zero while a frame is incomplete
+    int output_full = 0, rc = 0;
+    while (block != NULL) {
+        // A full output buffer may leave decoded bytes inside the context, so drain before reading more
+        if (input.pos == input.size && !output_full) {
+            size_t n = fread(in, 1, STREAM_READ_SIZE, reader->file);
+            if (n == 0) {
+                if (ferror(reader->file)) {
+                    rc = -1;
+                } else if (pending != 0) {
+                    fprintf(stderr, "zstd input ends in the middle of a frame: %s\n", reader->path);
+                    rc = -1;
+                }
+                break;
+            }
+            input.size = n;
+            input.pos = 0;
+        }
+        ZSTD_outBuffer output = {block->data, STREAM_BLOCK_SIZE, block->length};
+        pending = ZSTD_decompressStream(dctx, &output, &input);
+        if (ZSTD_isError(pending)) {
+            fprintf(stderr, "Corrupt zstd input in %s: %s\n", reader->path, ZSTD_getErrorName(pending));
+            rc = -1;
+            break;
+        }
+        block->length = output.pos;
+        output_full = output.pos == output.size;
+        if (output_full) {
+            ring_queue_push(&reader->filled, block);
+            block = take_empty(reader);
+        }
+    }
+    if (block != NULL && block->length > 0 && rc == 0) {
+        ring_queue_push(&reader->filled, block);
+    } else if (block != NULL) {
+        ring_queue_push(&reader->empty, block);
+    }
+    ZSTD_freeDCtx(dctx);
+    return rc;
+}
+
+// Reader thread: fills blocks until the input ends, fails or the parser stops, then queues the end marker
+static void *reader_thread(void *arg) {
+    StreamReader *reader = arg;
+    int rc = 0;
+    if (reader->format == STREAM_PLAIN) {
+        rc = read_plain(reader);
+    } else {
+        unsigned char *in = malloc(STREAM_READ_SIZE);
+        if (in == NULL) {
+            fprintf(stderr, "Memory allocation failed for the input buffer!\n");
+            rc = -1;
+        } else {
+            rc = reader->format == STREAM_GZIP ? read_gzip(reader, in) : read_zstd(reader, in);
+            free(in);
+        }
+    }
+    if (rc != 0) {
+        if (ferror(reader->file)) {
+            fprintf(stderr, "Error reading %s: %s\n", reader->path, strerror(errno));
+        }
+        atomic_store(&reader->failed, 1);
+    }
+    ring_queue_push(&reader->filled, NULL);
+    return NULL;
+}
+
+/**
+ * Opens a pwned passwords file and starts decompressing it in the background.
+ *
+ * The format is taken from the file's magic bytes, so plain, ".gz" and ".zst"
+ * inputs need no flag. To resume an interrupted import, start_offset is the
+ * value stream_offset() reported at the last checkpoint: a plain file seeks
+ * straight there, while a compressed one is decompressed from the start and
+ * the bytes before the offset are dropped without being parsed.
+ *
+ * Parameters:
+ * - reader (StreamReader*): The reader to set up.
+ * - path (const char*): The input file; must outlive the reader.
+ * - start_offset (uint64_t): Decompressed bytes to skip.
+ *
+ * Returns:
+ * - int: 0 on success, -1 if the file cannot be opened or the thread cannot start.
+ */
+int stream_open(StreamReader *reader, const char *path, uint64_t start_offset) {
+    memset(reader, 0, sizeof(*reader));
+    reader->path = path;
+    reader->file = fopen(path, "rb");
+    if (reader->file == NULL) {
+        fprintf(stderr, "Could not open pwned password file: %s\n", path);
+        return -1;
+    }
+
+    unsigned char magic[4] = {0};
+    size_t magic_length = fread(magic, 1, sizeof(magic), reader->file);
+    reader->format = stream_format_of(magic, magic_length);
+    off_t start = reader->format == STREAM_PLAIN ? (off_t)start_offset : 0;
+    if (fseeko(reader->file, start, SEEK_SET) != 0) {
+        fprintf(stderr, "Can't seek to byte %llu of %s\n", (unsigned long long)start_offset, path);
+        fclose(reader->file);
+        return -1;
+    }
+    reader->offset = reader->format == STREAM_PLAIN ? start_offset : 0;
+    reader->skip = reader->format == STREAM_PLAIN ? 0 : start_offset;
+
+    if (ring_queue_init(&reader->filled, STREAM_BLOCKS + 1) != 0 ||
+        ring_queue_init(&reader->empty, STREAM_BLOCKS) != 0) {
+        fprintf(stderr, "Memory allocation failed for the input queues!\n");
+        fclose(reader->file);
+        return -1;
+    }
+    for (int i = 0; i < STREAM_BLOCKS; i++) {
+        reader->blocks[i].data = malloc(STREAM_BLOCK_SIZE);
+        if (reader->blocks[i].data == NULL) {
+            fprintf(stderr, "Memory allocation failed for the input blocks!\n");
+            for (int j = 0; j < i; j++) {
+                free(reader->blocks[j].data);
+            }
+            ring_queue_destroy(&reader->filled);
+            ring_queue_destroy(&reader->empty);
+            fclose(reader->file);
+            return -1;
+        }
+        ring_queue_push(&reader->empty, &reader->blocks[i]);
+    }
+    atomic_init(&reader->stop, 0);
+    atomic_init(&reader->failed, 0);
+    if (pthread_create(&reader->thread, NULL, reader_thread, reader) != 0) {
+        fprintf(stderr, "Can't start the input reader thread\n");
+        for (int i = 0; i < STREAM_BLOCKS; i++) {
+            free(reader->blocks[i].data);
+        }
+        ring_queue_destroy(&reader->filled);
+        ring_queue_destroy(&reader->empty);
+        fclose(reader->file);
+        return -1;
+    }
+    return 0;
+}
+
+// Returns the parsed block and takes the next one; -1 at the end of the input
+static int next_block(StreamReader *reader) {
+    if (reader->current != NULL) {
+        ring_queue_push(&reader->empty, reader->current);
+        reader->current = NULL;
+    }
+    if (reader->finished) {
+        return -1;
+    }
+    reader->current = ring_queue_pop(&reader->filled);
+    reader->position = 0;
+    if (reader->current == NULL) {
+        reader->finished = 1;
+        return -1;
+    }
+    return 0;
+}
+
+const char *stream_read_line(StreamReader *reader, size_t *length) {
+    size_t used = 0;
+    for (;;) {
+        if (reader->current == NULL || reader->position == reader->current->length) {
+            if (next_block(reader) != 0) {
+                break;
+            }
+            continue;
+        }
+        const char *start = reader->current->data + reader->position;
+        size_t available = reader->current->length - reader->position;
+        if (reader->skip > 0) {
+            size_t dropped = reader->skip < available ? (size_t)reader->skip : available;
+            reader->position += dropped;
+            reader->offset += dropped;
+            reader->skip -= dropped;
+            continue;
+        }
+
+        const char *newline = memchr(start, '\n', available);
+        size_t take = newline != NULL ? (size_t)(newline - start) + 1 : available;
+        if (used + take + 1 > reader->line_capacity) {
+            size_t capacity = reader->line_capacity ? reader->line_capacity : 256;
+            while (capacity < used + take + 1) {
+                capacity *= 2;
+            }
+            char *grown = realloc(reader->line, capacity);
+            if (grown == NULL) {
+                fprintf(stderr, "Memory allocation failed for an input line!\n");
+                atomic_store(&reader->failed, 1);
+                return NULL;
+            }
+            reader->line = grown;
+            reader->line_capacity = capacity;
+        }
+        memcpy(reader->line + used, start, take);
+        used += take;
+        reader->position += take;
+        reader->offset += take;
+        if (newline != NULL) {
+            break;
+        }
+    }
+    if (used == 0) {
+        return NULL;
+    }
+    while (used > 0 && (reader->line[used - 1] == '\n' || reader->line[used - 1] == '\r')) {
+        used--;
+    }
+    reader->line[used] = '\0';
+    *length = used;
+    return reader->line;
+}
+
+uint64_t stream_offset(const StreamReader *reader) {
+    return reader->offset;
+}
+
+int stream_close(StreamReader *reader) {
+    // Hand every block back until the reader thread sees the stop flag and queues its end marker
+    atomic_store(&reader->stop, 1);
+    while (next_block(reader) == 0) {
+    }
+    pthread_join(reader->thread, NULL);
+    fclose(reader->file);
+    for (int i = 0; i < STREAM_BLOCKS; i++) {
+        free(reader->blocks[i].data);
+    }
+    ring_queue_destroy(&reader->filled);
+    ring_queue_destroy(&reader->empty);
+    free(reader->line);
+    int failed = atomic_load(&reader->failed);
+    memset(reader, 0, sizeof(*reader));
+    return failed ? -1 : 0;
+}
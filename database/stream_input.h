@@ -0,0 +1,88 @@
+#ifndef STREAM_INPUT_H
+#define STREAM_INPUT_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <pthread.h>
+#include <stdatomic.h>
+
+#include "ring_queue.h"
+
+#define STREAM_BLOCK_SIZE (4u << 20)  // Decompressed bytes handed over at a time
+#define STREAM_BLOCKS 4               // Blocks in flight between the reader thread and the parser
+
+// How an input file is encoded, detected from its first bytes
+typedef enum {
+    STREAM_PLAIN,
+    STREAM_GZIP,
+    STREAM_ZSTD
+} StreamFormat;
+
+// One block of decompressed input
+typedef struct {
+    char *data;
+    size_t length;
+} StreamBlock;
+
+/**
+ * Line reader over a plain, gzip or zstd pwned passwords file.
+ *
+ * A reader thread reads and decompresses the file into STREAM_BLOCKS blocks
+ * that cycle between two queues, so decompression of the next block overlaps
+ * with parsing of the current one. Lines are handed out one at a time, copied
+ * into a buffer of their own so a line split across two blocks reads like any
+ * other.
+ *
+ * Components:
+ * - path (const char*): The input file, for messages.
+ * - file (FILE*): The open input; owned by the reader thread once it runs.
+ * - format (StreamFormat): Detected encoding.
+ * - thread (pthread_t): Reader thread.
+ * - filled, empty (RingQueue): Blocks ready to parse (NULL marks the end) and blocks to refill.
+ * - blocks (StreamBlock[]): The block storage.
+ * - current (StreamBlock*), position (size_t): Block being parsed and the next byte in it.
+ * - line (char*), line_capacity (size_t): The line last returned, NUL-terminated.
+ * - offset (uint64_t): Decompressed bytes up to the end of the line last returned.
+ * - skip (uint64_t): Decompressed bytes still to drop before the first line, when resuming.
+ * - stop, failed (atomic_int): Asks the reader thread to finish early; set if reading or decompressing failed.
+ * - finished (int): Non-zero once the end marker has been taken from filled.
+ */
+typedef struct {
+    const char *path;
+    FILE *file;
+    StreamFormat format;
+    pthread_t thread;
+    RingQueue filled;
+    RingQueue empty;
+    StreamBlock blocks[STREAM_BLOCKS];
+    StreamBlock *current;
+    size_t position;
+    char *line;
+    size_t line_capacity;
+    uint64_t offset;
+    uint64_t skip;
+    atomic_int stop;
+    atomic_int failed;
+    int finished;
+} StreamReader;
+
+// Opens an input and starts its reader thread; lines begin start_offset decompressed bytes in. Returns 0 on success
+int stream_open(StreamReader *reader, const char *path, uint64_t start_offset);
+
+// Next line without its newline, or NULL at the end of the input or on an error
+const char *stream_read_line(StreamReader *reader, size_t *length);
+
+// Decompressed offset just past the line last returned; a resumed stream_open() starts there
+uint64_t stream_offset(const StreamReader *reader);
+
+// Stops the reader thread and frees the buffers; returns 0 if the input was read without error
+int stream_close(StreamReader *reader);
+
+// Encoding of a file from its first bytes
+StreamFormat stream_format_of(const unsigned char *start, size_t length);
+
+// "plain", "gzip" or "zstd"
+const char *stream_format_name(StreamFormat format);
+
+#endif // STREAM_INPUT_H
@@ -0,0 +1,78 @@
+#ifndef ASYNC_LOOKUP_H
+#define ASYNC_LOOKUP_H
+
+#include <stdint.h>      // For fixed-width results
+#include <stddef.h>      // For size_t
+
+#include "deep_check.h"
+
+#define ASYNC_DEFAULT_DEPTH 128     // Reads in flight per batch
+#define ASYNC_MAX_PREAD_THREADS 64  // The pread fallback uses one thread per read in flight, up to this
+#define ASYNC_RESULT_ERROR (-1)
+
+// How the base store's record reads are issued
+typedef enum {
+    ASYNC_ENGINE_AUTO,      // io_uring when the kernel allows it, the pread pool otherwise
+    ASYNC_ENGINE_IO_URING,  // One ring per lookup handle, raw syscalls (no liburing needed)
+    ASYNC_ENGINE_PREAD,     // A pool of threads issuing blocking pread() calls
+    ASYNC_ENGINE_SYNC       // Plain lookup_hash(); used for stores that are not flat
+} AsyncEngine;
+
+/**
+ * One base-store read issued for a batch.
+ *
+ * Components:
+ * - index (size_t): Position of the hash in the caller's batch.
+ * - offset (uint64_t): File offset of the first candidate record.
+ * - length (uint32_t): Bytes covering every candidate record.
+ */
+typedef struct {
+    size_t index;
+    uint64_t offset;
+    uint32_t length;
+} AsyncRead;
+
+struct AsyncRing;
+struct AsyncPool;
+
+/**
+ * Batched lookup handle for stores larger than memory.
+ *
+ * Delta segments and the filter are answered in memory first. For each hash
+ * that still needs the flat base store, the resident index gives the small
+ * record range that must hold it; those ranges are read with explicit I/O
+ * (many at once) rather than page faults, and each answer is resolved as its
+ * read completes, in whatever order the device returns them.
+ *
+ * Components:
+ * - db (PwnedDB*): The database the handle reads from; not owned.
+ * - engine (AsyncEngine): The engine actually in use after async_lookup_init().
+ * - depth (unsigned): Maximum reads in flight.
+ * - reads (AsyncRead*): Scratch list for the current batch, read_capacity entries.
+ * - ring (struct AsyncRing*): io_uring state when engine is ASYNC_ENGINE_IO_URING.
+ * - pool (struct AsyncPool*): Worker threads when engine is ASYNC_ENGINE_PREAD.
+ */
+typedef struct {
+    PwnedDB *db;
+    AsyncEngine engine;
+    unsigned depth;
+    AsyncRead *reads;
+    size_t read_capacity;
+    struct AsyncRing *ring;
+    struct AsyncPool *pool;
+} AsyncLookup;
+
+// Sets up the requested engine for db; depth 0 means ASYNC_DEFAULT_DEPTH. Returns 0 on success
+int async_lookup_init(AsyncLookup *lookup, PwnedDB *db, AsyncEngine engine, unsigned depth);
+
+// Looks up n hashes; results[i] is the count, 0 if absent, or ASYNC_RESULT_ERROR. Returns 0, or -1 if any read failed
+int async_lookup_batch(AsyncLookup *lookup, const unsigned char (*hashes)[SHA_DIGEST_LENGTH], size_t n,
+                       int32_t *results);
+
+// Stops the workers and releases the ring
+void async_lookup_close(AsyncLookup *lookup);
+
+// Printable engine name, e.g. "io_uring"
+const char *async_engine_name(AsyncEngine engine);
+
+#endif // ASYNC_LOOKUP_H
@@ -0,0 +1,75 @@
+#ifndef BATCH_MODE_H
+#define BATCH_MODE_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stddef.h>
+
+#include "deep_check.h"
+#include "async_lookup.h"
+#include "sha1_multi.h"
+
+// Lines grouped into one unit of work as it flows through the pipeline
+#define BATCH_LINES 4096
+// Batches in flight between two stages before the upstream stage waits
+#define BATCH_QUEUE_DEPTH 64
+
+// Per-line result codes written in place of a count
+#define BATCH_INVALID_LINE (-1)
+#define BATCH_LOOKUP_ERROR (-2)
+
+/**
+ * Settings for a non-interactive batch run.
+ *
+ * Components:
+ * - input_path (const char*): File of newline-separated entries, or NULL for stdin.
+ * - hashes (int): Non-zero if entries are hex hashes rather than passwords: 40 digits
+ *   for a SHA-1 store, 32 for an NTLM one.
+ * - threads (int): Hashing workers; values <= 0 use one per online core.
+ * - socket_path (const char*): Send lookups to the pwned_daemon listening here instead
+ *   of the local store, one request per batch; NULL to use the database handle.
+ * - async_io (int): Non-zero to read the store with explicit batched I/O (async_lookup.h)
+ *   instead of page faults, for stores larger than memory.
+ * - async_engine (AsyncEngine): Engine for async_io; ASYNC_ENGINE_AUTO prefers io_uring.
+ * - sha1_kernel (Sha1Kernel): SHA-1 implementation for password lines; SHA1_KERNEL_AUTO
+ *   picks the widest one the CPU supports. Passwords checked against an NTLM store
+ *   are hashed with ntlm_hash() instead.
+ */
+typedef struct {
+    const char *input_path;
+    int hashes;
+    int threads;
+    const char *socket_path;
+    int async_io;
+    AsyncEngine async_engine;
+    Sha1Kernel sha1_kernel;
+} BatchOptions;
+
+/**
+ * A group of input lines travelling through the pipeline together.
+ *
+ * Components:
+ * - seq (uint64_t): Position of the batch in the input, used to restore order.
+ * - n (size_t): Number of lines in the batch.
+ * - text (char*): The raw line bytes back to back; wiped before it is freed.
+ * - offsets, lengths (uint32_t*): Where each line starts in text and how long it is.
+ * - hashes (unsigned char (*)[20]): Binary hash of each line; an NTLM hash fills the first 16 bytes.
+ * - counts (int32_t*): Lookup result per line, or one of the BATCH_* codes.
+ */
+typedef struct {
+    uint64_t seq;
+    size_t n;
+    char *text;
+    size_t text_len;
+    size_t text_capacity;
+    uint32_t offsets[BATCH_LINES];
+    uint32_t lengths[BATCH_LINES];
+    unsigned char hashes[BATCH_LINES][SHA_DIGEST_LENGTH];
+    int32_t counts[BATCH_LINES];
+} Batch;
+
+// Runs the reader -> hash -> lookup -> output pipeline and writes "HASH:COUNT" lines to stdout;
+// db may be NULL when options->socket_path names a daemon
+int run_batch(PwnedDB *db, const BatchOptions *options);
+
+#endif // BATCH_MODE_H
@@ -0,0 +1,86 @@
+#ifndef BLOCK_CHECKSUM_H
+#define BLOCK_CHECKSUM_H
+
+#include <stdio.h>       // For fprintf()
+#include <stdint.h>      // For fixed-width on-disk fields
+#include <stddef.h>      // For size_t
+#include <stdatomic.h>   // For the shared verified-block bitmap
+
+// On-disk layout of a checksum manifest (all integers little-endian / host order):
+//   [ChecksumHeader][block_count x uint64 XXH3_64bits of each block of the file]
+// The last block is whatever remains of the file and may be short.
+#define CHECKSUM_MAGIC "PWNDXXH3"
+#define CHECKSUM_MAGIC_SIZE 8
+#define CHECKSUM_VERSION 1
+#define CHECKSUM_FILE_SUFFIX ".xxh"   // Appended to a store file's path to find its manifest
+#define CHECKSUM_BLOCK_SHIFT 18       // 256 KiB blocks: a first-touch check costs microseconds
+#define CHECKSUM_CHUNK_BLOCKS 16      // Blocks a verifying thread claims at once, 4 MiB of sequential reads
+
+typedef struct {
+    char magic[CHECKSUM_MAGIC_SIZE];
+    uint32_t version;
+    uint32_t block_shift;
+    uint64_t file_size;
+    uint64_t block_count;
+    uint64_t table_hash;    // XXH3_64bits of the checksum table, so a damaged manifest is not trusted
+    uint8_t reserved[24];
+} ChecksumHeader;
+
+/**
+ * Read-only view of a checksum manifest mapped into memory.
+ *
+ * Components:
+ * - map, map_size: Read-only mapping of the whole manifest.
+ * - header (const ChecksumHeader*): The validated header.
+ * - sums (const uint64_t*): One checksum per block of the covered file.
+ */
+typedef struct {
+    const unsigned char *map;
+    size_t map_size;
+    const ChecksumHeader *header;
+    const uint64_t *sums;
+} ChecksumManifest;
+
+/**
+ * Checks the blocks of a mapped store the first time a lookup touches them.
+ *
+ * A block is hashed and compared with the manifest once; after that a bit in
+ * the verified bitmap lets every later lookup through without hashing. A block
+ * that fails stays unverified, so every lookup that needs it fails too, and
+ * the damage is reported once.
+ *
+ * Components:
+ * - manifest (ChecksumManifest): The store file's manifest.
+ * - data (const unsigned char*): The store file's mapping; not owned.
+ * - verified (atomic_uint_fast64_t*): One bit per block, set once it has matched.
+ * - reported (atomic_int): Non-zero once a damaged block has been reported.
+ * - path (char*): The store file, for messages.
+ */
+typedef struct {
+    ChecksumManifest manifest;
+    const unsigned char *data;
+    atomic_uint_fast64_t *verified;
+    atomic_int reported;
+    char *path;
+} BlockChecker;
+
+// Writes "<path>.xxh" for a file, hashing its blocks on threads threads (0 for one per core)
+int checksum_write(const char *path, int threads);
+
+// Maps "<path>.xxh"; -1 if missing, malformed, or written for a file of another size than file_size
+int checksum_open(ChecksumManifest *manifest, const char *path, uint64_t file_size);
+
+void checksum_close(ChecksumManifest *manifest);
+
+// Hashes the whole file on threads threads and compares every block; 0 intact, 1 damaged, -1 not checkable
+int checksum_verify(const char *path, int threads, uint64_t *bytes_checked);
+
+// Sets up first-touch checks of a mapped file; -1 if it has no usable manifest
+int block_checker_open(BlockChecker *checker, const char *path, const unsigned char *data, size_t size);
+
+// Verifies every not yet verified block overlapping [offset, offset + length); 0 intact, -1 damaged
+int block_checker_check(BlockChecker *checker, uint64_t offset, uint64_t length);
+
+void block_checker_close(BlockChecker *checker);
+
+#endif // BLOCK_CHECKSUM_H
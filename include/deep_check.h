@@ -8,10 +8,136 @@
 #include <sqlite3.h>
 #include <ctype.h>
 
-// Function to perform a deep check using full SHA1 hash
-int deep_check_password(sqlite3 *db, unsigned const char *full_hash);
+#include "block_checksum.h"
+#include "flat_store.h"
+#include "fuse_filter.h"
+#include "hash_kind.h"
+#include "hot_set.h"
+#include "mphf_index.h"
+#include "packed_store.h"
+#include "shard_store.h"
 
-// Function to initialize the SQLite database (if needed)
-int init_db(sqlite3 **db, const char *db_path);
+// Read-side SQLite tuning applied by init_db(); SQLite caps mmap_size at its compile-time maximum
+#define SQLITE_LOOKUP_MMAP_SIZE 68719476736LL // Map up to 64 GiB of the file instead of copying pages
+#define SQLITE_LOOKUP_CACHE_KIB 65536         // Page cache for the upper B-tree levels, in KiB
+#define SQLITE_LOOKUP_BUSY_MS 10000           // How long a lookup waits for a compaction to commit
 
-#endif // DEEP_CHECK_H
\ No newline at end of file
+// Delta segments written by "create_database --update" sit next to the store as
+// "<db_path>.delta.1", ".delta.2", ...; later segments override earlier ones and the base
+#define DELTA_FILE_SUFFIX ".delta"
+#define DELTA_MAX_SEGMENTS 8 // An update compacts first when this many segments exist
+
+// Storage backends a database path can resolve to
+typedef enum {
+    DB_BACKEND_SQLITE,
+    DB_BACKEND_FLAT,
+    DB_BACKEND_PACKED,
+    DB_BACKEND_SHARDED
+} DbBackend;
+
+/**
+ * Handle for an opened pwned password store.
+ *
+ * Components:
+ * - backend (DbBackend): Which storage format the file was recognised as.
+ * - kind (HashKind), hash_size (uint32_t): Dataset the store holds and the width of the
+ *   binary hashes every lookup takes: 20 bytes for SHA-1, 16 for NTLM.
+ * - sqlite (sqlite3*): Read-only connection handle when backend is DB_BACKEND_SQLITE.
+ * - lookup_stmt, range_stmt (sqlite3_stmt*): Statements prepared once by init_db()
+ *   and reset after every use, so a lookup never re-parses SQL.
+ * - flat (FlatStore): Memory-mapped store when backend is DB_BACKEND_FLAT.
+ * - packed (PackedStore): Memory-mapped compressed store when backend is DB_BACKEND_PACKED.
+ * - shards (struct PwnedDB*): One opened store per shard when backend is DB_BACKEND_SHARDED;
+ *   shard_bits leading hash bits pick the shard.
+ * - deltas (FlatStore[]): Delta segments, oldest first; delta_count of them are open.
+ * - filter (FuseFilter): Pre-check filter loaded from "<db_path>.filter", if present.
+ *   It covers the base store only, so deltas are checked before it. A sharded
+ *   database has no filter of its own; each shard loads its own.
+ * - has_filter (int): Non-zero when lookups consult the filter first.
+ * - hot (HotSet): The most breached hashes of the base store, loaded from "<db_path>.hot"
+ *   if present and checked after the deltas (which may hold newer counts) and before
+ *   the filter. A sharded database keeps one per shard, like its filters.
+ * - has_hot (int): Non-zero when lookups consult the hot set.
+ * - mphf (MphfIndex): Minimal perfect hash index of a flat store, loaded from
+ *   "<db_path>.mphf" if present; base lookups then read one slot instead of
+ *   binary searching the records.
+ * - has_mphf (int): Non-zero when flat lookups go through the index.
+ * - checks (BlockChecker): First-touch checks of a flat store's blocks against
+ *   "<db_path>.xxh", set up when db_enable_block_checks() was called first.
+ * - has_checks (int): Non-zero when flat lookups verify the blocks they read.
+ */
+typedef struct PwnedDB {
+    DbBackend backend;
+    HashKind kind;
+    uint32_t hash_size;
+    sqlite3 *sqlite;
+    sqlite3_stmt *lookup_stmt;
+    sqlite3_stmt *range_stmt;
+    FlatStore flat;
+    PackedStore packed;
+    struct PwnedDB *shards;
+    unsigned shard_bits;
+    FlatStore deltas[DELTA_MAX_SEGMENTS];
+    int delta_count;
+    FuseFilter filter;
+    int has_filter;
+    HotSet hot;
+    int has_hot;
+    MphfIndex mphf;
+    int has_mphf;
+    BlockChecker checks;
+    int has_checks;
+} PwnedDB;
+
+// Function to perform a deep check using the full binary hash
+int deep_check_password(PwnedDB *db, unsigned const char *full_hash);
+
+// Looks up a binary hash; returns 1 if found (count set), 0 if not found, -1 on error
+int lookup_hash(PwnedDB *db, const unsigned char *binary_hash, int *count);
+
+// Returned by lookup_overlay() when only the base store can answer
+#define LOOKUP_NEEDS_BASE 2
+
+// Which part of a database answered a lookup, as reported by lookup_overlay_source()
+typedef enum {
+    LOOKUP_FROM_DELTA,
+    LOOKUP_FROM_HOT,
+    LOOKUP_FROM_FILTER,
+    LOOKUP_FROM_BASE
+} LookupSource;
+
+// Answers from the delta segments, the hot set and the filter alone: 1 found, 0 absent, or LOOKUP_NEEDS_BASE
+int lookup_overlay(PwnedDB *db, const unsigned char *binary_hash, int *count);
+
+// lookup_overlay() that also says which part answered (LOOKUP_FROM_BASE with LOOKUP_NEEDS_BASE)
+int lookup_overlay_source(PwnedDB *db, const unsigned char *binary_hash, int *count, LookupSource *source);
+
+// Answers from the base store alone, for when lookup_overlay() returned LOOKUP_NEEDS_BASE
+int lookup_base(PwnedDB *db, const unsigned char *binary_hash, int *count);
+
+// Receives each record of a range scan in hash order; return non-zero to stop the scan
+typedef int (*RangeCallback)(const unsigned char *binary_hash, int count, void *ctx);
+
+// Width of the k-anonymity prefix used by the HIBP range API (5 hex digits)
+#define RANGE_PREFIX_BITS 20
+
+// Visits every record whose hash starts with the given 20-bit prefix, deltas merged in; returns 0 or -1 on error
+int lookup_range(PwnedDB *db, uint32_t prefix, RangeCallback callback, void *ctx);
+
+// Which dataset an SQLite pwned_passwords table holds, from the width of its first key;
+// returns 1 with kind set, 0 if the table is empty, -1 on a query error
+int sqlite_hash_kind(sqlite3 *sqlite, HashKind *kind);
+
+// Function to open the database, picking the backend from the file contents
+int init_db(PwnedDB *db, const char *db_path);
+
+// Makes every later init_db() verify store blocks against their checksums the first time a lookup reads them
+void db_enable_block_checks(int enable);
+
+// Function to release the database handle
+void close_db(PwnedDB *db);
+
+// Non-zero when one handle may serve lookups from several threads; SQLite connections may not
+int db_thread_safe(const PwnedDB *db);
+
+#endif // DEEP_CHECK_H
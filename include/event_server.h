@@ -0,0 +1,69 @@
+#ifndef EVENT_SERVER_H
+#define EVENT_SERVER_H
+
+#include <stddef.h>      // For size_t
+
+#define SERVER_MAX_EVENTS 256
+#define SERVER_QUEUE_SIZE 4096      // Ready connections waiting for a worker
+
+/**
+ * State of one client connection, shared by pwned_server and pwned_daemon.
+ *
+ * Components:
+ * - fd (int): Non-blocking client socket.
+ * - in, in_len, in_capacity (char[], size_t): Bytes received but not yet consumed as
+ *   requests; the buffer holds the largest request the server accepts.
+ * - out, out_len, out_sent, out_capacity: Response bytes and how many were written.
+ * - close_after (int): Set by the request handler to close the connection once
+ *   the queued output has been sent.
+ */
+typedef struct {
+    int fd;
+    size_t in_len;
+    size_t in_capacity;
+    char *out;
+    size_t out_len;
+    size_t out_sent;
+    size_t out_capacity;
+    int close_after;
+    char in[];
+} ServerConnection;
+
+/**
+ * What a server built on server_run() does with its connections.
+ *
+ * Components:
+ * - request_limit (size_t): Size of every connection's input buffer.
+ * - process: Answers every complete request buffered on a connection, appending
+ *   to its output and consuming its input; returns -1 to drop the connection.
+ * - worker_open: Called once on each worker thread before it serves, to open
+ *   per-thread state such as SQLite handles; the result is passed to process.
+ * - worker_close: Releases what worker_open returned when the server stops.
+ * - ctx (void*): Passed to worker_open and worker_close.
+ * - metrics_path (const char*): Rewritten every STATS_METRICS_INTERVAL_MS while
+ *   serving and once on stop; NULL for none.
+ */
+typedef struct {
+    size_t request_limit;
+    int (*process)(ServerConnection *conn, void *worker);
+    void *(*worker_open)(void *ctx);
+    void (*worker_close)(void *worker, void *ctx);
+    void *ctx;
+    const char *metrics_path;
+} ServerHandlers;
+
+// Grows a connection's output buffer to take `extra` more bytes; -1 if memory ran out
+int server_out_reserve(ServerConnection *conn, size_t extra);
+
+// Appends bytes to a connection's output; -1 if memory ran out
+int server_out_append(ServerConnection *conn, const void *data, size_t len);
+
+/**
+ * Serves clients of a listening socket until SIGINT or SIGTERM.
+ *
+ * One epoll loop accepts clients and hands ready connections to a pool of
+ * worker threads; returns 0 after a clean stop, 1 if the loop could not start.
+ */
+int server_run(int listen_fd, int threads, const ServerHandlers *handlers);
+
+#endif // EVENT_SERVER_H
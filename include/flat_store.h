@@ -0,0 +1,133 @@
+#ifndef FLAT_STORE_H
+#define FLAT_STORE_H
+
+#include <stdio.h>       // For FILE, fprintf()
+#include <stdint.h>      // For fixed-width on-disk fields
+#include <stddef.h>      // For size_t
+#include <string.h>      // For memcpy() in the record accessors
+
+#include "hash_kind.h"
+#include "pla_index.h"
+
+// On-disk layout of a flat store (all integers little-endian / host order):
+//   [FlatHeader][record_count x FlatRecord or NtlmRecord sorted by hash][(1 << prefix_bits) + 1 x uint64 index]
+//   [model_segments x PlaSegment][(1 << model_radix_bits) + 1 x uint32 segment directory]
+// Stores written before the learned index existed have model_offset == 0 and use the prefix index.
+// record_size says which dataset the store holds: 24 for SHA-1 records, 20 for NTLM records.
+#define FLAT_MAGIC "PWNDFLAT"
+#define FLAT_MAGIC_SIZE 8
+#define FLAT_VERSION 1
+#define FLAT_HASH_SIZE SHA1_HASH_SIZE
+#define FLAT_HEADER_SIZE 64
+#define FLAT_MAX_PREFIX_BITS 28
+#define FLAT_TARGET_BUCKET 64   // Average records per prefix bucket the writer aims for
+#define FLAT_MODEL_EPSILON 16   // Learned index error bound: about 34 records (816 bytes) to search
+#define FLAT_SORT_RUN 32        // Records insertion-sorted before flat_sort_records() starts merging
+
+typedef struct {
+    char magic[FLAT_MAGIC_SIZE];
+    uint32_t version;
+    uint32_t record_size;
+    uint64_t record_count;
+    uint64_t records_offset;
+    uint64_t index_offset;
+    uint32_t prefix_bits;
+    uint32_t model_segments;
+    uint64_t model_offset;
+    uint16_t model_epsilon;     // Largest prediction error measured over every stored record
+    uint16_t model_radix_bits;
+    uint8_t reserved[4];
+} FlatHeader;
+
+/**
+ * A single fixed-width record: the raw SHA-1 digest followed by its breach count.
+ * 24 bytes with no padding, so records can be addressed directly in the mapping.
+ */
+typedef struct {
+    unsigned char hash[FLAT_HASH_SIZE];
+    uint32_t count;
+} FlatRecord;
+
+// The NTLM counterpart of FlatRecord: the 16-byte MD4 digest and its count, 20 bytes
+typedef struct {
+    unsigned char hash[NTLM_HASH_SIZE];
+    uint32_t count;
+} NtlmRecord;
+
+/**
+ * Read-only view of a flat store mapped into memory.
+ *
+ * Components:
+ * - fd (int): Descriptor of the open store file.
+ * - map (const unsigned char*): Start of the read-only mapping of the whole file.
+ * - map_size (size_t): Length of the mapping in bytes.
+ * - header, records, index: Pointers into the mapping for each section. records is
+ *   only meaningful for SHA-1 stores; flat_record_hash() and flat_record_count() read either kind.
+ * - segments, model_radix: The learned index, NULL when the store has none.
+ * - use_model (int): Non-zero when flat_lookup() searches through the learned index.
+ * - kind (HashKind), hash_size, record_size (uint32_t): The dataset and its key and record widths.
+ * - record_bytes (const unsigned char*): Start of the records as bytes.
+ * - lookup: Search routine compiled for this store's key width, picked at open.
+ */
+typedef struct FlatStore {
+    int fd;
+    const unsigned char *map;
+    size_t map_size;
+    const FlatHeader *header;
+    const FlatRecord *records;
+    const uint64_t *index;
+    const PlaSegment *segments;
+    const uint32_t *model_radix;
+    int use_model;
+    HashKind kind;
+    uint32_t hash_size;
+    uint32_t record_size;
+    const unsigned char *record_bytes;
+    int (*lookup)(const struct FlatStore *store, const unsigned char *hash, uint32_t *count);
+} FlatStore;
+
+// Key of record i, hash_size bytes; works for stores of either kind
+static inline const unsigned char *flat_record_hash(const FlatStore *store, uint64_t i) {
+    return store->record_bytes + i * store->record_size;
+}
+
+// Breach count of record i; works for stores of either kind
+static inline uint32_t flat_record_count(const FlatStore *store, uint64_t i) {
+    uint32_t count;
+    memcpy(&count, flat_record_hash(store, i) + store->hash_size, sizeof(count));
+    return count;
+}
+
+/**
+ * State for writing a flat store record by record.
+ *
+ * Records are appended as they arrive; if they turn out not to be in hash order
+ * the writer sorts them in place when the store is finished.
+ */
+typedef struct {
+    FILE *file;
+    char *path;
+    uint64_t record_count;
+    unsigned char last_hash[HASH_MAX_SIZE];
+    int sorted;
+    HashKind kind;
+    uint32_t hash_size;
+} FlatWriter;
+
+int flat_is_store(const char *path); // Returns 1 if the file starts with the flat store magic
+int flat_open(FlatStore *store, const char *path); // Map an existing store read-only
+int flat_lookup(const FlatStore *store, const unsigned char *hash, uint32_t *count); // 1 found, 0 not found; hash_size bytes
+void flat_prefix_range(const FlatStore *store, uint32_t prefix, uint32_t bits,
+                       uint64_t *begin, uint64_t *end); // Records whose leading `bits` bits equal prefix
+void flat_candidate_range(const FlatStore *store, const unsigned char *hash,
+                          uint64_t *begin, uint64_t *end); // Records that must hold hash if it is stored
+void flat_close(FlatStore *store); // Unmap and close the store
+
+int flat_writer_open(FlatWriter *writer, const char *path); // Start a new SHA-1 store file
+int flat_writer_open_kind(FlatWriter *writer, const char *path, HashKind kind); // Start a new store of either kind
+int flat_writer_add(FlatWriter *writer, const unsigned char *hash, uint32_t count); // Append one record; hash_size bytes
+int flat_writer_finish(FlatWriter *writer); // Sort if needed, write the indexes and header
+// Stable sort by hash; scratch holds count records, or NULL to borrow them from the heap. 1 if out of memory
+int flat_sort_records(void *records, void *scratch, uint64_t count, HashKind kind);
+
+#endif // FLAT_STORE_H
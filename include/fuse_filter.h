@@ -0,0 +1,63 @@
+#ifndef FUSE_FILTER_H
+#define FUSE_FILTER_H
+
+#include <stdio.h>       // For fprintf()
+#include <stdint.h>      // For fixed-width on-disk fields
+#include <stddef.h>      // For size_t
+
+// On-disk layout: [FuseHeader][array_length x uint8 fingerprints]
+#define FUSE_MAGIC "PWNDFUSE"
+#define FUSE_MAGIC_SIZE 8
+#define FUSE_VERSION 1
+#define FUSE_MAX_ATTEMPTS 100    // Seeds tried before construction gives up
+#define FUSE_FILE_SUFFIX ".filter" // Appended to the store path to find its filter
+
+typedef struct {
+    char magic[FUSE_MAGIC_SIZE];
+    uint32_t version;
+    uint32_t segment_length;
+    uint32_t segment_count;
+    uint32_t array_length;
+    uint64_t seed;
+    uint64_t key_count;
+    uint8_t reserved[24];
+} FuseHeader;
+
+/**
+ * A binary fuse filter with 8-bit fingerprints (about 9 bits per key).
+ *
+ * Every key maps to three fingerprint slots inside a window of three adjacent
+ * segments; a key is reported present when the XOR of those slots equals its
+ * fingerprint. Keys that were never added are reported present with
+ * probability 1/256, and keys that were added are never reported absent.
+ *
+ * Components:
+ * - seed (uint64_t): Hash seed that made construction succeed.
+ * - segment_length, segment_length_mask, segment_count_length: Slot layout.
+ * - array_length (uint32_t): Number of fingerprint slots.
+ * - fingerprints (uint8_t*): The slots, either heap-owned or inside map.
+ * - map, map_size: Read-only mapping when the filter was loaded from a file.
+ */
+typedef struct {
+    uint64_t seed;
+    uint32_t segment_length;
+    uint32_t segment_length_mask;
+    uint32_t segment_count;
+    uint32_t segment_count_length;
+    uint32_t array_length;
+    uint64_t key_count;
+    uint8_t *fingerprints;
+    const unsigned char *map;
+    size_t map_size;
+} FuseFilter;
+
+// Filters are keyed by the first 8 bytes of the SHA-1, which are already uniformly distributed
+uint64_t fuse_key(const unsigned char *binary_hash);
+
+int fuse_build(FuseFilter *filter, uint64_t *keys, size_t count); // Sorts and dedupes keys in place
+int fuse_contains(const FuseFilter *filter, uint64_t key); // 1 if possibly present, 0 if definitely absent
+int fuse_save(const FuseFilter *filter, const char *path); // Writes the filter file
+int fuse_open(FuseFilter *filter, const char *path); // Maps a filter file read-only
+void fuse_free(FuseFilter *filter); // Releases a built or mapped filter
+
+#endif // FUSE_FILTER_H
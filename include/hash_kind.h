@@ -0,0 +1,37 @@
+#ifndef HASH_KIND_H
+#define HASH_KIND_H
+
+#include <stddef.h>      // For size_t
+
+// Key widths of the datasets HIBP publishes
+#define SHA1_HASH_SIZE 20  // SHA-1 of the password
+#define NTLM_HASH_SIZE 16  // MD4 of the UTF-16LE password, as Windows stores it
+#define HASH_MAX_SIZE 20   // Room for a key of any kind
+
+// Which dataset a store holds; stores carry it, lookups take keys of its width
+typedef enum {
+    HASH_KIND_SHA1,
+    HASH_KIND_NTLM
+} HashKind;
+
+static inline size_t hash_kind_size(HashKind kind) {
+    return kind == HASH_KIND_NTLM ? NTLM_HASH_SIZE : SHA1_HASH_SIZE;
+}
+
+static inline const char *hash_kind_name(HashKind kind) {
+    return kind == HASH_KIND_NTLM ? "NTLM" : "SHA-1";
+}
+
+// The kind whose keys are hex_length hex digits long; -1 for any other length
+static inline int hash_kind_of_hex_length(size_t hex_length, HashKind *kind) {
+    if (hex_length == 2 * SHA1_HASH_SIZE) {
+        *kind = HASH_KIND_SHA1;
+    } else if (hex_length == 2 * NTLM_HASH_SIZE) {
+        *kind = HASH_KIND_NTLM;
+    } else {
+        return -1;
+    }
+    return 0;
+}
+
+#endif // HASH_KIND_H
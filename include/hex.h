@@ -0,0 +1,10 @@
+#ifndef HEX_H
+#define HEX_H
+
+// Table-driven hex decoder; returns 0 if the input was valid hex, -1 otherwise
+int hex_decode(const char *hex, unsigned char *bin, int bytes);
+
+// Encodes bytes as uppercase hex digits without a terminating null
+void hex_encode(const unsigned char *bin, int bytes, char *hex);
+
+#endif // HEX_H
@@ -0,0 +1,81 @@
+#ifndef HOT_SET_H
+#define HOT_SET_H
+
+#include <stdio.h>       // For fprintf()
+#include <stdint.h>      // For fixed-width on-disk fields
+#include <stddef.h>      // For size_t
+
+// On-disk layout: [HotHeader][bucket_count x HotBucket], every bucket one 64-byte cache line
+#define HOT_MAGIC "PWNDHOTS"
+#define HOT_MAGIC_SIZE 8
+#define HOT_VERSION 1
+#define HOT_FILE_SUFFIX ".hot"      // Appended to the store path to find its hot set
+#define HOT_BUCKET_SLOTS 2          // Entries per bucket
+#define HOT_LOAD_FACTOR 0.8         // Fraction of slots filled when the table is sized
+#define HOT_MAX_KICKS 500           // Evictions one insertion may cause before a rebuild
+#define HOT_MAX_ATTEMPTS 32         // Seeds tried before the table is grown
+#define HOT_HASH_SIZE 20
+#define HOT_PACKED_KEY_BYTES 8      // key_bytes of a set built from a packed store
+#define HOT_NTLM_KEY_BYTES 16       // key_bytes of a set built from an NTLM store
+
+typedef struct {
+    char magic[HOT_MAGIC_SIZE];
+    uint32_t version;
+    uint32_t bucket_count;
+    uint64_t entry_count;
+    uint64_t seed;
+    uint32_t min_count;
+    uint32_t key_bytes;
+    uint8_t reserved[24];
+} HotHeader;
+
+/**
+ * One hot hash and its breach count.
+ * An empty slot has count 0, which no stored hash has.
+ */
+typedef struct {
+    unsigned char hash[HOT_HASH_SIZE];
+    uint32_t count;
+} HotEntry;
+
+typedef struct {
+    HotEntry slots[HOT_BUCKET_SLOTS];
+    uint8_t padding[64 - HOT_BUCKET_SLOTS * sizeof(HotEntry)];
+} HotBucket;
+
+/**
+ * The K most breached hashes of a store in a bucketed cuckoo hash table.
+ *
+ * Every hash may live in one of two buckets picked from a seeded mix of its first
+ * 8 bytes, so a lookup reads at most two cache lines and never the store. Entries
+ * hold the whole hash and match exactly, except in a set built from a packed
+ * store, which keeps only the first 8 bytes itself. An NTLM store's set holds
+ * its 16-byte hashes. The table is read into heap
+ * memory on open, so it stays resident however the store's pages are evicted.
+ *
+ * Components:
+ * - buckets (HotBucket*): bucket_count cache-line-aligned buckets.
+ * - bucket_count (uint32_t): Number of buckets.
+ * - entry_count (uint64_t): Hashes held.
+ * - seed (uint64_t): Mixing seed that made construction succeed.
+ * - min_count (uint32_t): Smallest count in the set; anything rarer is not in it.
+ * - key_bytes (uint32_t): Leading hash bytes compared: HOT_HASH_SIZE, HOT_NTLM_KEY_BYTES or HOT_PACKED_KEY_BYTES.
+ */
+typedef struct {
+    HotBucket *buckets;
+    uint32_t bucket_count;
+    uint64_t entry_count;
+    uint64_t seed;
+    uint32_t min_count;
+    uint32_t key_bytes;
+} HotSet;
+
+uint64_t hot_entries_for_bytes(size_t bytes); // Entries that fit in a memory budget
+
+int hot_build(HotSet *set, const HotEntry *entries, size_t count, uint32_t key_bytes); // Entries must be distinct
+int hot_lookup(const HotSet *set, const unsigned char *binary_hash, uint32_t *count); // 1 found, 0 not in the set
+int hot_save(const HotSet *set, const char *path); // Writes the table under a temporary name, then renames it
+int hot_open(HotSet *set, const char *path); // Reads a table file into memory; -1 if missing or malformed
+void hot_free(HotSet *set); // Releases the table
+
+#endif // HOT_SET_H
@@ -0,0 +1,32 @@
+#ifndef LOOKUP_DAEMON_H
+#define LOOKUP_DAEMON_H
+
+#include <stdint.h>      // For the fixed-width wire fields
+#include <openssl/sha.h> // For SHA_DIGEST_LENGTH
+
+// Wire protocol between pwned_daemon and its clients over a Unix stream socket.
+// Both ends run on the same host, so integers travel in host byte order.
+//   request:  [DaemonHeader][count x 20-byte binary SHA-1]
+//   response: [DaemonHeader][count x int32 result]
+// A result is the breach count (0 when the hash is not listed) or DAEMON_RESULT_ERROR.
+// Requests on one connection are answered in order; a malformed header closes it.
+#define DAEMON_SOCKET_PATH "/tmp/pwned_checker.sock"
+#define DAEMON_MAGIC 0x444E5750u  // "PWND" in memory on little-endian hosts
+#define DAEMON_MAX_BATCH 4096     // Hashes per request; matches a batch-mode batch
+#define DAEMON_RESULT_ERROR (-1)
+
+typedef struct {
+    uint32_t magic;
+    uint32_t count;
+} DaemonHeader;
+
+// Connects to a running daemon; returns the socket descriptor or -1
+int daemon_connect(const char *socket_path);
+
+// Looks up count hashes in one round trip; returns 0 with results filled in, -1 if the exchange failed
+int daemon_lookup(int fd, const unsigned char (*hashes)[SHA_DIGEST_LENGTH], uint32_t count, int32_t *results);
+
+// Same report as deep_check_password(), answered by the daemon instead of a local store
+int daemon_check_password(int fd, const unsigned char *binary_hash);
+
+#endif // LOOKUP_DAEMON_H
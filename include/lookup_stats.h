@@ -0,0 +1,130 @@
+#ifndef LOOKUP_STATS_H
+#define LOOKUP_STATS_H
+
+#include <stdio.h>       // For FILE
+#include <stdint.h>      // For the fixed-width counters
+#include <stdatomic.h>   // For the mode flag read on every lookup
+
+#include "deep_check.h"
+
+// Latency histograms are log-linear, like HdrHistogram: each power of two of
+// nanoseconds is split into 2^STATS_SUB_BUCKET_BITS equal buckets, so every
+// recorded value is known to within 1/16 (6.25%). Values up to 2^STATS_MAX_EXPONENT
+// ns (about 18 minutes) are kept; anything longer lands in the last bucket.
+#define STATS_SUB_BUCKET_BITS 4
+#define STATS_MAX_EXPONENT 40
+#define STATS_BUCKETS ((STATS_MAX_EXPONENT - STATS_SUB_BUCKET_BITS + 2) << STATS_SUB_BUCKET_BITS)
+
+// How often the long-running servers rewrite their --metrics-file
+#define STATS_METRICS_INTERVAL_MS 10000
+
+// What lookup_stats_enable() turns on; 0 leaves lookups unmeasured
+#define LOOKUP_STATS_TIMING 1u  // Counters and latency histograms (two clock reads per lookup)
+#define LOOKUP_STATS_FAULTS 2u  // Also page faults through getrusage() and page residency through mincore()
+
+/**
+ * Latency distribution of one kind of operation.
+ *
+ * Components:
+ * - count (uint64_t): Operations recorded.
+ * - sum_ns, max_ns (uint64_t): Total and largest latency, in nanoseconds.
+ * - buckets (uint64_t[]): Operations per log-linear bucket (see STATS_BUCKETS).
+ */
+typedef struct {
+    uint64_t count;
+    uint64_t sum_ns;
+    uint64_t max_ns;
+    uint64_t buckets[STATS_BUCKETS];
+} LatencyHistogram;
+
+/**
+ * Totals over every thread that has looked anything up, as of one moment.
+ *
+ * Components:
+ * - hits, misses, errors (uint64_t): lookup_hash() results.
+ * - filter_rejects (uint64_t): Misses answered by the fuse filter without touching the store.
+ * - delta_hits (uint64_t): Hits answered by a delta segment.
+ * - hot_hits (uint64_t): Hits answered by the hot set.
+ * - fault_samples (uint64_t): Lookups measured with LOOKUP_STATS_FAULTS on.
+ * - minor_faults, major_faults (uint64_t): Page faults taken during those lookups.
+ * - cold_lookups (uint64_t): Flat-store lookups whose record page was not in the page cache.
+ * - sqlite_cache_hits, sqlite_cache_misses (uint64_t): SQLite page-cache activity of lookups.
+ * - range_errors (uint64_t): lookup_range() calls that failed.
+ * - lookup, range (LatencyHistogram): Latency of lookup_hash() and lookup_range().
+ */
+typedef struct {
+    uint64_t hits;
+    uint64_t misses;
+    uint64_t errors;
+    uint64_t filter_rejects;
+    uint64_t delta_hits;
+    uint64_t hot_hits;
+    uint64_t fault_samples;
+    uint64_t minor_faults;
+    uint64_t major_faults;
+    uint64_t cold_lookups;
+    uint64_t sqlite_cache_hits;
+    uint64_t sqlite_cache_misses;
+    uint64_t range_errors;
+    LatencyHistogram lookup;
+    LatencyHistogram range;
+} LookupStatsSnapshot;
+
+/**
+ * What one batch of lookups answered, for lookup_stats_record_batch().
+ *
+ * Components:
+ * - lookups (uint64_t): Hashes in the batch; the ones not found or failed are misses.
+ * - hits, errors (uint64_t): Hashes found, and lookups that failed.
+ * - filter_rejects, delta_hits, hot_hits (uint64_t): As in LookupStatsSnapshot.
+ */
+typedef struct {
+    uint64_t lookups;
+    uint64_t hits;
+    uint64_t errors;
+    uint64_t filter_rejects;
+    uint64_t delta_hits;
+    uint64_t hot_hits;
+} LookupBatchTally;
+
+// Current LOOKUP_STATS_* flags; checked by lookup_hash() and lookup_range() before measuring
+extern atomic_uint lookup_stats_mode;
+
+static inline unsigned lookup_stats_active(void) {
+    return atomic_load_explicit(&lookup_stats_mode, memory_order_relaxed);
+}
+
+// Turns measuring on (or off with 0) for every thread
+void lookup_stats_enable(unsigned flags);
+
+// Parses the optional value of --stats: none for LOOKUP_STATS_TIMING, "faults" to add fault sampling; 0 or -1
+int lookup_stats_parse(const char *arg, unsigned *flags);
+
+// lookup_hash() with the result, latency and page activity recorded in the calling thread's counters
+int lookup_hash_measured(PwnedDB *db, const unsigned char *binary_hash, int *count);
+
+// Records a batch of lookups answered together in elapsed_ns; each is charged an equal share of the time
+void lookup_stats_record_batch(const LookupBatchTally *tally, uint64_t elapsed_ns);
+
+// Records one lookup_range() call that took elapsed_ns and returned rc
+void lookup_stats_record_range(uint64_t elapsed_ns, int rc);
+
+// Monotonic clock in nanoseconds
+uint64_t lookup_stats_now_ns(void);
+
+// Sums every thread's counters; safe to call while lookups are running
+void lookup_stats_snapshot(LookupStatsSnapshot *snapshot);
+
+// Smallest latency, in ns, that at least fraction q (0 to 1) of the recorded operations did not exceed
+uint64_t lookup_stats_percentile(const LatencyHistogram *histogram, double q);
+
+// Human-readable summary for --stats
+void lookup_stats_print(FILE *out);
+
+// Prometheus text exposition format (version 0.0.4); returns 0, or -1 on a write error
+int lookup_stats_write_prometheus(FILE *out);
+
+// Writes the Prometheus text to path through a temporary file, so scrapers never see half of it
+int lookup_stats_write_file(const char *path);
+
+#endif // LOOKUP_STATS_H
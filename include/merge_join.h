@@ -0,0 +1,39 @@
+#ifndef MERGE_JOIN_H
+#define MERGE_JOIN_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stddef.h>
+
+#include "deep_check.h"
+
+// Memory for sorting input hashes before a sorted run is spilled to disk
+#define JOIN_DEFAULT_MEMORY ((size_t)256 << 20)
+// Read buffer of each spilled run while the runs are merged
+#define JOIN_RUN_BUFFER ((size_t)1 << 20)
+
+/**
+ * Settings for a sort-merge join of a hash list against the store.
+ *
+ * Components:
+ * - input_path (const char*): File of 40-digit SHA-1 hex digests, one per line, or NULL for stdin.
+ * - memory_bytes (size_t): Hashes held in memory at once; 0 for JOIN_DEFAULT_MEMORY.
+ * - tmp_dir (const char*): Where sorted runs are spilled; NULL for $TMPDIR or /tmp.
+ */
+typedef struct {
+    const char *input_path;
+    size_t memory_bytes;
+    const char *tmp_dir;
+} JoinOptions;
+
+/**
+ * Joins a list of hashes against the database in one ordered pass and writes
+ * "HASH:COUNT" to stdout for every input line whose hash is in it, in hash order.
+ * Prints a summary to stderr.
+ *
+ * Returns:
+ * - int: 0 on success, 1 if the input, a spill file or the store could not be read.
+ */
+int run_join(PwnedDB *db, const JoinOptions *options);
+
+#endif // MERGE_JOIN_H
@@ -0,0 +1,98 @@
+#ifndef MPHF_INDEX_H
+#define MPHF_INDEX_H
+
+#include <stdio.h>       // For fprintf()
+#include <stdint.h>      // For fixed-width on-disk fields
+#include <stddef.h>      // For size_t
+
+#include "flat_store.h"
+
+// On-disk layout of a minimal perfect hash index (all integers little-endian / host order):
+//   [MphfHeader][partition_count x MphfPartition][bucket_total x uint16 pilot]
+//   [remap_total x uint32 free slot][padding to 64 bytes][key_count x MphfSlot]
+#define MPHF_MAGIC "PWNDMPHF"
+#define MPHF_MAGIC_SIZE 8
+#define MPHF_VERSION 1
+#define MPHF_FILE_SUFFIX ".mphf"        // Appended to the store path to find its index
+#define MPHF_PARTITION_KEYS (1u << 21)  // Keys per partition the builder aims for
+#define MPHF_BUCKET_FACTOR 3.5          // Buckets = factor * keys / log2(keys), as in PTHash
+#define MPHF_LOAD_FACTOR 0.99           // Keys per position before the remap to [0, keys)
+#define MPHF_MAX_PILOT 0xFFFF           // Pilots are stored in 16 bits
+#define MPHF_MAX_ATTEMPTS 16            // Seeds a partition tries before the build fails
+
+typedef struct {
+    char magic[MPHF_MAGIC_SIZE];
+    uint32_t version;
+    uint32_t partition_count;
+    uint64_t key_count;
+    uint64_t key_base;
+    uint64_t partition_mult;
+    uint64_t bucket_total;
+    uint64_t remap_total;
+    uint64_t slots_offset;
+} MphfHeader;
+
+/**
+ * One independently built minimal perfect hash function over a contiguous key range.
+ * 40 bytes with no padding.
+ *
+ * Components:
+ * - slot_base, pilot_base, remap_base (uint64_t): Where the partition's slots,
+ *   pilots and remap entries start in the shared arrays.
+ * - key_count (uint32_t): Keys, and therefore slots, in the partition.
+ * - table_size (uint32_t): Positions the pilots search, key_count / MPHF_LOAD_FACTOR.
+ * - bucket_count (uint32_t): Buckets, one pilot each.
+ * - seed (uint32_t): Seed that made construction succeed.
+ */
+typedef struct {
+    uint64_t slot_base;
+    uint64_t pilot_base;
+    uint64_t remap_base;
+    uint32_t key_count;
+    uint32_t table_size;
+    uint32_t bucket_count;
+    uint32_t seed;
+} MphfPartition;
+
+/**
+ * The record a key maps to: its last 8 hash bytes as a fingerprint and its count.
+ * 12 bytes, packed, so the array costs exactly that per key.
+ */
+typedef struct __attribute__((packed)) {
+    uint64_t fingerprint;
+    uint32_t count;
+} MphfSlot;
+
+/**
+ * Read-only view of a minimal perfect hash index mapped into memory.
+ *
+ * Hashes are split into partitions by their leading 8 bytes, so every partition
+ * is one contiguous run of the sorted flat store and is built on its own. Within
+ * a partition a key picks a bucket and the bucket's pilot moves it to a position
+ * no other key has (PTHash). A lookup is one function evaluation, one pilot read
+ * and one slot read; the fingerprint rejects hashes that are not in the store.
+ *
+ * Components:
+ * - map, map_size: Read-only mapping of the whole file.
+ * - header (const MphfHeader*): The validated header.
+ * - partitions (const MphfPartition*): Partition table.
+ * - pilots (const uint16_t*): One pilot per bucket.
+ * - remap (const uint32_t*): Free slots for positions past a partition's key_count.
+ * - slots (const MphfSlot*): One slot per key.
+ */
+typedef struct {
+    const unsigned char *map;
+    size_t map_size;
+    const MphfHeader *header;
+    const MphfPartition *partitions;
+    const uint16_t *pilots;
+    const uint32_t *remap;
+    const MphfSlot *slots;
+} MphfIndex;
+
+int mphf_build(const FlatStore *store, const char *path, int threads); // Writes the index of a flat store
+int mphf_open(MphfIndex *index, const char *path); // Maps an index file; -1 if missing or malformed
+int mphf_lookup(const MphfIndex *index, const unsigned char *binary_hash, uint32_t *count); // 1 found, 0 not found
+void mphf_close(MphfIndex *index); // Unmaps the index
+
+#endif // MPHF_INDEX_H
@@ -0,0 +1,21 @@
+#ifndef NTLM_H
+#define NTLM_H
+
+#include <stddef.h>      // For size_t
+
+#include "hash_kind.h"
+
+/**
+ * NT hash of a password, the key of the HIBP NTLM dataset: MD4 of the password
+ * in UTF-16LE, as Windows stores it. The password is read as UTF-8; a byte that
+ * does not start a valid sequence is taken as the Latin-1 character it names.
+ * OpenSSL 3 only offers MD4 through its legacy provider, so it is done here.
+ *
+ * Parameters:
+ * - password (const unsigned char*): The password bytes, not necessarily NUL-terminated.
+ * - length (size_t): Number of bytes.
+ * - digest (unsigned char*): Receives the NTLM_HASH_SIZE-byte hash.
+ */
+void ntlm_hash(const unsigned char *password, size_t length, unsigned char digest[NTLM_HASH_SIZE]);
+
+#endif // NTLM_H
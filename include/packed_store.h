@@ -0,0 +1,74 @@
+#ifndef PACKED_STORE_H
+#define PACKED_STORE_H
+
+#include <stdio.h>       // For FILE, fprintf()
+#include <stdint.h>      // For fixed-width on-disk fields
+#include <stddef.h>      // For size_t
+
+#include "flat_store.h"
+
+// On-disk layout of a packed store (all integers little-endian / host order):
+//   [PackHeader][(1 << bucket_bits) + 1 x uint64 first rank][(1 << bucket_bits) + 1 x uint64 count offset]
+//   [high bits: unary-coded upper key bits][low bits: key_count x low_bits packed][counts: LEB128 varints]
+#define PACK_MAGIC "PWNDPACK"
+#define PACK_MAGIC_SIZE 8
+#define PACK_VERSION 1
+#define PACK_HEADER_SIZE 64
+#define PACK_KEY_BITS 64        // Leading hash bits kept per record
+#define PACK_BUCKET_SHIFT 6     // Buckets hold about 2^6 keys on average
+#define PACK_HIGH_BITS 6        // Key bits below the bucket that are coded in unary
+#define PACK_MAX_BUCKET_BITS 28
+
+typedef struct {
+    char magic[PACK_MAGIC_SIZE];
+    uint32_t version;
+    uint32_t bucket_bits;
+    uint32_t high_bits;
+    uint32_t low_bits;
+    uint64_t key_count;
+    uint64_t high_offset;
+    uint64_t low_offset;
+    uint64_t counts_offset;
+    uint64_t counts_size;
+} PackHeader;
+
+/**
+ * Read-only view of a packed store mapped into memory.
+ *
+ * Only the leading PACK_KEY_BITS bits of every hash are kept, as an Elias-Fano
+ * sequence: the top bucket_bits pick a bucket, the next high_bits are coded in
+ * unary in a shared bitvector and the remaining low_bits are stored verbatim.
+ * Counts are kept exactly, as variable-length integers addressed per bucket.
+ *
+ * Components:
+ * - fd, map, map_size: Descriptor and read-only mapping of the whole file.
+ * - header (const PackHeader*): The validated header.
+ * - ranks (const uint64_t*): Index of the first key of every bucket.
+ * - count_offsets (const uint64_t*): Byte offset of every bucket's first count.
+ * - high, low (const uint64_t*): The two halves of the Elias-Fano sequence.
+ * - counts (const uint8_t*): The varint count column.
+ */
+typedef struct {
+    int fd;
+    const unsigned char *map;
+    size_t map_size;
+    const PackHeader *header;
+    const uint64_t *ranks;
+    const uint64_t *count_offsets;
+    const uint64_t *high;
+    const uint64_t *low;
+    const uint8_t *counts;
+} PackedStore;
+
+// Receives every key of a packed store in order; return non-zero to stop
+typedef int (*PackedCallback)(uint64_t key, uint32_t count, void *ctx);
+
+int packed_is_store(const char *path); // Returns 1 if the file starts with the packed store magic
+int packed_open(PackedStore *store, const char *path); // Map an existing store read-only
+int packed_lookup(const PackedStore *store, const unsigned char *hash, uint32_t *count); // 1 found, 0 not found
+int packed_for_each(const PackedStore *store, PackedCallback callback, void *ctx); // Decode every key in order
+void packed_close(PackedStore *store); // Unmap and close the store
+
+int packed_write(const FlatStore *source, const char *path); // Encode a sorted flat store as a packed store
+
+#endif // PACKED_STORE_H
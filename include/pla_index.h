@@ -0,0 +1,60 @@
+#ifndef PLA_INDEX_H
+#define PLA_INDEX_H
+
+#include <stdint.h>      // For fixed-width on-disk fields
+#include <stddef.h>      // For size_t
+
+/**
+ * One piece of a piecewise-linear model mapping a 64-bit key to a record position.
+ *
+ * The segment passes exactly through its first key; later keys are predicted as
+ * first_pos + (key - first_key) * slope. 24 bytes with no padding, so segments
+ * are stored in files exactly as they are in memory.
+ */
+typedef struct {
+    uint64_t first_key;
+    uint64_t first_pos;
+    double slope;
+} PlaSegment;
+
+/**
+ * Streaming builder for a piecewise-linear approximation with a fixed error bound.
+ *
+ * Keys are fed in strictly increasing order with their positions. Each segment
+ * keeps the range of slopes ("cone") that still predicts every key seen so far to
+ * within epsilon positions; when a key falls outside the cone the segment is
+ * closed and a new one starts at that key.
+ *
+ * Components:
+ * - segments (PlaSegment*): Closed segments, heap-owned, count in segment_count.
+ * - epsilon (double): Maximum allowed prediction error in positions.
+ * - slope_lo, slope_hi (double): Cone of the open segment.
+ * - open (int): Non-zero once the first key has been added.
+ */
+typedef struct {
+    PlaSegment *segments;
+    size_t segment_count;
+    size_t capacity;
+    double epsilon;
+    PlaSegment current;
+    double slope_lo;
+    double slope_hi;
+    int open;
+} PlaBuilder;
+
+void pla_builder_init(PlaBuilder *builder, uint32_t epsilon);
+int pla_builder_add(PlaBuilder *builder, uint64_t key, uint64_t pos); // Keys must strictly increase
+int pla_builder_finish(PlaBuilder *builder); // Closes the last segment
+void pla_builder_free(PlaBuilder *builder);
+
+// Predicted position of a key inside the segment that covers it (never before first_pos)
+int64_t pla_predict(const PlaSegment *segment, uint64_t key);
+
+// Radix directory: entry t is the number of segments whose first key has top bits < t
+uint32_t pla_radix_bits(size_t segment_count); // Directory width for a given model size
+void pla_build_radix(const PlaSegment *segments, size_t segment_count, uint32_t bits, uint32_t *radix);
+
+// Index of the last segment whose first key is <= key, or -1 if key precedes the model
+int64_t pla_find_segment(const PlaSegment *segments, const uint32_t *radix, uint32_t bits, uint64_t key);
+
+#endif // PLA_INDEX_H
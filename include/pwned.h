@@ -0,0 +1,41 @@
+#ifndef PWNED_H
+#define PWNED_H
+
+#include <stddef.h>      // For size_t
+#include <stdint.h>      // For the fixed-width count array
+
+// Public C API of libpwned, the lookup code of pwned_checker built as a shared library
+// (bin/libpwned.so) for other languages to load. The handle hides the storage backend:
+// SQLite, flat, packed and sharded databases, with their delta segments and filter, all
+// open the same way. Only the functions below are exported; bump PWNED_API_VERSION when
+// their signatures or meaning change.
+#define PWNED_API_VERSION 1
+#define PWNED_HASH_SIZE 20 // A SHA-1 digest, in binary
+
+#if defined(__GNUC__)
+#define PWNED_API __attribute__((visibility("default")))
+#else
+#define PWNED_API
+#endif
+
+// Opaque handle; one open database shared by any number of threads
+typedef struct pwned_db pwned_db;
+
+// PWNED_API_VERSION of the loaded library, so bindings can refuse a mismatched one
+PWNED_API int pwned_api_version(void);
+
+// Opens a database, picking the backend from the file; NULL on failure (the reason goes to stderr)
+PWNED_API pwned_db *pwned_open(const char *path);
+
+// Looks up one binary hash; returns 1 if found (count set), 0 if not found, -1 on error
+PWNED_API int pwned_lookup(pwned_db *db, const unsigned char *hash, int32_t *count);
+
+// Looks up n hashes stored back to back (n * PWNED_HASH_SIZE bytes) into the caller's counts
+// array: the breach count, 0 when absent, or -1 where the lookup failed. Returns the number
+// of failed lookups, so 0 means every entry of counts is valid.
+PWNED_API size_t pwned_lookup_batch(pwned_db *db, const unsigned char *hashes, size_t n, int32_t *counts);
+
+// Releases the handle; NULL is ignored
+PWNED_API void pwned_close(pwned_db *db);
+
+#endif // PWNED_H
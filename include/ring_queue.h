@@ -0,0 +1,43 @@
+#ifndef RING_QUEUE_H
+#define RING_QUEUE_H
+
+#include <stddef.h>      // For size_t
+#include <stdatomic.h>   // For the per-slot sequence counters
+
+// Pad hot counters onto their own cache line so producers and consumers don't false-share
+#define RING_CACHE_LINE 64
+
+typedef struct {
+    atomic_size_t sequence;
+    void *data;
+} RingCell;
+
+/**
+ * Bounded multi-producer, multi-consumer lock-free queue of pointers.
+ *
+ * Each slot carries a sequence number that tells producers and consumers whose
+ * turn it is, so a push or pop is one compare-and-swap on the shared position
+ * plus a release store on the slot (Vyukov's bounded queue).
+ *
+ * Components:
+ * - cells (RingCell*): Slot array of `mask + 1` entries (a power of two).
+ * - mask (size_t): Capacity minus one, used to wrap positions.
+ * - enqueue_pos, dequeue_pos (atomic_size_t): Next slot to fill and to drain.
+ */
+typedef struct {
+    RingCell *cells;
+    size_t mask;
+    _Alignas(RING_CACHE_LINE) atomic_size_t enqueue_pos;
+    _Alignas(RING_CACHE_LINE) atomic_size_t dequeue_pos;
+} RingQueue;
+
+int ring_queue_init(RingQueue *queue, size_t capacity); // Capacity is rounded up to a power of two
+void ring_queue_destroy(RingQueue *queue); // Frees the slot array
+
+int ring_queue_try_push(RingQueue *queue, void *item); // Returns 0 on success, -1 if full
+int ring_queue_try_pop(RingQueue *queue, void **item); // Returns 0 on success, -1 if empty
+
+void ring_queue_push(RingQueue *queue, void *item); // Waits while the queue is full
+void *ring_queue_pop(RingQueue *queue); // Waits while the queue is empty
+
+#endif // RING_QUEUE_H
@@ -0,0 +1,57 @@
+#ifndef SHA1_MULTI_H
+#define SHA1_MULTI_H
+
+#include <stdint.h>      // For uint32_t offsets and lengths
+#include <stddef.h>      // For size_t
+
+#define SHA1_DIGEST_SIZE 20
+#define SHA1_BLOCK_SIZE 64
+#define SHA1_ONE_BLOCK_MAX 55  // Longest message whose padding fits in a single block
+
+/**
+ * SHA-1 implementations sha1_multi() can run on.
+ *
+ * - SHA1_KERNEL_AUTO: The fastest kernel the CPU supports, picked once per process.
+ * - SHA1_KERNEL_SCALAR: OpenSSL's SHA1(), one message at a time; runs everywhere.
+ * - SHA1_KERNEL_SHANI: The x86 SHA extensions, one message at a time, any length.
+ * - SHA1_KERNEL_AVX2: Eight single-block messages at once in 256-bit lanes.
+ * - SHA1_KERNEL_AVX512: Sixteen single-block messages at once in 512-bit lanes.
+ *
+ * The lane kernels hash messages of up to SHA1_ONE_BLOCK_MAX bytes, which covers
+ * practically every password; longer ones go through SHA-NI where the CPU has it
+ * and OpenSSL otherwise. Every kernel produces the same digests as OpenSSL.
+ */
+typedef enum {
+    SHA1_KERNEL_AUTO,
+    SHA1_KERNEL_SCALAR,
+    SHA1_KERNEL_SHANI,
+    SHA1_KERNEL_AVX2,
+    SHA1_KERNEL_AVX512
+} Sha1Kernel;
+
+// Name of a kernel as accepted by sha1_parse_kernel() ("auto", "scalar", "sha-ni", "avx2", "avx512")
+const char *sha1_kernel_name(Sha1Kernel kernel);
+
+// Parses a kernel name; returns 0 on success, -1 for anything else
+int sha1_parse_kernel(const char *name, Sha1Kernel *kernel);
+
+// Non-zero if the CPU and operating system can run the kernel; AUTO and SCALAR always can
+int sha1_kernel_supported(Sha1Kernel kernel);
+
+// The kernel AUTO resolves to on this machine
+Sha1Kernel sha1_kernel_best(void);
+
+/**
+ * Hashes n messages stored in one buffer.
+ *
+ * Parameters:
+ * - kernel (Sha1Kernel): Implementation to use; an unsupported one falls back to AUTO.
+ * - text (const unsigned char*): The messages, anywhere in the buffer.
+ * - offsets, lengths (const uint32_t*): Where message i starts in text and how long it is.
+ * - n (size_t): Number of messages.
+ * - digests (unsigned char (*)[20]): Receives the digest of message i at index i.
+ */
+void sha1_multi(Sha1Kernel kernel, const unsigned char *text, const uint32_t *offsets, const uint32_t *lengths,
+                size_t n, unsigned char (*digests)[SHA1_DIGEST_SIZE]);
+
+#endif // SHA1_MULTI_H
@@ -0,0 +1,37 @@
+#ifndef SHARD_STORE_H
+#define SHARD_STORE_H
+
+#include <stdio.h>       // For fprintf()
+#include <stdint.h>      // For fixed-width on-disk fields
+#include <stddef.h>      // For size_t
+
+// A sharded database is a small manifest at <db_path> plus (1 << shard_bits) complete
+// stores, "<db_path>.shard.<i>" with i in hex, each holding the hashes whose leading
+// shard_bits bits equal i. Every shard is an ordinary SQLite or flat store and carries
+// its own delta segments and filter, so shards can be rebuilt or moved one at a time.
+//   [ShardHeader]
+#define SHARD_MAGIC "PWNDSHRD"
+#define SHARD_MAGIC_SIZE 8
+#define SHARD_VERSION 1
+#define SHARD_HEADER_SIZE 64
+#define SHARD_MAX_BITS 12       // 4096 shards; every shard then still covers whole range-API prefixes
+#define SHARD_FILE_SUFFIX ".shard"
+
+typedef struct {
+    char magic[SHARD_MAGIC_SIZE];
+    uint32_t version;
+    uint32_t shard_bits;
+    uint8_t reserved[48];
+} ShardHeader;
+
+// Shard that holds a hash: its leading shard_bits bits
+static inline uint32_t shard_of(const unsigned char *hash, unsigned shard_bits) {
+    return (((uint32_t)hash[0] << 8) | hash[1]) >> (16 - shard_bits);
+}
+
+int shard_is_store(const char *path);   // True if the file starts with the shard manifest magic
+int shard_read_header(const char *path, ShardHeader *header); // 0 on success, 1 if missing or malformed
+int shard_write_header(const char *path, unsigned shard_bits); // Written under a temporary name, then renamed
+void shard_path(char *out, size_t size, const char *db_path, uint32_t shard, unsigned shard_bits);
+
+#endif // SHARD_STORE_H
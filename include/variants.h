@@ -0,0 +1,96 @@
+#ifndef VARIANTS_H
+#define VARIANTS_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stddef.h>
+
+#include "deep_check.h"
+#include "async_lookup.h"
+#include "sha1_multi.h"
+
+#define VARIANT_MAX_RULES 16384   // Rules, and so variants, checked per password
+#define VARIANT_MAX_LENGTH 256    // Longest variant a rule may produce; longer ones are skipped
+#define VARIANT_RULE_MAX 64       // Longest rule text
+#define VARIANT_REPORT_LIMIT 10   // Pwned variants listed per password
+
+/**
+ * A rule set: every rule turns the entered password into one variant.
+ *
+ * Rules use a subset of the hashcat rule language, applied left to right:
+ *   :  nothing            l  lowercase           u  uppercase
+ *   c  capitalize         C  invert capitalize   t  toggle case
+ *   TN toggle position N  r  reverse             d  duplicate
+ *   $X append X           ^X prepend X           [  delete first    ]  delete last
+ *   sXY replace X with Y  @X purge X
+ * plus one extension: ~d, ~p or ~a strips trailing digits, trailing symbols,
+ * or trailing non-letters. N is 0-9 or A-Z for 10-35. Spaces between
+ * operations are ignored; in a rules file, lines starting with '#' are comments.
+ *
+ * Components:
+ * - rules (char (*)[VARIANT_RULE_MAX]): The rules, validated when loaded.
+ * - count (size_t): Number of rules.
+ */
+typedef struct {
+    char (*rules)[VARIANT_RULE_MAX];
+    size_t count;
+} VariantRules;
+
+// Builds the default set: case, leetspeak and stripped-suffix bases times common digit, year and symbol suffixes
+int variant_rules_default(VariantRules *rules);
+
+// Loads one rule per line; returns 0, or -1 with the offending line reported
+int variant_rules_load(VariantRules *rules, const char *path);
+
+void variant_rules_free(VariantRules *rules);
+
+// One distinct variant digest and the first rule that produced it
+typedef struct {
+    unsigned char hash[SHA_DIGEST_LENGTH];
+    uint32_t rule;
+} VariantEntry;
+
+/**
+ * Expands and checks the variants of one password at a time.
+ *
+ * Every rule is applied, the variants are hashed in one sha1_multi() call, the
+ * digests are sorted and deduplicated, and all of them are looked up in one
+ * batch: through the daemon, or through an async lookup handle on the local
+ * database (plain lookups in hash order for backends it does not read itself).
+ * Scratch buffers are allocated once and wiped after every password.
+ *
+ * Components:
+ * - rules (VariantRules): The rule set.
+ * - db (PwnedDB*): Local database, or NULL when daemon_fd is used.
+ * - daemon_fd (int): Daemon connection, or -1.
+ * - async (AsyncLookup): Batched lookup handle on db.
+ * - text, offsets, lengths (unsigned char*, uint32_t*): The variants of the current password.
+ * - rule_of (uint32_t*): Rule that produced each variant.
+ * - digests (unsigned char (*)[20]): Digest of each variant.
+ * - entries (VariantEntry*): Digests with their rule, sorted and deduplicated.
+ * - unique (unsigned char (*)[20]), results (int32_t*): The deduplicated digests and their counts.
+ */
+typedef struct {
+    VariantRules rules;
+    PwnedDB *db;
+    int daemon_fd;
+    AsyncLookup async;
+    unsigned char *text;
+    uint32_t *offsets;
+    uint32_t *lengths;
+    uint32_t *rule_of;
+    unsigned char (*digests)[SHA_DIGEST_LENGTH];
+    VariantEntry *entries;
+    unsigned char (*unique)[SHA_DIGEST_LENGTH];
+    int32_t *results;
+} VariantChecker;
+
+// Takes ownership of rules; db or daemon_fd answers the lookups. Returns 0 on success
+int variant_checker_init(VariantChecker *checker, VariantRules *rules, PwnedDB *db, int daemon_fd);
+
+// Checks every variant of a password and prints the pwned ones; returns 0, or -1 if a lookup failed
+int variant_check_password(VariantChecker *checker, const unsigned char *password, size_t length);
+
+void variant_checker_close(VariantChecker *checker);
+
+#endif // VARIANTS_H
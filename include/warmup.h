@@ -0,0 +1,76 @@
+#ifndef WARMUP_H
+#define WARMUP_H
+
+#include <stdio.h>       // For FILE
+#include <stdint.h>      // For the byte counters
+
+#include "deep_check.h"
+
+#define WARM_CHUNK_SIZE (16u << 20)   // Bytes a prefetching thread claims at a time
+#define WARM_HUGE_PAGE_SIZE (2u << 20) // x86-64 and arm64 PMD-sized huge page
+#define WARM_SQLITE_PROBES 16384      // Evenly spaced lookups that pull in the upper B-tree levels
+
+// How much of a store db_warm() faults in before the first lookup
+typedef enum {
+    WARM_PREFETCH_NONE,
+    WARM_PREFETCH_INDEX,  // Headers, indexes, filters, delta segments and the upper B-tree levels
+    WARM_PREFETCH_ALL     // Also every record, slot and packed key
+} WarmPrefetch;
+
+// What db_warm() backs the index structures of mapped stores with
+typedef enum {
+    WARM_HUGE_PAGES_OFF,
+    WARM_HUGE_PAGES_TRANSPARENT, // Anonymous memory marked MADV_HUGEPAGE
+    WARM_HUGE_PAGES_EXPLICIT     // Reserved hugetlb pages (vm.nr_hugepages), transparent ones once they run out
+} WarmHugePages;
+
+/**
+ * Residency settings for an opened store, from --warm, --hugepages and --mlock.
+ *
+ * Components:
+ * - prefetch (WarmPrefetch): What to fault in.
+ * - huge_pages (WarmHugePages): Whether to move the index structures onto huge pages.
+ * - lock_budget (uint64_t): Bytes to mlock, index structures first; 0 locks nothing.
+ * - threads (int): Prefetching threads, 0 for one per core.
+ */
+typedef struct {
+    WarmPrefetch prefetch;
+    WarmHugePages huge_pages;
+    uint64_t lock_budget;
+    int threads;
+} WarmupOptions;
+
+/**
+ * What db_warm() did, for the startup report.
+ *
+ * Components:
+ * - prefetched (uint64_t): Bytes of mapped stores faulted in.
+ * - huge (uint64_t): Bytes the process holds on huge pages afterwards, from /proc/self/smaps_rollup.
+ * - locked (uint64_t): Bytes locked into memory.
+ * - probes (uint64_t): Lookups issued to warm SQLite B-trees.
+ * - seconds (double): Wall time from the call to the return.
+ */
+typedef struct {
+    uint64_t prefetched;
+    uint64_t huge;
+    uint64_t locked;
+    uint64_t probes;
+    double seconds;
+} WarmupReport;
+
+// Non-zero when any residency option is set
+int warmup_requested(const WarmupOptions *options);
+
+// Parses a --warm argument: NULL or "index", "all" or "none"; -1 if unknown
+int warmup_parse_prefetch(const char *arg, WarmPrefetch *prefetch);
+
+// Parses a --hugepages argument: NULL or "transparent", "explicit" or "off"; -1 if unknown
+int warmup_parse_huge_pages(const char *arg, WarmHugePages *huge_pages);
+
+// Faults in, moves onto huge pages and locks an opened store as options say; 0 on success, -1 if the handle is unusable
+int db_warm(PwnedDB *db, const WarmupOptions *options, WarmupReport *report);
+
+// One line saying how long the store took to warm and what is resident
+void warmup_print_report(FILE *out, const WarmupReport *report);
+
+#endif // WARMUP_H
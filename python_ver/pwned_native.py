@@ -0,0 +1,134 @@
+"""ctypes binding for libpwned (include/pwned.h).
+
+A PwnedDB keeps one native handle open, so every lookup after the first skips
+opening the database. Batch lookups pass the caller's buffers straight to the
+library: hashes are read from any bytes-like object holding 20-byte digests back
+to back, and counts are written into a caller-provided int32 buffer when one is
+given. ctypes releases the GIL for the duration of each call.
+"""
+
+import ctypes
+import ctypes.util
+import os
+import sys
+from array import array
+
+HASH_SIZE = 20
+API_VERSION = 1
+
+_library = None
+
+
+def _library_candidates():
+    override = os.environ.get('PWNED_LIB')
+    if override:
+        yield override
+    name = 'libpwned.dylib' if sys.platform == 'darwin' else 'libpwned.so'
+    yield os.path.join(os.path.dirname(os.path.abspath(__file__)), '..', 'bin', name)
+    found = ctypes.util.find_library('pwned')
+    if found:
+        yield found
+
+
+def load_library():
+    """Loads libpwned once; PWNED_LIB overrides the search for bin/libpwned.so."""
+    global _library
+    if _library is not None:
+        return _library
+
+    errors = []
+    for path in _library_candidates():
+        try:
+            lib = ctypes.CDLL(path)
+            break
+        except OSError as error:
+            errors.append(str(error))
+    else:
+        raise OSError('libpwned not found (build it with "make lib"): ' + '; '.join(errors))
+
+    lib.pwned_api_version.argtypes = []
+    lib.pwned_api_version.restype = ctypes.c_int
+    if lib.pwned_api_version() != API_VERSION:
+        raise OSError(f'libpwned API version {lib.pwned_api_version()}, expected {API_VERSION}')
+
+    lib.pwned_open.argtypes = [ctypes.c_char_p]
+    lib.pwned_open.restype = ctypes.c_void_p
+    lib.pwned_lookup.argtypes = [ctypes.c_void_p, ctypes.c_char_p, ctypes.POINTER(ctypes.c_int32)]
+    lib.pwned_lookup.restype = ctypes.c_int
+    lib.pwned_lookup_batch.argtypes = [ctypes.c_void_p, ctypes.c_void_p, ctypes.c_size_t, ctypes.c_void_p]
+    lib.pwned_lookup_batch.restype = ctypes.c_size_t
+    lib.pwned_close.argtypes = [ctypes.c_void_p]
+    lib.pwned_close.restype = None
+
+    _library = lib
+    return lib
+
+
+def _writable_address(buffer, size):
+    """Address of a writable buffer's memory, without copying it."""
+    view = memoryview(buffer)
+    if view.readonly or not view.c_contiguous or view.nbytes < size:
+        raise ValueError(f'buffer must be writable, contiguous and hold at least {size} bytes')
+    return ctypes.addressof(ctypes.c_char.from_buffer(view))
+
+
+class PwnedDB:
+    """An open pwned passwords database: SQLite, flat, packed or sharded."""
+
+    def __init__(self, db_path):
+        self._lib = load_library()
+        self._handle = self._lib.pwned_open(os.fsencode(db_path))
+        if not self._handle:
+            raise OSError(f'Failed to open the database: {db_path}')
+
+    def close(self):
+        if self._handle:
+            self._lib.pwned_close(self._handle)
+            self._handle = None
+
+    def __enter__(self):
+        return self
+
+    def __exit__(self, *exc):
+        self.close()
+
+    def __del__(self):
+        self.close()
+
+    def lookup(self, password_hash):
+        """Breach count of one 20-byte SHA-1 digest, 0 if it is not listed."""
+        if len(password_hash) != HASH_SIZE:
+            raise ValueError('a SHA-1 digest is 20 bytes')
+        count = ctypes.c_int32(0)
+        found = self._lib.pwned_lookup(self._handle, bytes(password_hash), ctypes.byref(count))
+        if found < 0:
+            raise OSError('lookup failed')
+        return count.value if found else 0
+
+    def lookup_batch(self, hashes, counts=None):
+        """Looks up len(hashes) // 20 digests stored back to back.
+
+        Counts land in `counts` (any writable buffer of int32, such as array('i')
+        or a NumPy int32 array) or in a new array('i'), in input order; an entry
+        is -1 where its lookup failed. Returns the counts buffer.
+        """
+        view = memoryview(hashes)
+        if view.nbytes % HASH_SIZE:
+            raise ValueError('hashes must be a multiple of 20 bytes')
+        n = view.nbytes // HASH_SIZE
+        if counts is None:
+            counts = array('i', [0]) * n
+        if n == 0:
+            return counts
+
+        # bytes are passed by pointer; other read-only buffers cannot be, so they are copied once
+        if not isinstance(hashes, bytes) and view.readonly:
+            hashes = view.tobytes()
+        if isinstance(hashes, bytes):
+            hashes_address = ctypes.cast(ctypes.c_char_p(hashes), ctypes.c_void_p).value
+        else:
+            hashes_address = _writable_address(view, n * HASH_SIZE)
+        counts_address = _writable_address(counts, 4 * n)
+
+        self._lib.pwned_lookup_batch(self._handle, hashes_address, n, counts_address)
+        return counts
@@ -1,17 +1,64 @@
 import hashlib
 import sqlite3
 
+try:
+    from pwned_native import PwnedDB, load_library
+except ImportError:
+    PwnedDB = None
+
+# One open handle per database path, kept for the life of the process
+_open_dbs = {}
+_native = None
+
 def hash_password(password):
     return hashlib.sha1(password.encode()).digest()
 
 
+def native_available():
+    """Whether libpwned could be loaded; decided once, on first use."""
+    global _native
+    if _native is None:
+        _native = False
+        if PwnedDB is not None:
+            try:
+                load_library()
+                _native = True
+            except OSError:
+                pass
+    return _native
+
+
+def open_db(db_path):
+    """Opens db_path once: through libpwned when it is built, else one SQLite connection.
+
+    Only a missing libpwned falls back to SQLite; a database the library fails
+    to open raises, since a flat or packed store is not readable as SQLite.
+    """
+    db = _open_dbs.get(db_path)
+    if db is None:
+        if native_available():
+            db = PwnedDB(db_path)
+        else:
+            db = sqlite3.connect(db_path, check_same_thread=False)
+        _open_dbs[db_path] = db
+    return db
+
+
 def check_password_in_db(db_path, password_hash):
-    with sqlite3.connect(db_path) as conn:
-        cursor = conn.cursor()
-        query = "SELECT count FROM pwned_passwords WHERE full_hash = ?"
-        cursor.execute(query, (password_hash,))
-        result = cursor.fetchone()
-        return result[0] if result else 0
+    db = open_db(db_path)
+    if not isinstance(db, sqlite3.Connection):
+        return db.lookup(password_hash)
+    query = "SELECT count FROM pwned_passwords WHERE full_hash = ?"
+    result = db.execute(query, (password_hash,)).fetchone()
+    return result[0] if result else 0
+
+
+def check_hashes_in_db(db_path, password_hashes):
+    """Counts for a list of 20-byte digests, looked up in one native batch call when possible."""
+    db = open_db(db_path)
+    if not isinstance(db, sqlite3.Connection):
+        return list(db.lookup_batch(b''.join(password_hashes)))
+    return [check_password_in_db(db_path, password_hash) for password_hash in password_hashes]
 
 def get_valid_response(prompt="\nCheck another? (y/n): "):
 
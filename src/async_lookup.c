@@ -0,0 +1,610 @@
+#include "async_lookup.h"
+#include "lookup_stats.h"
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#include <unistd.h>
+
+#ifdef __linux__
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#endif
+
+// Shared by every read of one async_lookup_batch() call
+typedef struct {
+    const unsigned char (*hashes)[SHA_DIGEST_LENGTH];
+    int32_t *results;
+    atomic_int failed;
+} BatchContext;
+
+/**
+ * pread() fallback: a pool of threads that each block on one read at a time.
+ *
+ * Workers sleep until the generation counter moves, claim reads from the
+ * shared cursor until the batch is exhausted, then report idle.
+ */
+struct AsyncPool {
+    pthread_t threads[ASYNC_MAX_PREAD_THREADS];
+    int count;
+    pthread_mutex_t lock;
+    pthread_cond_t wake;
+    pthread_cond_t idle;
+    uint64_t generation;
+    int busy;
+    int stop;
+    AsyncLookup *lookup;
+    BatchContext *ctx;
+    size_t nreads;
+    atomic_size_t next;
+};
+
+const char *async_engine_name(AsyncEngine engine) {
+    switch (engine) {
+    case ASYNC_ENGINE_IO_URING: return "io_uring";
+    case ASYNC_ENGINE_PREAD: return "pread";
+    case ASYNC_ENGINE_SYNC: return "sync";
+    default: return "auto";
+    }
+}
+
+// Binary search of a slice of records of one width; inlined with constant widths below
+static inline __attribute__((always_inline)) int32_t search_records(const unsigned char *buffer, size_t length,
+                                                                    const unsigned char *hash, size_t record_size,
+                                                                    size_t hash_size) {
+    size_t lo = 0;
+    size_t hi = length / record_size;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        const unsigned char *record = buffer + mid * record_size;
+        int cmp = memcmp(record, hash, hash_size);
+        if (cmp == 0) {
+            uint32_t count;
+            memcpy(&count, record + hash_size, sizeof(count));
+            return (int32_t)count;
+        }
+        if (cmp < 0) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return 0;
+}
+
+// Searches the records a read brought in; they are a sorted slice of the store
+static int32_t resolve_records(const FlatStore *store, const unsigned char *buffer, size_t length,
+                               const unsigned char *hash) {
+    if (store->kind == HASH_KIND_NTLM) {
+        return search_records(buffer, length, hash, sizeof(NtlmRecord), NTLM_HASH_SIZE);
+    }
+    return search_records(buffer, length, hash, sizeof(FlatRecord), SHA1_HASH_SIZE);
+}
+
+static int grow_buffer(unsigned char **buffer, size_t *capacity, size_t needed) {
+    if (needed <= *capacity) {
+        return 0;
+    }
+    size_t size = *capacity ? *capacity : 4096;
+    while (size < needed) {
+        size *= 2;
+    }
+    unsigned char *grown = realloc(*buffer, size);
+    if (grown == NULL) {
+        return -1;
+    }
+    *buffer = grown;
+    *capacity = size;
+    return 0;
+}
+
+// Blocking read of one candidate range, used by the pool and to retry short ring reads
+static void serve_read_pread(AsyncLookup *lookup, BatchContext *ctx, const AsyncRead *read,
+                             unsigned char **buffer, size_t *capacity) {
+    int fd = lookup->db->flat.fd;
+    size_t done = 0;
+    if (grow_buffer(buffer, capacity, read->length) == 0) {
+        while (done < read->length) {
+            ssize_t n = pread(fd, *buffer + done, read->length - done, (off_t)(read->offset + done));
+            if (n < 0 && errno == EINTR) {
+                continue;
+            }
+            if (n <= 0) {
+                break;
+            }
+            done += (size_t)n;
+        }
+    }
+    if (done == read->length) {
+        ctx->results[read->index] = resolve_records(&lookup->db->flat, *buffer, read->length,
+                                                    ctx->hashes[read->index]);
+    } else {
+        ctx->results[read->index] = ASYNC_RESULT_ERROR;
+        atomic_store(&ctx->failed, 1);
+    }
+}
+
+static void *pool_worker(void *arg) {
+    struct AsyncPool *pool = arg;
+    unsigned char *buffer = NULL;
+    size_t capacity = 0;
+    uint64_t seen = 0;
+
+    for (;;) {
+        pthread_mutex_lock(&pool->lock);
+        while (!pool->stop && pool->generation == seen) {
+            pthread_cond_wait(&pool->wake, &pool->lock);
+        }
+        if (pool->stop) {
+            pthread_mutex_unlock(&pool->lock);
+            break;
+        }
+        seen = pool->generation;
+        pthread_mutex_unlock(&pool->lock);
+
+        size_t i;
+        while ((i = atomic_fetch_add(&pool->next, 1)) < pool->nreads) {
+            serve_read_pread(pool->lookup, pool->ctx, &pool->lookup->reads[i], &buffer, &capacity);
+        }
+
+        pthread_mutex_lock(&pool->lock);
+        if (--pool->busy == 0) {
+            pthread_cond_signal(&pool->idle);
+        }
+        pthread_mutex_unlock(&pool->lock);
+    }
+    free(buffer);
+    return NULL;
+}
+
+static void pool_stop(struct AsyncPool *pool) {
+    pthread_mutex_lock(&pool->lock);
+    pool->stop = 1;
+    pthread_cond_broadcast(&pool->wake);
+    pthread_mutex_unlock(&pool->lock);
+    for (int i = 0; i < pool->count; i++) {
+        pthread_join(pool->threads[i], NULL);
+    }
+    pthread_mutex_destroy(&pool->lock);
+    pthread_cond_destroy(&pool->wake);
+    pthread_cond_destroy(&pool->idle);
+    free(pool);
+}
+
+static struct AsyncPool *pool_start(AsyncLookup *lookup, unsigned threads) {
+    struct AsyncPool *pool = calloc(1, sizeof(struct AsyncPool));
+    if (pool == NULL) {
+        return NULL;
+    }
+    pool->lookup = lookup;
+    pthread_mutex_init(&pool->lock, NULL);
+    pthread_cond_init(&pool->wake, NULL);
+    pthread_cond_init(&pool->idle, NULL);
+    for (unsigned i = 0; i < threads && i < ASYNC_MAX_PREAD_THREADS; i++) {
+        if (pthread_create(&pool->threads[pool->count], NULL, pool_worker, pool) != 0) {
+            break;
+        }
+        pool->count++;
+    }
+    if (pool->count == 0) {
+        pool_stop(pool);
+        return NULL;
+    }
+    return pool;
+}
+
+// Hands a batch of reads to the pool and waits until every one has been resolved
+static void pool_run(struct AsyncPool *pool, BatchContext *ctx, size_t nreads) {
+    pthread_mutex_lock(&pool->lock);
+    pool->ctx = ctx;
+    pool->nreads = nreads;
+    atomic_store(&pool->next, 0);
+    pool->busy = pool->count;
+    pool->generation++;
+    pthread_cond_broadcast(&pool->wake);
+    while (pool->busy > 0) {
+        pthread_cond_wait(&pool->idle, &pool->lock);
+    }
+    pthread_mutex_unlock(&pool->lock);
+}
+
+#ifdef __linux__
+
+/**
+ * A raw io_uring instance: the mapped submission and completion rings plus
+ * one read buffer per submission slot. Only this thread submits, so the
+ * submission tail needs no atomics beyond publishing it to the kernel.
+ */
+struct AsyncRing {
+    int fd;
+    unsigned entries;
+    unsigned sq_mask;
+    unsigned cq_mask;
+    unsigned *sq_head;
+    unsigned *sq_tail;
+    unsigned *sq_array;
+    unsigned *cq_head;
+    unsigned *cq_tail;
+    struct io_uring_sqe *sqes;
+    struct io_uring_cqe *cqes;
+    void *sq_map;
+    void *cq_map;
+    size_t sq_map_size;
+    size_t cq_map_size;
+    size_t sqes_size;
+    unsigned char **buffers;    // One per slot
+    size_t *buffer_sizes;
+    size_t *slot_read;          // Read index a slot is serving, SIZE_MAX when free
+    unsigned *free_slots;
+    unsigned free_count;
+    unsigned long retries;      // Reads the ring returned short and pread() finished
+};
+
+static void ring_close(struct AsyncRing *ring) {
+    if (ring->sqes != NULL && ring->sqes != MAP_FAILED) {
+        munmap(ring->sqes, ring->sqes_size);
+    }
+    if (ring->cq_map != NULL && ring->cq_map != MAP_FAILED && ring->cq_map != ring->sq_map) {
+        munmap(ring->cq_map, ring->cq_map_size);
+    }
+    if (ring->sq_map != NULL && ring->sq_map != MAP_FAILED) {
+        munmap(ring->sq_map, ring->sq_map_size);
+    }
+    if (ring->fd >= 0) {
+        close(ring->fd);
+    }
+    for (unsigned i = 0; ring->buffers != NULL && i < ring->entries; i++) {
+        free(ring->buffers[i]);
+    }
+    free(ring->buffers);
+    free(ring->buffer_sizes);
+    free(ring->slot_read);
+    free(ring->free_slots);
+    free(ring);
+}
+
+static struct AsyncRing *ring_open(unsigned depth) {
+    struct AsyncRing *ring = calloc(1, sizeof(struct AsyncRing));
+    if (ring == NULL) {
+        return NULL;
+    }
+    struct io_uring_params params;
+    memset(&params, 0, sizeof(params));
+    ring->fd = (int)syscall(__NR_io_uring_setup, depth, &params);
+    if (ring->fd < 0) {
+        free(ring);
+        return NULL; // Old kernel, or io_uring disabled by policy
+    }
+
+    ring->sq_map_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    ring->cq_map_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    if (params.features & IORING_FEAT_SINGLE_MMAP) {
+        if (ring->cq_map_size > ring->sq_map_size) {
+            ring->sq_map_size = ring->cq_map_size;
+        }
+        ring->cq_map_size = ring->sq_map_size;
+    }
+    ring->sq_map = mmap(NULL, ring->sq_map_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                        ring->fd, IORING_OFF_SQ_RING);
+    ring->cq_map = (params.features & IORING_FEAT_SINGLE_MMAP)
+                       ? ring->sq_map
+                       : mmap(NULL, ring->cq_map_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                              ring->fd, IORING_OFF_CQ_RING);
+    ring->sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+    ring->sqes = mmap(NULL, ring->sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                      ring->fd, IORING_OFF_SQES);
+    if (ring->sq_map == MAP_FAILED || ring->cq_map == MAP_FAILED || ring->sqes == MAP_FAILED) {
+        ring_close(ring);
+        return NULL;
+    }
+
+    unsigned char *sq = ring->sq_map;
+    unsigned char *cq = ring->cq_map;
+    ring->sq_head = (unsigned *)(sq + params.sq_off.head);
+    ring->sq_tail = (unsigned *)(sq + params.sq_off.tail);
+    ring->sq_mask = *(unsigned *)(sq + params.sq_off.ring_mask);
+    ring->sq_array = (unsigned *)(sq + params.sq_off.array);
+    ring->cq_head = (unsigned *)(cq + params.cq_off.head);
+    ring->cq_tail = (unsigned *)(cq + params.cq_off.tail);
+    ring->cq_mask = *(unsigned *)(cq + params.cq_off.ring_mask);
+    ring->cqes = (struct io_uring_cqe *)(cq + params.cq_off.cqes);
+
+    ring->entries = params.sq_entries;
+    ring->buffers = calloc(ring->entries, sizeof(unsigned char *));
+    ring->buffer_sizes = calloc(ring->entries, sizeof(size_t));
+    ring->slot_read = calloc(ring->entries, sizeof(size_t));
+    ring->free_slots = malloc(ring->entries * sizeof(unsigned));
+    if (ring->buffers == NULL || ring->buffer_sizes == NULL || ring->slot_read == NULL || ring->free_slots == NULL) {
+        ring_close(ring);
+        return NULL;
+    }
+    for (unsigned i = 0; i < ring->entries; i++) {
+        ring->free_slots[i] = ring->entries - 1 - i;
+        ring->slot_read[i] = SIZE_MAX;
+    }
+    ring->free_count = ring->entries;
+    return ring;
+}
+
+/**
+ * Issues every read of a batch through the ring and resolves them as they complete.
+ *
+ * Up to `entries` reads are kept in flight: each pass queues reads into free
+ * slots, submits them and waits for at least one completion, then resolves
+ * whatever has finished. Completions arrive in device order, not submission
+ * order. A short read (which a regular file should never give) is retried with
+ * pread().
+ *
+ * Returns:
+ * - int: 0 when the ring worked, -1 if io_uring_enter() itself failed.
+ */
+static int ring_run(AsyncLookup *lookup, BatchContext *ctx, size_t nreads) {
+    struct AsyncRing *ring = lookup->ring;
+    int fd = lookup->db->flat.fd;
+    size_t next = 0;
+    size_t done = 0;
+    unsigned char *retry_buffer = NULL;
+    size_t retry_capacity = 0;
+    int rc = 0;
+
+    while (done < nreads) {
+        unsigned tail = *ring->sq_tail;
+        while (next < nreads && ring->free_count > 0) {
+            const AsyncRead *read = &lookup->reads[next++];
+            unsigned slot = ring->free_slots[--ring->free_count];
+            if (grow_buffer(&ring->buffers[slot], &ring->buffer_sizes[slot], read->length) != 0) {
+                ctx->results[read->index] = ASYNC_RESULT_ERROR;
+                atomic_store(&ctx->failed, 1);
+                ring->free_slots[ring->free_count++] = slot;
+                done++;
+                continue;
+            }
+            ring->slot_read[slot] = next - 1;
+
+            struct io_uring_sqe *sqe = &ring->sqes[tail & ring->sq_mask];
+            memset(sqe, 0, sizeof(*sqe));
+            sqe->opcode = IORING_OP_READ;
+            sqe->fd = fd;
+            sqe->addr = (uint64_t)(uintptr_t)ring->buffers[slot];
+            sqe->len = read->length;
+            sqe->off = read->offset;
+            sqe->user_data = slot;
+            ring->sq_array[tail & ring->sq_mask] = tail & ring->sq_mask;
+            tail++;
+        }
+        __atomic_store_n(ring->sq_tail, tail, __ATOMIC_RELEASE);
+
+        unsigned in_flight = ring->entries - ring->free_count;
+        if (in_flight == 0) {
+            continue; // Everything left failed before submission
+        }
+        unsigned to_submit = tail - __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE);
+        if (syscall(__NR_io_uring_enter, ring->fd, to_submit, 1, IORING_ENTER_GETEVENTS, NULL, 0) < 0) {
+            if (errno == EINTR || errno == EAGAIN || errno == EBUSY) {
+                continue;
+            }
+            rc = -1;
+            break;
+        }
+
+        unsigned head = *ring->cq_head;
+        unsigned cq_tail = __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE);
+        for (; head != cq_tail; head++) {
+            const struct io_uring_cqe *cqe = &ring->cqes[head & ring->cq_mask];
+            unsigned slot = (unsigned)cqe->user_data;
+            const AsyncRead *read = &lookup->reads[ring->slot_read[slot]];
+            if (cqe->res == (int32_t)read->length) {
+                ctx->results[read->index] = resolve_records(&lookup->db->flat, ring->buffers[slot], read->length,
+                                                            ctx->hashes[read->index]);
+            } else {
+                serve_read_pread(lookup, ctx, read, &retry_buffer, &retry_capacity);
+                ring->retries++;
+            }
+            ring->slot_read[slot] = SIZE_MAX;
+            ring->free_slots[ring->free_count++] = slot;
+            done++;
+        }
+        __atomic_store_n(ring->cq_head, head, __ATOMIC_RELEASE);
+    }
+    free(retry_buffer);
+
+    // Reads still in flight or never queued are reported as errors
+    if (rc != 0) {
+        for (unsigned slot = 0; slot < ring->entries; slot++) {
+            if (ring->slot_read[slot] != SIZE_MAX) {
+                ctx->results[lookup->reads[ring->slot_read[slot]].index] = ASYNC_RESULT_ERROR;
+            }
+        }
+        for (size_t i = next; i < nreads; i++) {
+            ctx->results[lookup->reads[i].index] = ASYNC_RESULT_ERROR;
+        }
+        atomic_store(&ctx->failed, 1);
+    }
+    return rc;
+}
+
+#endif // __linux__
+
+/**
+ * Prepares a batched lookup handle.
+ *
+ * With ASYNC_ENGINE_AUTO the io_uring engine is tried first and proven with a
+ * read of the store header; kernels without io_uring, or sandboxes that forbid
+ * it, get the pread pool instead. Stores that are not flat (SQLite, packed)
+ * always use plain lookup_hash().
+ *
+ * Parameters:
+ * - lookup (AsyncLookup*): Handle to initialize.
+ * - db (PwnedDB*): An initialized database; must outlive the handle.
+ * - engine (AsyncEngine): Requested engine.
+ * - depth (unsigned): Reads in flight; 0 for ASYNC_DEFAULT_DEPTH.
+ *
+ * Returns:
+ * - int: 0 on success, 1 if the requested engine could not be started.
+ */
+int async_lookup_init(AsyncLookup *lookup, PwnedDB *db, AsyncEngine engine, unsigned depth) {
+    memset(lookup, 0, sizeof(*lookup));
+    lookup->db = db;
+    lookup->depth = depth ? depth : ASYNC_DEFAULT_DEPTH;
+    if (db->backend != DB_BACKEND_FLAT || db->has_mphf) {
+        lookup->engine = ASYNC_ENGINE_SYNC; // An indexed lookup is one slot read, with nothing to overlap
+        return 0;
+    }
+    if (db->has_checks) {
+        lookup->engine = ASYNC_ENGINE_SYNC; // Checked blocks are read through the mapping, where they were verified
+        return 0;
+    }
+    if (engine == ASYNC_ENGINE_SYNC) {
+        lookup->engine = ASYNC_ENGINE_SYNC;
+        return 0;
+    }
+
+#ifdef __linux__
+    if (engine == ASYNC_ENGINE_AUTO || engine == ASYNC_ENGINE_IO_URING) {
+        lookup->ring = ring_open(lookup->depth);
+        if (lookup->ring != NULL) {
+            // Prove the ring can read this file before trusting it with real lookups
+            int32_t probe_result = 0;
+            const unsigned char probe_hash[SHA_DIGEST_LENGTH] = {0};
+            BatchContext probe = {&probe_hash, &probe_result, 0};
+            AsyncRead header_read = {0, 0, FLAT_HEADER_SIZE};
+            lookup->reads = &header_read;
+            int ok = ring_run(lookup, &probe, 1) == 0 && !atomic_load(&probe.failed) &&
+                     lookup->ring->retries == 0;
+            lookup->reads = NULL;
+            if (ok) {
+                lookup->engine = ASYNC_ENGINE_IO_URING;
+                return 0;
+            }
+            ring_close(lookup->ring);
+            lookup->ring = NULL;
+        }
+        if (engine == ASYNC_ENGINE_IO_URING) {
+            fprintf(stderr, "io_uring is not available on this system\n");
+            return 1;
+        }
+    }
+#else
+    if (engine == ASYNC_ENGINE_IO_URING) {
+        fprintf(stderr, "io_uring is only available on Linux\n");
+        return 1;
+    }
+#endif
+
+    lookup->pool = pool_start(lookup, lookup->depth);
+    if (lookup->pool == NULL) {
+        fprintf(stderr, "Failed to start the pread lookup threads\n");
+        return 1;
+    }
+    lookup->engine = ASYNC_ENGINE_PREAD;
+    return 0;
+}
+
+/**
+ * Looks up a batch of hashes, overlapping the base-store reads.
+ *
+ * Every hash is first run past the delta segments and the filter. The rest get
+ * their candidate record range from flat_candidate_range(), which is one read
+ * of under 1 KB with the learned index, and all of those reads are issued
+ * together through the engine.
+ *
+ * Parameters:
+ * - lookup (AsyncLookup*): Handle from async_lookup_init().
+ * - hashes (const unsigned char (*)[20]): Binary hashes of the store's kind; an NTLM hash
+ *   fills the first 16 bytes of its slot.
+ * - n (size_t): Number of digests.
+ * - results (int32_t*): Receives the count for each digest, 0 when absent, or
+ *   ASYNC_RESULT_ERROR.
+ *
+ * Returns:
+ * - int: 0 if every lookup was answered, -1 if any failed.
+ */
+int async_lookup_batch(AsyncLookup *lookup, const unsigned char (*hashes)[SHA_DIGEST_LENGTH], size_t n,
+                       int32_t *results) {
+    PwnedDB *db = lookup->db;
+    BatchContext ctx = {hashes, results, 0};
+
+    if (lookup->engine == ASYNC_ENGINE_SYNC) {
+        for (size_t i = 0; i < n; i++) {
+            int count = 0;
+            int found = lookup_hash(db, hashes[i], &count);
+            results[i] = found < 0 ? ASYNC_RESULT_ERROR : (found ? count : 0);
+            if (found < 0) {
+                atomic_store(&ctx.failed, 1);
+            }
+        }
+        return atomic_load(&ctx.failed) ? -1 : 0;
+    }
+
+    if (n > lookup->read_capacity) {
+        AsyncRead *grown = realloc(lookup->reads, n * sizeof(AsyncRead));
+        if (grown == NULL) {
+            return -1;
+        }
+        lookup->reads = grown;
+        lookup->read_capacity = n;
+    }
+
+    LookupBatchTally tally = {n, 0, 0, 0, 0, 0};
+    int measured = lookup_stats_active() != 0;
+    uint64_t start = measured ? lookup_stats_now_ns() : 0;
+
+    size_t nreads = 0;
+    for (size_t i = 0; i < n; i++) {
+        int count = 0;
+        LookupSource source;
+        int overlay = lookup_overlay_source(db, hashes[i], &count, &source);
+        if (overlay != LOOKUP_NEEDS_BASE) {
+            results[i] = overlay ? count : 0;
+            tally.filter_rejects += source == LOOKUP_FROM_FILTER;
+            tally.delta_hits += source == LOOKUP_FROM_DELTA;
+            tally.hot_hits += source == LOOKUP_FROM_HOT;
+            continue;
+        }
+        uint64_t begin, end;
+        flat_candidate_range(&db->flat, hashes[i], &begin, &end);
+        if (begin == end) {
+            results[i] = 0;
+            continue;
+        }
+        AsyncRead *read = &lookup->reads[nreads++];
+        read->index = i;
+        read->offset = db->flat.header->records_offset + begin * db->flat.record_size;
+        read->length = (uint32_t)((end - begin) * db->flat.record_size);
+    }
+
+    if (nreads > 0) {
+#ifdef __linux__
+        if (lookup->engine == ASYNC_ENGINE_IO_URING) {
+            ring_run(lookup, &ctx, nreads);
+        } else
+#endif
+        pool_run(lookup->pool, &ctx, nreads);
+    }
+
+    // The engines bypass lookup_hash(), so --stats is fed from the results once the batch is done
+    if (measured) {
+        uint64_t elapsed = lookup_stats_now_ns() - start;
+        for (size_t i = 0; i < n; i++) {
+            tally.hits += results[i] > 0;
+            tally.errors += results[i] == ASYNC_RESULT_ERROR;
+        }
+        lookup_stats_record_batch(&tally, elapsed);
+    }
+    return atomic_load(&ctx.failed) ? -1 : 0;
+}
+
+void async_lookup_close(AsyncLookup *lookup) {
+#ifdef __linux__
+    if (lookup->ring != NULL) {
+        ring_close(lookup->ring);
+    }
+#endif
+    if (lookup->pool != NULL) {
+        pool_stop(lookup->pool);
+    }
+    free(lookup->reads);
+    memset(lookup, 0, sizeof(*lookup));
+}
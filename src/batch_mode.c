@@ -0,0 +1,455 @@
+#include "batch_mode.h"
+#include "ring_queue.h"
+#include "hex.h"
+#include "lookup_daemon.h"
+#include "ntlm.h"
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <time.h>
+#include <unistd.h>
+
+// Shared state of one pipeline run
+typedef struct {
+    PwnedDB *db;
+    const BatchOptions *options;
+    HashKind kind; // Of the store queried; the daemon serves SHA-1 only
+    FILE *input;
+    RingQueue hash_queue;
+    RingQueue lookup_queue;
+    RingQueue output_queue;
+    int hash_workers;
+    int lookup_workers;
+    atomic_int hash_remaining;
+    atomic_int lookup_remaining;
+    atomic_int failed;
+    atomic_int async_engine; // Engine the async lookup workers ended up with
+} Pipeline;
+
+// Sort key for the lookup stage: leading hash bytes plus the line they belong to
+typedef struct {
+    uint64_t prefix;
+    uint32_t line;
+} LookupKey;
+
+static Batch *batch_new(uint64_t seq) {
+    Batch *batch = malloc(sizeof(Batch));
+    if (batch == NULL) {
+        fprintf(stderr, "Memory allocation failed for batch!\n");
+        return NULL;
+    }
+    batch->seq = seq;
+    batch->n = 0;
+    batch->text_len = 0;
+    batch->text_capacity = BATCH_LINES * 16;
+    batch->text = malloc(batch->text_capacity);
+    if (batch->text == NULL) {
+        fprintf(stderr, "Memory allocation failed for batch!\n");
+        free(batch);
+        return NULL;
+    }
+    return batch;
+}
+
+// Wipes the batch before releasing it, since its text holds plaintext passwords
+static void batch_free(Batch *batch) {
+    memset(batch->text, 0, batch->text_capacity);
+    free(batch->text);
+    memset(batch, 0, sizeof(*batch));
+    free(batch);
+}
+
+static int batch_append(Batch *batch, const char *line, size_t len) {
+    if (batch->text_len + len > batch->text_capacity) {
+        size_t capacity = batch->text_capacity * 2;
+        while (capacity < batch->text_len + len) {
+            capacity *= 2;
+        }
+        // Grow by copying so the old buffer can be wiped rather than left behind by realloc
+        char *grown = malloc(capacity);
+        if (grown == NULL) {
+            fprintf(stderr, "Memory allocation failed for batch!\n");
+            return -1;
+        }
+        memcpy(grown, batch->text, batch->text_len);
+        memset(batch->text, 0, batch->text_capacity);
+        free(batch->text);
+        batch->text = grown;
+        batch->text_capacity = capacity;
+    }
+
+    memcpy(batch->text + batch->text_len, line, len);
+    batch->offsets[batch->n] = (uint32_t)batch->text_len;
+    batch->lengths[batch->n] = (uint32_t)len;
+    batch->text_len += len;
+    batch->n++;
+    return 0;
+}
+
+// Reader stage: splits the input into batches of lines
+static void *reader_stage(void *arg) {
+    Pipeline *pipeline = arg;
+    char *line = NULL;
+    size_t line_capacity = 0;
+    ssize_t len;
+    uint64_t seq = 0;
+    Batch *batch = NULL;
+
+    while ((len = getline(&line, &line_capacity, pipeline->input)) != -1) {
+        while (len > 0 && (line[len - 1] == '\n' || line[len - 1] == '\r')) {
+            len--;
+        }
+        if (batch == NULL && (batch = batch_new(seq++)) == NULL) {
+            atomic_store(&pipeline->failed, 1);
+            break;
+        }
+        if (batch_append(batch, line, (size_t)len) != 0) {
+            atomic_store(&pipeline->failed, 1);
+            break;
+        }
+        if (batch->n == BATCH_LINES) {
+            ring_queue_push(&pipeline->hash_queue, batch);
+            batch = NULL;
+        }
+    }
+    if (batch != NULL) {
+        ring_queue_push(&pipeline->hash_queue, batch);
+    }
+
+    if (line != NULL) {
+        memset(line, 0, line_capacity);
+        free(line);
+    }
+
+    // One end-of-input marker per hashing worker
+    for (int i = 0; i < pipeline->hash_workers; i++) {
+        ring_queue_push(&pipeline->hash_queue, NULL);
+    }
+    return NULL;
+}
+
+// Hash stage: turns each line into a binary hash of the store's kind
+static void *hash_stage(void *arg) {
+    Pipeline *pipeline = arg;
+    Batch *batch;
+    int hash_size = (int)hash_kind_size(pipeline->kind);
+
+    while ((batch = ring_queue_pop(&pipeline->hash_queue)) != NULL) {
+        memset(batch->counts, 0, batch->n * sizeof(batch->counts[0]));
+        if (pipeline->options->hashes) {
+            for (size_t i = 0; i < batch->n; i++) {
+                if (batch->lengths[i] != 2 * (uint32_t)hash_size ||
+                    hex_decode(batch->text + batch->offsets[i], batch->hashes[i], hash_size) != 0) {
+                    batch->counts[i] = BATCH_INVALID_LINE;
+                }
+            }
+        } else if (pipeline->kind == HASH_KIND_NTLM) {
+            for (size_t i = 0; i < batch->n; i++) {
+                ntlm_hash((const unsigned char *)batch->text + batch->offsets[i], batch->lengths[i], batch->hashes[i]);
+            }
+        } else {
+            // The whole batch in one call, so the kernel can hash many lines side by side
+            sha1_multi(pipeline->options->sha1_kernel, (const unsigned char *)batch->text,
+                       batch->offsets, batch->lengths, batch->n, batch->hashes);
+        }
+        ring_queue_push(&pipeline->lookup_queue, batch);
+    }
+
+    // The last hashing worker to finish tells every lookup worker
+    if (atomic_fetch_sub(&pipeline->hash_remaining, 1) == 1) {
+        for (int i = 0; i < pipeline->lookup_workers; i++) {
+            ring_queue_push(&pipeline->lookup_queue, NULL);
+        }
+    }
+    return NULL;
+}
+
+static int compare_lookup_keys(const void *a, const void *b) {
+    uint64_t x = ((const LookupKey *)a)->prefix;
+    uint64_t y = ((const LookupKey *)b)->prefix;
+    return (x > y) - (x < y);
+}
+
+// Hands the valid lines of a batch over in one call: one daemon request, or one async lookup batch
+static void lookup_bulk(Pipeline *pipeline, int fd, AsyncLookup *async, Batch *batch,
+                        unsigned char (*hashes)[SHA_DIGEST_LENGTH], int32_t *results) {
+    uint32_t lines[BATCH_LINES];
+    uint32_t n = 0;
+    for (size_t i = 0; i < batch->n; i++) {
+        if (batch->counts[i] != BATCH_INVALID_LINE) {
+            memcpy(hashes[n], batch->hashes[i], SHA_DIGEST_LENGTH);
+            lines[n++] = (uint32_t)i;
+        }
+    }
+
+    int rc;
+    int remote_failed = 0;
+    if (async != NULL) {
+        rc = async_lookup_batch(async, (const unsigned char (*)[SHA_DIGEST_LENGTH])hashes, n, results);
+    } else {
+        rc = fd >= 0 ? daemon_lookup(fd, (const unsigned char (*)[SHA_DIGEST_LENGTH])hashes, n, results) : -1;
+        remote_failed = rc != 0; // Nothing came back, so no result can be trusted
+    }
+    if (rc != 0) {
+        atomic_store(&pipeline->failed, 1);
+    }
+    for (uint32_t k = 0; k < n; k++) {
+        int32_t result = remote_failed ? DAEMON_RESULT_ERROR : results[k];
+        batch->counts[lines[k]] = result < 0 ? BATCH_LOOKUP_ERROR : result;
+    }
+}
+
+// Lookup stage: queries each batch in hash order so neighbouring lookups share pages
+static void *lookup_stage(void *arg) {
+    Pipeline *pipeline = arg;
+    const BatchOptions *options = pipeline->options;
+    LookupKey *keys = malloc(BATCH_LINES * sizeof(LookupKey));
+    Batch *batch;
+
+    // A daemon connection or an async lookup handle per worker; either way whole batches go at once
+    int fd = -1;
+    AsyncLookup async;
+    int use_async = 0;
+    unsigned char (*bulk_hashes)[SHA_DIGEST_LENGTH] = NULL;
+    int32_t *bulk_results = NULL;
+    int bulk = options->socket_path != NULL || options->async_io;
+    if (options->socket_path != NULL) {
+        fd = daemon_connect(options->socket_path);
+    } else if (options->async_io) {
+        if (async_lookup_init(&async, pipeline->db, options->async_engine, 0) == 0) {
+            use_async = 1;
+            atomic_store(&pipeline->async_engine, (int)async.engine);
+        } else {
+            free(keys);
+            keys = NULL;
+        }
+    }
+    if (bulk) {
+        bulk_hashes = malloc(BATCH_LINES * SHA_DIGEST_LENGTH);
+        bulk_results = malloc(BATCH_LINES * sizeof(int32_t));
+        if (bulk_hashes == NULL || bulk_results == NULL) {
+            free(keys);
+            keys = NULL;
+        }
+    }
+
+    while ((batch = ring_queue_pop(&pipeline->lookup_queue)) != NULL) {
+        if (keys != NULL && bulk) {
+            lookup_bulk(pipeline, fd, use_async ? &async : NULL, batch, bulk_hashes, bulk_results);
+            ring_queue_push(&pipeline->output_queue, batch);
+            continue;
+        }
+        if (keys == NULL) {
+            for (size_t i = 0; i < batch->n; i++) {
+                batch->counts[i] = BATCH_LOOKUP_ERROR;
+            }
+            ring_queue_push(&pipeline->output_queue, batch);
+            continue;
+        }
+
+        size_t nkeys = 0;
+        for (size_t i = 0; i < batch->n; i++) {
+            if (batch->counts[i] == BATCH_INVALID_LINE) {
+                continue;
+            }
+            uint64_t prefix = 0;
+            for (int b = 0; b < 8; b++) {
+                prefix = (prefix << 8) | batch->hashes[i][b];
+            }
+            keys[nkeys].prefix = prefix;
+            keys[nkeys].line = (uint32_t)i;
+            nkeys++;
+        }
+        qsort(keys, nkeys, sizeof(LookupKey), compare_lookup_keys);
+
+        for (size_t k = 0; k < nkeys; k++) {
+            uint32_t line = keys[k].line;
+            int count = 0;
+            int found = lookup_hash(pipeline->db, batch->hashes[line], &count);
+            batch->counts[line] = found < 0 ? BATCH_LOOKUP_ERROR : (found ? count : 0);
+            if (found < 0) {
+                atomic_store(&pipeline->failed, 1);
+            }
+        }
+        ring_queue_push(&pipeline->output_queue, batch);
+    }
+    free(keys);
+    free(bulk_hashes);
+    free(bulk_results);
+    if (fd >= 0) {
+        close(fd);
+    }
+    if (use_async) {
+        async_lookup_close(&async);
+    }
+
+    if (atomic_fetch_sub(&pipeline->lookup_remaining, 1) == 1) {
+        ring_queue_push(&pipeline->output_queue, NULL);
+    }
+    return NULL;
+}
+
+// Formats one batch as "HASH:COUNT" lines ("invalid" / "error" for failures) and writes it out
+static void write_batch(const Batch *batch, int hash_size, FILE *out) {
+    static char buffer[BATCH_LINES * 64];
+    size_t used = 0;
+
+    for (size_t i = 0; i < batch->n; i++) {
+        int32_t count = batch->counts[i];
+        if (count == BATCH_INVALID_LINE) {
+            memcpy(buffer + used, "invalid\n", 8);
+            used += 8;
+        } else if (count == BATCH_LOOKUP_ERROR) {
+            memcpy(buffer + used, "error\n", 6);
+            used += 6;
+        } else {
+            hex_encode(batch->hashes[i], hash_size, buffer + used);
+            used += 2 * (size_t)hash_size;
+            used += (size_t)snprintf(buffer + used, 16, ":%d\n", (int)count);
+        }
+    }
+    fwrite(buffer, 1, used, out);
+}
+
+// Starts one pipeline stage; a stage that can't start would leave the others waiting forever
+static void start_stage(pthread_t *thread, void *(*stage)(void *), Pipeline *pipeline, const char *name) {
+    if (pthread_create(thread, NULL, stage, pipeline) != 0) {
+        fprintf(stderr, "Failed to start %s thread; aborting.\n", name);
+        exit(1);
+    }
+}
+
+/**
+ * Checks every line of the input against the database without any prompts.
+ *
+ * The work is split into a pipeline of stages connected by bounded lock-free
+ * queues: one reader thread groups lines into batches, a pool of workers hash
+ * them, lookup workers query each batch sorted by hash so the store is read in
+ * order, and the calling thread writes results back in input order. Every input
+ * line produces exactly one output line on stdout. Passwords are hashed for the
+ * store's kind, SHA-1 or NTLM, and HASH is printed in that width:
+ *   HASH:COUNT   (COUNT is 0 when the hash is not in the database)
+ *   invalid      (--hashes mode, line is not a hex hash of the store's kind)
+ *   error        (the lookup itself failed)
+ *
+ * Parameters:
+ * - db (PwnedDB*): An initialized database handle.
+ * - options (const BatchOptions*): Input source, input kind and thread count.
+ *
+ * Returns:
+ * - int: 0 on success, 1 if the input cannot be read or the pipeline fails.
+ *
+ * Note:
+ * - The SQLite backend is queried from a single lookup worker, since one connection
+ *   serializes its callers anyway; the flat store is read by one lookup worker per
+ *   hashing worker.
+ * - With options->socket_path set, db is not used: each lookup worker holds one
+ *   daemon connection and sends every batch as a single request.
+ * - With options->async_io set, each lookup worker owns an AsyncLookup handle and
+ *   issues the base-store reads of a whole batch at once (io_uring or a pread pool).
+ */
+int run_batch(PwnedDB *db, const BatchOptions *options) {
+    Pipeline pipeline;
+    memset(&pipeline, 0, sizeof(pipeline));
+    pipeline.db = db;
+    pipeline.options = options;
+    pipeline.kind = db != NULL ? db->kind : HASH_KIND_SHA1;
+
+    pipeline.input = options->input_path ? fopen(options->input_path, "r") : stdin;
+    if (pipeline.input == NULL) {
+        fprintf(stderr, "Could not open batch input: %s\n", options->input_path);
+        return 1;
+    }
+
+    int threads = options->threads;
+    if (threads <= 0) {
+        long cores = sysconf(_SC_NPROCESSORS_ONLN);
+        threads = cores > 0 ? (int)cores : 1;
+    }
+    pipeline.hash_workers = threads;
+    pipeline.lookup_workers = db != NULL && !db_thread_safe(db) ? 1 : threads;
+    atomic_init(&pipeline.hash_remaining, pipeline.hash_workers);
+    atomic_init(&pipeline.lookup_remaining, pipeline.lookup_workers);
+    atomic_init(&pipeline.failed, 0);
+    atomic_init(&pipeline.async_engine, (int)options->async_engine);
+
+    if (ring_queue_init(&pipeline.hash_queue, BATCH_QUEUE_DEPTH) != 0 ||
+        ring_queue_init(&pipeline.lookup_queue, BATCH_QUEUE_DEPTH) != 0 ||
+        ring_queue_init(&pipeline.output_queue, BATCH_QUEUE_DEPTH) != 0) {
+        return 1;
+    }
+
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    // Batches in flight: every queue full plus one held by each thread
+    int nthreads = 1 + pipeline.hash_workers + pipeline.lookup_workers;
+    pthread_t *stage_threads = calloc((size_t)nthreads, sizeof(pthread_t));
+    Batch **pending = calloc(3 * BATCH_QUEUE_DEPTH + (size_t)nthreads + 1, sizeof(Batch *));
+    if (stage_threads == NULL || pending == NULL) {
+        fprintf(stderr, "Memory allocation failed for batch pipeline!\n");
+        free(stage_threads);
+        free(pending);
+        return 1;
+    }
+
+    int t = 0;
+    start_stage(&stage_threads[t++], reader_stage, &pipeline, "reader");
+    for (int i = 0; i < pipeline.hash_workers; i++) {
+        start_stage(&stage_threads[t++], hash_stage, &pipeline, "hashing");
+    }
+    for (int i = 0; i < pipeline.lookup_workers; i++) {
+        start_stage(&stage_threads[t++], lookup_stage, &pipeline, "lookup");
+    }
+
+    // Output stage: batches finish out of order, so hold them until their turn
+    size_t npending = 0;
+    uint64_t next_seq = 0;
+    uint64_t lines = 0;
+    Batch *batch;
+    while ((batch = ring_queue_pop(&pipeline.output_queue)) != NULL) {
+        pending[npending++] = batch;
+        for (size_t i = 0; i < npending;) {
+            if (pending[i]->seq == next_seq) {
+                write_batch(pending[i], (int)hash_kind_size(pipeline.kind), stdout);
+                lines += pending[i]->n;
+                batch_free(pending[i]);
+                pending[i] = pending[--npending];
+                next_seq++;
+                i = 0;
+            } else {
+                i++;
+            }
+        }
+    }
+    fflush(stdout);
+
+    for (int i = 0; i < nthreads; i++) {
+        pthread_join(stage_threads[i], NULL);
+    }
+    free(stage_threads);
+    free(pending);
+
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    double seconds = (double)(end.tv_sec - start.tv_sec) + (double)(end.tv_nsec - start.tv_nsec) / 1e9;
+    fprintf(stderr, "Checked %llu lines in %.2f s (%.0f lines/s)",
+            (unsigned long long)lines, seconds, seconds > 0 ? (double)lines / seconds : 0.0);
+    if (options->async_io) {
+        fprintf(stderr, ", %s reads", async_engine_name((AsyncEngine)atomic_load(&pipeline.async_engine)));
+    }
+    if (!options->hashes && pipeline.kind == HASH_KIND_NTLM) {
+        fprintf(stderr, ", NTLM");
+    } else if (!options->hashes) {
+        Sha1Kernel kernel = sha1_kernel_supported(options->sha1_kernel) ? options->sha1_kernel : SHA1_KERNEL_AUTO;
+        fprintf(stderr, ", %s SHA-1", sha1_kernel_name(kernel == SHA1_KERNEL_AUTO ? sha1_kernel_best() : kernel));
+    }
+    fputc('\n', stderr);
+
+    ring_queue_destroy(&pipeline.hash_queue);
+    ring_queue_destroy(&pipeline.lookup_queue);
+    ring_queue_destroy(&pipeline.output_queue);
+    if (options->input_path) {
+        fclose(pipeline.input);
+    }
+    return atomic_load(&pipeline.failed) ? 1 : 0;
+}
@@ -0,0 +1,374 @@
+#include "block_checksum.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <xxhash.h>
+
+_Static_assert(sizeof(ChecksumHeader) == 64, "ChecksumHeader must match its on-disk size");
+
+#define CHECKSUM_MIN_SHIFT 12
+#define CHECKSUM_MAX_SHIFT 30
+#define CHECKSUM_REPORT_LIMIT 10  // Damaged blocks listed by checksum_verify() before it only counts them
+
+static uint64_t block_count_for(uint64_t file_size, unsigned shift) {
+    return (file_size + ((uint64_t)1 << shift) - 1) >> shift;
+}
+
+// Checksum of block b; the last block covers only what is left of the file
+static uint64_t block_sum(const unsigned char *data, uint64_t size, unsigned shift, uint64_t b) {
+    uint64_t start = b << shift;
+    uint64_t length = size - start < ((uint64_t)1 << shift) ? size - start : (uint64_t)1 << shift;
+    return XXH3_64bits(data + start, (size_t)length);
+}
+
+// One file being hashed by several threads, each claiming CHECKSUM_CHUNK_BLOCKS blocks at a time
+typedef struct {
+    const unsigned char *data;
+    uint64_t size;
+    unsigned shift;
+    uint64_t block_count;
+    uint64_t *sums;
+    atomic_uint_fast64_t next;
+} HashJob;
+
+static void *hash_worker(void *arg) {
+    HashJob *job = arg;
+    for (;;) {
+        uint64_t first = atomic_fetch_add(&job->next, CHECKSUM_CHUNK_BLOCKS);
+        if (first >= job->block_count) {
+            break;
+        }
+        uint64_t last = first + CHECKSUM_CHUNK_BLOCKS < job->block_count ? first + CHECKSUM_CHUNK_BLOCKS : job->block_count;
+        for (uint64_t b = first; b < last; b++) {
+            job->sums[b] = block_sum(job->data, job->size, job->shift, b);
+        }
+    }
+    return NULL;
+}
+
+// Fills sums with the checksum of every block; the calling thread works as one of the threads
+static void hash_blocks(const unsigned char *data, uint64_t size, unsigned shift, uint64_t *sums, int threads) {
+    HashJob job = {data, size, shift, block_count_for(size, shift), sums, 0};
+    if (threads <= 0) {
+        long cores = sysconf(_SC_NPROCESSORS_ONLN);
+        threads = cores > 0 ? (int)cores : 1;
+    }
+    uint64_t chunks = (job.block_count + CHECKSUM_CHUNK_BLOCKS - 1) / CHECKSUM_CHUNK_BLOCKS;
+    if ((uint64_t)threads > chunks) {
+        threads = chunks > 0 ? (int)chunks : 1;
+    }
+
+    pthread_t *workers = threads > 1 ? malloc((size_t)(threads - 1) * sizeof(pthread_t)) : NULL;
+    int started = 0;
+    for (int t = 0; workers != NULL && t < threads - 1; t++) {
+        if (pthread_create(&workers[t], NULL, hash_worker, &job) != 0) {
+            break; // The threads already running, and this one, still cover every block
+        }
+        started++;
+    }
+    hash_worker(&job);
+    for (int t = 0; t < started; t++) {
+        pthread_join(workers[t], NULL);
+    }
+    free(workers);
+}
+
+// Maps a whole file read-only for one sequential pass; an empty file maps to NULL
+static int map_file(const char *path, const unsigned char **data, uint64_t *size) {
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        fprintf(stderr, "Can't open %s: %s\n", path, strerror(errno));
+        return -1;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        fprintf(stderr, "Can't stat %s: %s\n", path, strerror(errno));
+        close(fd);
+        return -1;
+    }
+    *size = (uint64_t)st.st_size;
+    *data = NULL;
+    if (*size > 0) {
+        void *map = mmap(NULL, (size_t)*size, PROT_READ, MAP_SHARED, fd, 0);
+        if (map == MAP_FAILED) {
+            fprintf(stderr, "Can't map %s: %s\n", path, strerror(errno));
+            close(fd);
+            return -1;
+        }
+        madvise(map, (size_t)*size, MADV_SEQUENTIAL);
+        *data = map;
+    }
+    close(fd);
+    return 0;
+}
+
+static void manifest_path(char *out, size_t size, const char *path) {
+    snprintf(out, size, "%s%s", path, CHECKSUM_FILE_SUFFIX);
+}
+
+/**
+ * Writes the checksum manifest of a file.
+ *
+ * The file is cut into blocks of 1 << CHECKSUM_BLOCK_SHIFT bytes and each block
+ * gets its own XXH3 checksum, so a damaged file can be located block by block
+ * and a lookup can check just the blocks it reads. Worker threads hash chunks
+ * of blocks in parallel. The manifest is written under a temporary name and
+ * renamed into place.
+ *
+ * Parameters:
+ * - path (const char*): The store file to cover; the manifest goes to "<path>.xxh".
+ * - threads (int): Hashing threads; 0 or less for one per core.
+ *
+ * Returns:
+ * - int: 0 on success, 1 on failure.
+ */
+int checksum_write(const char *path, int threads) {
+    const unsigned char *data;
+    uint64_t size;
+    if (map_file(path, &data, &size) != 0) {
+        return 1;
+    }
+    ChecksumHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, CHECKSUM_MAGIC, CHECKSUM_MAGIC_SIZE);
+    header.version = CHECKSUM_VERSION;
+    header.block_shift = CHECKSUM_BLOCK_SHIFT;
+    header.file_size = size;
+    header.block_count = block_count_for(size, CHECKSUM_BLOCK_SHIFT);
+
+    uint64_t *sums = malloc(header.block_count ? header.block_count * sizeof(uint64_t) : 1);
+    if (sums == NULL) {
+        fprintf(stderr, "Memory allocation failed for %llu checksums!\n", (unsigned long long)header.block_count);
+        if (data != NULL) {
+            munmap((void *)data, (size_t)size);
+        }
+        return 1;
+    }
+    hash_blocks(data, size, CHECKSUM_BLOCK_SHIFT, sums, threads);
+    if (data != NULL) {
+        munmap((void *)data, (size_t)size);
+    }
+    header.table_hash = XXH3_64bits(sums, header.block_count * sizeof(uint64_t));
+
+    char final_path[4096], tmp_path[4096 + 4];
+    manifest_path(final_path, sizeof(final_path), path);
+    snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", final_path);
+    FILE *file = fopen(tmp_path, "wb");
+    if (file == NULL) {
+        fprintf(stderr, "Can't create checksum file %s: %s\n", tmp_path, strerror(errno));
+        free(sums);
+        return 1;
+    }
+    int ok = fwrite(&header, sizeof(header), 1, file) == 1 &&
+             fwrite(sums, sizeof(uint64_t), header.block_count, file) == header.block_count;
+    ok = fclose(file) == 0 && ok;
+    free(sums);
+    if (!ok || rename(tmp_path, final_path) != 0) {
+        fprintf(stderr, "Failed to write checksum file %s\n", final_path);
+        remove(tmp_path);
+        return 1;
+    }
+    return 0;
+}
+
+int checksum_open(ChecksumManifest *manifest, const char *path, uint64_t file_size) {
+    memset(manifest, 0, sizeof(*manifest));
+
+    char sums_path[4096];
+    manifest_path(sums_path, sizeof(sums_path), path);
+    int fd = open(sums_path, O_RDONLY);
+    if (fd < 0) {
+        return -1;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(ChecksumHeader)) {
+        fprintf(stderr, "Checksum file is truncated: %s\n", sums_path);
+        close(fd);
+        return -1;
+    }
+    void *map = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        fprintf(stderr, "Can't map checksum file: %s\n", sums_path);
+        return -1;
+    }
+
+    const ChecksumHeader *header = map;
+    const uint64_t *sums = (const uint64_t *)((const unsigned char *)map + sizeof(ChecksumHeader));
+    if (memcmp(header->magic, CHECKSUM_MAGIC, CHECKSUM_MAGIC_SIZE) != 0 ||
+        header->version != CHECKSUM_VERSION ||
+        header->block_shift < CHECKSUM_MIN_SHIFT || header->block_shift > CHECKSUM_MAX_SHIFT ||
+        header->block_count != block_count_for(header->file_size, header->block_shift) ||
+        sizeof(ChecksumHeader) + header->block_count * sizeof(uint64_t) != (uint64_t)st.st_size ||
+        XXH3_64bits(sums, header->block_count * sizeof(uint64_t)) != header->table_hash) {
+        fprintf(stderr, "Checksum file is invalid: %s\n", sums_path);
+        munmap(map, (size_t)st.st_size);
+        return -1;
+    }
+    if (header->file_size != file_size) {
+        fprintf(stderr, "%s is %llu bytes, but its checksums cover %llu: the file is truncated or was replaced\n",
+                path, (unsigned long long)file_size, (unsigned long long)header->file_size);
+        munmap(map, (size_t)st.st_size);
+        return -1;
+    }
+
+    manifest->map = map;
+    manifest->map_size = (size_t)st.st_size;
+    manifest->header = header;
+    manifest->sums = sums;
+    return 0;
+}
+
+void checksum_close(ChecksumManifest *manifest) {
+    if (manifest->map != NULL) {
+        munmap((void *)manifest->map, manifest->map_size);
+    }
+    memset(manifest, 0, sizeof(*manifest));
+}
+
+/**
+ * Checks a whole file against its manifest.
+ *
+ * Every block is hashed in parallel, as when the manifest was written, and
+ * compared with its recorded checksum; the first CHECKSUM_REPORT_LIMIT damaged
+ * blocks are listed with their byte ranges. A file whose size no longer matches
+ * the manifest counts as damaged.
+ *
+ * Parameters:
+ * - path (const char*): The store file; its manifest is "<path>.xxh".
+ * - threads (int): Hashing threads; 0 or less for one per core.
+ * - bytes_checked (uint64_t*): Receives the number of bytes hashed.
+ *
+ * Returns:
+ * - int: 0 if every block matches, 1 if the file is damaged, -1 if it has no manifest or cannot be read.
+ */
+int checksum_verify(const char *path, int threads, uint64_t *bytes_checked) {
+    *bytes_checked = 0;
+    char sums_path[4096];
+    manifest_path(sums_path, sizeof(sums_path), path);
+    if (access(sums_path, F_OK) != 0) {
+        fprintf(stderr, "%s has no checksums; build them with \"create_database --checksums\"\n", path);
+        return -1;
+    }
+    const unsigned char *data;
+    uint64_t size;
+    if (map_file(path, &data, &size) != 0) {
+        return -1;
+    }
+    ChecksumManifest manifest;
+    if (checksum_open(&manifest, path, size) != 0) {
+        if (data != NULL) {
+            munmap((void *)data, (size_t)size);
+        }
+        return 1;
+    }
+
+    unsigned shift = manifest.header->block_shift;
+    uint64_t block_count = manifest.header->block_count;
+    uint64_t *sums = malloc(block_count ? block_count * sizeof(uint64_t) : 1);
+    if (sums == NULL) {
+        fprintf(stderr, "Memory allocation failed for %llu checksums!\n", (unsigned long long)block_count);
+        checksum_close(&manifest);
+        if (data != NULL) {
+            munmap((void *)data, (size_t)size);
+        }
+        return -1;
+    }
+    hash_blocks(data, size, shift, sums, threads);
+    *bytes_checked = size;
+
+    uint64_t damaged = 0;
+    for (uint64_t b = 0; b < block_count; b++) {
+        if (sums[b] == manifest.sums[b]) {
+            continue;
+        }
+        if (damaged++ < CHECKSUM_REPORT_LIMIT) {
+            uint64_t start = b << shift;
+            uint64_t end = start + ((uint64_t)1 << shift) < size ? start + ((uint64_t)1 << shift) : size;
+            fprintf(stderr, "%s: block %llu (bytes %llu-%llu) does not match its checksum\n", path,
+                    (unsigned long long)b, (unsigned long long)start, (unsigned long long)end - 1);
+        }
+    }
+    if (damaged > CHECKSUM_REPORT_LIMIT) {
+        fprintf(stderr, "%s: %llu damaged blocks in all\n", path, (unsigned long long)damaged);
+    }
+    free(sums);
+    checksum_close(&manifest);
+    if (data != NULL) {
+        munmap((void *)data, (size_t)size);
+    }
+    return damaged > 0;
+}
+
+int block_checker_open(BlockChecker *checker, const char *path, const unsigned char *data, size_t size) {
+    memset(checker, 0, sizeof(*checker));
+    if (checksum_open(&checker->manifest, path, size) != 0) {
+        return -1;
+    }
+    uint64_t words = (checker->manifest.header->block_count + 63) / 64;
+    checker->verified = calloc(words ? words : 1, sizeof(atomic_uint_fast64_t));
+    checker->path = strdup(path);
+    if (checker->verified == NULL || checker->path == NULL) {
+        fprintf(stderr, "Memory allocation failed for block checks of %s!\n", path);
+        block_checker_close(checker);
+        return -1;
+    }
+    checker->data = data;
+    atomic_init(&checker->reported, 0);
+    return 0;
+}
+
+/**
+ * Verifies the blocks a read is about to touch.
+ *
+ * Blocks already verified cost one bit test each. Any other block is hashed
+ * and compared with the manifest; a match sets its bit for every later
+ * lookup, from any thread. Two threads may hash the same new block at once,
+ * which is harmless.
+ *
+ * Parameters:
+ * - checker (BlockChecker*): An open checker.
+ * - offset, length (uint64_t): The byte range of the file about to be read.
+ *
+ * Returns:
+ * - int: 0 if every block in the range is intact, -1 if one is damaged.
+ */
+int block_checker_check(BlockChecker *checker, uint64_t offset, uint64_t length) {
+    const ChecksumHeader *header = checker->manifest.header;
+    if (length == 0 || offset >= header->file_size) {
+        return 0;
+    }
+    uint64_t first = offset >> header->block_shift;
+    uint64_t last = (offset + length - 1) >> header->block_shift;
+    if (last >= header->block_count) {
+        last = header->block_count - 1;
+    }
+    for (uint64_t b = first; b <= last; b++) {
+        uint_fast64_t bit = (uint_fast64_t)1 << (b & 63);
+        if (atomic_load_explicit(&checker->verified[b >> 6], memory_order_relaxed) & bit) {
+            continue;
+        }
+        if (block_sum(checker->data, header->file_size, header->block_shift, b) != checker->manifest.sums[b]) {
+            if (!atomic_exchange(&checker->reported, 1)) {
+                fprintf(stderr, "Block %llu of %s does not match its checksum; the store is damaged\n",
+                        (unsigned long long)b, checker->path);
+            }
+            return -1;
+        }
+        atomic_fetch_or_explicit(&checker->verified[b >> 6], bit, memory_order_relaxed);
+    }
+    return 0;
+}
+
+void block_checker_close(BlockChecker *checker) {
+    checksum_close(&checker->manifest);
+    free(checker->verified);
+    free(checker->path);
+    memset(checker, 0, sizeof(*checker));
+}
@@ -1,84 +1,709 @@
 #include "deep_check.h"
+#include "lookup_stats.h"
+
+#include <sys/resource.h>
+
+// Set by db_enable_block_checks() before the databases are opened
+static int block_checks_enabled = 0;
+
+void db_enable_block_checks(int enable) {
+    block_checks_enabled = enable;
+}
+
+// Tunes a fresh read-only connection and prepares the statements every lookup reuses
+static int prepare_sqlite(PwnedDB *db) {
+    char pragmas[256];
+    snprintf(pragmas, sizeof(pragmas),
+             "PRAGMA query_only=ON;"
+             "PRAGMA mmap_size=%lld;"
+             "PRAGMA cache_size=-%d;"
+             "PRAGMA temp_store=MEMORY;",
+             SQLITE_LOOKUP_MMAP_SIZE, SQLITE_LOOKUP_CACHE_KIB);
+    char *err_msg = 0;
+    sqlite3_busy_timeout(db->sqlite, SQLITE_LOOKUP_BUSY_MS); // Wait out a compaction's commit
+    if (sqlite3_exec(db->sqlite, pragmas, NULL, NULL, &err_msg) != SQLITE_OK) {
+        fprintf(stderr, "Failed to configure database: %s\n", err_msg);
+        sqlite3_free(err_msg);
+        return -1;
+    }
+
+    const char *sql_lookup = "SELECT count FROM pwned_passwords WHERE full_hash = ?";
+    const char *sql_range = "SELECT full_hash, count FROM pwned_passwords "
+                            "WHERE full_hash >= ?1 AND full_hash < ?2 ORDER BY full_hash";
+    if (sqlite3_prepare_v3(db->sqlite, sql_lookup, -1, SQLITE_PREPARE_PERSISTENT, &db->lookup_stmt, NULL) != SQLITE_OK ||
+        sqlite3_prepare_v3(db->sqlite, sql_range, -1, SQLITE_PREPARE_PERSISTENT, &db->range_stmt, NULL) != SQLITE_OK) {
+        fprintf(stderr, "Failed to prepare statement: %s\n", sqlite3_errmsg(db->sqlite));
+        return -1;
+    }
+
+    // An empty table is taken for SHA-1, the dataset every older database holds
+    db->kind = HASH_KIND_SHA1;
+    return sqlite_hash_kind(db->sqlite, &db->kind) < 0 ? -1 : 0;
+}
+
+int sqlite_hash_kind(sqlite3 *sqlite, HashKind *kind) {
+    sqlite3_stmt *stmt;
+    if (sqlite3_prepare_v2(sqlite, "SELECT length(full_hash) FROM pwned_passwords LIMIT 1", -1, &stmt,
+                           NULL) != SQLITE_OK) {
+        fprintf(stderr, "Failed to prepare statement: %s\n", sqlite3_errmsg(sqlite));
+        return -1;
+    }
+    int rc = sqlite3_step(stmt);
+    int found = rc == SQLITE_ROW;
+    if (found) {
+        *kind = sqlite3_column_int(stmt, 0) == NTLM_HASH_SIZE ? HASH_KIND_NTLM : HASH_KIND_SHA1;
+    } else if (rc != SQLITE_DONE) {
+        fprintf(stderr, "Failed to query database: %s\n", sqlite3_errmsg(sqlite));
+        found = -1;
+    }
+    sqlite3_finalize(stmt);
+    return found;
+}
+
+// Every shard keeps a descriptor open, so make the whole hard limit available before opening them
+static int raise_descriptor_limit(uint32_t shard_count) {
+    struct rlimit limit;
+    if (getrlimit(RLIMIT_NOFILE, &limit) != 0) {
+        return 0; // Let the opens themselves report any shortage
+    }
+    if (limit.rlim_cur < limit.rlim_max) {
+        limit.rlim_cur = limit.rlim_max;
+        setrlimit(RLIMIT_NOFILE, &limit);
+        getrlimit(RLIMIT_NOFILE, &limit);
+    }
+    if (limit.rlim_cur != RLIM_INFINITY && limit.rlim_cur < (rlim_t)shard_count + 64) {
+        fprintf(stderr, "%u shards need more open files than the limit of %llu allows (see ulimit -n)\n",
+                shard_count, (unsigned long long)limit.rlim_cur);
+        return -1;
+    }
+    return 0;
+}
+
+// Opens every shard named by the manifest at db_path; a shard cannot itself be sharded
+static int open_shards(PwnedDB *db, const char *db_path) {
+    ShardHeader header;
+    if (shard_read_header(db_path, &header) != 0) {
+        return 1;
+    }
+    uint32_t shard_count = (uint32_t)1 << header.shard_bits;
+    db->shards = calloc(shard_count, sizeof(PwnedDB));
+    if (db->shards == NULL) {
+        fprintf(stderr, "Memory allocation failed for %u shards!\n", shard_count);
+        return 1;
+    }
+    db->shard_bits = header.shard_bits;
+    if (raise_descriptor_limit(shard_count) != 0) {
+        free(db->shards);
+        db->shards = NULL;
+        return 1;
+    }
+
+    char path[4096];
+    for (uint32_t i = 0; i < shard_count; i++) {
+        shard_path(path, sizeof(path), db_path, i, header.shard_bits);
+        if (shard_is_store(path) || init_db(&db->shards[i], path) != 0) {
+            fprintf(stderr, "Can't open shard %u of %s\n", i, db_path);
+            for (uint32_t j = 0; j < i; j++) {
+                close_db(&db->shards[j]);
+            }
+            free(db->shards);
+            db->shards = NULL;
+            return 1;
+        }
+        if (db->shards[i].kind != db->shards[0].kind) {
+            fprintf(stderr, "Shard %u of %s holds %s hashes, shard 0 %s hashes\n", i, db_path,
+                    hash_kind_name(db->shards[i].kind), hash_kind_name(db->shards[0].kind));
+            for (uint32_t j = 0; j <= i; j++) {
+                close_db(&db->shards[j]);
+            }
+            free(db->shards);
+            db->shards = NULL;
+            return 1;
+        }
+    }
+    db->kind = db->shards[0].kind;
+    return 0;
+}
+
+// Checks a whole delta segment at open; segments are small next to the base
+static int check_delta_blocks(const FlatStore *delta, const char *path) {
+    BlockChecker checker;
+    if (block_checker_open(&checker, path, delta->map, delta->map_size) != 0) {
+        fprintf(stderr, "Block checks need checksums for %s; build them with \"create_database --checksums\"\n", path);
+        return -1;
+    }
+    int rc = block_checker_check(&checker, 0, delta->map_size);
+    block_checker_close(&checker);
+    return rc;
+}
 
 /**
- * Initializes a connection to an SQLite database.
+ * Sets up first-touch block checks of a flat base store.
  *
- * This function opens a database file located at the specified path. If the database
- * cannot be opened, an error message is printed, and a non-zero status code is returned.
+ * The header and the index sections behind the records are read by every
+ * lookup, so they are verified here, once. Record blocks are verified by
+ * lookup_base() and the range scans the first time they are read. The .mphf
+ * index has no checksums of its own, so it is not loaded while checks are on.
+ * SQLite and packed stores are left to "create_database --verify".
+ */
+static int open_block_checks(PwnedDB *db, const char *db_path) {
+    if (db->backend != DB_BACKEND_FLAT) {
+        if (db->backend != DB_BACKEND_SHARDED) {
+            fprintf(stderr, "Block checks cover flat stores only; verify %s with \"create_database --verify\"\n",
+                    db_path);
+        }
+        return 0;
+    }
+    if (block_checker_open(&db->checks, db_path, db->flat.map, db->flat.map_size) != 0) {
+        fprintf(stderr, "Block checks need checksums for %s; build them with \"create_database --checksums\"\n",
+                db_path);
+        return -1;
+    }
+    db->has_checks = 1;
+    const FlatHeader *header = db->flat.header;
+    uint64_t records_end = header->records_offset + header->record_count * db->flat.record_size;
+    if (block_checker_check(&db->checks, 0, header->records_offset) != 0 ||
+        block_checker_check(&db->checks, records_end, db->flat.map_size - records_end) != 0) {
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * Initializes a connection to the pwned password database.
+ *
+ * This function opens the database file located at the specified path. Files that
+ * start with the flat or packed store magic are memory-mapped and queried directly;
+ * anything else is opened as a read-only SQLite database with memory-mapped I/O, a
+ * larger page cache and its lookup statements prepared once for the life of the
+ * handle. A shard manifest opens every shard it names, each as a database of its
+ * own. The store says which dataset it holds, SHA-1 or NTLM, and every lookup
+ * on the handle then takes binary hashes of that width; a SHA-1 and an NTLM
+ * store are simply two handles. Delta segments ("<db_path>.delta.N"), a "<db_path>.filter" file, a
+ * "<db_path>.hot" hot set and, for a flat store, a "<db_path>.mphf" index are
+ * loaded as well when present. After db_enable_block_checks(), a flat store and
+ * its delta segments are checked against their "<path>.xxh" checksums as they
+ * are read. If the database cannot be opened, an error message
+ * is printed, and a non-zero status code is returned.
  *
  * Parameters:
- * - db (sqlite3**): Pointer to the SQLite database connection handle.
- * - db_path (const char*): Path to the SQLite database file.
+ * - db (PwnedDB*): Pointer to the database handle to initialize.
+ * - db_path (const char*): Path to the SQLite database, flat store, packed store or shard manifest.
  *
  * Returns:
  * - int: Returns 0 on successful database connection initialization.
  *   Returns 1 if an error occurs while opening the database.
  *
  * Note:
- * - The caller must ensure that the database connection is eventually closed
+ * - The caller must ensure that the database is eventually closed with close_db()
  *   to free resources and avoid memory leaks.
  */
-int init_db(sqlite3 **db, const char *db_path) {
-    int rc = sqlite3_open(db_path, db);
-    if (rc != SQLITE_OK) {
-        fprintf(stderr, "Can't open database: %s\n", sqlite3_errmsg(*db));
+int init_db(PwnedDB *db, const char *db_path) {
+    memset(db, 0, sizeof(*db));
+
+    if (flat_is_store(db_path)) {
+        db->backend = DB_BACKEND_FLAT;
+        if (flat_open(&db->flat, db_path) != 0) {
+            return 1;
+        }
+        db->kind = db->flat.kind;
+    } else if (packed_is_store(db_path)) {
+        db->backend = DB_BACKEND_PACKED;
+        if (packed_open(&db->packed, db_path) != 0) {
+            return 1;
+        }
+    } else if (shard_is_store(db_path)) {
+        db->backend = DB_BACKEND_SHARDED;
+        if (open_shards(db, db_path) != 0) {
+            return 1;
+        }
+    } else {
+        db->backend = DB_BACKEND_SQLITE;
+        int rc = sqlite3_open_v2(db_path, &db->sqlite, SQLITE_OPEN_READONLY | SQLITE_OPEN_NOMUTEX, NULL);
+        if (rc != SQLITE_OK) {
+            fprintf(stderr, "Can't open database: %s\n", sqlite3_errmsg(db->sqlite));
+            sqlite3_close(db->sqlite);
+            db->sqlite = NULL;
+            return 1;
+        }
+        if (prepare_sqlite(db) != 0) {
+            close_db(db);
+            return 1;
+        }
+    }
+    db->hash_size = (uint32_t)hash_kind_size(db->kind);
+
+    // Deltas are numbered from 1 without gaps; the first missing number ends the list
+    char delta_path[4096];
+    for (int i = 0; i < DELTA_MAX_SEGMENTS; i++) {
+        snprintf(delta_path, sizeof(delta_path), "%s%s.%d", db_path, DELTA_FILE_SUFFIX, i + 1);
+        if (!flat_is_store(delta_path)) {
+            break;
+        }
+        if (flat_open(&db->deltas[i], delta_path) != 0) {
+            close_db(db);
+            return 1;
+        }
+        db->delta_count++;
+        if (db->deltas[i].kind != db->kind) {
+            fprintf(stderr, "Delta segment %s holds %s hashes, but %s holds %s hashes\n", delta_path,
+                    hash_kind_name(db->deltas[i].kind), db_path, hash_kind_name(db->kind));
+            close_db(db);
+            return 1;
+        }
+        if (block_checks_enabled && check_delta_blocks(&db->deltas[i], delta_path) != 0) {
+            close_db(db);
+            return 1;
+        }
+    }
+    if (block_checks_enabled && open_block_checks(db, db_path) != 0) {
+        close_db(db);
         return 1;
     }
+
+    // A filter built next to the store answers most misses without touching it,
+    // and a hot set the most common hits
+    if (db->backend == DB_BACKEND_SHARDED) {
+        return 0; // Filters and hot sets are built per shard
+    }
+    char filter_path[4096];
+    snprintf(filter_path, sizeof(filter_path), "%s%s", db_path, FUSE_FILE_SUFFIX);
+    db->has_filter = fuse_open(&db->filter, filter_path) == 0;
+    char hot_path[4096];
+    snprintf(hot_path, sizeof(hot_path), "%s%s", db_path, HOT_FILE_SUFFIX);
+    db->has_hot = hot_open(&db->hot, hot_path) == 0;
+    if (db->has_hot && (db->kind == HASH_KIND_NTLM) != (db->hot.key_bytes == HOT_NTLM_KEY_BYTES)) {
+        fprintf(stderr, "Ignoring hot set %s: it was not built from the %s hashes of the store\n", hot_path,
+                hash_kind_name(db->kind));
+        hot_free(&db->hot);
+        db->has_hot = 0;
+    }
+
+    // An index built before the store was rewritten would send hashes to the wrong slots;
+    // indexes are only built over SHA-1 stores
+    if (db->backend == DB_BACKEND_FLAT && db->kind == HASH_KIND_SHA1 && !db->has_checks) {
+        char mphf_path[4096];
+        snprintf(mphf_path, sizeof(mphf_path), "%s%s", db_path, MPHF_FILE_SUFFIX);
+        db->has_mphf = mphf_open(&db->mphf, mphf_path) == 0;
+        if (db->has_mphf && db->mphf.header->key_count != db->flat.header->record_count) {
+            fprintf(stderr, "Ignoring stale index %s: it covers %llu keys, the store holds %llu\n", mphf_path,
+                    (unsigned long long)db->mphf.header->key_count,
+                    (unsigned long long)db->flat.header->record_count);
+            mphf_close(&db->mphf);
+            db->has_mphf = 0;
+        }
+    }
     return 0; // Success
 }
 
+// Closes whichever backend the handle was opened with
+void close_db(PwnedDB *db) {
+    if (db->has_filter) {
+        fuse_free(&db->filter);
+        db->has_filter = 0;
+    }
+    if (db->has_hot) {
+        hot_free(&db->hot);
+        db->has_hot = 0;
+    }
+    if (db->has_mphf) {
+        mphf_close(&db->mphf);
+        db->has_mphf = 0;
+    }
+    if (db->has_checks) {
+        block_checker_close(&db->checks);
+        db->has_checks = 0;
+    }
+    if (db->backend == DB_BACKEND_FLAT) {
+        flat_close(&db->flat);
+    } else if (db->backend == DB_BACKEND_PACKED) {
+        packed_close(&db->packed);
+    } else if (db->backend == DB_BACKEND_SHARDED) {
+        for (uint32_t i = 0; db->shards != NULL && i < (uint32_t)1 << db->shard_bits; i++) {
+            close_db(&db->shards[i]);
+        }
+        free(db->shards);
+        db->shards = NULL;
+    } else {
+        sqlite3_finalize(db->lookup_stmt);
+        sqlite3_finalize(db->range_stmt);
+        sqlite3_close(db->sqlite);
+        db->lookup_stmt = NULL;
+        db->range_stmt = NULL;
+        db->sqlite = NULL;
+    }
+    for (int i = 0; i < db->delta_count; i++) {
+        flat_close(&db->deltas[i]);
+    }
+    db->delta_count = 0;
+}
+
+int db_thread_safe(const PwnedDB *db) {
+    if (db->backend == DB_BACKEND_SQLITE) {
+        return 0;
+    }
+    for (uint32_t i = 0; db->backend == DB_BACKEND_SHARDED && i < (uint32_t)1 << db->shard_bits; i++) {
+        if (!db_thread_safe(&db->shards[i])) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+// Single-row query against the SQLite backend using the handle's cached statement
+static int lookup_hash_sqlite(PwnedDB *db, const unsigned char *binary_hash, int *count) {
+    sqlite3_stmt *stmt = db->lookup_stmt;
+
+    // Bind the binary hash to the query using BLOB
+    sqlite3_bind_blob(stmt, 1, binary_hash, (int)db->hash_size, SQLITE_STATIC);
+
+    // Execute the query
+    int found = 0;
+    int rc = sqlite3_step(stmt);
+    if (rc == SQLITE_ROW) {
+        *count = sqlite3_column_int(stmt, 0);
+        found = 1;
+    } else if (rc != SQLITE_DONE) {
+        fprintf(stderr, "Failed to query database: %s\n", sqlite3_errmsg(db->sqlite));
+        found = -1;
+    }
+
+    // Reset for the next lookup; the binding points at the caller's buffer
+    sqlite3_reset(stmt);
+    sqlite3_clear_bindings(stmt);
+    return found;
+}
+
+// The part of a lookup that never touches the base store: deltas, then the hot set, then the filter
+int lookup_overlay_source(PwnedDB *db, const unsigned char *binary_hash, int *count, LookupSource *source) {
+    for (int i = db->delta_count - 1; i >= 0; i--) {
+        uint32_t delta_count;
+        if (flat_lookup(&db->deltas[i], binary_hash, &delta_count)) {
+            *count = (int)delta_count;
+            *source = LOOKUP_FROM_DELTA;
+            return 1;
+        }
+    }
+
+    // Hot counts come from the base, so they are only trusted once no delta overrides them
+    uint32_t hot_count;
+    if (db->has_hot && hot_lookup(&db->hot, binary_hash, &hot_count)) {
+        *count = (int)hot_count;
+        *source = LOOKUP_FROM_HOT;
+        return 1;
+    }
+
+    if (db->has_filter && !fuse_contains(&db->filter, fuse_key(binary_hash))) {
+        *source = LOOKUP_FROM_FILTER;
+        return 0; // Definitely absent: no need to touch the store
+    }
+    *source = LOOKUP_FROM_BASE;
+    return LOOKUP_NEEDS_BASE;
+}
+
+int lookup_overlay(PwnedDB *db, const unsigned char *binary_hash, int *count) {
+    LookupSource source;
+    return lookup_overlay_source(db, binary_hash, count, &source);
+}
+
+// Verifies the records a flat lookup may read: its candidate range and the record just past it
+static int check_candidate_blocks(PwnedDB *db, const unsigned char *binary_hash) {
+    uint64_t begin, end;
+    flat_candidate_range(&db->flat, binary_hash, &begin, &end);
+    if (end < db->flat.header->record_count) {
+        end++;
+    }
+    return block_checker_check(&db->checks, db->flat.header->records_offset + begin * db->flat.record_size,
+                               (end - begin) * db->flat.record_size);
+}
+
+// The base store alone, once lookup_overlay() could not answer; a sharded database passes the hash on
+int lookup_base(PwnedDB *db, const unsigned char *binary_hash, int *count) {
+    if (db->backend == DB_BACKEND_FLAT) {
+        if (db->has_checks && check_candidate_blocks(db, binary_hash) != 0) {
+            return -1;
+        }
+        uint32_t flat_count;
+        int found = db->has_mphf ? mphf_lookup(&db->mphf, binary_hash, &flat_count)
+                                 : flat_lookup(&db->flat, binary_hash, &flat_count);
+        if (!found) {
+            return 0;
+        }
+        *count = (int)flat_count;
+        return 1;
+    }
+    if (db->backend == DB_BACKEND_PACKED) {
+        uint32_t packed_count;
+        if (!packed_lookup(&db->packed, binary_hash, &packed_count)) {
+            return 0;
+        }
+        *count = (int)packed_count;
+        return 1;
+    }
+    if (db->backend == DB_BACKEND_SHARDED) {
+        return lookup_hash(&db->shards[shard_of(binary_hash, db->shard_bits)], binary_hash, count);
+    }
+    return lookup_hash_sqlite(db, binary_hash, count);
+}
+
+/**
+ * Looks up a binary hash in whichever backend the database was opened with.
+ *
+ * Delta segments are checked first, newest to oldest, since they hold the most
+ * recent count of anything they contain. A hot set, if loaded, then answers the
+ * most common hashes from memory. When a fuse filter is loaded it is checked
+ * next; a negative answer from the filter is exact for the base store, so only
+ * hashes that pass it reach the store. A sharded database hands the
+ * hash to the one shard its leading bits select, which repeats the same steps.
+ * While lookup statistics are on, the same steps run through
+ * lookup_hash_measured() instead.
+ *
+ * Parameters:
+ * - db (PwnedDB*): An initialized database handle.
+ * - binary_hash (const unsigned char*): The digest to look for, db->hash_size bytes
+ *   (a 20-byte SHA-1 digest or a 16-byte NTLM hash, as the store holds).
+ * - count (int*): Receives the breach count when the hash is found.
+ *
+ * Returns:
+ * - int: 1 if the hash is present, 0 if it is not, -1 on a query error.
+ */
+int lookup_hash(PwnedDB *db, const unsigned char *binary_hash, int *count) {
+    if (lookup_stats_active()) {
+        return lookup_hash_measured(db, binary_hash, count);
+    }
+    int overlay = lookup_overlay(db, binary_hash, count);
+    if (overlay != LOOKUP_NEEDS_BASE) {
+        return overlay;
+    }
+    return lookup_base(db, binary_hash, count);
+}
+
+// Range scan against the SQLite backend: one walk of the primary key between two bounds
+static int lookup_range_sqlite(PwnedDB *db, uint32_t prefix, RangeCallback callback, void *ctx) {
+    sqlite3_stmt *stmt = db->range_stmt;
+
+    // Blobs compare bytewise, so a 3-byte key sorts before every full hash sharing its bytes
+    unsigned char low[3] = {prefix >> 12, prefix >> 4, (prefix & 0x0F) << 4};
+    unsigned char high[HASH_MAX_SIZE + 1];
+    int high_len = 3;
+    uint32_t next = prefix + 1;
+    if (next >> RANGE_PREFIX_BITS) {
+        memset(high, 0xFF, sizeof(high)); // Past the last prefix: above every hash of either width
+        high_len = sizeof(high);
+    } else {
+        high[0] = next >> 12;
+        high[1] = next >> 4;
+        high[2] = (next & 0x0F) << 4;
+    }
+    sqlite3_bind_blob(stmt, 1, low, sizeof(low), SQLITE_STATIC);
+    sqlite3_bind_blob(stmt, 2, high, high_len, SQLITE_STATIC);
+
+    int rc;
+    while ((rc = sqlite3_step(stmt)) == SQLITE_ROW) {
+        if (sqlite3_column_bytes(stmt, 0) != (int)db->hash_size) {
+            continue;
+        }
+        if (callback(sqlite3_column_blob(stmt, 0), sqlite3_column_int(stmt, 1), ctx) != 0) {
+            rc = SQLITE_DONE;
+            break;
+        }
+    }
+    if (rc != SQLITE_DONE) {
+        fprintf(stderr, "Failed to scan database: %s\n", sqlite3_errmsg(db->sqlite));
+    }
+    sqlite3_reset(stmt);
+    sqlite3_clear_bindings(stmt);
+    return rc == SQLITE_DONE ? 0 : -1;
+}
+
+static int lookup_range_merged(PwnedDB *db, uint32_t prefix, RangeCallback callback, void *ctx);
+
+// Range scan over the base store alone
+static int lookup_range_base(PwnedDB *db, uint32_t prefix, RangeCallback callback, void *ctx) {
+    if (db->backend == DB_BACKEND_PACKED) {
+        fprintf(stderr, "Range queries need full hashes, which a packed store does not keep\n");
+        return -1;
+    }
+    if (db->backend == DB_BACKEND_FLAT) {
+        uint64_t begin, end;
+        flat_prefix_range(&db->flat, prefix, RANGE_PREFIX_BITS, &begin, &end);
+        uint64_t offset = db->flat.header->records_offset + begin * db->flat.record_size;
+        if (db->has_checks && block_checker_check(&db->checks, offset, (end - begin) * db->flat.record_size) != 0) {
+            return -1;
+        }
+        for (uint64_t i = begin; i < end; i++) {
+            if (callback(flat_record_hash(&db->flat, i), (int)flat_record_count(&db->flat, i), ctx) != 0) {
+                break;
+            }
+        }
+        return 0;
+    }
+    if (db->backend == DB_BACKEND_SHARDED) {
+        // At most SHARD_MAX_BITS < RANGE_PREFIX_BITS, so a prefix never spans two shards
+        return lookup_range_merged(&db->shards[prefix >> (RANGE_PREFIX_BITS - db->shard_bits)], prefix, callback, ctx);
+    }
+    return lookup_range_sqlite(db, prefix, callback, ctx);
+}
+
+// Records of one prefix collected from the base store before merging, laid out like a delta's
+typedef struct {
+    unsigned char *records;
+    size_t count;
+    size_t capacity;
+    size_t hash_size;
+    int failed;
+} RangeBuffer;
+
+static int buffer_record(const unsigned char *binary_hash, int count, void *ctx) {
+    RangeBuffer *buffer = ctx;
+    size_t record_size = buffer->hash_size + sizeof(uint32_t);
+    if (buffer->count == buffer->capacity) {
+        size_t capacity = buffer->capacity ? buffer->capacity * 2 : 256;
+        unsigned char *grown = realloc(buffer->records, capacity * record_size);
+        if (grown == NULL) {
+            buffer->failed = 1;
+            return -1;
+        }
+        buffer->records = grown;
+        buffer->capacity = capacity;
+    }
+    unsigned char *record = buffer->records + buffer->count++ * record_size;
+    uint32_t stored = (uint32_t)count;
+    memcpy(record, binary_hash, buffer->hash_size);
+    memcpy(record + buffer->hash_size, &stored, sizeof(stored));
+    return 0;
+}
+
+/**
+ * Visits every record whose hash begins with a k-anonymity prefix.
+ *
+ * This is the storage side of the HIBP range API: the flat store resolves the
+ * prefix to a contiguous run of records and walks it, while SQLite does a single
+ * bounded scan of its primary key; a sharded database asks the shard that covers
+ * the prefix. Delta segments are merged in, the newest copy
+ * of a hash winning. Records are delivered in hash order. A packed
+ * store keeps only the leading 64 bits of each hash, so it cannot answer ranges.
+ * While lookup statistics are on, the time of each call is recorded.
+ *
+ * Parameters:
+ * - db (PwnedDB*): An initialized database handle.
+ * - prefix (uint32_t): The leading RANGE_PREFIX_BITS bits of the hash (5 hex digits).
+ * - callback (RangeCallback): Called once per matching record.
+ * - ctx (void*): Passed through to the callback.
+ *
+ * Returns:
+ * - int: 0 on success (including when the callback stops early), -1 on a query error
+ *   or when the backend cannot produce full hashes.
+ */
+int lookup_range(PwnedDB *db, uint32_t prefix, RangeCallback callback, void *ctx) {
+    if (!lookup_stats_active()) {
+        return lookup_range_merged(db, prefix, callback, ctx);
+    }
+    uint64_t start = lookup_stats_now_ns();
+    int rc = lookup_range_merged(db, prefix, callback, ctx);
+    lookup_stats_record_range(lookup_stats_now_ns() - start, rc);
+    return rc;
+}
+
+// lookup_range() without the statistics, so a shard's scan is not counted twice
+static int lookup_range_merged(PwnedDB *db, uint32_t prefix, RangeCallback callback, void *ctx) {
+    if (db->backend == DB_BACKEND_PACKED) {
+        fprintf(stderr, "Range queries need full hashes, which a packed store does not keep\n");
+        return -1;
+    }
+    if (db->delta_count == 0) {
+        return lookup_range_base(db, prefix, callback, ctx);
+    }
+
+    size_t hash_size = db->hash_size;
+    size_t record_size = hash_size + sizeof(uint32_t);
+    RangeBuffer base = {NULL, 0, 0, hash_size, 0};
+    if (lookup_range_base(db, prefix, buffer_record, &base) != 0 || base.failed) {
+        free(base.records);
+        return -1;
+    }
+
+    // Cursor 0 walks the base, cursor i + 1 walks delta i; on equal hashes the highest cursor wins.
+    // Every run shares the record layout of the store's kind, so cursors step by record_size
+    const unsigned char *runs[DELTA_MAX_SEGMENTS + 1];
+    uint64_t positions[DELTA_MAX_SEGMENTS + 1] = {0};
+    uint64_t ends[DELTA_MAX_SEGMENTS + 1];
+    runs[0] = base.records;
+    ends[0] = base.count;
+    for (int i = 0; i < db->delta_count; i++) {
+        uint64_t begin, end;
+        flat_prefix_range(&db->deltas[i], prefix, RANGE_PREFIX_BITS, &begin, &end);
+        runs[i + 1] = flat_record_hash(&db->deltas[i], begin);
+        ends[i + 1] = end - begin;
+    }
+
+    for (;;) {
+        int winner = -1;
+        for (int r = 0; r <= db->delta_count; r++) {
+            if (positions[r] < ends[r] &&
+                (winner < 0 || memcmp(runs[r] + positions[r] * record_size,
+                                      runs[winner] + positions[winner] * record_size, hash_size) <= 0)) {
+                winner = r;
+            }
+        }
+        if (winner < 0) {
+            break;
+        }
+
+        const unsigned char *record = runs[winner] + positions[winner] * record_size;
+        for (int r = 0; r <= db->delta_count; r++) {
+            if (r != winner && positions[r] < ends[r] &&
+                memcmp(runs[r] + positions[r] * record_size, record, hash_size) == 0) {
+                positions[r]++;
+            }
+        }
+        positions[winner]++;
+        uint32_t count;
+        memcpy(&count, record + hash_size, sizeof(count));
+        if (callback(record, (int)count, ctx) != 0) {
+            break;
+        }
+    }
+    free(base.records);
+    return 0;
+}
+
 /**
  * Performs a deep check to determine if a given hash is present in the database.
  *
- * This function queries the SQLite database to find an exact match for a provided binary hash.
- * It prepares a SQL statement to search for the hash in the 'pwned_passwords' table. If found,
- * it retrieves and prints the count of occurrences, indicating how many times the password
+ * This function looks up the provided binary hash through lookup_hash(), which queries
+ * either the 'pwned_passwords' SQLite table or the memory-mapped flat store. If found,
+ * it prints the count of occurrences, indicating how many times the password
  * associated with this hash has been exposed. If not found, a message stating that the password
  * is not pwned is printed.
  *
  * Parameters:
- * - db (sqlite3*): The SQLite database connection handle.
+ * - db (PwnedDB*): The database handle returned by init_db().
  * - binary_hash (const char*): The binary hash to be checked, expected to be in raw binary format.
  *
  * Returns:
  * - int: Returns 0 if the function completes successfully, regardless of the hash being found.
- *   Returns -1 if there is an error preparing the SQL statement.
+ *   Returns -1 if the lookup itself fails.
  *
  * Note:
- * - The binary hash should be exactly 20 bytes long as it represents a SHA1 hash.
- * - Ensure that the SQL statement correctly matches the schema of the 'pwned_passwords' table.
- * - This function handles all cleanup of the SQL statement to prevent memory leaks.
+ * - The binary hash should be db->hash_size bytes long: 20 for a SHA-1 store, 16 for an NTLM one.
  */
-int deep_check_password(sqlite3 *db, const unsigned char *binary_hash) 
+int deep_check_password(PwnedDB *db, const unsigned char *binary_hash)
 {
-    sqlite3_stmt *stmt;
-    int rc;
-    const char *sql = "SELECT count FROM pwned_passwords WHERE full_hash = ?";
-
-    // Prepare the SQL statement
-    rc = sqlite3_prepare_v2(db, sql, -1, &stmt, NULL);
-    if (rc != SQLITE_OK) 
+    int count = 0;
+    int found = lookup_hash(db, binary_hash, &count);
+    if (found < 0)
     {
-        fprintf(stderr, "Failed to prepare statement: %s\n", sqlite3_errmsg(db));
         return -1;
     }
 
-    // Bind the binary hash to the query using BLOB
-    sqlite3_bind_blob(stmt, 1, binary_hash, 20, SQLITE_STATIC);
-
-    // Execute the query
-    rc = sqlite3_step(stmt);
-    if (rc == SQLITE_ROW) 
+    if (found)
     {
-        int count = sqlite3_column_int(stmt, 0);
         printf("Password found in pwned list with %d occurrences!\n", count);
-    } 
-    else 
+    }
+    else
     {
         printf("Password not found in pwned list.\n");
     }
-
-    // Clean up
-    sqlite3_finalize(stmt);
     return 0; // Success
-}
\ No newline at end of file
+}
@@ -0,0 +1,320 @@
+#define _GNU_SOURCE // For accept4()
+
+#include "event_server.h"
+#include "lookup_stats.h"
+
+#include <errno.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+
+/**
+ * Ready connections handed from the event loop to the workers.
+ *
+ * Workers sleep on the condition variable while idle, so the pool costs
+ * nothing when there is no traffic.
+ */
+typedef struct {
+    ServerConnection *items[SERVER_QUEUE_SIZE];
+    size_t head;
+    size_t count;
+    pthread_mutex_t lock;
+    pthread_cond_t ready;
+    pthread_cond_t space;
+} WorkQueue;
+
+typedef struct {
+    const ServerHandlers *handlers;
+    int epoll_fd;
+    WorkQueue queue;
+} Server;
+
+static volatile sig_atomic_t stop_requested = 0;
+
+static void handle_stop(int signum) {
+    (void)signum;
+    stop_requested = 1;
+}
+
+static void work_queue_push(WorkQueue *queue, ServerConnection *conn) {
+    pthread_mutex_lock(&queue->lock);
+    while (queue->count == SERVER_QUEUE_SIZE) {
+        pthread_cond_wait(&queue->space, &queue->lock);
+    }
+    queue->items[(queue->head + queue->count) % SERVER_QUEUE_SIZE] = conn;
+    queue->count++;
+    pthread_cond_signal(&queue->ready);
+    pthread_mutex_unlock(&queue->lock);
+}
+
+static ServerConnection *work_queue_pop(WorkQueue *queue) {
+    pthread_mutex_lock(&queue->lock);
+    while (queue->count == 0) {
+        pthread_cond_wait(&queue->ready, &queue->lock);
+    }
+    ServerConnection *conn = queue->items[queue->head];
+    queue->head = (queue->head + 1) % SERVER_QUEUE_SIZE;
+    queue->count--;
+    pthread_cond_signal(&queue->space);
+    pthread_mutex_unlock(&queue->lock);
+    return conn;
+}
+
+int server_out_reserve(ServerConnection *conn, size_t extra) {
+    if (conn->out_len + extra <= conn->out_capacity) {
+        return 0;
+    }
+    size_t capacity = conn->out_capacity ? conn->out_capacity : 16384;
+    while (capacity < conn->out_len + extra) {
+        capacity *= 2;
+    }
+    char *grown = realloc(conn->out, capacity);
+    if (grown == NULL) {
+        return -1;
+    }
+    conn->out = grown;
+    conn->out_capacity = capacity;
+    return 0;
+}
+
+int server_out_append(ServerConnection *conn, const void *data, size_t len) {
+    if (server_out_reserve(conn, len) != 0) {
+        return -1;
+    }
+    memcpy(conn->out + conn->out_len, data, len);
+    conn->out_len += len;
+    return 0;
+}
+
+static void close_connection(ServerConnection *conn) {
+    close(conn->fd);
+    free(conn->out);
+    free(conn);
+}
+
+// Re-arms a one-shot connection for reading or, while output is pending, writing
+static void rearm(Server *server, ServerConnection *conn) {
+    struct epoll_event event;
+    event.events = EPOLLONESHOT | EPOLLRDHUP | (conn->out_sent < conn->out_len ? EPOLLOUT : EPOLLIN);
+    event.data.ptr = conn;
+    if (epoll_ctl(server->epoll_fd, EPOLL_CTL_MOD, conn->fd, &event) != 0) {
+        close_connection(conn);
+    }
+}
+
+// Writes as much pending output as the socket takes; returns -1 if the connection failed
+static int flush_output(ServerConnection *conn) {
+    while (conn->out_sent < conn->out_len) {
+        ssize_t n = send(conn->fd, conn->out + conn->out_sent, conn->out_len - conn->out_sent, MSG_NOSIGNAL);
+        if (n < 0) {
+            return errno == EAGAIN || errno == EWOULDBLOCK ? 0 : -1;
+        }
+        conn->out_sent += (size_t)n;
+    }
+    conn->out_len = conn->out_sent = 0;
+    return 0;
+}
+
+/**
+ * Handles one readiness notification for a connection.
+ *
+ * Connections are registered EPOLLONESHOT, so exactly one worker owns a
+ * connection between being woken and re-arming it; no locking is needed on
+ * the connection itself. Input is not read while earlier answers are still
+ * unsent, which bounds the output a slow client can pile up.
+ */
+static void handle_connection(Server *server, ServerConnection *conn, void *worker) {
+    if (flush_output(conn) != 0) {
+        close_connection(conn);
+        return;
+    }
+    if (conn->out_len > 0) {
+        rearm(server, conn);
+        return;
+    }
+    if (conn->close_after) {
+        close_connection(conn);
+        return;
+    }
+
+    int peer_closed = 0;
+    while (conn->out_len == 0 && !conn->close_after) {
+        if (conn->in_len == conn->in_capacity) {
+            // The handler left a full buffer without a complete request to answer
+            close_connection(conn);
+            return;
+        }
+        ssize_t n = recv(conn->fd, conn->in + conn->in_len, conn->in_capacity - conn->in_len, 0);
+        if (n > 0) {
+            conn->in_len += (size_t)n;
+            if (server->handlers->process(conn, worker) != 0 || flush_output(conn) != 0) {
+                close_connection(conn);
+                return;
+            }
+            continue;
+        }
+        if (n == 0 || (errno != EAGAIN && errno != EWOULDBLOCK)) {
+            peer_closed = 1;
+        }
+        break;
+    }
+
+    if (conn->out_len == 0 && (peer_closed || conn->close_after)) {
+        close_connection(conn);
+        return;
+    }
+    rearm(server, conn);
+}
+
+// Worker thread: serves connections the event loop marks ready
+static void *worker_main(void *arg) {
+    Server *server = arg;
+    const ServerHandlers *handlers = server->handlers;
+    void *worker = handlers->worker_open ? handlers->worker_open(handlers->ctx) : NULL;
+
+    ServerConnection *conn;
+    while ((conn = work_queue_pop(&server->queue)) != NULL) {
+        handle_connection(server, conn, worker);
+    }
+
+    if (handlers->worker_close) {
+        handlers->worker_close(worker, handlers->ctx);
+    }
+    return NULL;
+}
+
+// Accepts every pending client and registers it with the event loop
+static void accept_clients(Server *server, int listen_fd) {
+    for (;;) {
+        int fd = accept4(listen_fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (fd < 0) {
+            return; // EAGAIN once the backlog is drained; other errors are per-client
+        }
+        int one = 1;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one)); // Fails harmlessly on Unix sockets
+
+        ServerConnection *conn = malloc(sizeof(ServerConnection) + server->handlers->request_limit);
+        if (conn == NULL) {
+            close(fd);
+            continue;
+        }
+        memset(conn, 0, sizeof(*conn));
+        conn->fd = fd;
+        conn->in_capacity = server->handlers->request_limit;
+
+        struct epoll_event event;
+        event.events = EPOLLIN | EPOLLRDHUP | EPOLLONESHOT;
+        event.data.ptr = conn;
+        if (epoll_ctl(server->epoll_fd, EPOLL_CTL_ADD, fd, &event) != 0) {
+            close_connection(conn);
+        }
+    }
+}
+
+/**
+ * Runs the event loop of pwned_server and pwned_daemon on a bound, listening,
+ * non-blocking socket.
+ *
+ * The loop only accepts clients and queues ready connections; the workers
+ * read, answer through handlers->process and write. With a metrics file the
+ * loop wakes up at least once per interval to rewrite it.
+ *
+ * Parameters:
+ * - listen_fd (int): The listening socket; left open for the caller to close.
+ * - threads (int): Number of worker threads.
+ * - handlers (const ServerHandlers*): Request handler and per-worker state.
+ *
+ * Returns:
+ * - int: 0 after SIGINT or SIGTERM stopped the server, 1 if it could not start.
+ */
+int server_run(int listen_fd, int threads, const ServerHandlers *handlers) {
+    Server *server = calloc(1, sizeof(Server));
+    pthread_t *workers = calloc((size_t)threads, sizeof(pthread_t));
+    if (server == NULL || workers == NULL) {
+        fprintf(stderr, "Memory allocation failed for worker threads!\n");
+        free(server);
+        free(workers);
+        return 1;
+    }
+    server->handlers = handlers;
+
+    server->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    struct epoll_event event;
+    event.events = EPOLLIN;
+    event.data.ptr = NULL; // The listener is the only registration without a connection
+    if (server->epoll_fd < 0 || epoll_ctl(server->epoll_fd, EPOLL_CTL_ADD, listen_fd, &event) != 0) {
+        fprintf(stderr, "Can't set up epoll: %s\n", strerror(errno));
+        if (server->epoll_fd >= 0) {
+            close(server->epoll_fd);
+        }
+        free(server);
+        free(workers);
+        return 1;
+    }
+
+    pthread_mutex_init(&server->queue.lock, NULL);
+    pthread_cond_init(&server->queue.ready, NULL);
+    pthread_cond_init(&server->queue.space, NULL);
+
+    for (int i = 0; i < threads; i++) {
+        if (pthread_create(&workers[i], NULL, worker_main, server) != 0) {
+            fprintf(stderr, "Failed to start worker thread %d\n", i);
+            exit(1);
+        }
+    }
+
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = handle_stop;
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+    signal(SIGPIPE, SIG_IGN);
+
+    const char *metrics_path = handlers->metrics_path;
+    struct epoll_event events[SERVER_MAX_EVENTS];
+    uint64_t metrics_due = lookup_stats_now_ns();
+    while (!stop_requested) {
+        if (metrics_path != NULL && lookup_stats_now_ns() >= metrics_due) {
+            lookup_stats_write_file(metrics_path);
+            metrics_due = lookup_stats_now_ns() + (uint64_t)STATS_METRICS_INTERVAL_MS * 1000000;
+        }
+        int n = epoll_wait(server->epoll_fd, events, SERVER_MAX_EVENTS, metrics_path != NULL ? STATS_METRICS_INTERVAL_MS : -1);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            fprintf(stderr, "epoll_wait failed: %s\n", strerror(errno));
+            break;
+        }
+        for (int i = 0; i < n; i++) {
+            if (events[i].data.ptr == NULL) {
+                accept_clients(server, listen_fd);
+            } else {
+                work_queue_push(&server->queue, events[i].data.ptr);
+            }
+        }
+    }
+
+    // One stop marker per worker; connections still registered are dropped with the process
+    for (int i = 0; i < threads; i++) {
+        work_queue_push(&server->queue, NULL);
+    }
+    for (int i = 0; i < threads; i++) {
+        pthread_join(workers[i], NULL);
+    }
+    free(workers);
+
+    close(server->epoll_fd);
+    free(server);
+    if (metrics_path != NULL) {
+        lookup_stats_write_file(metrics_path);
+    }
+    return 0;
+}
@@ -0,0 +1,722 @@
+#include "flat_store.h"
+#include "hash_util.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+_Static_assert(sizeof(FlatHeader) == FLAT_HEADER_SIZE, "FlatHeader must match its on-disk size");
+_Static_assert(sizeof(FlatRecord) == 24, "FlatRecord must not be padded");
+_Static_assert(sizeof(NtlmRecord) == 20, "NtlmRecord must not be padded");
+
+// Every search routine is written once over (record_size, hash_size) and forced inline
+// into one wrapper per key width, so each copy compares and strides by constants
+#define FLAT_SPECIALIZE static inline __attribute__((always_inline))
+
+// Leading `bits` bits of a hash, used to pick its prefix bucket
+static uint32_t hash_prefix(const unsigned char *hash, uint32_t bits) {
+    if (bits == 0) {
+        return 0;
+    }
+    uint32_t lead = ((uint32_t)hash[0] << 24) | ((uint32_t)hash[1] << 16) |
+                    ((uint32_t)hash[2] << 8) | (uint32_t)hash[3];
+    return lead >> (32 - bits);
+}
+
+// First 8 bytes of a hash as a big-endian integer: the learned index key
+static uint64_t hash_key(const unsigned char *hash) {
+    return load_be64(hash);
+}
+
+// memcmp() order of two keys in word compares: two 64-bit words, then the 32-bit tail of a SHA-1
+FLAT_SPECIALIZE int compare_hash(const unsigned char *a, const unsigned char *b, size_t hash_size) {
+    uint64_t x = load_be64(a), y = load_be64(b);
+    if (x != y) {
+        return x < y ? -1 : 1;
+    }
+    x = load_be64(a + 8);
+    y = load_be64(b + 8);
+    if (x != y || hash_size == NTLM_HASH_SIZE) {
+        return (x > y) - (x < y);
+    }
+    uint32_t u = load_be32(a + 16), v = load_be32(b + 16);
+    return (u > v) - (u < v);
+}
+
+/**
+ * Stable merge sort of records by hash: sorted runs of FLAT_SORT_RUN records are
+ * merged bottom-up, alternating between the records and a scratch buffer of the
+ * same size. Stability keeps duplicates of a hash in input order, so the last
+ * one can be told apart from the others.
+ */
+FLAT_SPECIALIZE void sort_records(unsigned char *records, unsigned char *scratch, uint64_t count,
+                                  size_t record_size, size_t hash_size) {
+    unsigned char held[sizeof(FlatRecord)];
+    for (uint64_t run = 0; run < count; run += FLAT_SORT_RUN) {
+        uint64_t end = run + FLAT_SORT_RUN < count ? run + FLAT_SORT_RUN : count;
+        for (uint64_t i = run + 1; i < end; i++) {
+            uint64_t j = i;
+            memcpy(held, records + i * record_size, record_size);
+            while (j > run && compare_hash(records + (j - 1) * record_size, held, hash_size) > 0) {
+                j--;
+            }
+            memmove(records + (j + 1) * record_size, records + j * record_size, (i - j) * record_size);
+            memcpy(records + j * record_size, held, record_size);
+        }
+    }
+
+    unsigned char *from = records, *to = scratch;
+    for (uint64_t width = FLAT_SORT_RUN; width < count; width *= 2) {
+        for (uint64_t left = 0; left < count; left += 2 * width) {
+            uint64_t mid = left + width < count ? left + width : count;
+            uint64_t right = mid + width < count ? mid + width : count;
+            uint64_t i = left, j = mid, k = left;
+            // Ties take the left run first, which keeps the sort stable
+            while (i < mid && j < right) {
+                if (compare_hash(from + j * record_size, from + i * record_size, hash_size) < 0) {
+                    memcpy(to + k++ * record_size, from + j++ * record_size, record_size);
+                } else {
+                    memcpy(to + k++ * record_size, from + i++ * record_size, record_size);
+                }
+            }
+            memcpy(to + k * record_size, from + i * record_size, (mid - i) * record_size);
+            k += mid - i;
+            memcpy(to + k * record_size, from + j * record_size, (right - j) * record_size);
+        }
+        unsigned char *swap = from;
+        from = to;
+        to = swap;
+    }
+    if (from != records) {
+        memcpy(records, from, count * record_size);
+    }
+}
+
+int flat_sort_records(void *records, void *scratch, uint64_t count, HashKind kind) {
+    size_t record_size = kind == HASH_KIND_NTLM ? sizeof(NtlmRecord) : sizeof(FlatRecord);
+    unsigned char *allocated = NULL;
+    if (scratch == NULL && count > FLAT_SORT_RUN) {
+        scratch = allocated = malloc(count * record_size);
+        if (scratch == NULL) {
+            fprintf(stderr, "Memory allocation failed for sorting %llu records!\n", (unsigned long long)count);
+            return 1;
+        }
+    }
+    if (kind == HASH_KIND_NTLM) {
+        sort_records(records, scratch, count, sizeof(NtlmRecord), NTLM_HASH_SIZE);
+    } else {
+        sort_records(records, scratch, count, sizeof(FlatRecord), SHA1_HASH_SIZE);
+    }
+    free(allocated);
+    return 0;
+}
+
+// Maps an unlinked temporary file next to path as sort scratch, so a whole store never has to fit in the heap
+static unsigned char *map_sort_scratch(const char *path, size_t size) {
+    char scratch_path[4096];
+    snprintf(scratch_path, sizeof(scratch_path), "%s.sort.XXXXXX", path);
+    int fd = mkstemp(scratch_path);
+    if (fd < 0) {
+        fprintf(stderr, "Can't create a sort scratch file next to %s\n", path);
+        return NULL;
+    }
+    unlink(scratch_path);
+
+    // Blocks are reserved up front: running out of disk under a mapping would be a SIGBUS, not an error
+#ifdef __linux__
+    int reserved = posix_fallocate(fd, 0, (off_t)size) == 0;
+#else
+    int reserved = ftruncate(fd, (off_t)size) == 0;
+#endif
+    unsigned char *scratch = reserved ? mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0) : MAP_FAILED;
+    close(fd);
+    if (scratch == MAP_FAILED) {
+        fprintf(stderr, "Not enough space next to %s for the %.1f MB sort scratch file\n", path, size / 1e6);
+        return NULL;
+    }
+    return scratch;
+}
+
+static int lookup_sha1(const FlatStore *store, const unsigned char *hash, uint32_t *count);
+static int lookup_ntlm(const FlatStore *store, const unsigned char *hash, uint32_t *count);
+
+// Smallest prefix width that keeps the average bucket at or below FLAT_TARGET_BUCKET records
+static uint32_t choose_prefix_bits(uint64_t record_count) {
+    uint32_t bits = 0;
+    while (bits < FLAT_MAX_PREFIX_BITS && (record_count >> bits) > FLAT_TARGET_BUCKET) {
+        bits++;
+    }
+    return bits;
+}
+
+/**
+ * Checks whether a file is a flat store by looking at its magic bytes.
+ *
+ * Parameters:
+ * - path (const char*): Path of the file to inspect.
+ *
+ * Returns:
+ * - int: 1 if the file begins with FLAT_MAGIC, 0 otherwise (including when the
+ *   file cannot be read).
+ */
+int flat_is_store(const char *path) {
+    char magic[FLAT_MAGIC_SIZE];
+    FILE *file = fopen(path, "rb");
+    if (file == NULL) {
+        return 0;
+    }
+    size_t got = fread(magic, 1, sizeof(magic), file);
+    fclose(file);
+    return got == sizeof(magic) && memcmp(magic, FLAT_MAGIC, FLAT_MAGIC_SIZE) == 0;
+}
+
+/**
+ * Maps a flat store into memory for lookups.
+ *
+ * The whole file is mapped read-only and shared, so several processes checking
+ * against the same store share one copy in the page cache. The header is
+ * validated against the file size before any section pointer is handed out.
+ * When the store carries a learned index, lookups use it by default.
+ *
+ * Parameters:
+ * - store (FlatStore*): Store handle to fill in.
+ * - path (const char*): Path to the store file written by flat_writer_finish().
+ *
+ * Returns:
+ * - int: 0 on success, 1 if the file cannot be opened, mapped or is malformed.
+ */
+int flat_open(FlatStore *store, const char *path) {
+    memset(store, 0, sizeof(*store));
+    store->fd = -1;
+
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        fprintf(stderr, "Can't open flat store: %s\n", path);
+        return 1;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || (size_t)st.st_size < FLAT_HEADER_SIZE) {
+        fprintf(stderr, "Flat store is truncated: %s\n", path);
+        close(fd);
+        return 1;
+    }
+
+    void *map = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    if (map == MAP_FAILED) {
+        fprintf(stderr, "Can't map flat store: %s\n", path);
+        close(fd);
+        return 1;
+    }
+
+    const FlatHeader *header = map;
+    uint64_t index_entries = ((uint64_t)1 << header->prefix_bits) + 1;
+    if (memcmp(header->magic, FLAT_MAGIC, FLAT_MAGIC_SIZE) != 0 ||
+        header->version != FLAT_VERSION ||
+        (header->record_size != sizeof(FlatRecord) && header->record_size != sizeof(NtlmRecord)) ||
+        header->prefix_bits > FLAT_MAX_PREFIX_BITS ||
+        header->records_offset + header->record_count * header->record_size > (uint64_t)st.st_size ||
+        header->index_offset + index_entries * sizeof(uint64_t) > (uint64_t)st.st_size) {
+        fprintf(stderr, "Flat store header is invalid: %s\n", path);
+        munmap(map, (size_t)st.st_size);
+        close(fd);
+        return 1;
+    }
+
+    // The learned index is optional; a store whose model section is damaged still works without it
+    uint64_t model_size = header->model_segments * sizeof(PlaSegment) +
+                          (((uint64_t)1 << header->model_radix_bits) + 1) * sizeof(uint32_t);
+    int has_model = header->model_offset != 0 && header->model_segments > 0 &&
+                    header->model_radix_bits <= 32 &&
+                    header->model_offset + model_size <= (uint64_t)st.st_size;
+
+    store->fd = fd;
+    store->map = map;
+    store->map_size = (size_t)st.st_size;
+    store->header = header;
+    store->records = (const FlatRecord *)(store->map + header->records_offset);
+    store->record_bytes = store->map + header->records_offset;
+    store->record_size = header->record_size;
+    store->kind = header->record_size == sizeof(NtlmRecord) ? HASH_KIND_NTLM : HASH_KIND_SHA1;
+    store->hash_size = (uint32_t)hash_kind_size(store->kind);
+    store->lookup = store->kind == HASH_KIND_NTLM ? lookup_ntlm : lookup_sha1;
+    store->index = (const uint64_t *)(store->map + header->index_offset);
+    if (has_model) {
+        store->segments = (const PlaSegment *)(store->map + header->model_offset);
+        store->model_radix = (const uint32_t *)(store->segments + header->model_segments);
+        store->use_model = 1;
+
+        // Every lookup goes through the model, so pull it in up front
+        madvise((void *)(store->map + (header->model_offset & ~(uint64_t)(getpagesize() - 1))),
+                model_size + (header->model_offset & (uint64_t)(getpagesize() - 1)), MADV_WILLNEED);
+    }
+
+    // Lookups jump around the record section, so don't waste I/O on readahead
+    madvise((void *)store->record_bytes, header->record_count * header->record_size, MADV_RANDOM);
+    return 0;
+}
+
+// First record in [lo, hi) whose hash is >= hash
+FLAT_SPECIALIZE uint64_t lower_bound_hash(const FlatStore *store, uint64_t lo, uint64_t hi, const unsigned char *hash,
+                                          size_t record_size, size_t hash_size) {
+    const unsigned char *records = store->record_bytes;
+    while (lo < hi) {
+        uint64_t mid = lo + (hi - lo) / 2;
+        if (compare_hash(records + mid * record_size, hash, hash_size) < 0) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return lo;
+}
+
+// Learned index search: predict the position, then search only the error window around it
+FLAT_SPECIALIZE uint64_t model_lower_bound(const FlatStore *store, const unsigned char *hash,
+                                           size_t record_size, size_t hash_size) {
+    const FlatHeader *header = store->header;
+    const unsigned char *records = store->record_bytes;
+    uint64_t key = hash_key(hash);
+    int64_t s = pla_find_segment(store->segments, store->model_radix, header->model_radix_bits, key);
+    if (s < 0) {
+        return 0; // Below the first stored key
+    }
+
+    uint64_t seg_begin = store->segments[s].first_pos;
+    uint64_t seg_end = (uint64_t)s + 1 < header->model_segments ? store->segments[s + 1].first_pos
+                                                                 : header->record_count;
+    int64_t predicted = pla_predict(&store->segments[s], key);
+    int64_t eps = header->model_epsilon;
+    uint64_t lo = predicted - eps > (int64_t)seg_begin ? (uint64_t)(predicted - eps) : seg_begin;
+    uint64_t hi = predicted + eps + 2 < (int64_t)seg_end ? (uint64_t)(predicted + eps + 2) : seg_end;
+    if (lo > hi) {
+        lo = hi;
+    }
+
+    // Typical errors are a few records, so walk from the prediction through
+    // neighbouring cache lines instead of bisecting the whole window
+    uint64_t pos = predicted < (int64_t)lo ? lo : predicted > (int64_t)hi ? hi : (uint64_t)predicted;
+    if (pos < hi && compare_hash(records + pos * record_size, hash, hash_size) < 0) {
+        do {
+            pos++;
+        } while (pos < hi && compare_hash(records + pos * record_size, hash, hash_size) < 0);
+    } else {
+        while (pos > lo && compare_hash(records + (pos - 1) * record_size, hash, hash_size) >= 0) {
+            pos--;
+        }
+    }
+
+    // The bound holds for stored keys; if an absent key's answer lands on a window
+    // edge, confirm it and widen to the whole segment when it does not hold
+    if ((pos == hi && hi < seg_end) ||
+        (pos == lo && lo > seg_begin && compare_hash(records + (lo - 1) * record_size, hash, hash_size) >= 0)) {
+        pos = lower_bound_hash(store, seg_begin, seg_end, hash, record_size, hash_size);
+    }
+    return pos;
+}
+
+FLAT_SPECIALIZE int lookup_width(const FlatStore *store, const unsigned char *hash, uint32_t *count,
+                                 size_t record_size, size_t hash_size) {
+    uint64_t pos;
+    if (store->use_model) {
+        pos = model_lower_bound(store, hash, record_size, hash_size);
+    } else {
+        uint32_t prefix = hash_prefix(hash, store->header->prefix_bits);
+        pos = lower_bound_hash(store, store->index[prefix], store->index[prefix + 1], hash, record_size, hash_size);
+    }
+
+    const unsigned char *record = store->record_bytes + pos * record_size;
+    if (pos < store->header->record_count && compare_hash(record, hash, hash_size) == 0) {
+        memcpy(count, record + hash_size, sizeof(*count));
+        return 1;
+    }
+    return 0;
+}
+
+static int lookup_sha1(const FlatStore *store, const unsigned char *hash, uint32_t *count) {
+    return lookup_width(store, hash, count, sizeof(FlatRecord), SHA1_HASH_SIZE);
+}
+
+static int lookup_ntlm(const FlatStore *store, const unsigned char *hash, uint32_t *count) {
+    return lookup_width(store, hash, count, sizeof(NtlmRecord), NTLM_HASH_SIZE);
+}
+
+/**
+ * Looks up a binary hash in a flat store.
+ *
+ * With the learned index, the hash's leading 64 bits are fed to the piecewise-
+ * linear model, which predicts the record position to within model_epsilon
+ * records; a short walk from the prediction inside that window (under 1 KB)
+ * finishes the job. The model itself is small enough to stay resident, so a cold
+ * lookup costs a single record page fault. Without the model the leading prefix_bits of the hash
+ * select a bucket from the prefix index, which bounds a short binary search.
+ * The search is compiled once per key width (see lookup_sha1() and
+ * lookup_ntlm()), and flat_open() picks the copy for the store's kind.
+ *
+ * Parameters:
+ * - store (const FlatStore*): An open store.
+ * - hash (const unsigned char*): The digest to look for, hash_size bytes (20 for SHA-1, 16 for NTLM).
+ * - count (uint32_t*): Receives the breach count when the hash is found.
+ *
+ * Returns:
+ * - int: 1 if the hash is present, 0 if it is not.
+ */
+int flat_lookup(const FlatStore *store, const unsigned char *hash, uint32_t *count) {
+    return store->lookup(store, hash, count);
+}
+
+// First record in [lo, hi) whose leading `bits` bits are >= prefix
+static uint64_t lower_bound_prefix(const FlatStore *store, uint64_t lo, uint64_t hi,
+                                   uint32_t prefix, uint32_t bits) {
+    while (lo < hi) {
+        uint64_t mid = lo + (hi - lo) / 2;
+        if (hash_prefix(flat_record_hash(store, mid), bits) < prefix) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return lo;
+}
+
+/**
+ * Finds the contiguous run of records that share a hash prefix.
+ *
+ * When the requested prefix is at least as wide as the store's index the run is
+ * read straight from the index; otherwise the enclosing bucket is narrowed with
+ * two binary searches. Either way the caller can then walk the records in order.
+ *
+ * Parameters:
+ * - store (const FlatStore*): An open store.
+ * - prefix (uint32_t): Leading hash bits to match, right-aligned.
+ * - bits (uint32_t): Width of prefix in bits (1 to 32).
+ * - begin, end (uint64_t*): Receive the half-open record range [begin, end).
+ */
+void flat_prefix_range(const FlatStore *store, uint32_t prefix, uint32_t bits,
+                       uint64_t *begin, uint64_t *end) {
+    uint32_t index_bits = store->header->prefix_bits;
+    if (bits <= index_bits) {
+        uint32_t shift = index_bits - bits;
+        *begin = store->index[(uint64_t)prefix << shift];
+        *end = store->index[((uint64_t)prefix + 1) << shift];
+        return;
+    }
+
+    uint32_t bucket = prefix >> (bits - index_bits);
+    uint64_t lo = store->index[bucket];
+    uint64_t hi = store->index[bucket + 1];
+    *begin = lower_bound_prefix(store, lo, hi, prefix, bits);
+    *end = (uint64_t)prefix + 1 == ((uint64_t)1 << bits) ? hi : lower_bound_prefix(store, *begin, hi, prefix + 1, bits);
+}
+
+/**
+ * Bounds the records a stored hash can occupy without reading any record.
+ *
+ * Only the resident index sections are consulted: the learned index window of
+ * model_epsilon records around the prediction when the store has one, otherwise
+ * the hash's prefix bucket. A hash that is not inside [begin, end) is not in the
+ * store, which lets callers fetch the range with a single read of their own.
+ *
+ * Parameters:
+ * - store (const FlatStore*): An open store.
+ * - hash (const unsigned char*): The digest to locate; only its leading 8 bytes are read.
+ * - begin, end (uint64_t*): Receive the half-open record range, empty when the hash
+ *   sorts before every stored key.
+ */
+void flat_candidate_range(const FlatStore *store, const unsigned char *hash, uint64_t *begin, uint64_t *end) {
+    const FlatHeader *header = store->header;
+    if (!store->use_model) {
+        uint32_t prefix = hash_prefix(hash, header->prefix_bits);
+        *begin = store->index[prefix];
+        *end = store->index[prefix + 1];
+        return;
+    }
+
+    uint64_t key = hash_key(hash);
+    int64_t s = pla_find_segment(store->segments, store->model_radix, header->model_radix_bits, key);
+    if (s < 0) {
+        *begin = *end = 0;
+        return;
+    }
+    uint64_t seg_begin = store->segments[s].first_pos;
+    uint64_t seg_end = (uint64_t)s + 1 < header->model_segments ? store->segments[s + 1].first_pos
+                                                                 : header->record_count;
+    int64_t predicted = pla_predict(&store->segments[s], key);
+    int64_t eps = header->model_epsilon;
+    *begin = predicted - eps > (int64_t)seg_begin ? (uint64_t)(predicted - eps) : seg_begin;
+    // One past the window, as in model_lower_bound(): stores built before the error was measured at
+    // every record bound only the first of a run sharing the 64-bit key, and the second may follow it
+    *end = predicted + eps + 2 < (int64_t)seg_end ? (uint64_t)(predicted + eps + 2) : seg_end;
+    if (*begin > *end) {
+        *begin = *end;
+    }
+}
+
+// Releases the mapping and descriptor held by a store
+void flat_close(FlatStore *store) {
+    if (store->map != NULL) {
+        munmap((void *)store->map, store->map_size);
+    }
+    if (store->fd >= 0) {
+        close(store->fd);
+    }
+    memset(store, 0, sizeof(*store));
+    store->fd = -1;
+}
+
+int flat_writer_open(FlatWriter *writer, const char *path) {
+    return flat_writer_open_kind(writer, path, HASH_KIND_SHA1);
+}
+
+/**
+ * Creates a new flat store file and reserves space for its header.
+ *
+ * Parameters:
+ * - writer (FlatWriter*): Writer state to initialize.
+ * - path (const char*): Path of the store to create; an existing file is replaced.
+ * - kind (HashKind): Dataset of the store, which fixes the width of every hash added.
+ *
+ * Returns:
+ * - int: 0 on success, 1 if the file cannot be created.
+ */
+int flat_writer_open_kind(FlatWriter *writer, const char *path, HashKind kind) {
+    memset(writer, 0, sizeof(*writer));
+    writer->sorted = 1;
+    writer->kind = kind;
+    writer->hash_size = (uint32_t)hash_kind_size(kind);
+
+    writer->file = fopen(path, "w+b");
+    if (writer->file == NULL) {
+        fprintf(stderr, "Can't create flat store: %s\n", path);
+        return 1;
+    }
+    writer->path = strdup(path);
+
+    unsigned char placeholder[FLAT_HEADER_SIZE] = {0};
+    if (fwrite(placeholder, 1, sizeof(placeholder), writer->file) != sizeof(placeholder)) {
+        fprintf(stderr, "Failed to write flat store header: %s\n", path);
+        fclose(writer->file);
+        free(writer->path);
+        return 1;
+    }
+    return 0;
+}
+
+/**
+ * Appends one record to a flat store under construction.
+ *
+ * A duplicate of the previous hash replaces its count: the last count wins,
+ * as with the UPSERT of the SQLite importers. Out-of-order input is accepted
+ * and sorted later by flat_writer_finish(), which applies the same rule.
+ *
+ * Returns:
+ * - int: 0 on success, 1 on a write error.
+ */
+int flat_writer_add(FlatWriter *writer, const unsigned char *hash, uint32_t count) {
+    size_t hash_size = writer->hash_size;
+    if (writer->record_count > 0) {
+        int cmp = memcmp(hash, writer->last_hash, hash_size);
+        if (cmp == 0) {
+            // Rewrite the count of the record just written
+            if (fseeko(writer->file, -(off_t)sizeof(count), SEEK_CUR) != 0 ||
+                fwrite(&count, sizeof(count), 1, writer->file) != 1) {
+                fprintf(stderr, "Failed to write flat store record: %s\n", writer->path);
+                return 1;
+            }
+            return 0;
+        }
+        if (cmp < 0) {
+            writer->sorted = 0;
+        }
+    }
+
+    unsigned char record[sizeof(FlatRecord)];
+    memcpy(record, hash, hash_size);
+    memcpy(record + hash_size, &count, sizeof(count));
+    if (fwrite(record, hash_size + sizeof(count), 1, writer->file) != 1) {
+        fprintf(stderr, "Failed to write flat store record: %s\n", writer->path);
+        return 1;
+    }
+
+    memcpy(writer->last_hash, hash, hash_size);
+    writer->record_count++;
+    return 0;
+}
+
+// Fits the learned index over the sorted records and measures its real worst-case error
+static int build_model(const unsigned char *body, size_t record_size, uint64_t record_count, PlaBuilder *builder,
+                       uint16_t *epsilon) {
+    pla_builder_init(builder, FLAT_MODEL_EPSILON);
+    for (uint64_t i = 0; i < record_count; i++) {
+        uint64_t key = hash_key(body + i * record_size);
+        if ((i == 0 || key != hash_key(body + (i - 1) * record_size)) && pla_builder_add(builder, key, i) != 0) {
+            return 1;
+        }
+    }
+    if (pla_builder_finish(builder) != 0) {
+        return 1;
+    }
+
+    // The cone guarantees the bound in exact arithmetic; record what rounding actually left.
+    // Every record is measured, so hashes that share a 64-bit key past the first are covered too
+    int64_t worst = 0;
+    size_t s = 0;
+    for (uint64_t i = 0; i < record_count; i++) {
+        uint64_t key = hash_key(body + i * record_size);
+        while (s + 1 < builder->segment_count && builder->segments[s + 1].first_pos <= i) {
+            s++;
+        }
+        int64_t error = pla_predict(&builder->segments[s], key) - (int64_t)i;
+        if (error < 0) {
+            error = -error;
+        }
+        if (error > worst) {
+            worst = error;
+        }
+    }
+    *epsilon = worst > UINT16_MAX ? UINT16_MAX : (uint16_t)worst;
+    return 0;
+}
+
+/**
+ * Completes a flat store: sorts the records if needed, builds the prefix index
+ * and the learned index, and writes the final header.
+ *
+ * Sorting and index construction work on a shared mapping of the file, so the
+ * records never have to fit in the heap at once. The stable merge sort of
+ * unsorted input ping-pongs with an unlinked scratch file of the same size
+ * next to the store, which lives in the page cache rather than the heap.
+ *
+ * Returns:
+ * - int: 0 on success, 1 on failure. The writer is released in either case.
+ */
+int flat_writer_finish(FlatWriter *writer) {
+    int status = 1;
+    unsigned char *records = NULL;
+    unsigned char *scratch = NULL;
+    uint64_t *index = NULL;
+    uint32_t *radix = NULL;
+    PlaBuilder model;
+    pla_builder_init(&model, FLAT_MODEL_EPSILON);
+    size_t hash_size = writer->hash_size;
+    size_t record_size = hash_size + sizeof(uint32_t);
+    size_t records_size = writer->record_count * record_size;
+    int fd = fileno(writer->file);
+
+    if (fflush(writer->file) != 0) {
+        fprintf(stderr, "Failed to flush flat store: %s\n", writer->path);
+        goto done;
+    }
+
+    if (records_size > 0) {
+        records = mmap(NULL, FLAT_HEADER_SIZE + records_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        if (records == MAP_FAILED) {
+            records = NULL;
+            fprintf(stderr, "Can't map flat store for indexing: %s\n", writer->path);
+            goto done;
+        }
+    }
+    unsigned char *body = records ? records + FLAT_HEADER_SIZE : NULL;
+
+    if (!writer->sorted) {
+        if (writer->record_count > FLAT_SORT_RUN) {
+            scratch = map_sort_scratch(writer->path, records_size);
+            if (scratch == NULL) {
+                goto done;
+            }
+        }
+        flat_sort_records(body, scratch, writer->record_count, writer->kind);
+        if (scratch != NULL) {
+            munmap(scratch, records_size);
+            scratch = NULL;
+        }
+
+        // Duplicates that were not adjacent in the input are now, in input order; keep the last
+        uint64_t kept = 0;
+        for (uint64_t i = 0; i < writer->record_count; i++) {
+            if (kept > 0 && memcmp(body + (kept - 1) * record_size, body + i * record_size, hash_size) == 0) {
+                kept--;
+            }
+            memmove(body + kept * record_size, body + i * record_size, record_size);
+            kept++;
+        }
+        writer->record_count = kept;
+    }
+
+    FlatHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, FLAT_MAGIC, FLAT_MAGIC_SIZE);
+    header.version = FLAT_VERSION;
+    header.record_size = (uint32_t)record_size;
+    header.record_count = writer->record_count;
+    header.records_offset = FLAT_HEADER_SIZE;
+    header.index_offset = FLAT_HEADER_SIZE + writer->record_count * record_size;
+    header.prefix_bits = choose_prefix_bits(writer->record_count);
+
+    // index[p] is the first record whose prefix is >= p; index[1 << bits] closes the last bucket
+    uint64_t buckets = (uint64_t)1 << header.prefix_bits;
+    index = malloc((buckets + 1) * sizeof(uint64_t));
+    if (index == NULL) {
+        fprintf(stderr, "Memory allocation failed for flat store index!\n");
+        goto done;
+    }
+    uint64_t next = 0;
+    for (uint64_t p = 0; p < buckets; p++) {
+        while (next < writer->record_count && hash_prefix(body + next * record_size, header.prefix_bits) < p) {
+            next++;
+        }
+        index[p] = next;
+    }
+    index[buckets] = writer->record_count;
+
+    if (build_model(body, record_size, writer->record_count, &model, &header.model_epsilon) != 0) {
+        goto done;
+    }
+    header.model_segments = (uint32_t)model.segment_count;
+    header.model_radix_bits = (uint16_t)pla_radix_bits(model.segment_count);
+    header.model_offset = header.index_offset + (buckets + 1) * sizeof(uint64_t);
+    uint64_t radix_entries = ((uint64_t)1 << header.model_radix_bits) + 1;
+    radix = malloc(radix_entries * sizeof(uint32_t));
+    if (radix == NULL) {
+        fprintf(stderr, "Memory allocation failed for the learned index!\n");
+        goto done;
+    }
+    pla_build_radix(model.segments, model.segment_count, header.model_radix_bits, radix);
+
+    if (records != NULL) {
+        munmap(records, FLAT_HEADER_SIZE + records_size);
+        records = NULL;
+    }
+
+    if (ftruncate(fd, (off_t)header.index_offset) != 0 ||
+        fseeko(writer->file, (off_t)header.index_offset, SEEK_SET) != 0 ||
+        fwrite(index, sizeof(uint64_t), buckets + 1, writer->file) != buckets + 1 ||
+        fwrite(model.segments, sizeof(PlaSegment), model.segment_count, writer->file) != model.segment_count ||
+        fwrite(radix, sizeof(uint32_t), radix_entries, writer->file) != radix_entries ||
+        fseeko(writer->file, 0, SEEK_SET) != 0 ||
+        fwrite(&header, sizeof(header), 1, writer->file) != 1) {
+        fprintf(stderr, "Failed to write flat store index: %s\n", writer->path);
+        goto done;
+    }
+    status = 0;
+
+done:
+    if (records != NULL) {
+        munmap(records, FLAT_HEADER_SIZE + records_size);
+    }
+    if (scratch != NULL) {
+        munmap(scratch, records_size);
+    }
+    free(index);
+    free(radix);
+    pla_builder_free(&model);
+    if (fclose(writer->file) != 0) {
+        status = 1;
+    }
+    free(writer->path);
+    memset(writer, 0, sizeof(*writer));
+    return status;
+}
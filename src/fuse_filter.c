@@ -0,0 +1,355 @@
+#include "fuse_filter.h"
+#include "hash_util.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+_Static_assert(sizeof(FuseHeader) == 64, "FuseHeader must match its on-disk size");
+
+#define FUSE_ARITY 3
+#define FUSE_MAX_SEGMENT_LENGTH 262144
+
+static inline uint8_t fingerprint(uint64_t hash) {
+    return (uint8_t)(hash ^ (hash >> 32));
+}
+
+// Slot of a hashed key for one of its three segments; the low 36 hash bits pick offsets within them
+static inline uint32_t fuse_slot(const FuseFilter *filter, int index, uint64_t hash) {
+    uint64_t h = mulhi(hash, filter->segment_count_length);
+    h += (uint64_t)index * filter->segment_length;
+    uint64_t low = hash & ((1ULL << 36) - 1);
+    h ^= (low >> (36 - 18 * index)) & filter->segment_length_mask;
+    return (uint32_t)h;
+}
+
+uint64_t fuse_key(const unsigned char *binary_hash) {
+    return load_be64(binary_hash);
+}
+
+static int compare_keys(const void *a, const void *b) {
+    uint64_t x = *(const uint64_t *)a;
+    uint64_t y = *(const uint64_t *)b;
+    return (x > y) - (x < y);
+}
+
+// Sizes the slot array for `count` keys using the published binary fuse parameters
+static int fuse_allocate(FuseFilter *filter, size_t count) {
+    uint32_t segment_length = count == 0 ? 4 : 1u << (int)floor(log((double)count) / log(3.33) + 2.25);
+    if (segment_length > FUSE_MAX_SEGMENT_LENGTH) {
+        segment_length = FUSE_MAX_SEGMENT_LENGTH;
+    }
+    double size_factor = count <= 1 ? 0 : fmax(1.125, 0.875 + 0.25 * log(1000000.0) / log((double)count));
+    uint64_t capacity = count <= 1 ? 0 : (uint64_t)round((double)count * size_factor);
+
+    int64_t segment_count = (int64_t)((capacity + segment_length - 1) / segment_length) - (FUSE_ARITY - 1);
+    if (segment_count < 1) {
+        segment_count = 1;
+    }
+    uint64_t array_length = ((uint64_t)segment_count + FUSE_ARITY - 1) * segment_length;
+    if (array_length > UINT32_MAX) {
+        fprintf(stderr, "Too many keys for a single fuse filter: %zu\n", count);
+        return -1;
+    }
+
+    memset(filter, 0, sizeof(*filter));
+    filter->segment_length = segment_length;
+    filter->segment_length_mask = segment_length - 1;
+    filter->segment_count = (uint32_t)segment_count;
+    filter->segment_count_length = (uint32_t)segment_count * segment_length;
+    filter->array_length = (uint32_t)array_length;
+    filter->key_count = count;
+    filter->fingerprints = calloc(array_length, 1);
+    if (filter->fingerprints == NULL) {
+        fprintf(stderr, "Memory allocation failed for fuse filter!\n");
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * Builds a binary fuse filter over a set of 64-bit keys.
+ *
+ * Construction is the standard peeling process: every key is added to its
+ * three slots, slots holding a single key are repeatedly peeled off onto a
+ * stack, and the stack is unwound to assign fingerprints so that each key's
+ * three slots XOR to its fingerprint. If peeling gets stuck a new seed is tried.
+ *
+ * Parameters:
+ * - filter (FuseFilter*): Filter to build; owns its fingerprints afterwards.
+ * - keys (uint64_t*): Keys to add. Sorted and de-duplicated in place.
+ * - count (size_t): Number of keys.
+ *
+ * Returns:
+ * - int: 0 on success, -1 if memory runs out or no seed works.
+ *
+ * Note:
+ * - Construction needs roughly 22 bytes of scratch memory per key.
+ */
+int fuse_build(FuseFilter *filter, uint64_t *keys, size_t count) {
+    // Peeling needs distinct keys; input from a sorted store only needs the dedupe pass
+    int sorted = 1;
+    for (size_t i = 1; i < count && sorted; i++) {
+        sorted = keys[i - 1] <= keys[i];
+    }
+    if (!sorted) {
+        qsort(keys, count, sizeof(uint64_t), compare_keys);
+    }
+    size_t unique = 0;
+    for (size_t i = 0; i < count; i++) {
+        if (unique == 0 || keys[unique - 1] != keys[i]) {
+            keys[unique++] = keys[i];
+        }
+    }
+    count = unique;
+
+    if (fuse_allocate(filter, count) != 0) {
+        return -1;
+    }
+    if (count == 0) {
+        return 0;
+    }
+
+    uint32_t capacity = filter->array_length;
+    uint64_t *reverse_order = calloc(count + 1, sizeof(uint64_t));
+    uint8_t *reverse_h = malloc(count);
+    uint32_t *alone = malloc((size_t)capacity * sizeof(uint32_t));
+    uint8_t *t2count = calloc(capacity, 1);
+    uint64_t *t2hash = calloc(capacity, sizeof(uint64_t));
+
+    uint32_t block_bits = 1;
+    while (((uint32_t)1 << block_bits) < filter->segment_count) {
+        block_bits++;
+    }
+    uint32_t block = (uint32_t)1 << block_bits;
+    uint32_t *start_pos = malloc(block * sizeof(uint32_t));
+
+    int status = -1;
+    if (reverse_order == NULL || reverse_h == NULL || alone == NULL ||
+        t2count == NULL || t2hash == NULL || start_pos == NULL) {
+        fprintf(stderr, "Memory allocation failed for fuse filter construction!\n");
+        goto done;
+    }
+
+    uint64_t rng = 0x726b2b9d438b9d4dULL;
+    size_t stack_size = 0;
+    for (int attempt = 0; attempt < FUSE_MAX_ATTEMPTS; attempt++) {
+        filter->seed = splitmix64(&rng);
+        memset(reverse_order, 0, count * sizeof(uint64_t));
+        reverse_order[count] = 1;
+        memset(t2count, 0, capacity);
+        memset(t2hash, 0, (size_t)capacity * sizeof(uint64_t));
+
+        // Order hashes roughly by segment so the counting pass walks memory sequentially
+        for (uint32_t i = 0; i < block; i++) {
+            start_pos[i] = (uint32_t)(((uint64_t)i * count) >> block_bits);
+        }
+        for (size_t i = 0; i < count; i++) {
+            uint64_t hash = murmur64(keys[i] + filter->seed);
+            uint64_t segment = hash >> (64 - block_bits);
+            while (reverse_order[start_pos[segment]] != 0) {
+                segment = (segment + 1) & (block - 1);
+            }
+            reverse_order[start_pos[segment]] = hash;
+            start_pos[segment]++;
+        }
+
+        // Per slot: number of keys (count << 2), which of the three positions they used (XOR), and XOR of hashes
+        int overflow = 0;
+        for (size_t i = 0; i < count; i++) {
+            uint64_t hash = reverse_order[i];
+            for (int index = 0; index < FUSE_ARITY; index++) {
+                uint32_t slot = fuse_slot(filter, index, hash);
+                t2count[slot] += 4;
+                t2count[slot] ^= (uint8_t)index;
+                t2hash[slot] ^= hash;
+                overflow |= t2count[slot] < 4;
+            }
+        }
+        if (overflow) {
+            continue;
+        }
+
+        size_t queue_size = 0;
+        for (uint32_t i = 0; i < capacity; i++) {
+            alone[queue_size] = i;
+            queue_size += (t2count[i] >> 2) == 1;
+        }
+
+        stack_size = 0;
+        while (queue_size > 0) {
+            uint32_t index = alone[--queue_size];
+            if ((t2count[index] >> 2) != 1) {
+                continue;
+            }
+            uint64_t hash = t2hash[index];
+            uint8_t found = t2count[index] & 3;
+            reverse_h[stack_size] = found;
+            reverse_order[stack_size] = hash;
+            stack_size++;
+
+            // Remove the key from its two other slots, queueing any that become singletons
+            for (int other = 1; other < FUSE_ARITY; other++) {
+                int position = (found + other) % FUSE_ARITY;
+                uint32_t slot = fuse_slot(filter, position, hash);
+                alone[queue_size] = slot;
+                queue_size += (t2count[slot] >> 2) == 2;
+                t2count[slot] -= 4;
+                t2count[slot] ^= (uint8_t)position;
+                t2hash[slot] ^= hash;
+            }
+        }
+        if (stack_size == count) {
+            status = 0;
+            break;
+        }
+    }
+
+    if (status != 0) {
+        fprintf(stderr, "Fuse filter construction failed after %d seeds\n", FUSE_MAX_ATTEMPTS);
+        goto done;
+    }
+
+    // Unwind the peeling order so each key's free slot is assigned last
+    for (size_t i = stack_size; i-- > 0;) {
+        uint64_t hash = reverse_order[i];
+        uint8_t found = reverse_h[i];
+        uint32_t slots[FUSE_ARITY];
+        for (int index = 0; index < FUSE_ARITY; index++) {
+            slots[index] = fuse_slot(filter, index, hash);
+        }
+        filter->fingerprints[slots[found]] = (uint8_t)(fingerprint(hash) ^
+            filter->fingerprints[slots[(found + 1) % FUSE_ARITY]] ^
+            filter->fingerprints[slots[(found + 2) % FUSE_ARITY]]);
+    }
+
+done:
+    free(reverse_order);
+    free(reverse_h);
+    free(alone);
+    free(t2count);
+    free(t2hash);
+    free(start_pos);
+    if (status != 0) {
+        fuse_free(filter);
+    }
+    return status;
+}
+
+/**
+ * Tests whether a key may be in the filter.
+ *
+ * Three reads from the fingerprint array, each in a different segment, so a
+ * query costs at most three cache misses and never touches the main store.
+ *
+ * Returns:
+ * - int: 0 if the key is definitely absent, 1 if it is probably present.
+ */
+int fuse_contains(const FuseFilter *filter, uint64_t key) {
+    uint64_t hash = murmur64(key + filter->seed);
+    uint8_t f = fingerprint(hash);
+    f ^= filter->fingerprints[fuse_slot(filter, 0, hash)];
+    f ^= filter->fingerprints[fuse_slot(filter, 1, hash)];
+    f ^= filter->fingerprints[fuse_slot(filter, 2, hash)];
+    return f == 0;
+}
+
+// Writes the header and fingerprint array to a new file
+int fuse_save(const FuseFilter *filter, const char *path) {
+    // Written beside the target and renamed over it, so processes that have the
+    // old filter mapped never see it truncated
+    char tmp_path[4096];
+    snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", path);
+    FILE *file = fopen(tmp_path, "wb");
+    if (file == NULL) {
+        fprintf(stderr, "Can't create filter file: %s\n", tmp_path);
+        return -1;
+    }
+
+    FuseHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, FUSE_MAGIC, FUSE_MAGIC_SIZE);
+    header.version = FUSE_VERSION;
+    header.segment_length = filter->segment_length;
+    header.segment_count = filter->segment_count;
+    header.array_length = filter->array_length;
+    header.seed = filter->seed;
+    header.key_count = filter->key_count;
+
+    int ok = fwrite(&header, sizeof(header), 1, file) == 1 &&
+             fwrite(filter->fingerprints, 1, filter->array_length, file) == filter->array_length;
+    if (fclose(file) != 0 || !ok || rename(tmp_path, path) != 0) {
+        fprintf(stderr, "Failed to write filter file: %s\n", path);
+        remove(tmp_path);
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * Maps a filter file written by fuse_save().
+ *
+ * The fingerprints stay in the shared page cache mapping; they are read ahead
+ * on open because every query touches random slots across the whole array.
+ *
+ * Returns:
+ * - int: 0 on success, -1 if the file is missing or malformed.
+ */
+int fuse_open(FuseFilter *filter, const char *path) {
+    memset(filter, 0, sizeof(*filter));
+
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        return -1;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(FuseHeader)) {
+        fprintf(stderr, "Filter file is truncated: %s\n", path);
+        close(fd);
+        return -1;
+    }
+    void *map = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        fprintf(stderr, "Can't map filter file: %s\n", path);
+        return -1;
+    }
+
+    const FuseHeader *header = map;
+    if (memcmp(header->magic, FUSE_MAGIC, FUSE_MAGIC_SIZE) != 0 ||
+        header->version != FUSE_VERSION ||
+        header->segment_length == 0 ||
+        (header->segment_length & (header->segment_length - 1)) != 0 ||
+        (uint64_t)(header->segment_count + FUSE_ARITY - 1) * header->segment_length != header->array_length ||
+        sizeof(FuseHeader) + (uint64_t)header->array_length > (uint64_t)st.st_size) {
+        fprintf(stderr, "Filter file header is invalid: %s\n", path);
+        munmap(map, (size_t)st.st_size);
+        return -1;
+    }
+
+    filter->seed = header->seed;
+    filter->segment_length = header->segment_length;
+    filter->segment_length_mask = header->segment_length - 1;
+    filter->segment_count = header->segment_count;
+    filter->segment_count_length = header->segment_count * header->segment_length;
+    filter->array_length = header->array_length;
+    filter->key_count = header->key_count;
+    filter->map = map;
+    filter->map_size = (size_t)st.st_size;
+    filter->fingerprints = (uint8_t *)filter->map + sizeof(FuseHeader);
+    madvise(map, (size_t)st.st_size, MADV_WILLNEED);
+    return 0;
+}
+
+void fuse_free(FuseFilter *filter) {
+    if (filter->map != NULL) {
+        munmap((void *)filter->map, filter->map_size);
+    } else {
+        free(filter->fingerprints);
+    }
+    memset(filter, 0, sizeof(*filter));
+}
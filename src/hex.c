@@ -0,0 +1,36 @@
+#include "hex.h"
+
+// Nibble value of each hex digit tagged with 0x10; every other character maps to 0
+#define HEX_DIGIT(c, v) [c] = 0x10 | (v)
+static const unsigned char hex_table[256] = {
+    HEX_DIGIT('0', 0), HEX_DIGIT('1', 1), HEX_DIGIT('2', 2), HEX_DIGIT('3', 3),
+    HEX_DIGIT('4', 4), HEX_DIGIT('5', 5), HEX_DIGIT('6', 6), HEX_DIGIT('7', 7),
+    HEX_DIGIT('8', 8), HEX_DIGIT('9', 9),
+    HEX_DIGIT('A', 10), HEX_DIGIT('B', 11), HEX_DIGIT('C', 12),
+    HEX_DIGIT('D', 13), HEX_DIGIT('E', 14), HEX_DIGIT('F', 15),
+    HEX_DIGIT('a', 10), HEX_DIGIT('b', 11), HEX_DIGIT('c', 12),
+    HEX_DIGIT('d', 13), HEX_DIGIT('e', 14), HEX_DIGIT('f', 15),
+};
+#undef HEX_DIGIT
+
+// Table-driven hex decoder: returns 0 if all 2 * bytes characters were hex digits, -1 otherwise
+int hex_decode(const char *hex, unsigned char *bin, int bytes) {
+    const unsigned char *in = (const unsigned char *)hex;
+    unsigned char valid = 0x10;
+    for (int i = 0; i < bytes; ++i) {
+        unsigned char hi = hex_table[in[2*i]];
+        unsigned char lo = hex_table[in[2*i + 1]];
+        valid &= hi & lo;  // Drops the tag bit as soon as one character is not hex
+        bin[i] = (unsigned char)((hi << 4) | (lo & 0x0F));
+    }
+    return valid ? 0 : -1;
+}
+
+// Writes 2 * bytes uppercase hex digits (no terminator), the same form as the HIBP dump
+void hex_encode(const unsigned char *bin, int bytes, char *hex) {
+    static const char digits[] = "0123456789ABCDEF";
+    for (int i = 0; i < bytes; ++i) {
+        hex[2*i] = digits[bin[i] >> 4];
+        hex[2*i + 1] = digits[bin[i] & 0x0F];
+    }
+}
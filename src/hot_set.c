@@ -0,0 +1,243 @@
+#include "hot_set.h"
+#include "fuse_filter.h"
+#include "hash_util.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+_Static_assert(sizeof(HotHeader) == 64, "HotHeader must match its on-disk size");
+_Static_assert(sizeof(HotBucket) == 64, "A hot bucket must fill exactly one cache line");
+
+#define HOT_MAX_BUCKETS 0xFFFFFFFFu
+
+// Maps a 32-bit hash onto [0, n) with a multiply instead of a division
+static inline uint32_t fastrange32(uint32_t x, uint32_t n) {
+    return (uint32_t)(((uint64_t)x * n) >> 32);
+}
+
+// The two buckets a key may live in; they coincide now and then, which only costs a slot.
+// murmur64() spreads keys whose leading bits are all alike (every key of one shard) over the whole table
+static inline void hot_buckets_of(const HotSet *set, uint64_t key, uint32_t *first, uint32_t *second) {
+    uint64_t h = murmur64(key + set->seed);
+    *first = fastrange32((uint32_t)h, set->bucket_count);
+    *second = fastrange32((uint32_t)(h >> 32), set->bucket_count);
+}
+
+static uint64_t hot_bucket_count(uint64_t entries) {
+    uint64_t buckets = (uint64_t)ceil((double)entries / (HOT_BUCKET_SLOTS * HOT_LOAD_FACTOR));
+    return buckets ? buckets : 1;
+}
+
+uint64_t hot_entries_for_bytes(size_t bytes) {
+    return (uint64_t)((double)(bytes / sizeof(HotBucket)) * HOT_BUCKET_SLOTS * HOT_LOAD_FACTOR);
+}
+
+static HotBucket *hot_allocate(uint32_t bucket_count) {
+    size_t size = (size_t)bucket_count * sizeof(HotBucket);
+    HotBucket *buckets = aligned_alloc(sizeof(HotBucket), size);
+    if (buckets != NULL) {
+        memset(buckets, 0, size);
+    }
+    return buckets;
+}
+
+// Puts an entry in a free slot of the bucket; 0 if the bucket is full
+static inline int hot_place(HotBucket *bucket, const HotEntry *entry) {
+    for (int i = 0; i < HOT_BUCKET_SLOTS; i++) {
+        if (bucket->slots[i].count == 0) {
+            bucket->slots[i] = *entry;
+            return 1;
+        }
+    }
+    return 0;
+}
+
+// Cuckoo insertion by random walk: evict a random resident into its other bucket until one has room
+static int hot_insert(HotSet *set, HotEntry entry, uint64_t *rng) {
+    uint32_t first, second;
+    hot_buckets_of(set, fuse_key(entry.hash), &first, &second);
+    if (hot_place(&set->buckets[first], &entry) || hot_place(&set->buckets[second], &entry)) {
+        return 0;
+    }
+
+    uint32_t bucket = (splitmix64(rng) & 1) ? first : second;
+    for (int kick = 0; kick < HOT_MAX_KICKS; kick++) {
+        HotEntry *victim = &set->buckets[bucket].slots[splitmix64(rng) % HOT_BUCKET_SLOTS];
+        HotEntry evicted = *victim;
+        *victim = entry;
+        entry = evicted;
+
+        hot_buckets_of(set, fuse_key(entry.hash), &first, &second);
+        bucket = bucket == first ? second : first;
+        if (hot_place(&set->buckets[bucket], &entry)) {
+            return 0;
+        }
+    }
+    return -1; // The evicted entry is dropped; the caller starts over with a new seed
+}
+
+/**
+ * Builds a hot set over the given entries.
+ *
+ * The table is sized for HOT_LOAD_FACTOR. If an insertion cannot find room
+ * within HOT_MAX_KICKS evictions the table is rebuilt with a new seed, and after
+ * HOT_MAX_ATTEMPTS seeds it is grown by an eighth, so construction always ends.
+ *
+ * Parameters:
+ * - set (HotSet*): Receives the table.
+ * - entries (const HotEntry*): Distinct hashes with non-zero counts, zero past key_bytes.
+ * - count (size_t): Number of entries.
+ * - key_bytes (uint32_t): HOT_HASH_SIZE, HOT_NTLM_KEY_BYTES for an NTLM store, or HOT_PACKED_KEY_BYTES
+ *   for keys from a packed store.
+ *
+ * Returns:
+ * - int: 0 on success, -1 if memory runs out.
+ */
+int hot_build(HotSet *set, const HotEntry *entries, size_t count, uint32_t key_bytes) {
+    memset(set, 0, sizeof(*set));
+    uint64_t buckets = hot_bucket_count(count);
+    uint64_t rng = 0x2545F4914F6CDD1DULL ^ count;
+
+    while (buckets <= HOT_MAX_BUCKETS) {
+        set->bucket_count = (uint32_t)buckets;
+        for (int attempt = 0; attempt < HOT_MAX_ATTEMPTS; attempt++) {
+            set->seed = splitmix64(&rng);
+            set->buckets = hot_allocate(set->bucket_count);
+            if (set->buckets == NULL) {
+                fprintf(stderr, "Memory allocation failed for the hot set!\n");
+                return -1;
+            }
+            size_t placed = 0;
+            while (placed < count && hot_insert(set, entries[placed], &rng) == 0) {
+                placed++;
+            }
+            if (placed == count) {
+                set->entry_count = count;
+                set->key_bytes = key_bytes;
+                set->min_count = count ? UINT32_MAX : 0;
+                for (size_t i = 0; i < count; i++) {
+                    set->min_count = entries[i].count < set->min_count ? entries[i].count : set->min_count;
+                }
+                return 0;
+            }
+            free(set->buckets);
+            set->buckets = NULL;
+        }
+        buckets += buckets / 8 + 1;
+    }
+    fprintf(stderr, "Hot set of %zu entries is too large\n", count);
+    return -1;
+}
+
+/**
+ * Looks a hash up in the hot set.
+ *
+ * Reads the two candidate buckets, one cache line each, and compares every slot.
+ *
+ * Returns:
+ * - int: 1 with count set if the hash is one of the hot hashes, 0 otherwise.
+ */
+int hot_lookup(const HotSet *set, const unsigned char *binary_hash, uint32_t *count) {
+    uint32_t first, second;
+    hot_buckets_of(set, fuse_key(binary_hash), &first, &second);
+
+    const HotBucket *candidates[2] = {&set->buckets[first], &set->buckets[second]};
+    for (int b = 0; b < 2; b++) {
+        for (int i = 0; i < HOT_BUCKET_SLOTS; i++) {
+            const HotEntry *entry = &candidates[b]->slots[i];
+            if (entry->count != 0 && memcmp(entry->hash, binary_hash, set->key_bytes) == 0) {
+                *count = entry->count;
+                return 1;
+            }
+        }
+    }
+    return 0;
+}
+
+// Writes the header and buckets to a new file
+int hot_save(const HotSet *set, const char *path) {
+    // Renamed over the target, like the filter, so a process opening it never reads half a table
+    char tmp_path[4096];
+    snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", path);
+    FILE *file = fopen(tmp_path, "wb");
+    if (file == NULL) {
+        fprintf(stderr, "Can't create hot set file: %s\n", tmp_path);
+        return -1;
+    }
+
+    HotHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, HOT_MAGIC, HOT_MAGIC_SIZE);
+    header.version = HOT_VERSION;
+    header.bucket_count = set->bucket_count;
+    header.entry_count = set->entry_count;
+    header.seed = set->seed;
+    header.min_count = set->min_count;
+    header.key_bytes = set->key_bytes;
+
+    int ok = fwrite(&header, sizeof(header), 1, file) == 1 &&
+             fwrite(set->buckets, sizeof(HotBucket), set->bucket_count, file) == set->bucket_count;
+    if (fclose(file) != 0 || !ok || rename(tmp_path, path) != 0) {
+        fprintf(stderr, "Failed to write hot set file: %s\n", path);
+        remove(tmp_path);
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * Reads a hot set file written by hot_save() into cache-line-aligned heap memory.
+ *
+ * Unlike the filter, which is mapped, the table is copied: it is small, and a
+ * copy cannot be evicted under memory pressure along with the store's pages.
+ *
+ * Returns:
+ * - int: 0 on success, -1 if the file is missing or malformed.
+ */
+int hot_open(HotSet *set, const char *path) {
+    memset(set, 0, sizeof(*set));
+
+    FILE *file = fopen(path, "rb");
+    if (file == NULL) {
+        return -1;
+    }
+    HotHeader header;
+    if (fread(&header, sizeof(header), 1, file) != 1 ||
+        memcmp(header.magic, HOT_MAGIC, HOT_MAGIC_SIZE) != 0 ||
+        header.version != HOT_VERSION ||
+        header.bucket_count == 0 ||
+        (header.key_bytes != HOT_HASH_SIZE && header.key_bytes != HOT_NTLM_KEY_BYTES &&
+         header.key_bytes != HOT_PACKED_KEY_BYTES) ||
+        header.entry_count > (uint64_t)header.bucket_count * HOT_BUCKET_SLOTS) {
+        fprintf(stderr, "Hot set file header is invalid: %s\n", path);
+        fclose(file);
+        return -1;
+    }
+
+    set->buckets = hot_allocate(header.bucket_count);
+    if (set->buckets == NULL) {
+        fprintf(stderr, "Memory allocation failed for the hot set!\n");
+        fclose(file);
+        return -1;
+    }
+    if (fread(set->buckets, sizeof(HotBucket), header.bucket_count, file) != header.bucket_count) {
+        fprintf(stderr, "Hot set file is truncated: %s\n", path);
+        fclose(file);
+        hot_free(set);
+        return -1;
+    }
+    fclose(file);
+
+    set->bucket_count = header.bucket_count;
+    set->entry_count = header.entry_count;
+    set->seed = header.seed;
+    set->min_count = header.min_count;
+    set->key_bytes = header.key_bytes;
+    return 0;
+}
+
+void hot_free(HotSet *set) {
+    free(set->buckets);
+    memset(set, 0, sizeof(*set));
+}
@@ -0,0 +1,152 @@
+#include "pwned.h"
+#include "deep_check.h"
+
+#include <pthread.h>
+
+// Hashes sorted and looked up together by pwned_lookup_batch(), like one batch of batch mode
+#define PWNED_BATCH_CHUNK 4096
+
+_Static_assert(PWNED_HASH_SIZE == SHA_DIGEST_LENGTH, "The API hash size must match SHA-1");
+
+/**
+ * Library handle behind the opaque pwned_db.
+ *
+ * Components:
+ * - db (PwnedDB): The opened database.
+ * - lock (pthread_mutex_t): Serialises lookups when the backend cannot serve several
+ *   threads at once (an SQLite connection); unused otherwise.
+ * - locked (int): Non-zero when lookups take the lock.
+ */
+struct pwned_db {
+    PwnedDB db;
+    pthread_mutex_t lock;
+    int locked;
+};
+
+// Sort key for a batch: leading hash bytes plus the position they came from
+typedef struct {
+    uint64_t prefix;
+    uint32_t index;
+} BatchKey;
+
+int pwned_api_version(void) {
+    return PWNED_API_VERSION;
+}
+
+pwned_db *pwned_open(const char *path) {
+    if (path == NULL) {
+        return NULL;
+    }
+    pwned_db *handle = calloc(1, sizeof(pwned_db));
+    if (handle == NULL) {
+        fprintf(stderr, "Memory allocation failed for the database handle!\n");
+        return NULL;
+    }
+    if (init_db(&handle->db, path) != 0) {
+        free(handle);
+        return NULL;
+    }
+    if (handle->db.kind != HASH_KIND_SHA1) {
+        // The API takes PWNED_HASH_SIZE-byte keys
+        fprintf(stderr, "%s holds %s hashes; the library serves SHA-1 stores only\n", path, hash_kind_name(handle->db.kind));
+        close_db(&handle->db);
+        free(handle);
+        return NULL;
+    }
+    handle->locked = !db_thread_safe(&handle->db);
+    pthread_mutex_init(&handle->lock, NULL);
+    return handle;
+}
+
+int pwned_lookup(pwned_db *handle, const unsigned char *hash, int32_t *count) {
+    if (handle == NULL || hash == NULL) {
+        return -1;
+    }
+    int found_count = 0;
+    if (handle->locked) {
+        pthread_mutex_lock(&handle->lock);
+    }
+    int found = lookup_hash(&handle->db, hash, &found_count);
+    if (handle->locked) {
+        pthread_mutex_unlock(&handle->lock);
+    }
+    if (found == 1 && count != NULL) {
+        *count = found_count;
+    }
+    return found;
+}
+
+static int compare_batch_keys(const void *a, const void *b) {
+    uint64_t x = ((const BatchKey *)a)->prefix;
+    uint64_t y = ((const BatchKey *)b)->prefix;
+    return (x > y) - (x < y);
+}
+
+/**
+ * Looks up an array of binary hashes in one call.
+ *
+ * The hashes are taken in chunks of PWNED_BATCH_CHUNK and each chunk is looked up in
+ * hash order, so the store is read front to back as in batch mode. Results are
+ * written back in input order. Neither array is copied: bindings can pass the
+ * buffers they already own.
+ *
+ * Parameters:
+ * - handle (pwned_db*): A handle from pwned_open().
+ * - hashes (const unsigned char*): n digests of PWNED_HASH_SIZE bytes, back to back.
+ * - n (size_t): Number of hashes.
+ * - counts (int32_t*): Receives n results: the count, 0 when absent, -1 on error.
+ *
+ * Returns:
+ * - size_t: How many lookups failed; n if the handle or an array is missing.
+ */
+size_t pwned_lookup_batch(pwned_db *handle, const unsigned char *hashes, size_t n, int32_t *counts) {
+    if (handle == NULL || hashes == NULL || counts == NULL) {
+        return n;
+    }
+    // Without memory for the sort keys the lookups still run, just in input order
+    BatchKey *keys = malloc((n < PWNED_BATCH_CHUNK ? n : PWNED_BATCH_CHUNK) * sizeof(BatchKey) + 1);
+    size_t failed = 0;
+
+    for (size_t start = 0; start < n; start += PWNED_BATCH_CHUNK) {
+        size_t chunk = n - start < PWNED_BATCH_CHUNK ? n - start : PWNED_BATCH_CHUNK;
+        if (keys != NULL) {
+            for (size_t i = 0; i < chunk; i++) {
+                const unsigned char *hash = hashes + (start + i) * PWNED_HASH_SIZE;
+                uint64_t prefix = 0;
+                for (int b = 0; b < 8; b++) {
+                    prefix = (prefix << 8) | hash[b];
+                }
+                keys[i].prefix = prefix;
+                keys[i].index = (uint32_t)i;
+            }
+            qsort(keys, chunk, sizeof(BatchKey), compare_batch_keys);
+        }
+
+        if (handle->locked) {
+            pthread_mutex_lock(&handle->lock);
+        }
+        for (size_t k = 0; k < chunk; k++) {
+            size_t i = start + (keys != NULL ? keys[k].index : k);
+            int count = 0;
+            int found = lookup_hash(&handle->db, hashes + i * PWNED_HASH_SIZE, &count);
+            if (found < 0) {
+                failed++;
+            }
+            counts[i] = found < 0 ? -1 : (found ? count : 0);
+        }
+        if (handle->locked) {
+            pthread_mutex_unlock(&handle->lock);
+        }
+    }
+    free(keys);
+    return failed;
+}
+
+void pwned_close(pwned_db *handle) {
+    if (handle == NULL) {
+        return;
+    }
+    close_db(&handle->db);
+    pthread_mutex_destroy(&handle->lock);
+    free(handle);
+}
@@ -0,0 +1,105 @@
+#include "lookup_daemon.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+int daemon_connect(const char *socket_path) {
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (strlen(socket_path) >= sizeof(addr.sun_path)) {
+        fprintf(stderr, "Socket path too long: %s\n", socket_path);
+        return -1;
+    }
+    strcpy(addr.sun_path, socket_path);
+
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0) {
+        fprintf(stderr, "Can't create socket: %s\n", strerror(errno));
+        return -1;
+    }
+    if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0) {
+        fprintf(stderr, "Can't reach the daemon at %s: %s\n", socket_path, strerror(errno));
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+static int send_all(int fd, const void *data, size_t len) {
+    const char *p = data;
+    while (len > 0) {
+        ssize_t n = send(fd, p, len, MSG_NOSIGNAL);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return -1;
+        }
+        p += n;
+        len -= (size_t)n;
+    }
+    return 0;
+}
+
+static int recv_all(int fd, void *data, size_t len) {
+    char *p = data;
+    while (len > 0) {
+        ssize_t n = recv(fd, p, len, 0);
+        if (n <= 0) {
+            if (n < 0 && errno == EINTR) {
+                continue;
+            }
+            return -1;
+        }
+        p += n;
+        len -= (size_t)n;
+    }
+    return 0;
+}
+
+/**
+ * Sends one batched lookup request and waits for its answer.
+ *
+ * Parameters:
+ * - fd (int): Socket returned by daemon_connect().
+ * - hashes (const unsigned char (*)[20]): Binary SHA-1 digests to look up.
+ * - count (uint32_t): Number of digests, at most DAEMON_MAX_BATCH.
+ * - results (int32_t*): Receives one result per digest, in request order.
+ *
+ * Returns:
+ * - int: 0 on success, -1 if the request could not be sent or the reply was malformed.
+ */
+int daemon_lookup(int fd, const unsigned char (*hashes)[SHA_DIGEST_LENGTH], uint32_t count, int32_t *results) {
+    if (count > DAEMON_MAX_BATCH) {
+        return -1;
+    }
+    DaemonHeader header = {DAEMON_MAGIC, count};
+    if (send_all(fd, &header, sizeof(header)) != 0 ||
+        send_all(fd, hashes, (size_t)count * SHA_DIGEST_LENGTH) != 0) {
+        return -1;
+    }
+    if (recv_all(fd, &header, sizeof(header)) != 0 || header.magic != DAEMON_MAGIC || header.count != count) {
+        return -1;
+    }
+    return recv_all(fd, results, (size_t)count * sizeof(int32_t));
+}
+
+int daemon_check_password(int fd, const unsigned char *binary_hash) {
+    int32_t result;
+    if (daemon_lookup(fd, (const unsigned char (*)[SHA_DIGEST_LENGTH])binary_hash, 1, &result) != 0 ||
+        result == DAEMON_RESULT_ERROR) {
+        return -1;
+    }
+
+    if (result > 0) {
+        printf("Password found in pwned list with %d occurrences!\n", (int)result);
+    } else {
+        printf("Password not found in pwned list.\n");
+    }
+    return 0;
+}
@@ -0,0 +1,278 @@
+#include "deep_check.h"
+#include "lookup_stats.h"
+#include "warmup.h"
+#include "event_server.h"
+#include "lookup_daemon.h"
+
+#include <errno.h>
+#include <getopt.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+
+#define DAEMON_REQUEST_LIMIT (sizeof(DaemonHeader) + DAEMON_MAX_BATCH * SHA_DIGEST_LENGTH)
+
+typedef struct {
+    PwnedDB *shared_db;
+    const char *db_path;
+} Daemon;
+
+/**
+ * Answers every complete request buffered on a connection.
+ *
+ * Each hash of a request is looked up in order and its result appended to
+ * the connection's output, behind a header echoing the request's count.
+ *
+ * Returns:
+ * - int: 0 to keep the connection, -1 if it sent a malformed header or memory ran out.
+ */
+static int process_requests(ServerConnection *conn, void *worker) {
+    PwnedDB *db = worker;
+    size_t consumed = 0;
+    for (;;) {
+        DaemonHeader header;
+        if (conn->in_len - consumed < sizeof(header)) {
+            break;
+        }
+        memcpy(&header, conn->in + consumed, sizeof(header));
+        if (header.magic != DAEMON_MAGIC || header.count > DAEMON_MAX_BATCH) {
+            return -1;
+        }
+        size_t request_len = sizeof(header) + (size_t)header.count * SHA_DIGEST_LENGTH;
+        if (conn->in_len - consumed < request_len) {
+            break;
+        }
+
+        if (server_out_reserve(conn, sizeof(header) + (size_t)header.count * sizeof(int32_t)) != 0) {
+            return -1;
+        }
+        memcpy(conn->out + conn->out_len, &header, sizeof(header));
+        conn->out_len += sizeof(header);
+
+        const unsigned char *hashes = (const unsigned char *)conn->in + consumed + sizeof(header);
+        for (uint32_t i = 0; i < header.count; i++) {
+            int count = 0;
+            int found = lookup_hash(db, hashes + (size_t)i * SHA_DIGEST_LENGTH, &count);
+            int32_t result = found < 0 ? DAEMON_RESULT_ERROR : (found ? count : 0);
+            memcpy(conn->out + conn->out_len, &result, sizeof(result));
+            conn->out_len += sizeof(result);
+        }
+        consumed += request_len;
+    }
+
+    memmove(conn->in, conn->in + consumed, conn->in_len - consumed);
+    conn->in_len -= consumed;
+    return 0;
+}
+
+// SQLite connections (also those of SQLite shards) are per thread and opened once; mapped stores are shared
+static void *open_worker_db(void *ctx) {
+    Daemon *daemon = ctx;
+    if (db_thread_safe(daemon->shared_db)) {
+        return daemon->shared_db;
+    }
+    PwnedDB *own_db = malloc(sizeof(PwnedDB));
+    if (own_db == NULL || init_db(own_db, daemon->db_path) != 0) {
+        fprintf(stderr, "Worker failed to open the database.\n");
+        exit(1);
+    }
+    return own_db;
+}
+
+static void close_worker_db(void *worker, void *ctx) {
+    Daemon *daemon = ctx;
+    if (worker != daemon->shared_db) {
+        close_db(worker);
+        free(worker);
+    }
+}
+
+/**
+ * Binds the listening Unix socket.
+ *
+ * A socket file left behind by a daemon that died is replaced, but one that
+ * still accepts connections belongs to a running daemon and is left alone.
+ * Anything at the path that is not a socket is refused, never deleted.
+ */
+static int open_listener(const char *socket_path) {
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (strlen(socket_path) >= sizeof(addr.sun_path)) {
+        fprintf(stderr, "Socket path too long: %s\n", socket_path);
+        return -1;
+    }
+    strcpy(addr.sun_path, socket_path);
+
+    int probe = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (probe >= 0 && connect(probe, (struct sockaddr *)&addr, sizeof(addr)) == 0) {
+        fprintf(stderr, "A daemon is already listening on %s\n", socket_path);
+        close(probe);
+        return -1;
+    }
+    if (probe >= 0) {
+        close(probe);
+    }
+    struct stat st;
+    if (lstat(socket_path, &st) == 0) {
+        if (!S_ISSOCK(st.st_mode)) {
+            fprintf(stderr, "%s exists and is not a socket; not replacing it\n", socket_path);
+            return -1;
+        }
+        unlink(socket_path);
+    }
+
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd < 0) {
+        fprintf(stderr, "Can't create socket: %s\n", strerror(errno));
+        return -1;
+    }
+    if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0 || listen(fd, SOMAXCONN) != 0) {
+        fprintf(stderr, "Can't listen on %s: %s\n", socket_path, strerror(errno));
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+static void usage(const char *program) {
+    fprintf(stderr,
+            "Usage: %s [options] [database_path]\n"
+            "  -s, --socket PATH    Unix socket to listen on (default " DAEMON_SOCKET_PATH ")\n"
+            "  -t, --threads N      Worker threads (default: one per core)\n"
+            "  -c, --check-blocks   Verify each block of a flat store against its checksums the first\n"
+            "                       time a lookup reads it; a damaged block fails the lookup\n"
+            "  -w, --warm[=all]     Fault the store's indexes (or with \"all\", every page) in on the\n"
+            "                       worker threads before listening, and report the time to warm\n"
+            "  -P, --hugepages[=explicit]  Move the store's indexes onto transparent huge pages, or\n"
+            "                       onto reserved ones (vm.nr_hugepages) with \"explicit\"\n"
+            "  -l, --mlock MB       Lock up to MB of the store in memory, indexes first\n"
+            "  -S, --stats[=faults] Measure lookups and print a summary on shutdown;\n"
+            "                       \"faults\" also samples page faults per lookup\n"
+            "  -m, --metrics-file PATH  Rewrite PATH in Prometheus text format every %d s;\n"
+            "                       measures lookups even without --stats\n"
+            "  -h, --help           Show this message\n",
+            program, STATS_METRICS_INTERVAL_MS / 1000);
+}
+
+/**
+ * Resident lookup daemon.
+ *
+ * Opens the store once and answers batched binary lookups (see lookup_daemon.h)
+ * over a Unix socket, so repeated checks skip init_db() and find the index pages
+ * already warm. A single epoll loop accepts clients and hands ready connections
+ * to a pool of worker threads. Delta segments written after startup are picked
+ * up on restart.
+ */
+int main(int argc, char *argv[]) {
+    const char *socket_path = DAEMON_SOCKET_PATH;
+    int threads = 0;
+    unsigned stats_flags = 0;
+    int print_stats = 0;
+    const char *metrics_path = NULL;
+    WarmupOptions warm_options = {WARM_PREFETCH_NONE, WARM_HUGE_PAGES_OFF, 0, 0};
+
+    static const struct option long_options[] = {
+        {"socket",  required_argument, NULL, 's'},
+        {"threads", required_argument, NULL, 't'},
+        {"check-blocks", no_argument, NULL, 'c'},
+        {"warm",    optional_argument, NULL, 'w'},
+        {"hugepages", optional_argument, NULL, 'P'},
+        {"mlock",   required_argument, NULL, 'l'},
+        {"stats",   optional_argument, NULL, 'S'},
+        {"metrics-file", required_argument, NULL, 'm'},
+        {"help",    no_argument,       NULL, 'h'},
+        {NULL, 0, NULL, 0}
+    };
+    int opt;
+    while ((opt = getopt_long(argc, argv, "s:t:cw::P::l:S::m:h", long_options, NULL)) != -1) {
+        switch (opt) {
+            case 's': socket_path = optarg; break;
+            case 't': threads = atoi(optarg); break;
+            case 'c': db_enable_block_checks(1); break;
+            case 'w':
+                if (warmup_parse_prefetch(optarg, &warm_options.prefetch) != 0) {
+                    usage(argv[0]);
+                    return 1;
+                }
+                break;
+            case 'P':
+                if (warmup_parse_huge_pages(optarg, &warm_options.huge_pages) != 0) {
+                    usage(argv[0]);
+                    return 1;
+                }
+                break;
+            case 'l': warm_options.lock_budget = (uint64_t)(atof(optarg) * 1024 * 1024); break;
+            case 'S':
+                print_stats = 1;
+                if (lookup_stats_parse(optarg, &stats_flags) != 0) {
+                    usage(argv[0]);
+                    return 1;
+                }
+                break;
+            case 'm':
+                metrics_path = optarg;
+                stats_flags |= LOOKUP_STATS_TIMING;
+                break;
+            case 'h': usage(argv[0]); return 0;
+            default: usage(argv[0]); return 1;
+        }
+    }
+    if (threads <= 0) {
+        long cores = sysconf(_SC_NPROCESSORS_ONLN);
+        threads = cores > 0 ? (int)cores : 1;
+    }
+    lookup_stats_enable(stats_flags);
+
+    Daemon daemon;
+    daemon.db_path = optind < argc ? argv[optind] : "database/pwnedpasswords.db";
+
+    PwnedDB db;
+    if (init_db(&db, daemon.db_path) != 0) {
+        fprintf(stderr, "Failed to initialize the database.\n");
+        return 1;
+    }
+    if (db.kind != HASH_KIND_SHA1) {
+        // Requests carry SHA_DIGEST_LENGTH-byte hashes
+        fprintf(stderr, "%s holds %s hashes; the daemon serves SHA-1 stores only.\n", daemon.db_path, hash_kind_name(db.kind));
+        close_db(&db);
+        return 1;
+    }
+    if (warmup_requested(&warm_options)) {
+        // Warm before listening, so the first request after a deploy finds the indexes resident
+        WarmupReport warm_report;
+        warm_options.threads = threads;
+        if (db_warm(&db, &warm_options, &warm_report) != 0) {
+            fprintf(stderr, "Failed to warm the database.\n");
+            return 1;
+        }
+        warmup_print_report(stdout, &warm_report);
+    }
+    daemon.shared_db = &db;
+
+    int listen_fd = open_listener(socket_path);
+    if (listen_fd < 0) {
+        close_db(&db);
+        return 1;
+    }
+
+    printf("Serving lookups on %s with %d workers\n", socket_path, threads);
+    fflush(stdout);
+
+    ServerHandlers handlers = {DAEMON_REQUEST_LIMIT, process_requests, open_worker_db, close_worker_db, &daemon,
+                               metrics_path};
+    int rc = server_run(listen_fd, threads, &handlers);
+
+    close(listen_fd);
+    unlink(socket_path);
+    close_db(&db);
+    if (rc != 0) {
+        return 1;
+    }
+    if (print_stats) {
+        lookup_stats_print(stderr);
+    }
+    printf("Daemon stopped.\n");
+    return 0;
+}
@@ -0,0 +1,478 @@
+#define _GNU_SOURCE // For RUSAGE_THREAD
+
+#include "lookup_stats.h"
+
+#include <pthread.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+
+// Page faults are counted for the calling thread where the kernel can, for the process otherwise
+#ifdef RUSAGE_THREAD
+#define STATS_RUSAGE_WHO RUSAGE_THREAD
+#else
+#define STATS_RUSAGE_WHO RUSAGE_SELF
+#endif
+
+/**
+ * Counters owned by one thread.
+ *
+ * Only the owning thread writes them, so an update is a relaxed load and store
+ * rather than a locked read-modify-write; snapshots read them with relaxed
+ * loads and may be a few operations behind, never torn.
+ */
+typedef struct ThreadStats {
+    _Atomic uint64_t hits;
+    _Atomic uint64_t misses;
+    _Atomic uint64_t errors;
+    _Atomic uint64_t filter_rejects;
+    _Atomic uint64_t delta_hits;
+    _Atomic uint64_t hot_hits;
+    _Atomic uint64_t fault_samples;
+    _Atomic uint64_t minor_faults;
+    _Atomic uint64_t major_faults;
+    _Atomic uint64_t cold_lookups;
+    _Atomic uint64_t sqlite_cache_hits;
+    _Atomic uint64_t sqlite_cache_misses;
+    _Atomic uint64_t range_errors;
+    _Atomic uint64_t lookup_count, lookup_sum_ns, lookup_max_ns;
+    _Atomic uint64_t range_count, range_sum_ns, range_max_ns;
+    _Atomic uint64_t lookup_buckets[STATS_BUCKETS];
+    _Atomic uint64_t range_buckets[STATS_BUCKETS];
+    struct ThreadStats *next;
+} ThreadStats;
+
+atomic_uint lookup_stats_mode = 0;
+
+// Every thread's counters, newest first; entries outlive their threads so totals never go backwards
+static ThreadStats *registry = NULL;
+static pthread_mutex_t registry_lock = PTHREAD_MUTEX_INITIALIZER;
+static _Thread_local ThreadStats *local_stats = NULL;
+
+void lookup_stats_enable(unsigned flags) {
+    atomic_store(&lookup_stats_mode, flags);
+}
+
+int lookup_stats_parse(const char *arg, unsigned *flags) {
+    if (arg == NULL || strcmp(arg, "timing") == 0) {
+        *flags = LOOKUP_STATS_TIMING;
+    } else if (strcmp(arg, "faults") == 0) {
+        *flags = LOOKUP_STATS_TIMING | LOOKUP_STATS_FAULTS;
+    } else {
+        return -1;
+    }
+    return 0;
+}
+
+uint64_t lookup_stats_now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+// The calling thread's counters, registered on first use; NULL if they could not be allocated
+static ThreadStats *thread_stats(void) {
+    if (local_stats == NULL) {
+        ThreadStats *stats = calloc(1, sizeof(ThreadStats));
+        if (stats == NULL) {
+            return NULL;
+        }
+        pthread_mutex_lock(&registry_lock);
+        stats->next = registry;
+        registry = stats;
+        pthread_mutex_unlock(&registry_lock);
+        local_stats = stats;
+    }
+    return local_stats;
+}
+
+static inline void bump(_Atomic uint64_t *counter, uint64_t n) {
+    atomic_store_explicit(counter, atomic_load_explicit(counter, memory_order_relaxed) + n, memory_order_relaxed);
+}
+
+static inline void raise_max(_Atomic uint64_t *counter, uint64_t value) {
+    if (value > atomic_load_explicit(counter, memory_order_relaxed)) {
+        atomic_store_explicit(counter, value, memory_order_relaxed);
+    }
+}
+
+// Log-linear bucket of a latency: exact below 16 ns, then 16 buckets per power of two
+static unsigned bucket_of(uint64_t ns) {
+    if (ns < (1u << STATS_SUB_BUCKET_BITS)) {
+        return (unsigned)ns;
+    }
+    unsigned exponent = 63 - (unsigned)__builtin_clzll(ns);
+    if (exponent > STATS_MAX_EXPONENT) {
+        return STATS_BUCKETS - 1;
+    }
+    unsigned sub = (unsigned)(ns >> (exponent - STATS_SUB_BUCKET_BITS)) & ((1u << STATS_SUB_BUCKET_BITS) - 1);
+    return ((exponent - STATS_SUB_BUCKET_BITS + 1) << STATS_SUB_BUCKET_BITS) + sub;
+}
+
+// One past the largest latency that falls in a bucket
+static uint64_t bucket_limit(unsigned bucket) {
+    if (bucket < (1u << STATS_SUB_BUCKET_BITS)) {
+        return bucket + 1;
+    }
+    unsigned exponent = (bucket >> STATS_SUB_BUCKET_BITS) + STATS_SUB_BUCKET_BITS - 1;
+    uint64_t sub = bucket & ((1u << STATS_SUB_BUCKET_BITS) - 1);
+    uint64_t width = (uint64_t)1 << (exponent - STATS_SUB_BUCKET_BITS);
+    return (((uint64_t)1 << STATS_SUB_BUCKET_BITS) + sub + 1) * width;
+}
+
+#ifdef __linux__
+// Whether the page holding the first candidate record is in the page cache, before the lookup touches it
+static int flat_page_resident(const FlatStore *store, const unsigned char *binary_hash) {
+    uint64_t begin, end;
+    flat_candidate_range(store, binary_hash, &begin, &end);
+    if (begin >= end) {
+        return 1;
+    }
+    uintptr_t page_size = (uintptr_t)getpagesize();
+    uintptr_t address = (uintptr_t)flat_record_hash(store, begin) & ~(page_size - 1);
+    unsigned char resident = 1;
+    if (mincore((void *)address, page_size, &resident) != 0) {
+        return 1;
+    }
+    return resident & 1;
+}
+#endif
+
+/**
+ * Looks up a hash exactly as lookup_hash() does, recording where the answer came from.
+ *
+ * The delta segments, hot set and filter are asked first, shard by shard, so a
+ * filter reject, a delta hit or a hot-set hit is attributed as such; only then
+ * is the base store queried. With LOOKUP_STATS_FAULTS the thread's fault counters are read around
+ * the lookup and, for a flat store, the residency of the record page is checked
+ * before it is touched. An SQLite lookup adds the connection's page-cache hits
+ * and misses, which are reset as they are read.
+ *
+ * Parameters:
+ * - db (PwnedDB*): An initialized database handle.
+ * - binary_hash (const unsigned char*): The digest to look for, db->hash_size bytes.
+ * - count (int*): Receives the breach count when the hash is found.
+ *
+ * Returns:
+ * - int: 1 if the hash is present, 0 if it is not, -1 on a query error.
+ */
+int lookup_hash_measured(PwnedDB *db, const unsigned char *binary_hash, int *count) {
+    unsigned mode = lookup_stats_active();
+    ThreadStats *stats = thread_stats();
+    struct rusage before, after;
+    int faults = stats != NULL && (mode & LOOKUP_STATS_FAULTS) && getrusage(STATS_RUSAGE_WHO, &before) == 0;
+    uint64_t start = lookup_stats_now_ns();
+
+    int found;
+    LookupSource source = LOOKUP_FROM_BASE;
+    int cold = 0;
+    for (;;) {
+        found = lookup_overlay_source(db, binary_hash, count, &source);
+        if (found != LOOKUP_NEEDS_BASE) {
+            break;
+        }
+        if (db->backend == DB_BACKEND_SHARDED) {
+            db = &db->shards[shard_of(binary_hash, db->shard_bits)];
+            continue;
+        }
+#ifdef __linux__
+        if (faults && db->backend == DB_BACKEND_FLAT) {
+            cold = !flat_page_resident(&db->flat, binary_hash);
+        }
+#endif
+        found = lookup_base(db, binary_hash, count);
+        break;
+    }
+
+    uint64_t elapsed = lookup_stats_now_ns() - start;
+    if (stats == NULL) {
+        return found;
+    }
+    if (faults && getrusage(STATS_RUSAGE_WHO, &after) == 0) {
+        bump(&stats->fault_samples, 1);
+        bump(&stats->minor_faults, (uint64_t)(after.ru_minflt - before.ru_minflt));
+        bump(&stats->major_faults, (uint64_t)(after.ru_majflt - before.ru_majflt));
+        bump(&stats->cold_lookups, (uint64_t)cold);
+    }
+    if (source == LOOKUP_FROM_BASE && db->backend == DB_BACKEND_SQLITE) {
+        int hit = 0, miss = 0, high;
+        sqlite3_db_status(db->sqlite, SQLITE_DBSTATUS_CACHE_HIT, &hit, &high, 1);
+        sqlite3_db_status(db->sqlite, SQLITE_DBSTATUS_CACHE_MISS, &miss, &high, 1);
+        bump(&stats->sqlite_cache_hits, (uint64_t)hit);
+        bump(&stats->sqlite_cache_misses, (uint64_t)miss);
+    }
+
+    if (found < 0) {
+        bump(&stats->errors, 1);
+    } else if (found) {
+        bump(&stats->hits, 1);
+        bump(&stats->delta_hits, (uint64_t)(source == LOOKUP_FROM_DELTA));
+        bump(&stats->hot_hits, (uint64_t)(source == LOOKUP_FROM_HOT));
+    } else {
+        bump(&stats->misses, 1);
+        bump(&stats->filter_rejects, (uint64_t)(source == LOOKUP_FROM_FILTER));
+    }
+    bump(&stats->lookup_count, 1);
+    bump(&stats->lookup_sum_ns, elapsed);
+    raise_max(&stats->lookup_max_ns, elapsed);
+    bump(&stats->lookup_buckets[bucket_of(elapsed)], 1);
+    return found;
+}
+
+/**
+ * Records lookups that were answered as one batch, such as the overlapped reads
+ * of async_lookup_batch(), where no single lookup has a latency of its own.
+ *
+ * Every lookup of the batch is recorded with the batch time divided by its
+ * size, so the mean is exact while the percentiles and maximum describe
+ * batch averages rather than individual lookups.
+ *
+ * Parameters:
+ * - tally (const LookupBatchTally*): What the batch answered.
+ * - elapsed_ns (uint64_t): Time taken by the whole batch.
+ */
+void lookup_stats_record_batch(const LookupBatchTally *tally, uint64_t elapsed_ns) {
+    ThreadStats *stats = thread_stats();
+    if (stats == NULL || tally->lookups == 0) {
+        return;
+    }
+    uint64_t share = elapsed_ns / tally->lookups;
+    bump(&stats->hits, tally->hits);
+    bump(&stats->errors, tally->errors);
+    bump(&stats->misses, tally->lookups - tally->hits - tally->errors);
+    bump(&stats->filter_rejects, tally->filter_rejects);
+    bump(&stats->delta_hits, tally->delta_hits);
+    bump(&stats->hot_hits, tally->hot_hits);
+    bump(&stats->lookup_count, tally->lookups);
+    bump(&stats->lookup_sum_ns, elapsed_ns);
+    raise_max(&stats->lookup_max_ns, share);
+    bump(&stats->lookup_buckets[bucket_of(share)], tally->lookups);
+}
+
+void lookup_stats_record_range(uint64_t elapsed_ns, int rc) {
+    ThreadStats *stats = thread_stats();
+    if (stats == NULL) {
+        return;
+    }
+    bump(&stats->range_errors, rc != 0);
+    bump(&stats->range_count, 1);
+    bump(&stats->range_sum_ns, elapsed_ns);
+    raise_max(&stats->range_max_ns, elapsed_ns);
+    bump(&stats->range_buckets[bucket_of(elapsed_ns)], 1);
+}
+
+static inline uint64_t read_counter(_Atomic uint64_t *counter) {
+    return atomic_load_explicit(counter, memory_order_relaxed);
+}
+
+void lookup_stats_snapshot(LookupStatsSnapshot *snapshot) {
+    memset(snapshot, 0, sizeof(*snapshot));
+    pthread_mutex_lock(&registry_lock);
+    for (ThreadStats *stats = registry; stats != NULL; stats = stats->next) {
+        snapshot->hits += read_counter(&stats->hits);
+        snapshot->misses += read_counter(&stats->misses);
+        snapshot->errors += read_counter(&stats->errors);
+        snapshot->filter_rejects += read_counter(&stats->filter_rejects);
+        snapshot->delta_hits += read_counter(&stats->delta_hits);
+        snapshot->hot_hits += read_counter(&stats->hot_hits);
+        snapshot->fault_samples += read_counter(&stats->fault_samples);
+        snapshot->minor_faults += read_counter(&stats->minor_faults);
+        snapshot->major_faults += read_counter(&stats->major_faults);
+        snapshot->cold_lookups += read_counter(&stats->cold_lookups);
+        snapshot->sqlite_cache_hits += read_counter(&stats->sqlite_cache_hits);
+        snapshot->sqlite_cache_misses += read_counter(&stats->sqlite_cache_misses);
+        snapshot->range_errors += read_counter(&stats->range_errors);
+
+        snapshot->lookup.count += read_counter(&stats->lookup_count);
+        snapshot->lookup.sum_ns += read_counter(&stats->lookup_sum_ns);
+        uint64_t max = read_counter(&stats->lookup_max_ns);
+        snapshot->lookup.max_ns = max > snapshot->lookup.max_ns ? max : snapshot->lookup.max_ns;
+        snapshot->range.count += read_counter(&stats->range_count);
+        snapshot->range.sum_ns += read_counter(&stats->range_sum_ns);
+        max = read_counter(&stats->range_max_ns);
+        snapshot->range.max_ns = max > snapshot->range.max_ns ? max : snapshot->range.max_ns;
+        for (int i = 0; i < STATS_BUCKETS; i++) {
+            snapshot->lookup.buckets[i] += read_counter(&stats->lookup_buckets[i]);
+            snapshot->range.buckets[i] += read_counter(&stats->range_buckets[i]);
+        }
+    }
+    pthread_mutex_unlock(&registry_lock);
+}
+
+uint64_t lookup_stats_percentile(const LatencyHistogram *histogram, double q) {
+    uint64_t total = 0;
+    for (int i = 0; i < STATS_BUCKETS; i++) {
+        total += histogram->buckets[i];
+    }
+    if (total == 0) {
+        return 0;
+    }
+    uint64_t rank = (uint64_t)(q * (double)total + 0.5);
+    rank = rank < 1 ? 1 : rank > total ? total : rank;
+    uint64_t seen = 0;
+    for (unsigned i = 0; i < STATS_BUCKETS; i++) {
+        seen += histogram->buckets[i];
+        if (seen >= rank) {
+            uint64_t limit = bucket_limit(i) - 1;
+            return limit < histogram->max_ns ? limit : histogram->max_ns;
+        }
+    }
+    return histogram->max_ns;
+}
+
+// Formats a latency with a unit that keeps three significant digits readable
+static const char *format_ns(uint64_t ns, char *buf, size_t size) {
+    if (ns < 1000) {
+        snprintf(buf, size, "%llu ns", (unsigned long long)ns);
+    } else if (ns < 1000000) {
+        snprintf(buf, size, "%.1f us", ns / 1e3);
+    } else if (ns < 1000000000) {
+        snprintf(buf, size, "%.1f ms", ns / 1e6);
+    } else {
+        snprintf(buf, size, "%.2f s", ns / 1e9);
+    }
+    return buf;
+}
+
+static void print_latency(FILE *out, const char *label, const LatencyHistogram *histogram) {
+    char mean[32], p50[32], p90[32], p99[32], p999[32], max[32];
+    fprintf(out, "%s: mean %s, p50 %s, p90 %s, p99 %s, p99.9 %s, max %s\n", label,
+            format_ns(histogram->count ? histogram->sum_ns / histogram->count : 0, mean, sizeof(mean)),
+            format_ns(lookup_stats_percentile(histogram, 0.50), p50, sizeof(p50)),
+            format_ns(lookup_stats_percentile(histogram, 0.90), p90, sizeof(p90)),
+            format_ns(lookup_stats_percentile(histogram, 0.99), p99, sizeof(p99)),
+            format_ns(lookup_stats_percentile(histogram, 0.999), p999, sizeof(p999)),
+            format_ns(histogram->max_ns, max, sizeof(max)));
+}
+
+/**
+ * Prints the --stats summary.
+ *
+ * Parameters:
+ * - out (FILE*): Where to print; the tools use stderr so results on stdout stay clean.
+ */
+void lookup_stats_print(FILE *out) {
+    LookupStatsSnapshot s;
+    lookup_stats_snapshot(&s);
+
+    fprintf(out, "Lookups: %llu (%llu found, %llu not found, %llu errors); "
+                 "%llu ruled out by the filter, %llu answered by delta segments, %llu by the hot set\n",
+            (unsigned long long)s.lookup.count, (unsigned long long)s.hits, (unsigned long long)s.misses,
+            (unsigned long long)s.errors, (unsigned long long)s.filter_rejects, (unsigned long long)s.delta_hits,
+            (unsigned long long)s.hot_hits);
+    if (s.lookup.count > 0) {
+        print_latency(out, "Lookup latency", &s.lookup);
+    }
+    if (s.fault_samples > 0) {
+        fprintf(out, "Page faults per lookup: %.3f minor, %.3f major; %.2f%% of lookups found their record page uncached\n",
+                (double)s.minor_faults / (double)s.fault_samples, (double)s.major_faults / (double)s.fault_samples,
+                100.0 * (double)s.cold_lookups / (double)s.fault_samples);
+    }
+    uint64_t cache_total = s.sqlite_cache_hits + s.sqlite_cache_misses;
+    if (cache_total > 0) {
+        fprintf(out, "SQLite page cache: %.2f%% hits (%llu hits, %llu misses)\n",
+                100.0 * (double)s.sqlite_cache_hits / (double)cache_total,
+                (unsigned long long)s.sqlite_cache_hits, (unsigned long long)s.sqlite_cache_misses);
+    }
+    if (s.range.count > 0) {
+        fprintf(out, "Range queries: %llu (%llu errors)\n",
+                (unsigned long long)s.range.count, (unsigned long long)s.range_errors);
+        print_latency(out, "Range latency", &s.range);
+    }
+}
+
+// One Prometheus histogram; le bounds are the powers of two from 128 ns to about 4.3 s
+static int write_histogram(FILE *out, const char *name, const char *help, const LatencyHistogram *histogram) {
+    fprintf(out, "# HELP %s %s\n# TYPE %s histogram\n", name, help, name);
+    uint64_t cumulative = 0;
+    unsigned bucket = 0;
+    for (unsigned exponent = 7; exponent <= 32; exponent++) {
+        uint64_t bound = (uint64_t)1 << exponent;
+        while (bucket < STATS_BUCKETS && bucket_limit(bucket) <= bound) {
+            cumulative += histogram->buckets[bucket++];
+        }
+        fprintf(out, "%s_bucket{le=\"%.9g\"} %llu\n", name, bound / 1e9, (unsigned long long)cumulative);
+    }
+    fprintf(out, "%s_bucket{le=\"+Inf\"} %llu\n", name, (unsigned long long)histogram->count);
+    fprintf(out, "%s_sum %.9f\n", name, histogram->sum_ns / 1e9);
+    return fprintf(out, "%s_count %llu\n", name, (unsigned long long)histogram->count) < 0 ? -1 : 0;
+}
+
+static void write_counter(FILE *out, const char *name, const char *help) {
+    fprintf(out, "# HELP %s %s\n# TYPE %s counter\n", name, help, name);
+}
+
+/**
+ * Writes every metric in the Prometheus text exposition format.
+ *
+ * Latencies are exported as histograms so that histogram_quantile() can be
+ * aggregated across instances, plus a gauge with this process's own p50, p99
+ * and p99.9 taken from the finer internal buckets.
+ *
+ * Parameters:
+ * - out (FILE*): Destination stream.
+ *
+ * Returns:
+ * - int: 0 on success, -1 if writing failed.
+ */
+int lookup_stats_write_prometheus(FILE *out) {
+    LookupStatsSnapshot s;
+    lookup_stats_snapshot(&s);
+
+    write_counter(out, "pwned_lookups_total", "Hash lookups by result.");
+    fprintf(out, "pwned_lookups_total{result=\"found\"} %llu\n", (unsigned long long)s.hits);
+    fprintf(out, "pwned_lookups_total{result=\"not_found\"} %llu\n", (unsigned long long)s.misses);
+    fprintf(out, "pwned_lookups_total{result=\"error\"} %llu\n", (unsigned long long)s.errors);
+    write_counter(out, "pwned_filter_rejects_total", "Lookups ruled out by the fuse filter without reading the store.");
+    fprintf(out, "pwned_filter_rejects_total %llu\n", (unsigned long long)s.filter_rejects);
+    write_counter(out, "pwned_delta_hits_total", "Lookups answered by a delta segment.");
+    fprintf(out, "pwned_delta_hits_total %llu\n", (unsigned long long)s.delta_hits);
+    write_counter(out, "pwned_hot_hits_total", "Lookups answered by the in-memory hot set.");
+    fprintf(out, "pwned_hot_hits_total %llu\n", (unsigned long long)s.hot_hits);
+    write_counter(out, "pwned_lookup_page_faults_total", "Page faults taken during sampled lookups.");
+    fprintf(out, "pwned_lookup_page_faults_total{kind=\"minor\"} %llu\n", (unsigned long long)s.minor_faults);
+    fprintf(out, "pwned_lookup_page_faults_total{kind=\"major\"} %llu\n", (unsigned long long)s.major_faults);
+    write_counter(out, "pwned_lookup_fault_samples_total", "Lookups whose page faults were sampled.");
+    fprintf(out, "pwned_lookup_fault_samples_total %llu\n", (unsigned long long)s.fault_samples);
+    write_counter(out, "pwned_lookup_cold_pages_total", "Sampled flat-store lookups whose record page was not cached.");
+    fprintf(out, "pwned_lookup_cold_pages_total %llu\n", (unsigned long long)s.cold_lookups);
+    write_counter(out, "pwned_sqlite_cache_total", "SQLite page-cache lookups by result.");
+    fprintf(out, "pwned_sqlite_cache_total{result=\"hit\"} %llu\n", (unsigned long long)s.sqlite_cache_hits);
+    fprintf(out, "pwned_sqlite_cache_total{result=\"miss\"} %llu\n", (unsigned long long)s.sqlite_cache_misses);
+    write_counter(out, "pwned_range_errors_total", "Range queries that failed.");
+    fprintf(out, "pwned_range_errors_total %llu\n", (unsigned long long)s.range_errors);
+
+    fprintf(out, "# HELP pwned_latency_quantile_seconds Latency quantiles of this process.\n"
+                 "# TYPE pwned_latency_quantile_seconds gauge\n");
+    const double quantiles[] = {0.5, 0.99, 0.999};
+    for (int i = 0; i < 3; i++) {
+        fprintf(out, "pwned_latency_quantile_seconds{op=\"lookup\",quantile=\"%g\"} %.9f\n", quantiles[i],
+                lookup_stats_percentile(&s.lookup, quantiles[i]) / 1e9);
+        fprintf(out, "pwned_latency_quantile_seconds{op=\"range\",quantile=\"%g\"} %.9f\n", quantiles[i],
+                lookup_stats_percentile(&s.range, quantiles[i]) / 1e9);
+    }
+
+    if (write_histogram(out, "pwned_lookup_duration_seconds", "Latency of single hash lookups.", &s.lookup) != 0) {
+        return -1;
+    }
+    return write_histogram(out, "pwned_range_duration_seconds", "Latency of range queries.", &s.range);
+}
+
+int lookup_stats_write_file(const char *path) {
+    char tmp_path[4096];
+    snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", path);
+    FILE *file = fopen(tmp_path, "w");
+    if (file == NULL) {
+        fprintf(stderr, "Can't write metrics file: %s\n", tmp_path);
+        return -1;
+    }
+    int failed = lookup_stats_write_prometheus(file) != 0;
+    failed |= fclose(file) != 0;
+    if (failed || rename(tmp_path, path) != 0) {
+        fprintf(stderr, "Failed to write metrics file: %s\n", path);
+        remove(tmp_path);
+        return -1;
+    }
+    return 0;
+}
@@ -1,15 +1,284 @@
 #include "deep_check.h"
 #include "password_input.h"
 #include "utils.h"
+#include "batch_mode.h"
+#include "merge_join.h"
+#include "variants.h"
+#include "lookup_daemon.h"
+#include "lookup_stats.h"
+#include "ntlm.h"
+#include "warmup.h"
 
-int main(void) {
-    // Initialize SQLite for deep check
-    sqlite3 *db = NULL;
-    const char *db_path = "database/pwnedpasswords.db";
-    if (init_db(&db, db_path) != 0) {
+#include <getopt.h>
+
+static void usage(const char *program) {
+    fprintf(stderr,
+            "Usage: %s [options] [database_path]\n"
+            "  -b, --batch          Check newline-separated passwords from stdin without prompting\n"
+            "  -i, --input FILE     Read batch input from FILE instead of stdin (implies --batch)\n"
+            "  -H, --hashes         Batch input lines are hex hashes of the store's kind (SHA-1 or NTLM),\n"
+            "                       not passwords\n"
+            "  -t, --threads N      Hashing threads for batch mode (default: one per core)\n"
+            "  -s, --socket PATH    Ask the pwned_daemon on PATH instead of opening the database\n"
+            "  -d, --daemon         Same as --socket " DAEMON_SOCKET_PATH "\n"
+            "  -A, --async[=ENGINE] Batch mode: read the store with batched I/O for stores larger than\n"
+            "                       memory; ENGINE is io_uring, pread or auto (default)\n"
+            "  -j, --join           Audit a list of SHA-1 hex digests (--input or stdin) with a sort-merge\n"
+            "                       join in hash order, writing only the matches\n"
+            "  -M, --join-memory MB Memory for sorting before runs are spilled to disk (default 256)\n"
+            "  -T, --tmpdir DIR     Directory for spilled runs (default $TMPDIR or /tmp)\n"
+            "  -V, --variants[=FILE] Also check thousands of close variants of each entered password\n"
+            "                       (case, leetspeak, digit and year suffixes), or the rules in FILE\n"
+            "  -k, --sha1 KERNEL    Batch mode: SHA-1 implementation, one of auto (default), avx512,\n"
+            "                       avx2, sha-ni or scalar\n"
+            "  -c, --check-blocks   Verify each block of a flat store against its checksums the first\n"
+            "                       time a lookup reads it; a damaged block fails the lookup\n"
+            "  -S, --stats[=faults] Print lookup counts and latency percentiles to stderr when done;\n"
+            "                       \"faults\" also samples page faults per lookup\n"
+            "  -w, --warm[=all]     Fault the store's indexes (or with \"all\", every page) in on the --threads\n"
+            "                       threads before the first lookup and report the time to warm\n"
+            "  -P, --hugepages[=explicit]  Move the store's indexes onto transparent huge pages, or\n"
+            "                       onto reserved ones (vm.nr_hugepages) with \"explicit\"\n"
+            "  -l, --mlock MB       Lock up to MB of the store in memory, indexes first\n"
+            "  -n, --ntlm PATH      Also check each entered password against the NTLM store at PATH\n"
+            "  -m, --metrics-file PATH  Write the lookup metrics to PATH in Prometheus text format when done\n"
+            "  -h, --help           Show this message\n",
+            program);
+}
+
+// Hashes a password the way the store's dataset does, SHA-1 or NTLM, and runs the deep check on it
+static int check_password(PwnedDB *db, const unsigned char *password) {
+    unsigned char hash[HASH_MAX_SIZE];
+    size_t length = strlen((const char *)password);
+    if (db->kind == HASH_KIND_NTLM) {
+        ntlm_hash(password, length, hash);
+    } else {
+        SHA1(password, length, hash);
+    }
+    return deep_check_password(db, hash);
+}
+
+// Reports whatever --stats and --metrics-file asked for once the lookups are done
+static void report_stats(int print_stats, const char *metrics_path) {
+    if (print_stats) {
+        lookup_stats_print(stderr);
+    }
+    if (metrics_path != NULL) {
+        lookup_stats_write_file(metrics_path);
+    }
+}
+
+int main(int argc, char *argv[]) {
+    int batch = 0;
+    int join = 0;
+    JoinOptions join_options = {NULL, 0, NULL};
+    BatchOptions batch_options = {NULL, 0, 0, NULL, 0, ASYNC_ENGINE_AUTO, SHA1_KERNEL_AUTO};
+    unsigned stats_flags = 0;
+    int print_stats = 0;
+    const char *metrics_path = NULL;
+    int variants = 0;
+    const char *rules_path = NULL;
+    WarmupOptions warm_options = {WARM_PREFETCH_NONE, WARM_HUGE_PAGES_OFF, 0, 0};
+    const char *ntlm_path = NULL;
+
+    static const struct option long_options[] = {
+        {"batch",   no_argument,       NULL, 'b'},
+        {"input",   required_argument, NULL, 'i'},
+        {"hashes",  no_argument,       NULL, 'H'},
+        {"threads", required_argument, NULL, 't'},
+        {"socket",  required_argument, NULL, 's'},
+        {"daemon",  no_argument,       NULL, 'd'},
+        {"async",   optional_argument, NULL, 'A'},
+        {"sha1",    required_argument, NULL, 'k'},
+        {"variants", optional_argument, NULL, 'V'},
+        {"join",    no_argument,       NULL, 'j'},
+        {"join-memory", required_argument, NULL, 'M'},
+        {"tmpdir",  required_argument, NULL, 'T'},
+        {"check-blocks", no_argument, NULL, 'c'},
+        {"stats",   optional_argument, NULL, 'S'},
+        {"warm",    optional_argument, NULL, 'w'},
+        {"hugepages", optional_argument, NULL, 'P'},
+        {"mlock",   required_argument, NULL, 'l'},
+        {"metrics-file", required_argument, NULL, 'm'},
+        {"ntlm",    required_argument, NULL, 'n'},
+        {"help",    no_argument,       NULL, 'h'},
+        {NULL, 0, NULL, 0}
+    };
+    int opt;
+    while ((opt = getopt_long(argc, argv, "bi:Ht:s:dA::k:V::jM:T:cw::P::l:S::m:n:h", long_options, NULL)) != -1) {
+        switch (opt) {
+            case 'b': batch = 1; break;
+            case 'i': batch = 1; batch_options.input_path = optarg; break;
+            case 'H': batch = 1; batch_options.hashes = 1; break;
+            case 't': batch_options.threads = atoi(optarg); break;
+            case 's': batch_options.socket_path = optarg; break;
+            case 'd': batch_options.socket_path = DAEMON_SOCKET_PATH; break;
+            case 'A':
+                batch = 1;
+                batch_options.async_io = 1;
+                if (optarg == NULL || strcmp(optarg, "auto") == 0) {
+                    batch_options.async_engine = ASYNC_ENGINE_AUTO;
+                } else if (strcmp(optarg, "io_uring") == 0) {
+                    batch_options.async_engine = ASYNC_ENGINE_IO_URING;
+                } else if (strcmp(optarg, "pread") == 0) {
+                    batch_options.async_engine = ASYNC_ENGINE_PREAD;
+                } else {
+                    usage(argv[0]);
+                    return 1;
+                }
+                break;
+            case 'V': variants = 1; rules_path = optarg; break;
+            case 'j': join = 1; break;
+            case 'M': join_options.memory_bytes = (size_t)(atof(optarg) * 1024 * 1024); break;
+            case 'T': join_options.tmp_dir = optarg; break;
+            case 'k':
+                if (sha1_parse_kernel(optarg, &batch_options.sha1_kernel) != 0) {
+                    usage(argv[0]);
+                    return 1;
+                }
+                if (!sha1_kernel_supported(batch_options.sha1_kernel)) {
+                    fprintf(stderr, "This CPU cannot run the %s SHA-1 kernel\n", optarg);
+                    return 1;
+                }
+                break;
+            case 'c': db_enable_block_checks(1); break;
+            case 'w':
+                if (warmup_parse_prefetch(optarg, &warm_options.prefetch) != 0) {
+                    usage(argv[0]);
+                    return 1;
+                }
+                break;
+            case 'P':
+                if (warmup_parse_huge_pages(optarg, &warm_options.huge_pages) != 0) {
+                    usage(argv[0]);
+                    return 1;
+                }
+                break;
+            case 'l': warm_options.lock_budget = (uint64_t)(atof(optarg) * 1024 * 1024); break;
+            case 'S':
+                print_stats = 1;
+                if (lookup_stats_parse(optarg, &stats_flags) != 0) {
+                    usage(argv[0]);
+                    return 1;
+                }
+                break;
+            case 'm':
+                metrics_path = optarg;
+                stats_flags |= LOOKUP_STATS_TIMING;
+                break;
+            case 'n': ntlm_path = optarg; break;
+            case 'h': usage(argv[0]); return 0;
+            default: usage(argv[0]); return 1;
+        }
+    }
+
+    // Only lookups made in this process are measured; the daemon keeps its own statistics
+    lookup_stats_enable(stats_flags);
+
+    // Client mode: the daemon already holds the database open, so skip init_db() entirely
+    int daemon_fd = -1;
+    if (join && batch_options.socket_path != NULL) {
+        fprintf(stderr, "--join reads the store itself and cannot go through the daemon\n");
+        return 1;
+    }
+    if (variants && (batch || join)) {
+        fprintf(stderr, "--variants expands passwords entered at the prompt; it does not apply to --batch or --join\n");
+        return 1;
+    }
+    if (ntlm_path != NULL && (batch || join)) {
+        fprintf(stderr, "--ntlm adds a second store to the prompt; run --batch or --join against the NTLM store itself\n");
+        return 1;
+    }
+    if (batch_options.socket_path != NULL && warmup_requested(&warm_options)) {
+        fprintf(stderr, "--warm, --hugepages and --mlock apply to a store opened here; give them to pwned_daemon instead\n");
+        return 1;
+    }
+    if (batch_options.socket_path != NULL) {
+        if (batch) {
+            return run_batch(NULL, &batch_options);
+        }
+        daemon_fd = daemon_connect(batch_options.socket_path);
+        if (daemon_fd < 0) {
+            return 1;
+        }
+    }
+
+    // Initialize the database for deep check (SQLite or flat store, picked from the file)
+    PwnedDB db;
+    const char *db_path = optind < argc ? argv[optind] : "database/pwnedpasswords.db";
+    if (daemon_fd < 0 && init_db(&db, db_path) != 0) {
         fprintf(stderr, "Failed to initialize the database.\n");
         return 1;
     }
+    if (daemon_fd < 0 && db.kind != HASH_KIND_SHA1 && (join || variants)) {
+        fprintf(stderr, "--join and --variants work on SHA-1 stores; %s holds %s hashes\n", db_path,
+                hash_kind_name(db.kind));
+        close_db(&db);
+        return 1;
+    }
+
+    // The NTLM store is a second handle of its own, queried next to the first
+    PwnedDB ntlm_db;
+    if (ntlm_path != NULL && init_db(&ntlm_db, ntlm_path) != 0) {
+        fprintf(stderr, "Failed to initialize the NTLM database.\n");
+        if (daemon_fd < 0) {
+            close_db(&db);
+        }
+        return 1;
+    }
+    if (ntlm_path != NULL && ntlm_db.kind != HASH_KIND_NTLM) {
+        fprintf(stderr, "%s holds %s hashes, not NTLM ones\n", ntlm_path, hash_kind_name(ntlm_db.kind));
+        close_db(&ntlm_db);
+        if (daemon_fd < 0) {
+            close_db(&db);
+        }
+        return 1;
+    }
+    if (daemon_fd < 0 && warmup_requested(&warm_options)) {
+        WarmupReport warm_report;
+        warm_options.threads = batch_options.threads;
+        if (db_warm(&db, &warm_options, &warm_report) != 0) {
+            fprintf(stderr, "Failed to warm the database.\n");
+            return 1;
+        }
+        warmup_print_report(stderr, &warm_report);
+        if (ntlm_path != NULL) {
+            if (db_warm(&ntlm_db, &warm_options, &warm_report) != 0) {
+                fprintf(stderr, "Failed to warm the NTLM database.\n");
+                return 1;
+            }
+            warmup_print_report(stderr, &warm_report);
+        }
+    }
+
+    if (join) {
+        join_options.input_path = batch_options.input_path;
+        int rc = run_join(&db, &join_options);
+        close_db(&db);
+        report_stats(print_stats, metrics_path);
+        return rc;
+    }
+    if (batch) {
+        int rc = run_batch(&db, &batch_options);
+        close_db(&db);
+        report_stats(print_stats, metrics_path);
+        return rc;
+    }
+
+    // The rules and scratch buffers are set up once, not per password
+    VariantChecker checker;
+    if (variants) {
+        VariantRules rules;
+        int rc = rules_path != NULL ? variant_rules_load(&rules, rules_path) : variant_rules_default(&rules);
+        if (rc != 0 || variant_checker_init(&checker, &rules, daemon_fd >= 0 ? NULL : &db, daemon_fd) != 0) {
+            if (daemon_fd >= 0) {
+                close(daemon_fd);
+            } else {
+                close_db(&db);
+            }
+            return 1;
+        }
+    }
 
     atexit(cleanup);
     signal(SIGINT, signal_handler);
@@ -25,16 +294,31 @@ int main(void) {
             continue;
         }
 
-        // Compute the SHA-1 hash of the password
-        unsigned char hash[SHA_DIGEST_LENGTH];
-        SHA1(securePassword.buffer, securePassword.size, hash);
-        
-        // Perform a deep check using the binary hash directly
-        if (deep_check_password(db, hash) != 0) {
+        // Perform a deep check using the binary hash directly, locally or through the daemon
+        if (ntlm_path != NULL) {
+            printf("%s: ", daemon_fd >= 0 ? "SHA-1" : hash_kind_name(db.kind));
+        }
+        int rc;
+        if (daemon_fd >= 0) {
+            unsigned char hash[SHA_DIGEST_LENGTH];
+            SHA1(securePassword.buffer, strlen((const char *)securePassword.buffer), hash);
+            rc = daemon_check_password(daemon_fd, hash);
+        } else {
+            rc = check_password(&db, securePassword.buffer);
+        }
+        if (rc == 0 && ntlm_path != NULL) {
+            printf("NTLM: ");
+            rc = check_password(&ntlm_db, securePassword.buffer);
+        }
+        if (rc != 0) {
             fprintf(stderr, "Error during the deep check.\n");
         } else {
             printf("Check complete.\n\n");
         }
+        if (variants && variant_check_password(&checker, securePassword.buffer,
+                                               strlen((const char *)securePassword.buffer)) == 0) {
+            printf("\n");
+        }
 
         secure_free(securePassword.buffer, securePassword.size); // Securely free the password
         securePassword.buffer = NULL; // Ensure pointer is cleared
@@ -44,6 +328,20 @@ int main(void) {
     
     printf("Always use strong passwords. Goodbye!\n\n");
 
-    sqlite3_close(db);
+    if (variants) {
+        variant_checker_close(&checker);
+    }
+
+    if (ntlm_path != NULL) {
+        close_db(&ntlm_db);
+    }
+    if (daemon_fd >= 0) {
+        close(daemon_fd);
+    } else {
+        close_db(&db);
+    }
+    if (daemon_fd < 0 || ntlm_path != NULL) {
+        report_stats(print_stats, metrics_path);
+    }
     return 0;
 }
\ No newline at end of file
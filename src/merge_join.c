@@ -0,0 +1,421 @@
+#include "merge_join.h"
+#include "hex.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#define JOIN_HASH_SIZE SHA_DIGEST_LENGTH
+
+// One sorted run spilled to a temporary file, read back through its own buffer
+typedef struct {
+    int fd;
+    FILE *file;
+    unsigned char head[JOIN_HASH_SIZE];
+} JoinRun;
+
+/**
+ * The input hashes in ascending order: straight from memory when they all fit,
+ * otherwise a k-way merge of the spilled runs through a min-heap of run heads.
+ */
+typedef struct {
+    unsigned char (*keys)[JOIN_HASH_SIZE];
+    size_t count;
+    size_t position;
+    JoinRun *runs;
+    size_t run_count;
+    size_t *heap;
+    size_t heap_size;
+    int failed;
+} JoinStream;
+
+// Distinct hashes sharing one range prefix, with how often each appeared and what the store says
+typedef struct {
+    unsigned char (*keys)[JOIN_HASH_SIZE];
+    uint64_t *occurrences;
+    int *counts;
+    int *needs_base;
+    size_t count;
+    size_t capacity;
+    size_t cursor; // Next key the range scan compares against
+} JoinGroup;
+
+static int compare_hashes(const void *a, const void *b) {
+    return memcmp(a, b, JOIN_HASH_SIZE);
+}
+
+static uint32_t range_prefix(const unsigned char *hash) {
+    return ((uint32_t)hash[0] << 12) | ((uint32_t)hash[1] << 4) | (hash[2] >> 4);
+}
+
+// Sorts the keys and writes them to an unlinked temporary file, so nothing is left behind on a crash
+static int spill_run(JoinStream *stream, const char *tmp_dir) {
+    qsort(stream->keys, stream->count, JOIN_HASH_SIZE, compare_hashes);
+
+    JoinRun *grown = realloc(stream->runs, (stream->run_count + 1) * sizeof(JoinRun));
+    if (grown == NULL) {
+        fprintf(stderr, "Memory allocation failed for join runs!\n");
+        return -1;
+    }
+    stream->runs = grown;
+    char path[4096];
+    snprintf(path, sizeof(path), "%s/pwned_join.XXXXXX", tmp_dir);
+    int fd = mkstemp(path);
+    if (fd < 0) {
+        fprintf(stderr, "Can't create a spill file in %s\n", tmp_dir);
+        return -1;
+    }
+    unlink(path);
+
+    const unsigned char *data = (const unsigned char *)stream->keys;
+    size_t size = stream->count * JOIN_HASH_SIZE;
+    while (size > 0) {
+        ssize_t written = write(fd, data, size);
+        if (written <= 0) {
+            fprintf(stderr, "Failed to write a spill file in %s\n", tmp_dir);
+            close(fd);
+            return -1;
+        }
+        data += written;
+        size -= (size_t)written;
+    }
+    stream->runs[stream->run_count].fd = fd;
+    stream->runs[stream->run_count].file = NULL;
+    stream->run_count++;
+    stream->count = 0;
+    return 0;
+}
+
+// Hex digest at the start of a line: the whole line, or the part before a ':' as in the HIBP dump format
+static int parse_hash(const char *line, size_t length, unsigned char *hash) {
+    while (length > 0 && (line[length - 1] == '\n' || line[length - 1] == '\r')) {
+        length--;
+    }
+    if (length < 2 * JOIN_HASH_SIZE || (length > 2 * JOIN_HASH_SIZE && line[2 * JOIN_HASH_SIZE] != ':')) {
+        return -1;
+    }
+    return hex_decode(line, hash, JOIN_HASH_SIZE);
+}
+
+/**
+ * Reads every input hash, sorting and spilling a run whenever the memory budget is full.
+ *
+ * Returns:
+ * - int: 0 on success, -1 on an allocation or spill failure.
+ */
+static int load_input(JoinStream *stream, FILE *input, const JoinOptions *options,
+                      uint64_t *lines, uint64_t *invalid) {
+    size_t memory = options->memory_bytes ? options->memory_bytes : JOIN_DEFAULT_MEMORY;
+    size_t capacity = memory / JOIN_HASH_SIZE;
+    capacity = capacity ? capacity : 1;
+    const char *tmp_dir = options->tmp_dir ? options->tmp_dir : getenv("TMPDIR");
+    tmp_dir = tmp_dir && *tmp_dir ? tmp_dir : "/tmp";
+
+    stream->keys = malloc(capacity * JOIN_HASH_SIZE);
+    if (stream->keys == NULL) {
+        fprintf(stderr, "Memory allocation failed for the join buffer!\n");
+        return -1;
+    }
+    char *line = NULL;
+    size_t line_capacity = 0;
+    ssize_t length;
+    int rc = 0;
+    while (rc == 0 && (length = getline(&line, &line_capacity, input)) >= 0) {
+        (*lines)++;
+        if (parse_hash(line, (size_t)length, stream->keys[stream->count]) != 0) {
+            (*invalid)++;
+            continue;
+        }
+        if (++stream->count == capacity) {
+            rc = spill_run(stream, tmp_dir);
+        }
+    }
+    free(line);
+    if (rc != 0) {
+        return -1;
+    }
+
+    // Everything fitted: no need to touch the disk at all
+    if (stream->run_count == 0) {
+        qsort(stream->keys, stream->count, JOIN_HASH_SIZE, compare_hashes);
+        return 0;
+    }
+    if (stream->count > 0 && spill_run(stream, tmp_dir) != 0) {
+        return -1;
+    }
+    free(stream->keys);
+    stream->keys = NULL;
+    return 0;
+}
+
+static int run_less(const JoinStream *stream, size_t a, size_t b) {
+    return memcmp(stream->runs[a].head, stream->runs[b].head, JOIN_HASH_SIZE) < 0;
+}
+
+static void heap_sift_down(JoinStream *stream, size_t i) {
+    for (;;) {
+        size_t smallest = i, left = 2 * i + 1, right = left + 1;
+        if (left < stream->heap_size && run_less(stream, stream->heap[left], stream->heap[smallest])) {
+            smallest = left;
+        }
+        if (right < stream->heap_size && run_less(stream, stream->heap[right], stream->heap[smallest])) {
+            smallest = right;
+        }
+        if (smallest == i) {
+            return;
+        }
+        size_t swap = stream->heap[i];
+        stream->heap[i] = stream->heap[smallest];
+        stream->heap[smallest] = swap;
+        i = smallest;
+    }
+}
+
+// Reads the next hash of a run into its head; 0 at the end of the run
+static int run_advance(JoinStream *stream, JoinRun *run) {
+    size_t got = fread(run->head, 1, JOIN_HASH_SIZE, run->file);
+    if (got != JOIN_HASH_SIZE) {
+        stream->failed |= got != 0 || ferror(run->file);
+        return 0;
+    }
+    return 1;
+}
+
+// Rewinds every run and seeds the heap with its first hash
+static int stream_start_merge(JoinStream *stream) {
+    stream->heap = malloc(stream->run_count * sizeof(size_t));
+    if (stream->heap == NULL) {
+        fprintf(stderr, "Memory allocation failed for join runs!\n");
+        return -1;
+    }
+    for (size_t r = 0; r < stream->run_count; r++) {
+        JoinRun *run = &stream->runs[r];
+        if (lseek(run->fd, 0, SEEK_SET) != 0 || (run->file = fdopen(run->fd, "rb")) == NULL) {
+            fprintf(stderr, "Failed to read back a spill file\n");
+            return -1;
+        }
+        setvbuf(run->file, NULL, _IOFBF, JOIN_RUN_BUFFER);
+        if (run_advance(stream, run)) {
+            stream->heap[stream->heap_size++] = r;
+        }
+    }
+    for (size_t i = stream->heap_size; i-- > 0;) {
+        heap_sift_down(stream, i);
+    }
+    return 0;
+}
+
+// Next hash in ascending order; 0 once the input is exhausted
+static int stream_next(JoinStream *stream, unsigned char *hash) {
+    if (stream->run_count == 0) {
+        if (stream->position == stream->count) {
+            return 0;
+        }
+        memcpy(hash, stream->keys[stream->position++], JOIN_HASH_SIZE);
+        return 1;
+    }
+    if (stream->heap_size == 0) {
+        return 0;
+    }
+    JoinRun *run = &stream->runs[stream->heap[0]];
+    memcpy(hash, run->head, JOIN_HASH_SIZE);
+    if (!run_advance(stream, run)) {
+        stream->heap[0] = stream->heap[--stream->heap_size];
+    }
+    heap_sift_down(stream, 0);
+    return 1;
+}
+
+static void stream_free(JoinStream *stream) {
+    for (size_t r = 0; r < stream->run_count; r++) {
+        if (stream->runs[r].file != NULL) {
+            fclose(stream->runs[r].file);
+        } else {
+            close(stream->runs[r].fd);
+        }
+    }
+    free(stream->runs);
+    free(stream->heap);
+    free(stream->keys);
+}
+
+static int group_append(JoinGroup *group, const unsigned char *hash) {
+    if (group->count == group->capacity) {
+        size_t capacity = group->capacity ? group->capacity * 2 : 64;
+        unsigned char (*keys)[JOIN_HASH_SIZE] = realloc(group->keys, capacity * JOIN_HASH_SIZE);
+        if (keys != NULL) {
+            group->keys = keys;
+        }
+        uint64_t *occurrences = realloc(group->occurrences, capacity * sizeof(uint64_t));
+        if (occurrences != NULL) {
+            group->occurrences = occurrences;
+        }
+        int *counts = realloc(group->counts, capacity * sizeof(int));
+        if (counts != NULL) {
+            group->counts = counts;
+        }
+        int *needs_base = realloc(group->needs_base, capacity * sizeof(int));
+        if (needs_base != NULL) {
+            group->needs_base = needs_base;
+        }
+        if (keys == NULL || occurrences == NULL || counts == NULL || needs_base == NULL) {
+            fprintf(stderr, "Memory allocation failed for the join!\n");
+            return -1;
+        }
+        group->capacity = capacity;
+    }
+    memcpy(group->keys[group->count], hash, JOIN_HASH_SIZE);
+    group->occurrences[group->count] = 1;
+    group->counts[group->count] = 0;
+    group->needs_base[group->count] = 0;
+    group->count++;
+    return 0;
+}
+
+// Both sides are sorted, so the scan only ever moves the cursor forward
+static int join_record(const unsigned char *binary_hash, int count, void *ctx) {
+    JoinGroup *group = ctx;
+    while (group->cursor < group->count) {
+        int order = memcmp(group->keys[group->cursor], binary_hash, JOIN_HASH_SIZE);
+        if (order > 0) {
+            return 0; // The record is not in the input; wait for the next one
+        }
+        if (order == 0 && group->needs_base[group->cursor]) {
+            group->counts[group->cursor] = count;
+        }
+        group->cursor++;
+    }
+    return 1; // Every input hash of the prefix is settled: stop the scan
+}
+
+/**
+ * Resolves one prefix group and writes its matches.
+ *
+ * Deltas, the hot set and the filter settle what they can first; only when a
+ * hash is left over is the store's range for the prefix scanned, once for the
+ * whole group. A packed store cannot scan ranges, so the leftover hashes are
+ * looked up one by one, still in ascending order.
+ */
+static int join_group(PwnedDB *db, JoinGroup *group, FILE *out, uint64_t *matched) {
+    size_t pending = 0;
+    for (size_t i = 0; i < group->count; i++) {
+        int count = 0;
+        int found = lookup_overlay(db, group->keys[i], &count);
+        group->needs_base[i] = found == LOOKUP_NEEDS_BASE;
+        group->counts[i] = found == 1 ? count : 0;
+        pending += group->needs_base[i];
+    }
+
+    if (pending > 0 && db->backend == DB_BACKEND_PACKED) {
+        for (size_t i = 0; i < group->count; i++) {
+            int count = 0;
+            int found = group->needs_base[i] ? lookup_base(db, group->keys[i], &count) : 0;
+            if (found < 0) {
+                return -1;
+            }
+            group->counts[i] = found ? count : group->counts[i];
+        }
+    } else if (pending > 0) {
+        group->cursor = 0;
+        if (lookup_range(db, range_prefix(group->keys[0]), join_record, group) != 0) {
+            return -1;
+        }
+    }
+
+    char line[2 * JOIN_HASH_SIZE + 16];
+    for (size_t i = 0; i < group->count; i++) {
+        if (group->counts[i] <= 0) {
+            continue;
+        }
+        hex_encode(group->keys[i], JOIN_HASH_SIZE, line);
+        int length = 2 * JOIN_HASH_SIZE + snprintf(line + 2 * JOIN_HASH_SIZE, 16, ":%d\n", group->counts[i]);
+        for (uint64_t n = 0; n < group->occurrences[i]; n++) {
+            fwrite(line, 1, (size_t)length, out);
+        }
+        *matched += group->occurrences[i];
+    }
+    group->count = 0;
+    return 0;
+}
+
+/**
+ * Audits a hash list with a sort-merge join instead of one lookup per line.
+ *
+ * The input is parsed into 20-byte binary hashes (the representation the
+ * importer stores) and sorted in memory; when it does not fit in memory_bytes,
+ * sorted runs are spilled to unlinked temporary files and merged back. The
+ * merged stream is then cut into 20-bit prefix groups and every group is joined
+ * against one range scan of the store, so the store is read once, front to back,
+ * and only where the input has hashes. Duplicate input lines are matched once
+ * and written once each.
+ *
+ * Parameters:
+ * - db (PwnedDB*): An initialized database.
+ * - options (const JoinOptions*): Input, memory budget and spill directory.
+ *
+ * Returns:
+ * - int: 0 on success, 1 on a read, spill or store error.
+ */
+int run_join(PwnedDB *db, const JoinOptions *options) {
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    FILE *input = stdin;
+    if (options->input_path != NULL) {
+        input = fopen(options->input_path, "r");
+        if (input == NULL) {
+            fprintf(stderr, "Can't open input file: %s\n", options->input_path);
+            return 1;
+        }
+    }
+
+    JoinStream stream;
+    memset(&stream, 0, sizeof(stream));
+    uint64_t lines = 0, invalid = 0, distinct = 0, matched = 0;
+    int rc = load_input(&stream, input, options, &lines, &invalid);
+    if (options->input_path != NULL) {
+        fclose(input);
+    }
+    if (rc == 0 && stream.run_count > 0) {
+        rc = stream_start_merge(&stream);
+    }
+
+    JoinGroup group;
+    memset(&group, 0, sizeof(group));
+    unsigned char hash[JOIN_HASH_SIZE];
+    while (rc == 0 && stream_next(&stream, hash)) {
+        if (group.count > 0 && memcmp(group.keys[group.count - 1], hash, JOIN_HASH_SIZE) == 0) {
+            group.occurrences[group.count - 1]++;
+            continue;
+        }
+        if (group.count > 0 && range_prefix(group.keys[0]) != range_prefix(hash)) {
+            rc = join_group(db, &group, stdout, &matched);
+        }
+        distinct++;
+        rc = rc == 0 ? group_append(&group, hash) : rc;
+    }
+    if (rc == 0 && group.count > 0) {
+        rc = join_group(db, &group, stdout, &matched);
+    }
+    fflush(stdout);
+    if (stream.failed) {
+        fprintf(stderr, "Failed to read back a spill file\n");
+        rc = -1;
+    } else if (rc != 0) {
+        fprintf(stderr, "Join failed\n");
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    double seconds = (double)(end.tv_sec - start.tv_sec) + (double)(end.tv_nsec - start.tv_nsec) / 1e9;
+    fprintf(stderr, "Joined %llu lines (%llu distinct hashes, %llu invalid) in %.2f s using %zu spilled run(s): %llu matched\n",
+            (unsigned long long)lines, (unsigned long long)distinct, (unsigned long long)invalid, seconds,
+            stream.run_count, (unsigned long long)matched);
+
+    free(group.keys);
+    free(group.occurrences);
+    free(group.counts);
+    free(group.needs_base);
+    stream_free(&stream);
+    return rc == 0 ? 0 : 1;
+}
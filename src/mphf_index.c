@@ -0,0 +1,557 @@
+#include "mphf_index.h"
+#include "hash_util.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+
+_Static_assert(sizeof(MphfHeader) == 64, "MphfHeader must match its on-disk size");
+_Static_assert(sizeof(MphfPartition) == 40, "MphfPartition must match its on-disk size");
+_Static_assert(sizeof(MphfSlot) == 12, "MphfSlot must not be padded");
+
+#define MPHF_DENSE_KEYS 0x9999999999999999ULL // 60% of the hash range goes to the dense buckets
+
+// Partitions are contiguous key ranges, so the sorted store splits into them without a shuffle
+static inline uint32_t partition_of(const MphfHeader *header, uint64_t k0) {
+    uint64_t p = mulhi(k0 - header->key_base, header->partition_mult);
+    return p < header->partition_count ? (uint32_t)p : header->partition_count - 1;
+}
+
+// First-level hash of a key: picks its bucket
+static inline uint64_t key_hash(uint64_t k0, uint32_t seed) {
+    return murmur64(k0 + (uint64_t)seed * 0x9e3779b97f4a7c15ULL);
+}
+
+// PTHash skew: 60% of the keys share the first 30% of the buckets, so large buckets are placed while the table is empty
+static inline uint32_t bucket_of(uint64_t h1, uint32_t bucket_count) {
+    uint32_t dense = (uint32_t)((uint64_t)bucket_count * 3 / 10);
+    uint32_t r = (uint32_t)h1;
+    if (dense == 0) {
+        return (uint32_t)(((uint64_t)r * bucket_count) >> 32);
+    }
+    if (h1 < MPHF_DENSE_KEYS) {
+        return (uint32_t)(((uint64_t)r * dense) >> 32);
+    }
+    return dense + (uint32_t)(((uint64_t)r * (bucket_count - dense)) >> 32);
+}
+
+static inline uint64_t pilot_hash(uint32_t pilot) {
+    return murmur64((uint64_t)pilot + 0x9e3779b97f4a7c15ULL);
+}
+
+// Position of a key in the partition's table for a given pilot; h2 mixes in every hashed byte
+static inline uint32_t position_of(uint64_t h2, uint64_t pilot_hash, uint32_t table_size) {
+    return (uint32_t)mulhi(h2 ^ pilot_hash, table_size);
+}
+
+static uint32_t partition_buckets(uint32_t keys) {
+    if (keys < 2) {
+        return 1;
+    }
+    uint64_t buckets = (uint64_t)ceil(MPHF_BUCKET_FACTOR * keys / log2((double)keys));
+    return buckets ? (uint32_t)buckets : 1;
+}
+
+static uint32_t partition_table_size(uint32_t keys) {
+    uint64_t size = (uint64_t)ceil(keys / MPHF_LOAD_FACTOR);
+    return size > keys ? (uint32_t)size : keys;
+}
+
+/**
+ * Looks a hash up through the index.
+ *
+ * The partition, bucket and position all come from the first 16 bytes of the
+ * hash; the slot at that position then confirms the last 8 bytes. A hash that is
+ * not in the store lands on some other key's slot and is rejected by its
+ * fingerprint, except with probability 2^-64.
+ *
+ * Returns:
+ * - int: 1 with count set if the hash is in the store, 0 otherwise.
+ */
+int mphf_lookup(const MphfIndex *index, const unsigned char *binary_hash, uint32_t *count) {
+    uint64_t k0 = load_be64(binary_hash);
+    const MphfPartition *partition = &index->partitions[partition_of(index->header, k0)];
+    if (partition->key_count == 0) {
+        return 0;
+    }
+    uint64_t h1 = key_hash(k0, partition->seed);
+    uint64_t h2 = murmur64(load_be64(binary_hash + 8) ^ h1);
+    uint32_t pilot = index->pilots[partition->pilot_base + bucket_of(h1, partition->bucket_count)];
+    uint32_t pos = position_of(h2, pilot_hash(pilot), partition->table_size);
+    if (pos >= partition->key_count) {
+        pos = index->remap[partition->remap_base + (pos - partition->key_count)];
+    }
+    const MphfSlot *slot = &index->slots[partition->slot_base + pos];
+    if (slot->fingerprint != load_be64(binary_hash + 12)) {
+        return 0;
+    }
+    *count = slot->count;
+    return 1;
+}
+
+// Shared state of one parallel build
+typedef struct {
+    const FlatStore *store;
+    const MphfHeader *header;
+    MphfPartition *partitions;
+    uint64_t *record_starts; // partition_count + 1 record indices
+    int fd;
+    atomic_uint next_partition;
+    atomic_int failed;
+} MphfBuild;
+
+// Key of a partition under construction
+typedef struct {
+    uint64_t h2;
+    uint32_t bucket;
+    uint32_t record;
+} BuildKey;
+
+static int compare_build_keys(const void *a, const void *b) {
+    const BuildKey *x = a, *y = b;
+    if (x->bucket != y->bucket) {
+        return (x->bucket > y->bucket) - (x->bucket < y->bucket);
+    }
+    return (x->h2 > y->h2) - (x->h2 < y->h2);
+}
+
+// Scratch memory of one worker, grown to the largest partition it meets
+typedef struct {
+    BuildKey *keys;
+    uint32_t *bucket_starts;
+    uint32_t *order;
+    uint64_t *taken;
+    uint16_t *pilots;
+    uint32_t *remap;
+    MphfSlot *slots;
+    uint32_t positions[256];
+    uint64_t *pilot_hashes; // pilot_hash() of every pilot, computed once per worker
+} BuildScratch;
+
+// Searches every bucket's pilot, largest bucket first; 0 on success, 1 if some bucket found none
+static int place_buckets(const MphfPartition *partition, BuildScratch *s, uint32_t max_bucket) {
+    uint32_t m = partition->bucket_count, t = partition->table_size;
+    memset(s->taken, 0, ((size_t)t + 63) / 64 * sizeof(uint64_t));
+    memset(s->pilots, 0, (size_t)m * sizeof(uint16_t));
+
+    // Counting sort of the buckets by size, descending
+    uint32_t *size_starts = calloc((size_t)max_bucket + 2, sizeof(uint32_t));
+    if (size_starts == NULL) {
+        return 1;
+    }
+    for (uint32_t b = 0; b < m; b++) {
+        size_starts[max_bucket - (s->bucket_starts[b + 1] - s->bucket_starts[b])]++;
+    }
+    for (uint32_t i = 0, sum = 0; i <= max_bucket; i++) {
+        uint32_t c = size_starts[i];
+        size_starts[i] = sum;
+        sum += c;
+    }
+    for (uint32_t b = 0; b < m; b++) {
+        s->order[size_starts[max_bucket - (s->bucket_starts[b + 1] - s->bucket_starts[b])]++] = b;
+    }
+    free(size_starts);
+
+    for (uint32_t i = 0; i < m; i++) {
+        uint32_t b = s->order[i];
+        uint32_t begin = s->bucket_starts[b], size = s->bucket_starts[b + 1] - begin;
+        if (size == 0) {
+            break; // Sorted by size, so only empty buckets remain
+        }
+        uint32_t pilot = 0;
+        for (; pilot <= MPHF_MAX_PILOT; pilot++) {
+            uint32_t k = 0;
+            for (; k < size; k++) {
+                uint32_t pos = position_of(s->keys[begin + k].h2, s->pilot_hashes[pilot], t);
+                if (s->taken[pos / 64] & (1ULL << (pos % 64))) {
+                    break;
+                }
+                // Mark as we go so two keys of the bucket cannot share a position
+                s->taken[pos / 64] |= 1ULL << (pos % 64);
+                s->positions[k] = pos;
+            }
+            if (k == size) {
+                break;
+            }
+            for (uint32_t j = 0; j < k; j++) {
+                s->taken[s->positions[j] / 64] &= ~(1ULL << (s->positions[j] % 64));
+            }
+        }
+        if (pilot > MPHF_MAX_PILOT) {
+            return 1;
+        }
+        s->pilots[b] = (uint16_t)pilot;
+    }
+    return 0;
+}
+
+/**
+ * Builds one partition and writes its pilots, remap entries and slots to the output file.
+ *
+ * Returns:
+ * - int: 0 on success, 1 if no seed worked or a write failed.
+ */
+static int build_partition(MphfBuild *build, uint32_t p, BuildScratch *s) {
+    MphfPartition *partition = &build->partitions[p];
+    const FlatRecord *records = build->store->records + build->record_starts[p];
+    uint32_t n = partition->key_count, m = partition->bucket_count, t = partition->table_size;
+    if (n == 0) {
+        return 0;
+    }
+
+    int placed = 0;
+    for (uint32_t attempt = 0; attempt < MPHF_MAX_ATTEMPTS && !placed; attempt++) {
+        partition->seed = (uint32_t)murmur64(((uint64_t)p << 32) | attempt);
+        memset(s->bucket_starts, 0, ((size_t)m + 1) * sizeof(uint32_t));
+        for (uint32_t i = 0; i < n; i++) {
+            uint64_t h1 = key_hash(load_be64(records[i].hash), partition->seed);
+            s->keys[i].h2 = murmur64(load_be64(records[i].hash + 8) ^ h1);
+            s->keys[i].bucket = bucket_of(h1, m);
+            s->keys[i].record = i;
+            s->bucket_starts[s->keys[i].bucket + 1]++;
+        }
+        qsort(s->keys, n, sizeof(BuildKey), compare_build_keys);
+
+        uint32_t max_bucket = 0;
+        int duplicate = 0;
+        for (uint32_t b = 0; b < m; b++) {
+            uint32_t size = s->bucket_starts[b + 1];
+            max_bucket = size > max_bucket ? size : max_bucket;
+            s->bucket_starts[b + 1] += s->bucket_starts[b];
+        }
+        for (uint32_t i = 1; i < n; i++) {
+            duplicate |= s->keys[i].bucket == s->keys[i - 1].bucket && s->keys[i].h2 == s->keys[i - 1].h2;
+        }
+        if (duplicate || max_bucket > sizeof(s->positions) / sizeof(s->positions[0])) {
+            continue; // Two keys no pilot can separate, or an absurd bucket: try another seed
+        }
+        placed = place_buckets(partition, s, max_bucket) == 0;
+    }
+    if (!placed) {
+        fprintf(stderr, "Minimal perfect hash construction failed for partition %u\n", p);
+        return 1;
+    }
+
+    // Positions past n are folded onto the free slots below n, in order
+    uint32_t free_slot = 0;
+    for (uint32_t pos = n; pos < t; pos++) {
+        s->remap[pos - n] = 0;
+        if (s->taken[pos / 64] & (1ULL << (pos % 64))) {
+            while (s->taken[free_slot / 64] & (1ULL << (free_slot % 64))) {
+                free_slot++;
+            }
+            s->remap[pos - n] = free_slot++;
+        }
+    }
+    for (uint32_t i = 0; i < n; i++) {
+        const BuildKey *key = &s->keys[i];
+        uint32_t pos = position_of(key->h2, s->pilot_hashes[s->pilots[key->bucket]], t);
+        if (pos >= n) {
+            pos = s->remap[pos - n];
+        }
+        const FlatRecord *record = &records[key->record];
+        s->slots[pos].fingerprint = load_be64(record->hash + 12);
+        s->slots[pos].count = record->count;
+    }
+
+    const MphfHeader *header = build->header;
+    off_t pilots_offset = sizeof(MphfHeader) + (off_t)header->partition_count * sizeof(MphfPartition);
+    off_t remap_offset = pilots_offset + (off_t)header->bucket_total * sizeof(uint16_t);
+    size_t pilots_size = (size_t)m * sizeof(uint16_t);
+    size_t remap_size = (size_t)(t - n) * sizeof(uint32_t);
+    size_t slots_size = (size_t)n * sizeof(MphfSlot);
+    if (pwrite(build->fd, s->pilots, pilots_size, pilots_offset + (off_t)partition->pilot_base * sizeof(uint16_t)) != (ssize_t)pilots_size ||
+        pwrite(build->fd, s->remap, remap_size, remap_offset + (off_t)partition->remap_base * sizeof(uint32_t)) != (ssize_t)remap_size ||
+        pwrite(build->fd, s->slots, slots_size, (off_t)header->slots_offset + (off_t)partition->slot_base * sizeof(MphfSlot)) != (ssize_t)slots_size) {
+        fprintf(stderr, "Failed to write the minimal perfect hash index\n");
+        return 1;
+    }
+    return 0;
+}
+
+static void scratch_free(BuildScratch *s) {
+    free(s->keys);
+    free(s->bucket_starts);
+    free(s->order);
+    free(s->taken);
+    free(s->pilots);
+    free(s->remap);
+    free(s->slots);
+    free(s->pilot_hashes);
+}
+
+// Sized for the largest partition, so a worker allocates once
+static int scratch_alloc(BuildScratch *s, uint32_t max_keys) {
+    memset(s, 0, sizeof(*s));
+    uint32_t buckets = partition_buckets(max_keys), table = partition_table_size(max_keys);
+    s->keys = malloc(((size_t)max_keys + 1) * sizeof(BuildKey));
+    s->bucket_starts = malloc(((size_t)buckets + 1) * sizeof(uint32_t));
+    s->order = malloc((size_t)buckets * sizeof(uint32_t));
+    s->taken = malloc(((size_t)table + 63) / 64 * sizeof(uint64_t));
+    s->pilots = malloc((size_t)buckets * sizeof(uint16_t));
+    s->remap = malloc(((size_t)(table - max_keys) + 1) * sizeof(uint32_t));
+    s->slots = malloc(((size_t)max_keys + 1) * sizeof(MphfSlot));
+    s->pilot_hashes = malloc(((size_t)MPHF_MAX_PILOT + 1) * sizeof(uint64_t));
+    if (s->keys == NULL || s->bucket_starts == NULL || s->order == NULL || s->taken == NULL ||
+        s->pilots == NULL || s->remap == NULL || s->slots == NULL || s->pilot_hashes == NULL) {
+        scratch_free(s);
+        return -1;
+    }
+    for (uint32_t pilot = 0; pilot <= MPHF_MAX_PILOT; pilot++) {
+        s->pilot_hashes[pilot] = pilot_hash(pilot);
+    }
+    return 0;
+}
+
+static void *build_worker(void *arg) {
+    MphfBuild *build = arg;
+    uint32_t max_keys = 0;
+    for (uint32_t p = 0; p < build->header->partition_count; p++) {
+        max_keys = build->partitions[p].key_count > max_keys ? build->partitions[p].key_count : max_keys;
+    }
+    BuildScratch scratch;
+    if (scratch_alloc(&scratch, max_keys) != 0) {
+        fprintf(stderr, "Memory allocation failed for the index build!\n");
+        atomic_store(&build->failed, 1);
+        return NULL;
+    }
+    for (;;) {
+        uint32_t p = atomic_fetch_add(&build->next_partition, 1);
+        if (p >= build->header->partition_count || atomic_load(&build->failed)) {
+            break;
+        }
+        if (build_partition(build, p, &scratch) != 0) {
+            atomic_store(&build->failed, 1);
+        }
+    }
+    scratch_free(&scratch);
+    return NULL;
+}
+
+// First record whose partition is at least p; records are sorted, so partitions are monotonic
+static uint64_t first_record_of(const FlatStore *store, const MphfHeader *header, uint32_t p) {
+    uint64_t lo = 0, hi = store->header->record_count;
+    while (lo < hi) {
+        uint64_t mid = lo + (hi - lo) / 2;
+        if (partition_of(header, load_be64(store->records[mid].hash)) < p) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return lo;
+}
+
+/**
+ * Builds the minimal perfect hash index of a flat store.
+ *
+ * The key range is cut into partitions of about MPHF_PARTITION_KEYS keys, each a
+ * contiguous run of the sorted store. Their sizes, and so every offset in the
+ * file, are known before any is built, so worker threads take partitions in turn
+ * and write them straight to their place in the file. The header goes in last
+ * and the file is renamed into place, as the filter is.
+ *
+ * Parameters:
+ * - store (const FlatStore*): An open flat store.
+ * - path (const char*): Where to write the index.
+ * - threads (int): Worker threads; 0 or less for one per core.
+ *
+ * Returns:
+ * - int: 0 on success, 1 on failure.
+ */
+int mphf_build(const FlatStore *store, const char *path, int threads) {
+    uint64_t n = store->header->record_count;
+    if (n / MPHF_PARTITION_KEYS >= UINT32_MAX) {
+        fprintf(stderr, "Too many keys for a minimal perfect hash index\n");
+        return 1;
+    }
+
+    MphfHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, MPHF_MAGIC, MPHF_MAGIC_SIZE);
+    header.version = MPHF_VERSION;
+    header.key_count = n;
+    header.partition_count = (uint32_t)((n + MPHF_PARTITION_KEYS - 1) / MPHF_PARTITION_KEYS);
+    header.partition_count = header.partition_count ? header.partition_count : 1;
+    if (n > 0) {
+        header.key_base = load_be64(store->records[0].hash);
+        __uint128_t span = (__uint128_t)(load_be64(store->records[n - 1].hash) - header.key_base) + 1;
+        __uint128_t mult = ((__uint128_t)header.partition_count << 64) / span;
+        header.partition_mult = mult > UINT64_MAX ? UINT64_MAX : (uint64_t)mult;
+    }
+
+    MphfBuild build;
+    memset(&build, 0, sizeof(build));
+    build.store = store;
+    build.header = &header;
+    build.partitions = calloc(header.partition_count, sizeof(MphfPartition));
+    build.record_starts = calloc((size_t)header.partition_count + 1, sizeof(uint64_t));
+    if (build.partitions == NULL || build.record_starts == NULL) {
+        fprintf(stderr, "Memory allocation failed for the index build!\n");
+        free(build.partitions);
+        free(build.record_starts);
+        return 1;
+    }
+    for (uint32_t p = 1; p < header.partition_count; p++) {
+        build.record_starts[p] = first_record_of(store, &header, p);
+    }
+    build.record_starts[header.partition_count] = n;
+    int oversized = 0;
+    for (uint32_t p = 0; p < header.partition_count; p++) {
+        MphfPartition *partition = &build.partitions[p];
+        uint64_t keys = build.record_starts[p + 1] - build.record_starts[p];
+        oversized |= keys > UINT32_MAX / 2;
+        partition->key_count = (uint32_t)keys;
+        partition->table_size = partition_table_size(partition->key_count);
+        partition->bucket_count = partition_buckets(partition->key_count);
+        partition->slot_base = build.record_starts[p];
+        partition->pilot_base = header.bucket_total;
+        partition->remap_base = header.remap_total;
+        header.bucket_total += partition->bucket_count;
+        header.remap_total += partition->table_size - partition->key_count;
+    }
+    uint64_t remap_end = sizeof(MphfHeader) + (uint64_t)header.partition_count * sizeof(MphfPartition) +
+                         header.bucket_total * sizeof(uint16_t) + header.remap_total * sizeof(uint32_t);
+    header.slots_offset = (remap_end + 63) & ~(uint64_t)63;
+
+    char tmp_path[4096];
+    snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", path);
+    build.fd = oversized ? -1 : open(tmp_path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (build.fd < 0) {
+        fprintf(stderr, oversized ? "Key range is too uneven to partition\n" : "Can't create index file: %s\n", tmp_path);
+        free(build.partitions);
+        free(build.record_starts);
+        return 1;
+    }
+
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    if (threads <= 0) {
+        long cores = sysconf(_SC_NPROCESSORS_ONLN);
+        threads = cores > 0 ? (int)cores : 1;
+    }
+    if ((uint32_t)threads > header.partition_count) {
+        threads = (int)header.partition_count;
+    }
+    pthread_t *workers = calloc((size_t)threads, sizeof(pthread_t));
+    int started = 0;
+    for (; workers != NULL && started < threads; started++) {
+        if (pthread_create(&workers[started], NULL, build_worker, &build) != 0) {
+            break;
+        }
+    }
+    if (started == 0) {
+        build_worker(&build); // No threads to be had: build on this one
+    }
+    for (int i = 0; i < started; i++) {
+        pthread_join(workers[i], NULL);
+    }
+    free(workers);
+
+    int failed = atomic_load(&build.failed);
+    size_t table_size = (size_t)header.partition_count * sizeof(MphfPartition);
+    off_t file_size = (off_t)(header.slots_offset + n * sizeof(MphfSlot));
+    if (!failed) {
+        failed = ftruncate(build.fd, file_size) != 0 ||
+                 pwrite(build.fd, build.partitions, table_size, sizeof(MphfHeader)) != (ssize_t)table_size ||
+                 pwrite(build.fd, &header, sizeof(header), 0) != (ssize_t)sizeof(header);
+    }
+    failed |= close(build.fd) != 0;
+    if (!failed && rename(tmp_path, path) != 0) {
+        failed = 1;
+    }
+    if (failed) {
+        fprintf(stderr, "Failed to write index file: %s\n", path);
+        remove(tmp_path);
+    } else {
+        clock_gettime(CLOCK_MONOTONIC, &end);
+        printf("Built minimal perfect hash index over %llu keys in %u partition(s) on %d thread(s) in %.1f s: "
+               "%.2f bits per key plus %zu-byte slots\n",
+               (unsigned long long)n, header.partition_count, threads,
+               (double)(end.tv_sec - start.tv_sec) + (double)(end.tv_nsec - start.tv_nsec) / 1e9,
+               n ? 8.0 * (double)(header.slots_offset - sizeof(MphfHeader)) / (double)n : 0.0, sizeof(MphfSlot));
+    }
+    free(build.partitions);
+    free(build.record_starts);
+    return failed ? 1 : 0;
+}
+
+/**
+ * Maps an index file written by mphf_build().
+ *
+ * Lookups touch one pilot and one slot at random, so read-ahead is turned off.
+ *
+ * Returns:
+ * - int: 0 on success, -1 if the file is missing or malformed.
+ */
+int mphf_open(MphfIndex *index, const char *path) {
+    memset(index, 0, sizeof(*index));
+
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        return -1;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(MphfHeader)) {
+        fprintf(stderr, "Index file is truncated: %s\n", path);
+        close(fd);
+        return -1;
+    }
+    void *map = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        fprintf(stderr, "Can't map index file: %s\n", path);
+        return -1;
+    }
+
+    const MphfHeader *header = map;
+    uint64_t remap_end = sizeof(MphfHeader) + (uint64_t)header->partition_count * sizeof(MphfPartition) +
+                         header->bucket_total * sizeof(uint16_t) + header->remap_total * sizeof(uint32_t);
+    if (memcmp(header->magic, MPHF_MAGIC, MPHF_MAGIC_SIZE) != 0 ||
+        header->version != MPHF_VERSION ||
+        header->partition_count == 0 ||
+        header->slots_offset < remap_end ||
+        header->slots_offset + header->key_count * sizeof(MphfSlot) > (uint64_t)st.st_size) {
+        fprintf(stderr, "Index file header is invalid: %s\n", path);
+        munmap(map, (size_t)st.st_size);
+        return -1;
+    }
+
+    index->map = map;
+    index->map_size = (size_t)st.st_size;
+    index->header = header;
+    index->partitions = (const MphfPartition *)(index->map + sizeof(MphfHeader));
+    index->pilots = (const uint16_t *)(index->partitions + header->partition_count);
+    index->remap = (const uint32_t *)(index->pilots + header->bucket_total);
+    index->slots = (const MphfSlot *)(index->map + header->slots_offset);
+
+    // Every partition must stay inside the arrays it points into
+    for (uint32_t p = 0; p < header->partition_count; p++) {
+        const MphfPartition *partition = &index->partitions[p];
+        if (partition->table_size < partition->key_count ||
+            partition->bucket_count == 0 ||
+            partition->pilot_base + partition->bucket_count > header->bucket_total ||
+            partition->remap_base + (partition->table_size - partition->key_count) > header->remap_total ||
+            partition->slot_base + partition->key_count > header->key_count) {
+            fprintf(stderr, "Index file partition table is invalid: %s\n", path);
+            mphf_close(index);
+            return -1;
+        }
+    }
+    madvise(map, (size_t)st.st_size, MADV_RANDOM);
+    return 0;
+}
+
+void mphf_close(MphfIndex *index) {
+    if (index->map != NULL) {
+        munmap((void *)index->map, index->map_size);
+    }
+    memset(index, 0, sizeof(*index));
+}
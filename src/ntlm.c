@@ -0,0 +1,123 @@
+#include "ntlm.h"
+
+#include <stdint.h>
+#include <string.h>
+
+// MD4 (RFC 1320) state, fed one 64-byte block at a time
+typedef struct {
+    uint32_t state[4];
+    unsigned char block[64];
+    size_t used;
+    uint64_t bytes;
+} Md4;
+
+static uint32_t rotl32(uint32_t x, int s) {
+    return (x << s) | (x >> (32 - s));
+}
+
+static void md4_compress(uint32_t state[4], const unsigned char block[64]) {
+    static const int order2[16] = {0, 4, 8, 12, 1, 5, 9, 13, 2, 6, 10, 14, 3, 7, 11, 15};
+    static const int order3[16] = {0, 8, 4, 12, 2, 10, 6, 14, 1, 9, 5, 13, 3, 11, 7, 15};
+    static const int shift1[4] = {3, 7, 11, 19};
+    static const int shift2[4] = {3, 5, 9, 13};
+    static const int shift3[4] = {3, 9, 11, 15};
+    uint32_t x[16];
+    for (int i = 0; i < 16; i++) {
+        x[i] = (uint32_t)block[4 * i] | (uint32_t)block[4 * i + 1] << 8 |
+               (uint32_t)block[4 * i + 2] << 16 | (uint32_t)block[4 * i + 3] << 24;
+    }
+
+    // Each step updates one word and rotates the roles: a, d, c, b, a, ...
+    uint32_t v[4] = {state[0], state[1], state[2], state[3]};
+    for (int i = 0; i < 16; i++) {
+        uint32_t *a = &v[(4 - i % 4) % 4], b = v[(5 - i % 4) % 4], c = v[(6 - i % 4) % 4], d = v[(7 - i % 4) % 4];
+        *a = rotl32(*a + ((b & c) | (~b & d)) + x[i], shift1[i % 4]);
+    }
+    for (int i = 0; i < 16; i++) {
+        uint32_t *a = &v[(4 - i % 4) % 4], b = v[(5 - i % 4) % 4], c = v[(6 - i % 4) % 4], d = v[(7 - i % 4) % 4];
+        *a = rotl32(*a + ((b & c) | (b & d) | (c & d)) + x[order2[i]] + 0x5A827999u, shift2[i % 4]);
+    }
+    for (int i = 0; i < 16; i++) {
+        uint32_t *a = &v[(4 - i % 4) % 4], b = v[(5 - i % 4) % 4], c = v[(6 - i % 4) % 4], d = v[(7 - i % 4) % 4];
+        *a = rotl32(*a + (b ^ c ^ d) + x[order3[i]] + 0x6ED9EBA1u, shift3[i % 4]);
+    }
+    for (int i = 0; i < 4; i++) {
+        state[i] += v[i];
+    }
+}
+
+// Appends one UTF-16LE code unit to the message
+static void md4_add_unit(Md4 *md4, uint32_t unit) {
+    md4->block[md4->used++] = (unsigned char)unit;
+    md4->block[md4->used++] = (unsigned char)(unit >> 8);
+    md4->bytes += 2;
+    if (md4->used == sizeof(md4->block)) {
+        md4_compress(md4->state, md4->block);
+        md4->used = 0;
+    }
+}
+
+// Decodes one UTF-8 sequence at p; returns its length, or 0 if it is not a valid one
+static size_t utf8_decode(const unsigned char *p, size_t left, uint32_t *code_point) {
+    size_t length = p[0] >= 0xF5 ? 0 : p[0] >= 0xF0 ? 4 : p[0] >= 0xE0 ? 3 : p[0] >= 0xC2 ? 2 : 0;
+    if (p[0] < 0x80) {
+        *code_point = p[0];
+        return 1;
+    }
+    if (length == 0 || length > left) {
+        return 0;
+    }
+    uint32_t value = p[0] & (0x7F >> length);
+    for (size_t i = 1; i < length; i++) {
+        if ((p[i] & 0xC0) != 0x80) {
+            return 0;
+        }
+        value = value << 6 | (p[i] & 0x3F);
+    }
+    // Overlong forms, surrogates and values past U+10FFFF are not characters
+    static const uint32_t smallest[5] = {0, 0, 0x80, 0x800, 0x10000};
+    if (value < smallest[length] || (value >= 0xD800 && value <= 0xDFFF) || value > 0x10FFFF) {
+        return 0;
+    }
+    *code_point = value;
+    return length;
+}
+
+void ntlm_hash(const unsigned char *password, size_t length, unsigned char digest[NTLM_HASH_SIZE]) {
+    Md4 md4 = {{0x67452301u, 0xEFCDAB89u, 0x98BADCFEu, 0x10325476u}, {0}, 0, 0};
+    for (size_t i = 0; i < length;) {
+        uint32_t code_point;
+        size_t used = utf8_decode(password + i, length - i, &code_point);
+        if (used == 0) {
+            code_point = password[i]; // Latin-1, as a legacy code page would give it
+            used = 1;
+        }
+        if (code_point > 0xFFFF) {
+            code_point -= 0x10000;
+            md4_add_unit(&md4, 0xD800 | (code_point >> 10));
+            md4_add_unit(&md4, 0xDC00 | (code_point & 0x3FF));
+        } else {
+            md4_add_unit(&md4, code_point);
+        }
+        i += used;
+    }
+
+    // Padding: a 1 bit, zeros up to 56 bytes into a block, then the length in bits, little-endian
+    uint64_t bits = md4.bytes * 8;
+    md4.block[md4.used++] = 0x80;
+    if (md4.used > 56) {
+        memset(md4.block + md4.used, 0, sizeof(md4.block) - md4.used);
+        md4_compress(md4.state, md4.block);
+        md4.used = 0;
+    }
+    memset(md4.block + md4.used, 0, 56 - md4.used);
+    for (int i = 0; i < 8; i++) {
+        md4.block[56 + i] = (unsigned char)(bits >> (8 * i));
+    }
+    md4_compress(md4.state, md4.block);
+    for (int i = 0; i < 4; i++) {
+        for (int j = 0; j < 4; j++) {
+            digest[4 * i + j] = (unsigned char)(md4.state[i] >> (8 * j));
+        }
+    }
+}
@@ -0,0 +1,456 @@
+#include "packed_store.h"
+#include "hash_util.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+_Static_assert(sizeof(PackHeader) == PACK_HEADER_SIZE, "PackHeader must match its on-disk size");
+
+// Leading PACK_KEY_BITS bits of a hash as a big-endian integer
+static uint64_t pack_key(const unsigned char *hash) {
+    return load_be64(hash);
+}
+
+static uint64_t low_mask(uint32_t bits) {
+    return bits >= 64 ? ~(uint64_t)0 : ((uint64_t)1 << bits) - 1;
+}
+
+// Reads `bits` (at most 64) bits starting at bit offset `pos` of a little-endian word array
+static uint64_t read_bits(const uint64_t *words, uint64_t pos, uint32_t bits) {
+    if (bits == 0) {
+        return 0;
+    }
+    uint64_t word = pos >> 6;
+    uint32_t shift = pos & 63;
+    uint64_t value = words[word] >> shift;
+    if (shift + bits > 64) {
+        value |= words[word + 1] << (64 - shift);
+    }
+    return value & low_mask(bits);
+}
+
+// Position of the first set bit at or after `pos` in the high bitvector
+static uint64_t next_set_bit(const uint64_t *words, uint64_t pos) {
+    uint64_t word = pos >> 6;
+    uint64_t bits = words[word] & (~(uint64_t)0 << (pos & 63));
+    while (bits == 0) {
+        bits = words[++word];
+    }
+    return (word << 6) + (uint64_t)__builtin_ctzll(bits);
+}
+
+// Decodes one LEB128 varint and advances the cursor
+static uint32_t read_varint(const uint8_t **cursor) {
+    const uint8_t *p = *cursor;
+    uint32_t value = 0;
+    uint32_t shift = 0;
+    while (*p & 0x80) {
+        value |= (uint32_t)(*p++ & 0x7F) << shift;
+        shift += 7;
+    }
+    value |= (uint32_t)*p++ << shift;
+    *cursor = p;
+    return value;
+}
+
+/**
+ * Checks whether a file is a packed store by looking at its magic bytes.
+ *
+ * Returns:
+ * - int: 1 if the file begins with PACK_MAGIC, 0 otherwise (including when the
+ *   file cannot be read).
+ */
+int packed_is_store(const char *path) {
+    char magic[PACK_MAGIC_SIZE];
+    FILE *file = fopen(path, "rb");
+    if (file == NULL) {
+        return 0;
+    }
+    size_t got = fread(magic, 1, sizeof(magic), file);
+    fclose(file);
+    return got == sizeof(magic) && memcmp(magic, PACK_MAGIC, PACK_MAGIC_SIZE) == 0;
+}
+
+/**
+ * Maps a packed store into memory for lookups.
+ *
+ * Like flat_open(), the file is mapped read-only and shared, and every section
+ * is checked against the file size before it is used.
+ *
+ * Parameters:
+ * - store (PackedStore*): Store handle to fill in.
+ * - path (const char*): Path to the store file written by packed_write().
+ *
+ * Returns:
+ * - int: 0 on success, 1 if the file cannot be opened, mapped or is malformed.
+ */
+int packed_open(PackedStore *store, const char *path) {
+    memset(store, 0, sizeof(*store));
+    store->fd = -1;
+
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        fprintf(stderr, "Can't open packed store: %s\n", path);
+        return 1;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || (size_t)st.st_size < PACK_HEADER_SIZE) {
+        fprintf(stderr, "Packed store is truncated: %s\n", path);
+        close(fd);
+        return 1;
+    }
+
+    void *map = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    if (map == MAP_FAILED) {
+        fprintf(stderr, "Can't map packed store: %s\n", path);
+        close(fd);
+        return 1;
+    }
+
+    const PackHeader *header = map;
+    uint64_t directory_size = (((uint64_t)1 << header->bucket_bits) + 1) * sizeof(uint64_t);
+    uint64_t high_words = (header->key_count + ((uint64_t)1 << (header->bucket_bits + header->high_bits)) + 63) / 64;
+    if (memcmp(header->magic, PACK_MAGIC, PACK_MAGIC_SIZE) != 0 ||
+        header->version != PACK_VERSION ||
+        header->bucket_bits > PACK_MAX_BUCKET_BITS ||
+        header->bucket_bits + header->high_bits + header->low_bits != PACK_KEY_BITS ||
+        header->high_offset < PACK_HEADER_SIZE + 2 * directory_size ||
+        header->high_offset + high_words * sizeof(uint64_t) > header->low_offset ||
+        header->low_offset + ((header->key_count * header->low_bits + 63) / 64 + 1) * sizeof(uint64_t) > header->counts_offset ||
+        header->counts_offset + header->counts_size > (uint64_t)st.st_size) {
+        fprintf(stderr, "Packed store header is invalid: %s\n", path);
+        munmap(map, (size_t)st.st_size);
+        close(fd);
+        return 1;
+    }
+
+    store->fd = fd;
+    store->map = map;
+    store->map_size = (size_t)st.st_size;
+    store->header = header;
+    store->ranks = (const uint64_t *)(store->map + PACK_HEADER_SIZE);
+    store->count_offsets = (const uint64_t *)(store->map + PACK_HEADER_SIZE + directory_size);
+    store->high = (const uint64_t *)(store->map + header->high_offset);
+    store->low = (const uint64_t *)(store->map + header->low_offset);
+    store->counts = store->map + header->counts_offset;
+
+    madvise((void *)store->map, store->map_size, MADV_RANDOM);
+    return 0;
+}
+
+/**
+ * Looks up a binary hash in a packed store.
+ *
+ * The bucket's first rank locates its run in the high bitvector; the run is
+ * walked one set bit at a time, comparing the unary-coded high part and then the
+ * stored low bits, until the key is found or passed. A hit decodes the bucket's
+ * varints up to the matching position to recover the exact count. With about
+ * 64 keys per bucket that is two or three cache lines of bits and counts.
+ *
+ * Parameters:
+ * - store (const PackedStore*): An open store.
+ * - hash (const unsigned char*): The 20-byte SHA-1 digest to look for.
+ * - count (uint32_t*): Receives the breach count when the hash is found.
+ *
+ * Returns:
+ * - int: 1 if the hash's leading PACK_KEY_BITS bits are present, 0 if not.
+ *
+ * Note:
+ * - Only 64 bits of each hash are kept, so a hash that was never added is
+ *   reported present with probability key_count / 2^64 (about 5e-11 for the
+ *   full dump). Stored hashes never share a key; packed_write() refuses those.
+ */
+int packed_lookup(const PackedStore *store, const unsigned char *hash, uint32_t *count) {
+    const PackHeader *header = store->header;
+    uint64_t key = pack_key(hash);
+    uint32_t low_shift = header->low_bits;
+    uint64_t bucket = header->bucket_bits == 0 ? 0 : key >> (PACK_KEY_BITS - header->bucket_bits);
+    uint64_t target_high = (key >> low_shift) & low_mask(header->high_bits);
+    uint64_t target_low = key & low_mask(low_shift);
+
+    uint64_t begin = store->ranks[bucket];
+    uint64_t end = store->ranks[bucket + 1];
+    uint64_t base = bucket << header->high_bits;
+    uint64_t cursor = base + begin;
+    for (uint64_t i = begin; i < end; i++) {
+        cursor = next_set_bit(store->high, cursor);
+        uint64_t high = cursor - base - i;
+        cursor++;
+        if (high < target_high) {
+            continue;
+        }
+        if (high > target_high) {
+            return 0;
+        }
+
+        uint64_t low = read_bits(store->low, i * low_shift, low_shift);
+        if (low < target_low) {
+            continue;
+        }
+        if (low > target_low) {
+            return 0;
+        }
+
+        const uint8_t *cursor_counts = store->counts + store->count_offsets[bucket];
+        for (uint64_t skip = begin; skip < i; skip++) {
+            read_varint(&cursor_counts);
+        }
+        *count = read_varint(&cursor_counts);
+        return 1;
+    }
+    return 0;
+}
+
+/**
+ * Decodes every key and count of a packed store in key order.
+ *
+ * Parameters:
+ * - store (const PackedStore*): An open store.
+ * - callback (PackedCallback): Called once per key; a non-zero return stops the walk.
+ * - ctx (void*): Passed through to the callback.
+ *
+ * Returns:
+ * - int: 0 when every key was visited, 1 if the callback stopped early.
+ */
+int packed_for_each(const PackedStore *store, PackedCallback callback, void *ctx) {
+    const PackHeader *header = store->header;
+    uint64_t buckets = (uint64_t)1 << header->bucket_bits;
+    const uint8_t *counts = store->counts;
+    uint64_t cursor = 0;
+    uint64_t i = 0;
+    for (uint64_t bucket = 0; bucket < buckets; bucket++) {
+        uint64_t base = bucket << header->high_bits;
+        for (; i < store->ranks[bucket + 1]; i++) {
+            cursor = next_set_bit(store->high, cursor);
+            uint64_t high = cursor - base - i;
+            cursor++;
+            uint64_t key = ((base + high) << header->low_bits) | read_bits(store->low, i * header->low_bits, header->low_bits);
+            if (callback(key, read_varint(&counts), ctx) != 0) {
+                return 1;
+            }
+        }
+    }
+    return 0;
+}
+
+// Releases the mapping and descriptor held by a store
+void packed_close(PackedStore *store) {
+    if (store->map != NULL) {
+        munmap((void *)store->map, store->map_size);
+    }
+    if (store->fd >= 0) {
+        close(store->fd);
+    }
+    memset(store, 0, sizeof(*store));
+    store->fd = -1;
+}
+
+// Sequential bit sink that writes whole little-endian words to a file
+typedef struct {
+    FILE *file;
+    uint64_t word;
+    uint64_t bit;   // Bits written so far
+    int failed;
+} BitWriter;
+
+static void bit_flush_word(BitWriter *writer) {
+    if (fwrite(&writer->word, sizeof(writer->word), 1, writer->file) != 1) {
+        writer->failed = 1;
+    }
+    writer->word = 0;
+}
+
+// Appends the low `bits` bits of value
+static void bit_append(BitWriter *writer, uint64_t value, uint32_t bits) {
+    while (bits > 0) {
+        uint32_t used = writer->bit & 63;
+        uint32_t take = 64 - used < bits ? 64 - used : bits;
+        writer->word |= (value & low_mask(take)) << used;
+        value = take >= 64 ? 0 : value >> take;
+        bits -= take;
+        writer->bit += take;
+        if ((writer->bit & 63) == 0) {
+            bit_flush_word(writer);
+        }
+    }
+}
+
+// Pads the stream with zero bits up to `total_words` words
+static void bit_finish(BitWriter *writer, uint64_t total_words) {
+    if (writer->bit & 63) {
+        bit_flush_word(writer);
+        writer->bit = (writer->bit + 63) & ~(uint64_t)63;
+    }
+    while (writer->bit < total_words * 64) {
+        bit_flush_word(writer);
+        writer->bit += 64;
+    }
+}
+
+static size_t varint_size(uint32_t value) {
+    size_t size = 1;
+    while (value >= 0x80) {
+        value >>= 7;
+        size++;
+    }
+    return size;
+}
+
+static int write_varint(FILE *file, uint32_t value) {
+    uint8_t bytes[5];
+    size_t size = 0;
+    while (value >= 0x80) {
+        bytes[size++] = (uint8_t)(value | 0x80);
+        value >>= 7;
+    }
+    bytes[size++] = (uint8_t)value;
+    return fwrite(bytes, 1, size, file) == size ? 0 : 1;
+}
+
+// Names two hashes that share a packed key; they are printed in hex without pulling in hex.c
+static void report_collision(const unsigned char *a, const unsigned char *b) {
+    fprintf(stderr, "Can't build a packed store: two hashes share their leading %d bits and would get one count:\n",
+            PACK_KEY_BITS);
+    for (const unsigned char *hash = a; hash != NULL; hash = hash == a ? b : NULL) {
+        fprintf(stderr, "  ");
+        for (int i = 0; i < FLAT_HASH_SIZE; i++) {
+            fprintf(stderr, "%02X", hash[i]);
+        }
+        fprintf(stderr, "\n");
+    }
+    fprintf(stderr, "Use a flat store, which keeps full hashes, for this dump.\n");
+}
+
+// Smallest bucket width that keeps the average bucket near 2^PACK_BUCKET_SHIFT keys
+static uint32_t choose_bucket_bits(uint64_t key_count) {
+    uint32_t bits = 0;
+    while (bits < PACK_MAX_BUCKET_BITS && (key_count >> bits) > ((uint64_t)1 << PACK_BUCKET_SHIFT)) {
+        bits++;
+    }
+    return bits;
+}
+
+/**
+ * Encodes a flat store as a packed store.
+ *
+ * The flat store's records are already sorted by hash, so each section of the
+ * packed file is produced by one sequential pass over them: the two bucket
+ * directories, the unary high bits, the fixed-width low bits and finally the
+ * varint counts. Apart from the directories nothing is buffered in memory.
+ * The build is refused if two records share their leading PACK_KEY_BITS bits,
+ * since the store could then return one record's count for the other.
+ *
+ * Parameters:
+ * - source (const FlatStore*): An open flat store to encode.
+ * - path (const char*): Path of the packed store to create; an existing file is replaced.
+ *
+ * Returns:
+ * - int: 0 on success, 1 on failure.
+ */
+int packed_write(const FlatStore *source, const char *path) {
+    uint64_t n = source->header->record_count;
+    const FlatRecord *records = source->records;
+
+    PackHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, PACK_MAGIC, PACK_MAGIC_SIZE);
+    header.version = PACK_VERSION;
+    header.bucket_bits = choose_bucket_bits(n);
+    header.high_bits = PACK_HIGH_BITS;
+    header.low_bits = PACK_KEY_BITS - header.bucket_bits - header.high_bits;
+    header.key_count = n;
+
+    uint64_t buckets = (uint64_t)1 << header.bucket_bits;
+    uint64_t *ranks = malloc((buckets + 1) * sizeof(uint64_t));
+    uint64_t *count_offsets = malloc((buckets + 1) * sizeof(uint64_t));
+    FILE *file = fopen(path, "wb");
+    int status = 1;
+    if (ranks == NULL || count_offsets == NULL || file == NULL) {
+        fprintf(stderr, "Can't create packed store: %s\n", path);
+        goto done;
+    }
+
+    // Pass 1: first key and first count byte of every bucket. Two hashes that share their
+    // leading PACK_KEY_BITS bits would become one key with two counts, so they stop the build
+    uint64_t next = 0;
+    uint64_t count_bytes = 0;
+    for (uint64_t b = 0; b < buckets; b++) {
+        ranks[b] = next;
+        count_offsets[b] = count_bytes;
+        while (next < n && (header.bucket_bits == 0 ? 0 : pack_key(records[next].hash) >> (PACK_KEY_BITS - header.bucket_bits)) == b) {
+            if (next > 0 && pack_key(records[next].hash) == pack_key(records[next - 1].hash)) {
+                report_collision(records[next - 1].hash, records[next].hash);
+                goto done;
+            }
+            count_bytes += varint_size(records[next].count);
+            next++;
+        }
+    }
+    ranks[buckets] = n;
+    count_offsets[buckets] = count_bytes;
+
+    uint64_t directory_size = (buckets + 1) * sizeof(uint64_t);
+    uint64_t high_words = (n + (buckets << header.high_bits) + 63) / 64;
+    uint64_t low_words = (n * header.low_bits + 63) / 64 + 1; // One spare word for unaligned reads
+    header.high_offset = PACK_HEADER_SIZE + 2 * directory_size;
+    header.low_offset = header.high_offset + high_words * sizeof(uint64_t);
+    header.counts_offset = header.low_offset + low_words * sizeof(uint64_t);
+    header.counts_size = count_bytes;
+
+    if (fwrite(&header, sizeof(header), 1, file) != 1 ||
+        fwrite(ranks, sizeof(uint64_t), buckets + 1, file) != buckets + 1 ||
+        fwrite(count_offsets, sizeof(uint64_t), buckets + 1, file) != buckets + 1) {
+        fprintf(stderr, "Failed to write packed store directories: %s\n", path);
+        goto done;
+    }
+
+    // Pass 2: key i sets bit (key >> low_bits) + i of the high bitvector
+    BitWriter high = {file, 0, 0, 0};
+    for (uint64_t i = 0; i < n; i++) {
+        uint64_t position = (pack_key(records[i].hash) >> header.low_bits) + i;
+        while (high.bit < position) {
+            uint64_t gap = position - high.bit;
+            bit_append(&high, 0, gap > 64 ? 64 : (uint32_t)gap);
+        }
+        bit_append(&high, 1, 1);
+    }
+    bit_finish(&high, high_words);
+
+    // Pass 3: the low bits, back to back
+    BitWriter low = {file, 0, 0, 0};
+    for (uint64_t i = 0; i < n; i++) {
+        bit_append(&low, pack_key(records[i].hash) & low_mask(header.low_bits), header.low_bits);
+    }
+    bit_finish(&low, low_words);
+
+    // Pass 4: the counts
+    int failed = high.failed || low.failed;
+    for (uint64_t i = 0; i < n && !failed; i++) {
+        failed = write_varint(file, records[i].count);
+    }
+    if (failed) {
+        fprintf(stderr, "Failed to write packed store: %s\n", path);
+        goto done;
+    }
+
+    printf("Packed %llu keys into %.1f MB (%.2f bytes per key)\n", (unsigned long long)n,
+           (header.counts_offset + count_bytes) / 1e6,
+           n ? (double)(header.counts_offset + count_bytes) / (double)n : 0.0);
+    status = 0;
+
+done:
+    free(ranks);
+    free(count_offsets);
+    if (file != NULL && fclose(file) != 0) {
+        status = 1;
+    }
+    if (file != NULL && status != 0) {
+        remove(path); // Never leave a partial store that would open as a valid one
+    }
+    return status;
+}
@@ -0,0 +1,144 @@
+#include "pla_index.h"
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+_Static_assert(sizeof(PlaSegment) == 24, "PlaSegment must not be padded");
+
+#define PLA_MAX_RADIX_BITS 24
+
+// Top `bits` bits of a key, safe for bits == 0
+static uint64_t key_top(uint64_t key, uint32_t bits) {
+    return bits == 0 ? 0 : key >> (64 - bits);
+}
+
+void pla_builder_init(PlaBuilder *builder, uint32_t epsilon) {
+    memset(builder, 0, sizeof(*builder));
+    builder->epsilon = epsilon;
+}
+
+// Appends the open segment to the closed list, choosing the middle of its cone
+static int close_segment(PlaBuilder *builder) {
+    if (builder->segment_count == builder->capacity) {
+        size_t capacity = builder->capacity ? builder->capacity * 2 : 1024;
+        PlaSegment *grown = realloc(builder->segments, capacity * sizeof(PlaSegment));
+        if (grown == NULL) {
+            fprintf(stderr, "Memory allocation failed for the learned index!\n");
+            return 1;
+        }
+        builder->segments = grown;
+        builder->capacity = capacity;
+    }
+
+    PlaSegment segment = builder->current;
+    segment.slope = isinf(builder->slope_hi) ? 0.0 : (builder->slope_lo + builder->slope_hi) / 2;
+    builder->segments[builder->segment_count++] = segment;
+    return 0;
+}
+
+/**
+ * Adds the next key to the model.
+ *
+ * A slope s keeps key within the bound when first_pos + (key - first_key) * s lies
+ * in [pos - epsilon, pos + epsilon]. Intersecting that interval with the current
+ * cone either narrows the cone or, if the two no longer overlap, ends the segment.
+ *
+ * Parameters:
+ * - builder (PlaBuilder*): Builder initialized with pla_builder_init().
+ * - key (uint64_t): Next key, strictly greater than the previous one.
+ * - pos (uint64_t): Position of the first record carrying this key.
+ *
+ * Returns:
+ * - int: 0 on success, 1 if memory for a new segment could not be allocated.
+ */
+int pla_builder_add(PlaBuilder *builder, uint64_t key, uint64_t pos) {
+    if (builder->open) {
+        double dx = (double)(key - builder->current.first_key);
+        double dy = (double)pos - (double)builder->current.first_pos;
+        double lo = fmax(builder->slope_lo, (dy - builder->epsilon) / dx);
+        double hi = fmin(builder->slope_hi, (dy + builder->epsilon) / dx);
+        if (lo <= hi) {
+            builder->slope_lo = lo;
+            builder->slope_hi = hi;
+            return 0;
+        }
+        if (close_segment(builder) != 0) {
+            return 1;
+        }
+    }
+
+    builder->current.first_key = key;
+    builder->current.first_pos = pos;
+    builder->slope_lo = 0.0; // Positions never decrease, so neither may the model
+    builder->slope_hi = INFINITY;
+    builder->open = 1;
+    return 0;
+}
+
+int pla_builder_finish(PlaBuilder *builder) {
+    if (!builder->open) {
+        return 0;
+    }
+    builder->open = 0;
+    return close_segment(builder);
+}
+
+void pla_builder_free(PlaBuilder *builder) {
+    free(builder->segments);
+    memset(builder, 0, sizeof(*builder));
+}
+
+int64_t pla_predict(const PlaSegment *segment, uint64_t key) {
+    return (int64_t)segment->first_pos + (int64_t)((double)(key - segment->first_key) * segment->slope + 0.5);
+}
+
+// About one directory entry per segment keeps the search within a directory slot short
+uint32_t pla_radix_bits(size_t segment_count) {
+    uint32_t bits = 0;
+    while (bits < PLA_MAX_RADIX_BITS && ((uint64_t)1 << bits) < segment_count) {
+        bits++;
+    }
+    return bits;
+}
+
+void pla_build_radix(const PlaSegment *segments, size_t segment_count, uint32_t bits, uint32_t *radix) {
+    uint64_t slots = (uint64_t)1 << bits;
+    size_t next = 0;
+    for (uint64_t t = 0; t < slots; t++) {
+        while (next < segment_count && key_top(segments[next].first_key, bits) < t) {
+            next++;
+        }
+        radix[t] = (uint32_t)next;
+    }
+    radix[slots] = (uint32_t)segment_count;
+}
+
+/**
+ * Finds the segment responsible for a key.
+ *
+ * The radix directory narrows the candidates to the segments starting in the
+ * key's own top-bits slot; a binary search over that handful picks the last one
+ * that starts at or before the key. If none does, the segment before the slot
+ * covers it.
+ *
+ * Returns:
+ * - int64_t: Segment index, or -1 when key is smaller than every first_key.
+ */
+int64_t pla_find_segment(const PlaSegment *segments, const uint32_t *radix, uint32_t bits, uint64_t key) {
+    uint64_t top = key_top(key, bits);
+    int64_t lo = radix[top];
+    int64_t hi = radix[top + 1];
+
+    // First segment in the slot that starts after key
+    while (lo < hi) {
+        int64_t mid = lo + (hi - lo) / 2;
+        if (segments[mid].first_key <= key) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return lo - 1;
+}
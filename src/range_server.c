@@ -0,0 +1,477 @@
+#include "deep_check.h"
+#include "lookup_stats.h"
+#include "warmup.h"
+#include "event_server.h"
+#include "hex.h"
+
+#include <errno.h>
+#include <strings.h>
+#include <getopt.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+
+#define SERVER_REQUEST_LIMIT 8192   // Largest request head accepted before answering 431
+
+// Stores being served, indexed by HashKind; a kind without a store has a NULL entry
+typedef struct {
+    PwnedDB *shared_db[2];
+    const char *db_path[2];
+} Server;
+
+// A worker's view of the stores: the shared mappings, or its own SQLite handles
+typedef struct {
+    PwnedDB own_db[2];
+    PwnedDB *dbs[2];
+} ServerWorker;
+
+// Queues a complete response with the given status line and body
+static int respond(ServerConnection *conn, const char *status, const char *body, size_t body_len) {
+    char head[256];
+    int head_len = snprintf(head, sizeof(head),
+                            "HTTP/1.1 %s\r\n"
+                            "Content-Type: text/plain\r\n"
+                            "Content-Length: %zu\r\n"
+                            "Connection: %s\r\n"
+                            "\r\n",
+                            status, body_len, conn->close_after ? "close" : "keep-alive");
+    if (server_out_append(conn, head, (size_t)head_len) != 0) {
+        return -1;
+    }
+    return server_out_append(conn, body, body_len);
+}
+
+// Appends "SUFFIX:COUNT\r\n" for one record; the suffix is the hash minus its 5-digit prefix
+static inline __attribute__((always_inline)) int append_range_line(const unsigned char *binary_hash, int count,
+                                                                   ServerConnection *conn, size_t hash_size) {
+    char hex[2 * HASH_MAX_SIZE];
+    if (server_out_reserve(conn, 2 * hash_size + 16) != 0) {
+        return -1;
+    }
+    hex_encode(binary_hash, hash_size, hex);
+    memcpy(conn->out + conn->out_len, hex + 5, 2 * hash_size - 5);
+    conn->out_len += 2 * hash_size - 5;
+    conn->out_len += (size_t)snprintf(conn->out + conn->out_len, 16, ":%d\r\n", count);
+    return 0;
+}
+
+// One formatter per key width, so the suffix length is a constant in each
+static int append_sha1_line(const unsigned char *binary_hash, int count, void *ctx) {
+    return append_range_line(binary_hash, count, ctx, SHA1_HASH_SIZE);
+}
+
+static int append_ntlm_line(const unsigned char *binary_hash, int count, void *ctx) {
+    return append_range_line(binary_hash, count, ctx, NTLM_HASH_SIZE);
+}
+
+/**
+ * Serves GET /range/{prefix} for one parsed request line.
+ *
+ * The response body is produced straight into the connection's output buffer
+ * by a single prefix scan; only the header is written afterwards, once the
+ * body length is known. Suffixes are 35 hex digits from a SHA-1 store and 27
+ * from an NTLM one, as the public API returns them.
+ */
+static int serve_range(ServerConnection *conn, PwnedDB *db, const char *prefix_hex) {
+    unsigned char bytes[3];
+    char padded[6];
+    memcpy(padded, prefix_hex, 5);
+    padded[5] = '0';
+    if (hex_decode(padded, bytes, 3) != 0) {
+        const char *msg = "The hash prefix was not in a valid format";
+        return respond(conn, "400 Bad Request", msg, strlen(msg));
+    }
+    uint32_t prefix = ((uint32_t)bytes[0] << 12) | ((uint32_t)bytes[1] << 4) | ((uint32_t)bytes[2] >> 4);
+
+    // Reserve room for the header, scan the body in place, then slide it behind the header
+    size_t head_start = conn->out_len;
+    size_t body_start = head_start + 256;
+    if (server_out_reserve(conn, 256) != 0) {
+        return -1;
+    }
+    conn->out_len = body_start;
+    RangeCallback append = db->kind == HASH_KIND_NTLM ? append_ntlm_line : append_sha1_line;
+    if (lookup_range(db, prefix, append, conn) != 0) {
+        conn->out_len = head_start;
+        const char *msg = "Lookup failed";
+        return respond(conn, "500 Internal Server Error", msg, strlen(msg));
+    }
+    size_t body_len = conn->out_len - body_start;
+
+    char head[256];
+    int head_len = snprintf(head, sizeof(head),
+                            "HTTP/1.1 200 OK\r\n"
+                            "Content-Type: text/plain\r\n"
+                            "Content-Length: %zu\r\n"
+                            "Connection: %s\r\n"
+                            "\r\n",
+                            body_len, conn->close_after ? "close" : "keep-alive");
+    memcpy(conn->out + head_start, head, (size_t)head_len);
+    memmove(conn->out + head_start + head_len, conn->out + body_start, body_len);
+    conn->out_len = head_start + (size_t)head_len + body_len;
+    return 0;
+}
+
+// Serves GET /metrics: the lookup statistics in Prometheus text format, when they are being kept
+static int serve_metrics(ServerConnection *conn) {
+    if (!lookup_stats_active()) {
+        const char *msg = "Metrics are off; start the server with --stats";
+        return respond(conn, "404 Not Found", msg, strlen(msg));
+    }
+    char *body = NULL;
+    size_t body_len = 0;
+    FILE *out = open_memstream(&body, &body_len);
+    if (out == NULL) {
+        return -1;
+    }
+    int failed = lookup_stats_write_prometheus(out) != 0;
+    failed |= fclose(out) != 0;
+    int rc = failed ? -1 : respond(conn, "200 OK", body, body_len);
+    free(body);
+    return rc;
+}
+
+// Whether the query string of a request target (from the '?' on) asks for mode=ntlm
+static int query_wants_ntlm(const char *query, size_t len) {
+    static const char key[] = "mode=ntlm";
+    size_t key_len = sizeof(key) - 1;
+    for (size_t i = 1; i + key_len <= len; i++) {
+        if ((query[i - 1] == '?' || query[i - 1] == '&') && strncasecmp(query + i, key, key_len) == 0 &&
+            (i + key_len == len || query[i + key_len] == '&')) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+// Case-insensitive search for a header line within the request head
+static int header_has(const char *head, size_t len, const char *name, const char *value) {
+    size_t name_len = strlen(name);
+    size_t value_len = strlen(value);
+    for (size_t i = 0; i + name_len + value_len <= len; i++) {
+        if ((i == 0 || head[i - 1] == '\n') && strncasecmp(head + i, name, name_len) == 0) {
+            const char *v = head + i + name_len;
+            while (*v == ' ' && v < head + len) {
+                v++;
+            }
+            return (size_t)(head + len - v) >= value_len && strncasecmp(v, value, value_len) == 0;
+        }
+    }
+    return 0;
+}
+
+/**
+ * Answers every complete request buffered on a connection.
+ *
+ * Returns:
+ * - int: 0 to keep the connection, -1 if it should be closed.
+ */
+static int process_requests(ServerConnection *conn, void *worker) {
+    PwnedDB *const *dbs = ((ServerWorker *)worker)->dbs;
+    for (;;) {
+        char *end = NULL;
+        for (size_t i = 3; i < conn->in_len; i++) {
+            if (memcmp(conn->in + i - 3, "\r\n\r\n", 4) == 0) {
+                end = conn->in + i + 1;
+                break;
+            }
+        }
+        if (end == NULL) {
+            if (conn->in_len == conn->in_capacity) {
+                conn->close_after = 1;
+                const char *msg = "Request header too large";
+                respond(conn, "431 Request Header Fields Too Large", msg, strlen(msg));
+                conn->in_len = 0;
+            }
+            return 0;
+        }
+
+        size_t head_len = (size_t)(end - conn->in);
+        const char *line_end = memchr(conn->in, '\r', head_len);
+        size_t line_len = (size_t)(line_end - conn->in);
+        int http10 = line_len >= 8 && memcmp(line_end - 8, "HTTP/1.0", 8) == 0;
+        if (header_has(conn->in, head_len, "Connection:", "close") ||
+            (http10 && !header_has(conn->in, head_len, "Connection:", "keep-alive"))) {
+            conn->close_after = 1;
+        }
+
+        int rc;
+        static const char range_path[] = "GET /range/";
+        size_t path_len = sizeof(range_path) - 1;
+        if (line_len >= 4 && memcmp(conn->in, "GET ", 4) != 0) {
+            const char *msg = "Method not allowed";
+            rc = respond(conn, "405 Method Not Allowed", msg, strlen(msg));
+        } else if (line_len >= path_len + 5 && memcmp(conn->in, range_path, path_len) == 0 &&
+                   (conn->in[path_len + 5] == ' ' || conn->in[path_len + 5] == '?')) {
+            // The target ends at the space before the protocol
+            const char *query = conn->in + path_len + 5;
+            const char *target_end = memchr(query, ' ', (size_t)(line_end - query));
+            size_t query_len = (size_t)((target_end ? target_end : line_end) - query);
+            HashKind kind = query_wants_ntlm(query, query_len) ? HASH_KIND_NTLM : HASH_KIND_SHA1;
+            if (dbs[kind] == NULL) {
+                const char *msg = kind == HASH_KIND_NTLM ? "No NTLM store is being served"
+                                                         : "No SHA-1 store is being served";
+                rc = respond(conn, "404 Not Found", msg, strlen(msg));
+            } else {
+                rc = serve_range(conn, dbs[kind], conn->in + path_len);
+            }
+        } else if (line_len >= 13 && memcmp(conn->in, "GET /metrics", 12) == 0 &&
+                   (conn->in[12] == ' ' || conn->in[12] == '?')) {
+            rc = serve_metrics(conn);
+        } else {
+            const char *msg = "Not found";
+            rc = respond(conn, "404 Not Found", msg, strlen(msg));
+        }
+        if (rc != 0) {
+            return -1;
+        }
+
+        memmove(conn->in, end, conn->in_len - head_len);
+        conn->in_len -= head_len;
+        if (conn->close_after) {
+            conn->in_len = 0;
+            return 0;
+        }
+    }
+}
+
+// SQLite connections (also those of SQLite shards) are per thread and opened once; mappings are shared
+static void *open_worker_dbs(void *ctx) {
+    Server *server = ctx;
+    ServerWorker *worker = malloc(sizeof(ServerWorker));
+    if (worker == NULL) {
+        fprintf(stderr, "Memory allocation failed for a worker!\n");
+        exit(1);
+    }
+    for (int kind = 0; kind < 2; kind++) {
+        worker->dbs[kind] = server->shared_db[kind];
+        if (worker->dbs[kind] != NULL && !db_thread_safe(worker->dbs[kind])) {
+            if (init_db(&worker->own_db[kind], server->db_path[kind]) != 0) {
+                fprintf(stderr, "Worker failed to open the database.\n");
+                exit(1);
+            }
+            worker->dbs[kind] = &worker->own_db[kind];
+        }
+    }
+    return worker;
+}
+
+static void close_worker_dbs(void *worker_ptr, void *ctx) {
+    Server *server = ctx;
+    ServerWorker *worker = worker_ptr;
+    for (int kind = 0; kind < 2; kind++) {
+        if (worker->dbs[kind] != server->shared_db[kind]) {
+            close_db(worker->dbs[kind]);
+        }
+    }
+    free(worker);
+}
+
+static int open_listener(const char *bind_addr, int port) {
+    int fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd < 0) {
+        fprintf(stderr, "Can't create socket: %s\n", strerror(errno));
+        return -1;
+    }
+    int one = 1;
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons((uint16_t)port);
+    if (inet_pton(AF_INET, bind_addr, &addr.sin_addr) != 1) {
+        fprintf(stderr, "Invalid bind address: %s\n", bind_addr);
+        close(fd);
+        return -1;
+    }
+    if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0 || listen(fd, SOMAXCONN) != 0) {
+        fprintf(stderr, "Can't listen on %s:%d: %s\n", bind_addr, port, strerror(errno));
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+static void close_server_dbs(Server *server) {
+    for (int kind = 0; kind < 2; kind++) {
+        if (server->shared_db[kind] != NULL) {
+            close_db(server->shared_db[kind]);
+        }
+    }
+}
+
+static void usage(const char *program) {
+    fprintf(stderr,
+            "Usage: %s [options] [database_path]\n"
+            "  -a, --bind ADDR      Address to listen on (default 127.0.0.1)\n"
+            "  -p, --port N         Port to listen on (default 8080)\n"
+            "  -t, --threads N      Worker threads (default: one per core)\n"
+            "  -n, --ntlm PATH      Also serve an NTLM store, for /range/{prefix}?mode=ntlm\n"
+            "  -c, --check-blocks   Verify each block of a flat store against its checksums the first\n"
+            "                       time a lookup reads it; a damaged block fails the lookup\n"
+            "  -w, --warm[=all]     Fault the store's indexes (or with \"all\", every page) in on the\n"
+            "                       worker threads before listening, and report the time to warm\n"
+            "  -P, --hugepages[=explicit]  Move the store's indexes onto transparent huge pages, or\n"
+            "                       onto reserved ones (vm.nr_hugepages) with \"explicit\"\n"
+            "  -l, --mlock MB       Lock up to MB of the store in memory, indexes first\n"
+            "  -S, --stats[=faults] Measure lookups and print a summary on shutdown;\n"
+            "                       \"faults\" also samples page faults per lookup\n"
+            "  -m, --metrics-file PATH  Rewrite PATH in Prometheus text format every %d s;\n"
+            "                       measures lookups even without --stats\n"
+            "  -h, --help           Show this message\n",
+            program, STATS_METRICS_INTERVAL_MS / 1000);
+}
+
+/**
+ * Local HIBP-compatible range API server.
+ *
+ * Serves GET /range/{5 hex digits} with the same "SUFFIX:COUNT" body as the
+ * public k-anonymity API, from the SHA-1 store or, with ?mode=ntlm, the NTLM
+ * one, and GET /metrics when started with --stats. A single epoll loop accepts clients and hands ready
+ * connections to a pool of worker threads; each request is answered from one
+ * contiguous prefix scan of the local database.
+ */
+int main(int argc, char *argv[]) {
+    const char *bind_addr = "127.0.0.1";
+    int port = 8080;
+    int threads = 0;
+    unsigned stats_flags = 0;
+    int print_stats = 0;
+    const char *metrics_path = NULL;
+    const char *ntlm_path = NULL;
+    WarmupOptions warm_options = {WARM_PREFETCH_NONE, WARM_HUGE_PAGES_OFF, 0, 0};
+
+    static const struct option long_options[] = {
+        {"bind",    required_argument, NULL, 'a'},
+        {"port",    required_argument, NULL, 'p'},
+        {"threads", required_argument, NULL, 't'},
+        {"ntlm",    required_argument, NULL, 'n'},
+        {"check-blocks", no_argument, NULL, 'c'},
+        {"warm",    optional_argument, NULL, 'w'},
+        {"hugepages", optional_argument, NULL, 'P'},
+        {"mlock",   required_argument, NULL, 'l'},
+        {"stats",   optional_argument, NULL, 'S'},
+        {"metrics-file", required_argument, NULL, 'm'},
+        {"help",    no_argument,       NULL, 'h'},
+        {NULL, 0, NULL, 0}
+    };
+    int opt;
+    while ((opt = getopt_long(argc, argv, "a:p:t:n:cw::P::l:S::m:h", long_options, NULL)) != -1) {
+        switch (opt) {
+            case 'a': bind_addr = optarg; break;
+            case 'p': port = atoi(optarg); break;
+            case 't': threads = atoi(optarg); break;
+            case 'n': ntlm_path = optarg; break;
+            case 'c': db_enable_block_checks(1); break;
+            case 'w':
+                if (warmup_parse_prefetch(optarg, &warm_options.prefetch) != 0) {
+                    usage(argv[0]);
+                    return 1;
+                }
+                break;
+            case 'P':
+                if (warmup_parse_huge_pages(optarg, &warm_options.huge_pages) != 0) {
+                    usage(argv[0]);
+                    return 1;
+                }
+                break;
+            case 'l': warm_options.lock_budget = (uint64_t)(atof(optarg) * 1024 * 1024); break;
+            case 'S':
+                print_stats = 1;
+                if (lookup_stats_parse(optarg, &stats_flags) != 0) {
+                    usage(argv[0]);
+                    return 1;
+                }
+                break;
+            case 'm':
+                metrics_path = optarg;
+                stats_flags |= LOOKUP_STATS_TIMING;
+                break;
+            case 'h': usage(argv[0]); return 0;
+            default: usage(argv[0]); return 1;
+        }
+    }
+    if (threads <= 0) {
+        long cores = sysconf(_SC_NPROCESSORS_ONLN);
+        threads = cores > 0 ? (int)cores : 1;
+    }
+    lookup_stats_enable(stats_flags);
+
+    Server server;
+    memset(&server, 0, sizeof(server));
+    const char *db_path = optind < argc ? argv[optind] : "database/pwnedpasswords.db";
+
+    // The positional store serves the requests of its own kind, --ntlm the NTLM ones
+    PwnedDB db, ntlm_db;
+    if (init_db(&db, db_path) != 0) {
+        fprintf(stderr, "Failed to initialize the database.\n");
+        return 1;
+    }
+    server.shared_db[db.kind] = &db;
+    server.db_path[db.kind] = db_path;
+    if (ntlm_path != NULL) {
+        if (db.kind == HASH_KIND_NTLM) {
+            fprintf(stderr, "%s is already an NTLM store; --ntlm wants a SHA-1 store as the database.\n", db_path);
+            close_db(&db);
+            return 1;
+        }
+        if (init_db(&ntlm_db, ntlm_path) != 0) {
+            fprintf(stderr, "Failed to initialize the NTLM database.\n");
+            close_db(&db);
+            return 1;
+        }
+        if (ntlm_db.kind != HASH_KIND_NTLM) {
+            fprintf(stderr, "%s holds %s hashes, not NTLM ones.\n", ntlm_path, hash_kind_name(ntlm_db.kind));
+            close_db(&ntlm_db);
+            close_db(&db);
+            return 1;
+        }
+        server.shared_db[HASH_KIND_NTLM] = &ntlm_db;
+        server.db_path[HASH_KIND_NTLM] = ntlm_path;
+    }
+    if (warmup_requested(&warm_options)) {
+        // Warm before listening, so the first request after a deploy finds the indexes resident
+        warm_options.threads = threads;
+        for (int kind = 0; kind < 2; kind++) {
+            WarmupReport warm_report;
+            if (server.shared_db[kind] == NULL) {
+                continue;
+            }
+            if (db_warm(server.shared_db[kind], &warm_options, &warm_report) != 0) {
+                fprintf(stderr, "Failed to warm the database.\n");
+                return 1;
+            }
+            if (ntlm_path != NULL) {
+                printf("%s: ", hash_kind_name((HashKind)kind));
+            }
+            warmup_print_report(stdout, &warm_report);
+        }
+    }
+
+    int listen_fd = open_listener(bind_addr, port);
+    if (listen_fd < 0) {
+        close_server_dbs(&server);
+        return 1;
+    }
+
+    printf("Serving /range/{prefix} on http://%s:%d with %d workers%s\n", bind_addr, port, threads,
+           server.shared_db[HASH_KIND_NTLM] != NULL ? " (NTLM with ?mode=ntlm)" : "");
+    fflush(stdout);
+
+    ServerHandlers handlers = {SERVER_REQUEST_LIMIT, process_requests, open_worker_dbs, close_worker_dbs, &server,
+                               metrics_path};
+    int rc = server_run(listen_fd, threads, &handlers);
+
+    close(listen_fd);
+    close_server_dbs(&server);
+    if (rc != 0) {
+        return 1;
+    }
+    if (print_stats) {
+        lookup_stats_print(stderr);
+    }
+    printf("Server stopped.\n");
+    return 0;
+}
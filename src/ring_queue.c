@@ -0,0 +1,116 @@
+#include "ring_queue.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <sched.h>
+#include <time.h>
+
+/**
+ * Initializes an empty queue.
+ *
+ * Parameters:
+ * - queue (RingQueue*): Queue to initialize.
+ * - capacity (size_t): Minimum number of slots; rounded up to a power of two.
+ *
+ * Returns:
+ * - int: 0 on success, -1 if the slot array cannot be allocated.
+ */
+int ring_queue_init(RingQueue *queue, size_t capacity) {
+    size_t size = 2;
+    while (size < capacity) {
+        size <<= 1;
+    }
+
+    queue->cells = malloc(size * sizeof(RingCell));
+    if (queue->cells == NULL) {
+        fprintf(stderr, "Memory allocation failed for ring queue!\n");
+        return -1;
+    }
+    for (size_t i = 0; i < size; i++) {
+        atomic_init(&queue->cells[i].sequence, i);
+        queue->cells[i].data = NULL;
+    }
+    queue->mask = size - 1;
+    atomic_init(&queue->enqueue_pos, 0);
+    atomic_init(&queue->dequeue_pos, 0);
+    return 0;
+}
+
+void ring_queue_destroy(RingQueue *queue) {
+    free(queue->cells);
+    queue->cells = NULL;
+}
+
+int ring_queue_try_push(RingQueue *queue, void *item) {
+    size_t pos = atomic_load_explicit(&queue->enqueue_pos, memory_order_relaxed);
+    for (;;) {
+        RingCell *cell = &queue->cells[pos & queue->mask];
+        size_t seq = atomic_load_explicit(&cell->sequence, memory_order_acquire);
+        intptr_t diff = (intptr_t)seq - (intptr_t)pos;
+        if (diff == 0) {
+            // Slot is free for this lap; claim it
+            if (atomic_compare_exchange_weak_explicit(&queue->enqueue_pos, &pos, pos + 1,
+                                                      memory_order_relaxed, memory_order_relaxed)) {
+                cell->data = item;
+                atomic_store_explicit(&cell->sequence, pos + 1, memory_order_release);
+                return 0;
+            }
+        } else if (diff < 0) {
+            return -1; // Consumer hasn't drained this slot yet: full
+        } else {
+            pos = atomic_load_explicit(&queue->enqueue_pos, memory_order_relaxed);
+        }
+    }
+}
+
+int ring_queue_try_pop(RingQueue *queue, void **item) {
+    size_t pos = atomic_load_explicit(&queue->dequeue_pos, memory_order_relaxed);
+    for (;;) {
+        RingCell *cell = &queue->cells[pos & queue->mask];
+        size_t seq = atomic_load_explicit(&cell->sequence, memory_order_acquire);
+        intptr_t diff = (intptr_t)seq - (intptr_t)(pos + 1);
+        if (diff == 0) {
+            if (atomic_compare_exchange_weak_explicit(&queue->dequeue_pos, &pos, pos + 1,
+                                                      memory_order_relaxed, memory_order_relaxed)) {
+                *item = cell->data;
+                // Hand the slot back to producers for the next lap
+                atomic_store_explicit(&cell->sequence, pos + queue->mask + 1, memory_order_release);
+                return 0;
+            }
+        } else if (diff < 0) {
+            return -1; // Producer hasn't filled this slot yet: empty
+        } else {
+            pos = atomic_load_explicit(&queue->dequeue_pos, memory_order_relaxed);
+        }
+    }
+}
+
+// Spin briefly, then yield, then sleep, so idle stages don't burn a core
+static void backoff(unsigned *attempt) {
+    if (*attempt < 64) {
+        // Busy wait
+    } else if (*attempt < 256) {
+        sched_yield();
+    } else {
+        struct timespec pause = {0, 50000};
+        nanosleep(&pause, NULL);
+    }
+    (*attempt)++;
+}
+
+void ring_queue_push(RingQueue *queue, void *item) {
+    unsigned attempt = 0;
+    while (ring_queue_try_push(queue, item) != 0) {
+        backoff(&attempt);
+    }
+}
+
+void *ring_queue_pop(RingQueue *queue) {
+    void *item;
+    unsigned attempt = 0;
+    while (ring_queue_try_pop(queue, &item) != 0) {
+        backoff(&attempt);
+    }
+    return item;
+}
@@ -0,0 +1,348 @@
+#include "sha1_multi.h"
+#include "hash_util.h"
+
+#include <string.h>
+#include <pthread.h>
+#include <openssl/sha.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define SHA1_X86 1
+#endif
+
+const char *sha1_kernel_name(Sha1Kernel kernel) {
+    switch (kernel) {
+    case SHA1_KERNEL_AUTO: return "auto";
+    case SHA1_KERNEL_SCALAR: return "scalar";
+    case SHA1_KERNEL_SHANI: return "sha-ni";
+    case SHA1_KERNEL_AVX2: return "avx2";
+    case SHA1_KERNEL_AVX512: return "avx512";
+    }
+    return "unknown";
+}
+
+int sha1_parse_kernel(const char *name, Sha1Kernel *kernel) {
+    static const Sha1Kernel kernels[] = {SHA1_KERNEL_AUTO, SHA1_KERNEL_SCALAR, SHA1_KERNEL_SHANI,
+                                         SHA1_KERNEL_AVX2, SHA1_KERNEL_AVX512};
+    for (size_t i = 0; i < sizeof(kernels) / sizeof(kernels[0]); i++) {
+        if (strcmp(name, sha1_kernel_name(kernels[i])) == 0) {
+            *kernel = kernels[i];
+            return 0;
+        }
+    }
+    return -1;
+}
+
+int sha1_kernel_supported(Sha1Kernel kernel) {
+    switch (kernel) {
+    case SHA1_KERNEL_AUTO:
+    case SHA1_KERNEL_SCALAR:
+        return 1;
+#ifdef SHA1_X86
+    // libgcc's checks include whether the OS saves the wider registers (XGETBV)
+    case SHA1_KERNEL_SHANI:
+        __builtin_cpu_init();
+        return __builtin_cpu_supports("sha") && __builtin_cpu_supports("ssse3") && __builtin_cpu_supports("sse4.1");
+    case SHA1_KERNEL_AVX2:
+        __builtin_cpu_init();
+        return __builtin_cpu_supports("avx2");
+    case SHA1_KERNEL_AVX512:
+        __builtin_cpu_init();
+        return __builtin_cpu_supports("avx512f");
+#else
+    default:
+        return 0;
+#endif
+    }
+    return 0;
+}
+
+// Widest lanes first: sixteen one-block messages in flight beat one message on SHA-NI
+static Sha1Kernel best_kernel = SHA1_KERNEL_SCALAR;
+static pthread_once_t best_kernel_once = PTHREAD_ONCE_INIT;
+
+static void pick_best_kernel(void) {
+    static const Sha1Kernel preference[] = {SHA1_KERNEL_AVX512, SHA1_KERNEL_AVX2, SHA1_KERNEL_SHANI};
+    for (size_t i = 0; i < sizeof(preference) / sizeof(preference[0]); i++) {
+        if (sha1_kernel_supported(preference[i])) {
+            best_kernel = preference[i];
+            return;
+        }
+    }
+}
+
+Sha1Kernel sha1_kernel_best(void) {
+    pthread_once(&best_kernel_once, pick_best_kernel);
+    return best_kernel;
+}
+
+#ifdef SHA1_X86
+
+static const uint32_t SHA1_INIT[5] = {0x67452301, 0xEFCDAB89, 0x98BADCFE, 0x10325476, 0xC3D2E1F0};
+static const uint32_t SHA1_K[4] = {0x5A827999, 0x6ED9EBA1, 0x8F1BBCDC, 0xCA62C1D6};
+
+#define SHA1_MAX_LANES 16
+
+// The round loops run fully unrolled, so the round function and schedule index become constants
+#if defined(__clang__)
+#define SHA1_UNROLL_ROUNDS _Pragma("unroll")
+#else
+#define SHA1_UNROLL_ROUNDS _Pragma("GCC unroll 80")
+#endif
+
+/**
+ * Lays out up to lanes one-block messages for the lane kernels.
+ *
+ * Word t of the padded block of message `lane` lands at words[t * lanes + lane],
+ * so one vector load picks up word t of every message. Unused lanes hash an
+ * empty message and are never read back.
+ */
+static void pad_lanes(const unsigned char *text, const uint32_t *offsets, const uint32_t *lengths,
+                      const size_t *messages, size_t count, uint32_t *words, size_t lanes) {
+    unsigned char block[SHA1_BLOCK_SIZE];
+    for (size_t lane = 0; lane < lanes; lane++) {
+        memset(block, 0, sizeof(block));
+        uint32_t length = 0;
+        if (lane < count) {
+            length = lengths[messages[lane]];
+            memcpy(block, text + offsets[messages[lane]], length);
+        }
+        block[length] = 0x80;
+        store_be32(block + 56, 0);
+        store_be32(block + 60, length * 8);
+        for (size_t t = 0; t < 16; t++) {
+            words[t * lanes + lane] = load_be32(block + 4 * t);
+        }
+    }
+}
+
+// Writes the lane kernels' transposed state (state[i * lanes + lane]) out as digests
+static void store_lanes(const uint32_t *state, const size_t *messages, size_t count, size_t lanes,
+                        unsigned char (*digests)[SHA1_DIGEST_SIZE]) {
+    for (size_t lane = 0; lane < count; lane++) {
+        for (size_t i = 0; i < 5; i++) {
+            store_be32(digests[messages[lane]] + 4 * i, state[i * lanes + lane]);
+        }
+    }
+}
+
+/**
+ * Compresses blocks with the SHA extensions.
+ *
+ * The message schedule is expanded four words at a time with SHA1MSG1/SHA1MSG2,
+ * and each SHA1RNDS4 runs four rounds; SHA1NEXTE derives the next E from the
+ * A of four rounds before.
+ */
+__attribute__((target("sha,ssse3,sse4.1")))
+static void shani_compress(uint32_t state[5], const unsigned char *data, size_t blocks) {
+    const __m128i byte_swap = _mm_set_epi64x(0x0001020304050607LL, 0x08090a0b0c0d0e0fLL);
+    __m128i abcd = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i *)state), 0x1B);
+    __m128i e0 = _mm_set_epi32((int)state[4], 0, 0, 0);
+
+    for (; blocks > 0; blocks--, data += SHA1_BLOCK_SIZE) {
+        __m128i w[20];
+        for (int g = 0; g < 4; g++) {
+            w[g] = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)(data + 16 * g)), byte_swap);
+        }
+        for (int g = 4; g < 20; g++) {
+            w[g] = _mm_sha1msg2_epu32(_mm_xor_si128(_mm_sha1msg1_epu32(w[g - 4], w[g - 3]), w[g - 2]), w[g - 1]);
+        }
+
+        __m128i abcd_save = abcd, e_save = e0, e, prev;
+        e = _mm_add_epi32(e0, w[0]);
+        prev = abcd;
+        abcd = _mm_sha1rnds4_epu32(abcd, e, 0);
+        for (int g = 1; g < 5; g++) {
+            e = _mm_sha1nexte_epu32(prev, w[g]);
+            prev = abcd;
+            abcd = _mm_sha1rnds4_epu32(abcd, e, 0);
+        }
+        for (int g = 5; g < 10; g++) {
+            e = _mm_sha1nexte_epu32(prev, w[g]);
+            prev = abcd;
+            abcd = _mm_sha1rnds4_epu32(abcd, e, 1);
+        }
+        for (int g = 10; g < 15; g++) {
+            e = _mm_sha1nexte_epu32(prev, w[g]);
+            prev = abcd;
+            abcd = _mm_sha1rnds4_epu32(abcd, e, 2);
+        }
+        for (int g = 15; g < 20; g++) {
+            e = _mm_sha1nexte_epu32(prev, w[g]);
+            prev = abcd;
+            abcd = _mm_sha1rnds4_epu32(abcd, e, 3);
+        }
+        e0 = _mm_sha1nexte_epu32(prev, e_save);
+        abcd = _mm_add_epi32(abcd, abcd_save);
+    }
+
+    _mm_storeu_si128((__m128i *)state, _mm_shuffle_epi32(abcd, 0x1B));
+    state[4] = (uint32_t)_mm_extract_epi32(e0, 3);
+}
+
+// One whole message with SHA-NI: its full blocks straight from the input, then one or two padded tail blocks
+static void shani_message(const unsigned char *message, uint32_t length, unsigned char *digest) {
+    uint32_t state[5];
+    memcpy(state, SHA1_INIT, sizeof(state));
+    size_t full = length / SHA1_BLOCK_SIZE;
+    shani_compress(state, message, full);
+
+    unsigned char tail[2 * SHA1_BLOCK_SIZE];
+    size_t rest = length % SHA1_BLOCK_SIZE;
+    size_t tail_blocks = rest <= SHA1_ONE_BLOCK_MAX ? 1 : 2;
+    memset(tail, 0, sizeof(tail));
+    memcpy(tail, message + full * SHA1_BLOCK_SIZE, rest);
+    tail[rest] = 0x80;
+    uint64_t bits = (uint64_t)length * 8;
+    store_be32(tail + tail_blocks * SHA1_BLOCK_SIZE - 8, (uint32_t)(bits >> 32));
+    store_be32(tail + tail_blocks * SHA1_BLOCK_SIZE - 4, (uint32_t)bits);
+    shani_compress(state, tail, tail_blocks);
+
+    for (int i = 0; i < 5; i++) {
+        store_be32(digest + 4 * i, state[i]);
+    }
+}
+
+// The four round functions of SHA-1 for eight lanes
+#define AVX2_ROL(x, n) _mm256_or_si256(_mm256_slli_epi32((x), (n)), _mm256_srli_epi32((x), 32 - (n)))
+
+__attribute__((target("avx2")))
+static void avx2_compress(const uint32_t *words, uint32_t *state) {
+    __m256i w[16];
+    for (int t = 0; t < 16; t++) {
+        w[t] = _mm256_loadu_si256((const __m256i *)(words + 8 * t));
+    }
+    __m256i a = _mm256_set1_epi32((int)SHA1_INIT[0]), b = _mm256_set1_epi32((int)SHA1_INIT[1]);
+    __m256i c = _mm256_set1_epi32((int)SHA1_INIT[2]), d = _mm256_set1_epi32((int)SHA1_INIT[3]);
+    __m256i e = _mm256_set1_epi32((int)SHA1_INIT[4]);
+
+    SHA1_UNROLL_ROUNDS
+    for (int t = 0; t < 80; t++) {
+        if (t >= 16) {
+            __m256i x = _mm256_xor_si256(_mm256_xor_si256(w[(t - 3) & 15], w[(t - 8) & 15]),
+                                         _mm256_xor_si256(w[(t - 14) & 15], w[t & 15]));
+            w[t & 15] = AVX2_ROL(x, 1);
+        }
+        __m256i f;
+        if (t < 20) {
+            f = _mm256_xor_si256(d, _mm256_and_si256(b, _mm256_xor_si256(c, d)));
+        } else if (t < 40 || t >= 60) {
+            f = _mm256_xor_si256(_mm256_xor_si256(b, c), d);
+        } else {
+            f = _mm256_or_si256(_mm256_and_si256(b, c), _mm256_and_si256(d, _mm256_or_si256(b, c)));
+        }
+        __m256i temp = _mm256_add_epi32(_mm256_add_epi32(AVX2_ROL(a, 5), f),
+                                        _mm256_add_epi32(_mm256_add_epi32(e, w[t & 15]),
+                                                         _mm256_set1_epi32((int)SHA1_K[t / 20])));
+        e = d;
+        d = c;
+        c = AVX2_ROL(b, 30);
+        b = a;
+        a = temp;
+    }
+
+    __m256i result[5] = {a, b, c, d, e};
+    for (int i = 0; i < 5; i++) {
+        result[i] = _mm256_add_epi32(result[i], _mm256_set1_epi32((int)SHA1_INIT[i]));
+        _mm256_storeu_si256((__m256i *)(state + 8 * i), result[i]);
+    }
+}
+
+// The same rounds on sixteen lanes, with native rotates and one ternary-logic op per round function
+__attribute__((target("avx512f")))
+static void avx512_compress(const uint32_t *words, uint32_t *state) {
+    __m512i w[16];
+    for (int t = 0; t < 16; t++) {
+        w[t] = _mm512_loadu_si512((const void *)(words + 16 * t));
+    }
+    __m512i a = _mm512_set1_epi32((int)SHA1_INIT[0]), b = _mm512_set1_epi32((int)SHA1_INIT[1]);
+    __m512i c = _mm512_set1_epi32((int)SHA1_INIT[2]), d = _mm512_set1_epi32((int)SHA1_INIT[3]);
+    __m512i e = _mm512_set1_epi32((int)SHA1_INIT[4]);
+
+    SHA1_UNROLL_ROUNDS
+    for (int t = 0; t < 80; t++) {
+        if (t >= 16) {
+            __m512i x = _mm512_ternarylogic_epi32(w[(t - 3) & 15], w[(t - 8) & 15], w[(t - 14) & 15], 0x96);
+            w[t & 15] = _mm512_rol_epi32(_mm512_xor_si512(x, w[t & 15]), 1);
+        }
+        __m512i f;
+        if (t < 20) {
+            f = _mm512_ternarylogic_epi32(b, c, d, 0xCA); // b ? c : d
+        } else if (t < 40 || t >= 60) {
+            f = _mm512_ternarylogic_epi32(b, c, d, 0x96); // b ^ c ^ d
+        } else {
+            f = _mm512_ternarylogic_epi32(b, c, d, 0xE8); // majority
+        }
+        __m512i temp = _mm512_add_epi32(_mm512_add_epi32(_mm512_rol_epi32(a, 5), f),
+                                        _mm512_add_epi32(_mm512_add_epi32(e, w[t & 15]),
+                                                         _mm512_set1_epi32((int)SHA1_K[t / 20])));
+        e = d;
+        d = c;
+        c = _mm512_rol_epi32(b, 30);
+        b = a;
+        a = temp;
+    }
+
+    __m512i result[5] = {a, b, c, d, e};
+    for (int i = 0; i < 5; i++) {
+        result[i] = _mm512_add_epi32(result[i], _mm512_set1_epi32((int)SHA1_INIT[i]));
+        _mm512_storeu_si512((void *)(state + 16 * i), result[i]);
+    }
+}
+
+// A message the lane kernels cannot take: SHA-NI if the CPU has it, else OpenSSL
+static void hash_long(const unsigned char *message, uint32_t length, unsigned char *digest) {
+    if (sha1_kernel_supported(SHA1_KERNEL_SHANI)) {
+        shani_message(message, length, digest);
+    } else {
+        SHA1(message, length, digest);
+    }
+}
+
+#endif // SHA1_X86
+
+void sha1_multi(Sha1Kernel kernel, const unsigned char *text, const uint32_t *offsets, const uint32_t *lengths,
+                size_t n, unsigned char (*digests)[SHA1_DIGEST_SIZE]) {
+    if (kernel == SHA1_KERNEL_AUTO || !sha1_kernel_supported(kernel)) {
+        kernel = sha1_kernel_best();
+    }
+
+    if (kernel == SHA1_KERNEL_SCALAR) {
+        for (size_t i = 0; i < n; i++) {
+            SHA1(text + offsets[i], lengths[i], digests[i]);
+        }
+        return;
+    }
+#ifdef SHA1_X86
+    if (kernel == SHA1_KERNEL_SHANI) {
+        for (size_t i = 0; i < n; i++) {
+            shani_message(text + offsets[i], lengths[i], digests[i]);
+        }
+        return;
+    }
+
+    // Gather one-block messages into groups of a full vector; longer ones are hashed on the way
+    size_t lanes = kernel == SHA1_KERNEL_AVX512 ? 16 : 8;
+    uint32_t words[16 * SHA1_MAX_LANES], state[5 * SHA1_MAX_LANES];
+    size_t group[SHA1_MAX_LANES], count = 0;
+    for (size_t i = 0; i <= n; i++) {
+        if (i < n && lengths[i] > SHA1_ONE_BLOCK_MAX) {
+            hash_long(text + offsets[i], lengths[i], digests[i]);
+            continue;
+        }
+        if (i < n) {
+            group[count++] = i;
+        }
+        if (count == lanes || (i == n && count > 0)) {
+            pad_lanes(text, offsets, lengths, group, count, words, lanes);
+            if (lanes == 16) {
+                avx512_compress(words, state);
+            } else {
+                avx2_compress(words, state);
+            }
+            store_lanes(state, group, count, lanes, digests);
+            count = 0;
+        }
+    }
+#endif
+}
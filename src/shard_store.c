@@ -0,0 +1,87 @@
+#include "shard_store.h"
+
+#include <string.h>
+
+_Static_assert(sizeof(ShardHeader) == SHARD_HEADER_SIZE, "ShardHeader must match its on-disk size");
+
+// Checks the manifest magic, the same way flat_is_store() does for flat stores
+int shard_is_store(const char *path) {
+    char magic[SHARD_MAGIC_SIZE];
+    FILE *file = fopen(path, "rb");
+    if (file == NULL) {
+        return 0;
+    }
+    size_t got = fread(magic, 1, sizeof(magic), file);
+    fclose(file);
+    return got == sizeof(magic) && memcmp(magic, SHARD_MAGIC, SHARD_MAGIC_SIZE) == 0;
+}
+
+/**
+ * Reads and validates a shard manifest.
+ *
+ * Parameters:
+ * - path (const char*): The database path the manifest was written to.
+ * - header (ShardHeader*): Receives the manifest.
+ *
+ * Returns:
+ * - int: 0 on success, 1 if the file cannot be read or describes an unsupported layout.
+ */
+int shard_read_header(const char *path, ShardHeader *header) {
+    FILE *file = fopen(path, "rb");
+    if (file == NULL) {
+        fprintf(stderr, "Can't open shard manifest: %s\n", path);
+        return 1;
+    }
+    size_t got = fread(header, 1, sizeof(*header), file);
+    fclose(file);
+    if (got != sizeof(*header) ||
+        memcmp(header->magic, SHARD_MAGIC, SHARD_MAGIC_SIZE) != 0 ||
+        header->version != SHARD_VERSION ||
+        header->shard_bits == 0 || header->shard_bits > SHARD_MAX_BITS) {
+        fprintf(stderr, "Shard manifest is invalid: %s\n", path);
+        return 1;
+    }
+    return 0;
+}
+
+/**
+ * Writes the manifest that turns a set of shard files into one database.
+ *
+ * The manifest is written last, once every shard exists, and renamed into place,
+ * so a reader never opens a shard set that is still being built.
+ *
+ * Parameters:
+ * - path (const char*): The database path.
+ * - shard_bits (unsigned): Leading hash bits that select a shard, 1 to SHARD_MAX_BITS.
+ *
+ * Returns:
+ * - int: 0 on success, 1 on failure.
+ */
+int shard_write_header(const char *path, unsigned shard_bits) {
+    ShardHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, SHARD_MAGIC, SHARD_MAGIC_SIZE);
+    header.version = SHARD_VERSION;
+    header.shard_bits = shard_bits;
+
+    char tmp_path[4096];
+    snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", path);
+    FILE *file = fopen(tmp_path, "wb");
+    if (file == NULL) {
+        fprintf(stderr, "Can't create shard manifest: %s\n", tmp_path);
+        return 1;
+    }
+    int failed = fwrite(&header, sizeof(header), 1, file) != 1;
+    failed |= fclose(file) != 0;
+    if (failed || rename(tmp_path, path) != 0) {
+        fprintf(stderr, "Failed to write shard manifest: %s\n", path);
+        remove(tmp_path);
+        return 1;
+    }
+    return 0;
+}
+
+// "<db_path>.shard.<hex>", padded so that with a multiple of 4 bits the name is the hash prefix
+void shard_path(char *out, size_t size, const char *db_path, uint32_t shard, unsigned shard_bits) {
+    snprintf(out, size, "%s%s.%0*x", db_path, SHARD_FILE_SUFFIX, (int)((shard_bits + 3) / 4), shard);
+}
@@ -0,0 +1,446 @@
+#include "variants.h"
+#include "lookup_daemon.h"
+
+#include <errno.h>
+#include <time.h>
+
+// Error codes of apply_rule(); a rule that is too long for one password is only skipped for it
+#define RULE_INVALID (-1)
+#define RULE_TOO_LONG (-2)
+
+// Rule positions: 0-9, then A-Z for 10-35, as in hashcat
+static int rule_position(char c) {
+    if (c >= '0' && c <= '9') {
+        return c - '0';
+    }
+    if (c >= 'A' && c <= 'Z') {
+        return c - 'A' + 10;
+    }
+    return -1;
+}
+
+static int toggle_case(int c) {
+    return islower(c) ? toupper(c) : tolower(c);
+}
+
+/**
+ * Applies one rule to a password.
+ *
+ * Parameters:
+ * - rule (const char*): The rule text.
+ * - in (const unsigned char*), in_length (size_t): The password.
+ * - out (unsigned char*): Receives the variant; VARIANT_MAX_LENGTH bytes.
+ *
+ * Returns:
+ * - int: The variant's length, RULE_TOO_LONG if it would exceed VARIANT_MAX_LENGTH,
+ *   or RULE_INVALID if the rule does not parse.
+ */
+static int apply_rule(const char *rule, const unsigned char *in, size_t in_length, unsigned char *out) {
+    if (in_length > VARIANT_MAX_LENGTH) {
+        return RULE_TOO_LONG;
+    }
+    size_t length = in_length;
+    memcpy(out, in, length);
+
+    for (const char *p = rule; *p != '\0'; p++) {
+        switch (*p) {
+            case ' ':
+            case ':':
+                break;
+            case 'l':
+                for (size_t i = 0; i < length; i++) out[i] = (unsigned char)tolower(out[i]);
+                break;
+            case 'u':
+                for (size_t i = 0; i < length; i++) out[i] = (unsigned char)toupper(out[i]);
+                break;
+            case 'c':
+            case 'C':
+                for (size_t i = 0; i < length; i++) {
+                    int upper = (i == 0) == (*p == 'c');
+                    out[i] = (unsigned char)(upper ? toupper(out[i]) : tolower(out[i]));
+                }
+                break;
+            case 't':
+                for (size_t i = 0; i < length; i++) out[i] = (unsigned char)toggle_case(out[i]);
+                break;
+            case 'T': {
+                int position = rule_position(*++p);
+                if (position < 0) {
+                    return RULE_INVALID;
+                }
+                if ((size_t)position < length) {
+                    out[position] = (unsigned char)toggle_case(out[position]);
+                }
+                break;
+            }
+            case 'r':
+                for (size_t i = 0; i < length / 2; i++) {
+                    unsigned char c = out[i];
+                    out[i] = out[length - 1 - i];
+                    out[length - 1 - i] = c;
+                }
+                break;
+            case 'd':
+                if (length * 2 > VARIANT_MAX_LENGTH) {
+                    return RULE_TOO_LONG;
+                }
+                memcpy(out + length, out, length);
+                length *= 2;
+                break;
+            case '$':
+            case '^':
+                if (p[1] == '\0') {
+                    return RULE_INVALID;
+                }
+                if (length == VARIANT_MAX_LENGTH) {
+                    return RULE_TOO_LONG;
+                }
+                if (*p == '^') {
+                    memmove(out + 1, out, length);
+                    out[0] = (unsigned char)*++p;
+                } else {
+                    out[length] = (unsigned char)*++p;
+                }
+                length++;
+                break;
+            case '[':
+                if (length > 0) {
+                    memmove(out, out + 1, --length);
+                }
+                break;
+            case ']':
+                if (length > 0) {
+                    length--;
+                }
+                break;
+            case 's':
+                if (p[1] == '\0' || p[2] == '\0') {
+                    return RULE_INVALID;
+                }
+                for (size_t i = 0; i < length; i++) {
+                    if (out[i] == (unsigned char)p[1]) {
+                        out[i] = (unsigned char)p[2];
+                    }
+                }
+                p += 2;
+                break;
+            case '@': {
+                if (p[1] == '\0') {
+                    return RULE_INVALID;
+                }
+                size_t kept = 0;
+                for (size_t i = 0; i < length; i++) {
+                    if (out[i] != (unsigned char)p[1]) {
+                        out[kept++] = out[i];
+                    }
+                }
+                length = kept;
+                p++;
+                break;
+            }
+            case '~': {
+                char what = *++p;
+                if (what != 'd' && what != 'p' && what != 'a') {
+                    return RULE_INVALID;
+                }
+                while (length > 0) {
+                    int c = out[length - 1];
+                    int strip = what == 'd' ? isdigit(c) : what == 'p' ? ispunct(c) : !isalpha(c);
+                    if (!strip) {
+                        break;
+                    }
+                    length--;
+                }
+                break;
+            }
+            default:
+                return RULE_INVALID;
+        }
+    }
+    return (int)length;
+}
+
+// Appends a rule to the set, validating it against a sample password
+static int add_rule(VariantRules *rules, size_t *capacity, const char *rule) {
+    unsigned char sample[VARIANT_MAX_LENGTH];
+    if (strlen(rule) >= VARIANT_RULE_MAX || apply_rule(rule, (const unsigned char *)"Passw0rd!", 9, sample) == RULE_INVALID) {
+        return -1;
+    }
+    if (rules->count == VARIANT_MAX_RULES) {
+        return -2;
+    }
+    if (rules->count == *capacity) {
+        size_t grown = *capacity ? *capacity * 2 : 256;
+        char (*resized)[VARIANT_RULE_MAX] = realloc(rules->rules, grown * VARIANT_RULE_MAX);
+        if (resized == NULL) {
+            return -3;
+        }
+        rules->rules = resized;
+        *capacity = grown;
+    }
+    strcpy(rules->rules[rules->count++], rule);
+    return 0;
+}
+
+int variant_rules_default(VariantRules *rules) {
+    // A base undoes or applies the usual mutations of a word; every base gets every suffix.
+    // Leetspeak is applied to every letter or only to the few people usually swap, as in "P@ssw0rd"
+    static const char *const strips[] = {"", "~a "};
+    static const char *const leets[] = {"", "s4a s@a s3e s1i s!i s0o s5s s$s s7t ", "sa@ se3 si1 so0 ss$ ",
+                                        "sa@ ", "se3 ", "so0 ", "sa@ so0 ", "sa@ se3 so0 "};
+    static const char *const cases[] = {":", "l", "c", "u", "t"};
+    static const char *const symbols[] = {"!", "!!", "123", "1234", "123!", "?", "@", "#", ".", "*"};
+
+    char suffixes[1 + 10 + 100 + 61 + 10][16];
+    size_t suffix_count = 0;
+    suffixes[suffix_count++][0] = '\0';
+    for (int d = 0; d < 10; d++) {
+        snprintf(suffixes[suffix_count++], sizeof(suffixes[0]), " $%d", d);
+    }
+    for (int d = 0; d < 100; d++) {
+        snprintf(suffixes[suffix_count++], sizeof(suffixes[0]), " $%d$%d", d / 10, d % 10);
+    }
+    for (int year = 1970; year <= 2030; year++) {
+        snprintf(suffixes[suffix_count++], sizeof(suffixes[0]), " $%d$%d$%d$%d",
+                 year / 1000, year / 100 % 10, year / 10 % 10, year % 10);
+    }
+    for (size_t s = 0; s < sizeof(symbols) / sizeof(symbols[0]); s++) {
+        char *suffix = suffixes[suffix_count++];
+        suffix[0] = ' ';
+        size_t used = 1;
+        for (const char *c = symbols[s]; *c != '\0'; c++) {
+            suffix[used++] = '$';
+            suffix[used++] = *c;
+        }
+        suffix[used] = '\0';
+    }
+
+    rules->rules = NULL;
+    rules->count = 0;
+    size_t capacity = 0;
+    char rule[VARIANT_RULE_MAX];
+    for (size_t s = 0; s < sizeof(strips) / sizeof(strips[0]); s++) {
+        for (size_t l = 0; l < sizeof(leets) / sizeof(leets[0]); l++) {
+            for (size_t c = 0; c < sizeof(cases) / sizeof(cases[0]); c++) {
+                for (size_t x = 0; x < suffix_count; x++) {
+                    if (snprintf(rule, sizeof(rule), "%s%s%s%s", strips[s], leets[l], cases[c], suffixes[x]) >=
+                            (int)sizeof(rule) || add_rule(rules, &capacity, rule) != 0) {
+                        variant_rules_free(rules);
+                        return -1;
+                    }
+                }
+            }
+        }
+    }
+    return 0;
+}
+
+int variant_rules_load(VariantRules *rules, const char *path) {
+    FILE *file = fopen(path, "r");
+    if (file == NULL) {
+        fprintf(stderr, "Can't open rules file %s: %s\n", path, strerror(errno));
+        return -1;
+    }
+    rules->rules = NULL;
+    rules->count = 0;
+    size_t capacity = 0;
+    char line[1024];
+    unsigned line_number = 0;
+    while (fgets(line, sizeof(line), file) != NULL) {
+        line_number++;
+        line[strcspn(line, "\r\n")] = '\0';
+        if (line[0] == '#' || line[strspn(line, " \t")] == '\0') {
+            continue;
+        }
+        int rc = add_rule(rules, &capacity, line);
+        if (rc != 0) {
+            if (rc == -1) {
+                fprintf(stderr, "%s:%u: invalid rule \"%s\"\n", path, line_number, line);
+            } else if (rc == -2) {
+                fprintf(stderr, "%s:%u: more than %d rules\n", path, line_number, VARIANT_MAX_RULES);
+            } else {
+                fprintf(stderr, "Memory allocation failed!\n");
+            }
+            fclose(file);
+            variant_rules_free(rules);
+            return -1;
+        }
+    }
+    fclose(file);
+    if (rules->count == 0) {
+        fprintf(stderr, "%s holds no rules\n", path);
+        return -1;
+    }
+    return 0;
+}
+
+void variant_rules_free(VariantRules *rules) {
+    free(rules->rules);
+    rules->rules = NULL;
+    rules->count = 0;
+}
+
+int variant_checker_init(VariantChecker *checker, VariantRules *rules, PwnedDB *db, int daemon_fd) {
+    memset(checker, 0, sizeof(*checker));
+    checker->rules = *rules;
+    checker->db = db;
+    checker->daemon_fd = daemon_fd;
+
+    size_t n = rules->count;
+    checker->text = malloc(n * VARIANT_MAX_LENGTH);
+    checker->offsets = malloc(n * sizeof(uint32_t));
+    checker->lengths = malloc(n * sizeof(uint32_t));
+    checker->rule_of = malloc(n * sizeof(uint32_t));
+    checker->digests = malloc(n * SHA_DIGEST_LENGTH);
+    checker->entries = malloc(n * sizeof(VariantEntry));
+    checker->unique = malloc(n * SHA_DIGEST_LENGTH);
+    checker->results = malloc(n * sizeof(int32_t));
+    if (checker->text == NULL || checker->offsets == NULL || checker->lengths == NULL || checker->rule_of == NULL ||
+        checker->digests == NULL || checker->entries == NULL || checker->unique == NULL || checker->results == NULL) {
+        fprintf(stderr, "Memory allocation failed!\n");
+        variant_checker_close(checker);
+        return -1;
+    }
+    if (db != NULL && async_lookup_init(&checker->async, db, ASYNC_ENGINE_AUTO, 0) != 0) {
+        fprintf(stderr, "Can't set up batched lookups for the variant check\n");
+        checker->db = NULL;
+        variant_checker_close(checker);
+        return -1;
+    }
+    return 0;
+}
+
+// Orders entries by digest, then by rule, so the first of each run of equal digests has the lowest rule
+static int compare_entries(const void *a, const void *b) {
+    const VariantEntry *x = a, *y = b;
+    int c = memcmp(x->hash, y->hash, SHA_DIGEST_LENGTH);
+    if (c != 0) {
+        return c;
+    }
+    return (x->rule > y->rule) - (x->rule < y->rule);
+}
+
+static double elapsed_ms(const struct timespec *start) {
+    struct timespec end;
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    return (end.tv_sec - start->tv_sec) * 1e3 + (end.tv_nsec - start->tv_nsec) / 1e6;
+}
+
+// Looks up the deduplicated digests in one batched pass, locally or through the daemon
+static int lookup_variants(VariantChecker *checker, size_t n) {
+    if (checker->daemon_fd < 0) {
+        return async_lookup_batch(&checker->async, (const unsigned char (*)[SHA_DIGEST_LENGTH])checker->unique, n,
+                                  checker->results);
+    }
+    for (size_t start = 0; start < n; start += DAEMON_MAX_BATCH) {
+        uint32_t count = (uint32_t)(n - start < DAEMON_MAX_BATCH ? n - start : DAEMON_MAX_BATCH);
+        if (daemon_lookup(checker->daemon_fd, (const unsigned char (*)[SHA_DIGEST_LENGTH])checker->unique + start,
+                          count, checker->results + start) != 0) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+int variant_check_password(VariantChecker *checker, const unsigned char *password, size_t length) {
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    // Expand: every rule writes its variant straight into the shared text buffer
+    size_t n = 0, used = 0;
+    for (size_t r = 0; r < checker->rules.count; r++) {
+        int variant_length = apply_rule(checker->rules.rules[r], password, length, checker->text + used);
+        if (variant_length < 0) {
+            continue;
+        }
+        checker->offsets[n] = (uint32_t)used;
+        checker->lengths[n] = (uint32_t)variant_length;
+        checker->rule_of[n] = (uint32_t)r;
+        used += (size_t)variant_length;
+        n++;
+    }
+    sha1_multi(SHA1_KERNEL_AUTO, checker->text, checker->offsets, checker->lengths, n, checker->digests);
+
+    // Rules often agree (lowercasing a lowercase word); the password itself was already checked
+    unsigned char original[SHA_DIGEST_LENGTH];
+    SHA1(password, length, original);
+    size_t kept = 0;
+    for (size_t i = 0; i < n; i++) {
+        if (memcmp(checker->digests[i], original, SHA_DIGEST_LENGTH) != 0) {
+            memcpy(checker->entries[kept].hash, checker->digests[i], SHA_DIGEST_LENGTH);
+            checker->entries[kept].rule = checker->rule_of[i];
+            kept++;
+        }
+    }
+    qsort(checker->entries, kept, sizeof(VariantEntry), compare_entries);
+    size_t unique = 0;
+    for (size_t i = 0; i < kept; i++) {
+        if (unique == 0 || memcmp(checker->entries[i].hash, checker->entries[unique - 1].hash, SHA_DIGEST_LENGTH) != 0) {
+            checker->entries[unique] = checker->entries[i];
+            memcpy(checker->unique[unique], checker->entries[i].hash, SHA_DIGEST_LENGTH);
+            unique++;
+        }
+    }
+
+    int rc = lookup_variants(checker, unique);
+    double ms = elapsed_ms(&start);
+
+    if (rc != 0) {
+        fprintf(stderr, "Variant lookups failed.\n");
+    } else {
+        size_t pwned = 0, failed = 0;
+        for (size_t i = 0; i < unique; i++) {
+            pwned += checker->results[i] > 0;
+            failed += checker->results[i] < 0;
+        }
+        if (pwned == 0) {
+            printf("None of %zu close variants found in pwned list (%.1f ms).\n", unique, ms);
+        } else {
+            // Only the rule is shown, never the variant: it is as sensitive as the masked password
+            printf("%zu of %zu close variants found in pwned list (%.1f ms), most breached first:\n", pwned, unique, ms);
+            for (size_t shown = 0; shown < pwned && shown < VARIANT_REPORT_LIMIT; shown++) {
+                size_t best = 0;
+                for (size_t i = 1; i < unique; i++) {
+                    int32_t count = checker->results[i], top = checker->results[best];
+                    if (count > top || (count == top && checker->entries[i].rule < checker->entries[best].rule)) {
+                        best = i;
+                    }
+                }
+                printf("  %-52s %d occurrences\n", checker->rules.rules[checker->entries[best].rule],
+                       checker->results[best]);
+                checker->results[best] = 0;
+            }
+            if (pwned > VARIANT_REPORT_LIMIT) {
+                printf("  ... and %zu more\n", pwned - VARIANT_REPORT_LIMIT);
+            }
+        }
+        if (failed > 0) {
+            fprintf(stderr, "%zu variant lookups failed.\n", failed);
+            rc = -1;
+        }
+    }
+
+    // The variants are as sensitive as the password they came from
+    memset(checker->text, 0, used);
+    memset(checker->digests, 0, n * SHA_DIGEST_LENGTH);
+    memset(checker->entries, 0, kept * sizeof(VariantEntry));
+    memset(checker->unique, 0, unique * SHA_DIGEST_LENGTH);
+    memset(original, 0, sizeof(original));
+    return rc;
+}
+
+void variant_checker_close(VariantChecker *checker) {
+    if (checker->db != NULL) {
+        async_lookup_close(&checker->async);
+    }
+    free(checker->text);
+    free(checker->offsets);
+    free(checker->lengths);
+    free(checker->rule_of);
+    free(checker->digests);
+    free(checker->entries);
+    free(checker->unique);
+    free(checker->results);
+    variant_rules_free(&checker->rules);
+    memset(checker, 0, sizeof(*checker));
+}
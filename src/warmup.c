@@ -0,0 +1,511 @@
+#include "warmup.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+
+/**
+ * A stretch of memory that lookups read.
+ *
+ * Components:
+ * - start (const unsigned char*), length (size_t): The bytes.
+ * - index (int): Non-zero for headers, indexes and filters that every lookup reads,
+ *   zero for the records, slots and keys a lookup reads one of.
+ * - mapped (int): Non-zero for file mappings; the hot set lives on the heap and is already resident.
+ * - transient (int): Non-zero for a mapping opened here only to pull an SQLite file into the page cache.
+ */
+typedef struct {
+    const unsigned char *start;
+    size_t length;
+    int index;
+    int mapped;
+    int transient;
+} WarmRegion;
+
+typedef struct {
+    WarmRegion *items;
+    size_t count;
+    size_t capacity;
+    int failed;
+} RegionList;
+
+// Shared by the prefetching threads, which claim WARM_CHUNK_SIZE chunks in turn
+typedef struct {
+    const RegionList *regions;
+    const size_t *first_chunk; // Chunk number each region starts at; one extra entry holds the total
+    size_t region_count;
+    atomic_size_t next;
+    atomic_uint_fast64_t bytes;
+} PrefetchJob;
+
+int warmup_requested(const WarmupOptions *options) {
+    return options->prefetch != WARM_PREFETCH_NONE || options->huge_pages != WARM_HUGE_PAGES_OFF ||
+           options->lock_budget > 0;
+}
+
+int warmup_parse_prefetch(const char *arg, WarmPrefetch *prefetch) {
+    if (arg == NULL || strcmp(arg, "index") == 0) {
+        *prefetch = WARM_PREFETCH_INDEX;
+    } else if (strcmp(arg, "all") == 0) {
+        *prefetch = WARM_PREFETCH_ALL;
+    } else if (strcmp(arg, "none") == 0) {
+        *prefetch = WARM_PREFETCH_NONE;
+    } else {
+        return -1;
+    }
+    return 0;
+}
+
+int warmup_parse_huge_pages(const char *arg, WarmHugePages *huge_pages) {
+    if (arg == NULL || strcmp(arg, "transparent") == 0) {
+        *huge_pages = WARM_HUGE_PAGES_TRANSPARENT;
+    } else if (strcmp(arg, "explicit") == 0) {
+        *huge_pages = WARM_HUGE_PAGES_EXPLICIT;
+    } else if (strcmp(arg, "off") == 0) {
+        *huge_pages = WARM_HUGE_PAGES_OFF;
+    } else {
+        return -1;
+    }
+    return 0;
+}
+
+static void add_region(RegionList *list, const void *start, size_t length, int index, int mapped) {
+    if (length == 0 || list->failed) {
+        return;
+    }
+    if (list->count == list->capacity) {
+        size_t capacity = list->capacity ? list->capacity * 2 : 32;
+        WarmRegion *grown = realloc(list->items, capacity * sizeof(WarmRegion));
+        if (grown == NULL) {
+            fprintf(stderr, "Memory allocation failed for the warm-up regions!\n");
+            list->failed = 1;
+            return;
+        }
+        list->items = grown;
+        list->capacity = capacity;
+    }
+    list->items[list->count++] = (WarmRegion){start, length, index, mapped, 0};
+}
+
+// Maps an SQLite file read-only for the length of the warm-up, so its pages can be prefetched like a store's
+static void add_sqlite_file(RegionList *list, PwnedDB *db) {
+    const char *path = sqlite3_db_filename(db->sqlite, "main");
+    int fd = path != NULL ? open(path, O_RDONLY) : -1;
+    if (fd < 0) {
+        return;
+    }
+    struct stat st;
+    void *map = fstat(fd, &st) == 0 && st.st_size > 0
+                    ? mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_SHARED, fd, 0)
+                    : MAP_FAILED;
+    close(fd);
+    if (map == MAP_FAILED) {
+        return;
+    }
+    size_t before = list->count;
+    add_region(list, map, (size_t)st.st_size, 0, 1);
+    if (list->count == before) {
+        munmap(map, (size_t)st.st_size);
+        return;
+    }
+    list->items[before].transient = 1;
+}
+
+// Lists what lookups read in an opened database, shards and overlays included
+static void collect_regions(PwnedDB *db, WarmPrefetch prefetch, RegionList *list) {
+    for (int i = 0; i < db->delta_count; i++) {
+        add_region(list, db->deltas[i].map, db->deltas[i].map_size, 1, 1);
+    }
+    if (db->backend == DB_BACKEND_FLAT) {
+        const FlatHeader *header = db->flat.header;
+        uint64_t records_end = header->records_offset + header->record_count * db->flat.record_size;
+        add_region(list, db->flat.map, header->records_offset, 1, 1);
+        add_region(list, db->flat.map + header->records_offset, records_end - header->records_offset, 0, 1);
+        add_region(list, db->flat.map + records_end, db->flat.map_size - records_end, 1, 1);
+    } else if (db->backend == DB_BACKEND_PACKED) {
+        uint64_t high_offset = db->packed.header->high_offset;
+        add_region(list, db->packed.map, high_offset, 1, 1);
+        add_region(list, db->packed.map + high_offset, db->packed.map_size - high_offset, 0, 1);
+    } else if (db->backend == DB_BACKEND_SHARDED) {
+        for (uint32_t i = 0; i < (uint32_t)1 << db->shard_bits; i++) {
+            collect_regions(&db->shards[i], prefetch, list);
+        }
+    } else if (prefetch == WARM_PREFETCH_ALL) {
+        add_sqlite_file(list, db);
+    }
+    if (db->has_mphf) {
+        uint64_t slots_offset = db->mphf.header->slots_offset;
+        add_region(list, db->mphf.map, slots_offset, 1, 1);
+        add_region(list, db->mphf.map + slots_offset, db->mphf.map_size - slots_offset, 0, 1);
+    }
+    if (db->has_filter && db->filter.map != NULL) {
+        add_region(list, db->filter.map, db->filter.map_size, 1, 1);
+    }
+    if (db->has_hot) {
+        add_region(list, db->hot.buckets, (size_t)db->hot.bucket_count * sizeof(HotBucket), 1, 0);
+    }
+}
+
+/**
+ * Pulls the upper levels of an SQLite B-tree into the page cache.
+ *
+ * SQLite maps the file itself, so there is no index section to prefetch;
+ * instead WARM_SQLITE_PROBES lookups spread evenly over the key range each
+ * walk from the root to a leaf. Together they read every page of the upper
+ * levels and a sample of the rest. A shard's probes are spread over the part
+ * of the key range it holds.
+ */
+static uint64_t probe_sqlite(PwnedDB *db, uint64_t first, uint64_t span, uint64_t probes) {
+    if (db->backend == DB_BACKEND_SHARDED) {
+        uint64_t total = 0;
+        uint32_t shard_count = (uint32_t)1 << db->shard_bits;
+        uint64_t shard_probes = probes / shard_count > 64 ? probes / shard_count : 64;
+        for (uint32_t i = 0; i < shard_count; i++) {
+            total += probe_sqlite(&db->shards[i], first + span / shard_count * i, span / shard_count, shard_probes);
+        }
+        return total;
+    }
+    if (db->backend != DB_BACKEND_SQLITE) {
+        return 0;
+    }
+    unsigned char hash[HASH_MAX_SIZE] = {0};
+    for (uint64_t i = 0; i < probes; i++) {
+        uint64_t prefix = first + span * i / probes;
+        hash[0] = (unsigned char)(prefix >> 24);
+        hash[1] = (unsigned char)(prefix >> 16);
+        hash[2] = (unsigned char)(prefix >> 8);
+        hash[3] = (unsigned char)prefix;
+        int count;
+        lookup_base(db, hash, &count);
+    }
+    return probes;
+}
+
+// Faults a range in: readahead for the whole range first, since the record sections are mapped MADV_RANDOM
+static void populate(const unsigned char *start, size_t length) {
+    uintptr_t page = (uintptr_t)getpagesize();
+    uintptr_t begin = (uintptr_t)start & ~(page - 1);
+    uintptr_t end = (uintptr_t)start + length;
+    madvise((void *)begin, end - begin, MADV_WILLNEED);
+#ifdef MADV_POPULATE_READ
+    if (madvise((void *)begin, end - begin, MADV_POPULATE_READ) == 0) {
+        return;
+    }
+#endif
+    // Kernels before 5.14 have no MADV_POPULATE_READ: touch one byte per page instead
+    unsigned char sink = 0;
+    for (uintptr_t p = begin; p < end; p += page) {
+        sink ^= *(const volatile unsigned char *)p;
+    }
+    (void)sink;
+}
+
+static void *prefetch_worker(void *arg) {
+    PrefetchJob *job = arg;
+    size_t total = job->first_chunk[job->region_count];
+    size_t chunk;
+    while ((chunk = atomic_fetch_add(&job->next, 1)) < total) {
+        // Find the region holding the chunk: the last one starting at or before it
+        size_t low = 0, high = job->region_count;
+        while (high - low > 1) {
+            size_t mid = low + (high - low) / 2;
+            if (job->first_chunk[mid] <= chunk) {
+                low = mid;
+            } else {
+                high = mid;
+            }
+        }
+        const WarmRegion *region = &job->regions->items[low];
+        size_t offset = (chunk - job->first_chunk[low]) * (size_t)WARM_CHUNK_SIZE;
+        size_t length = region->length - offset < WARM_CHUNK_SIZE ? region->length - offset : WARM_CHUNK_SIZE;
+        populate(region->start + offset, length);
+        atomic_fetch_add(&job->bytes, length);
+    }
+    return NULL;
+}
+
+// Faults in the regions prefetch selects, chunk by chunk on threads threads; returns the bytes covered
+static uint64_t prefetch_regions(const RegionList *list, WarmPrefetch prefetch, int threads) {
+    RegionList selected = {0};
+    for (size_t i = 0; i < list->count; i++) {
+        const WarmRegion *region = &list->items[i];
+        if (region->mapped && (region->index || prefetch == WARM_PREFETCH_ALL)) {
+            add_region(&selected, region->start, region->length, region->index, 1);
+        }
+    }
+    size_t *first_chunk = calloc(selected.count + 1, sizeof(size_t));
+    if (selected.failed || first_chunk == NULL) {
+        free(selected.items);
+        free(first_chunk);
+        return 0;
+    }
+    for (size_t i = 0; i < selected.count; i++) {
+        first_chunk[i + 1] = first_chunk[i] + (selected.items[i].length + WARM_CHUNK_SIZE - 1) / WARM_CHUNK_SIZE;
+    }
+
+    PrefetchJob job = {&selected, first_chunk, selected.count, 0, 0};
+    if ((size_t)threads > first_chunk[selected.count]) {
+        threads = first_chunk[selected.count] > 0 ? (int)first_chunk[selected.count] : 1;
+    }
+    pthread_t *workers = calloc((size_t)threads, sizeof(pthread_t));
+    int started = 0;
+    for (; workers != NULL && started < threads; started++) {
+        if (pthread_create(&workers[started], NULL, prefetch_worker, &job) != 0) {
+            break;
+        }
+    }
+    if (started == 0) {
+        prefetch_worker(&job); // No threads to spare: prefetch on this one
+    }
+    for (int i = 0; i < started; i++) {
+        pthread_join(workers[i], NULL);
+    }
+    free(workers);
+    free(first_chunk);
+    free(selected.items);
+    return atomic_load(&job.bytes);
+}
+
+// Huge page usage of the whole process, from the kernel's own accounting; 0 where there is none
+static uint64_t huge_page_bytes(void) {
+    FILE *file = fopen("/proc/self/smaps_rollup", "r");
+    if (file == NULL) {
+        return 0;
+    }
+    char line[256];
+    uint64_t total = 0;
+    while (fgets(line, sizeof(line), file)) {
+        unsigned long long kib;
+        if (sscanf(line, "AnonHugePages: %llu kB", &kib) == 1 || sscanf(line, "Private_Hugetlb: %llu kB", &kib) == 1 ||
+            sscanf(line, "Shared_Hugetlb: %llu kB", &kib) == 1) {
+            total += (uint64_t)kib << 10;
+        }
+    }
+    fclose(file);
+    return total;
+}
+
+// Warns when the kernel will not hand out transparent huge pages at all
+static void check_transparent_huge_pages(void) {
+    FILE *file = fopen("/sys/kernel/mm/transparent_hugepage/enabled", "r");
+    if (file == NULL) {
+        return;
+    }
+    char mode[128] = {0};
+    if (fgets(mode, sizeof(mode), file) && strstr(mode, "[never]") != NULL) {
+        fprintf(stderr, "Transparent huge pages are disabled (/sys/kernel/mm/transparent_hugepage/enabled); "
+                        "index structures stay on normal pages\n");
+    }
+    fclose(file);
+}
+
+/**
+ * Moves the aligned part of one mapped index region onto huge pages.
+ *
+ * File pages cannot be huge, so every whole huge page inside the region is
+ * copied out, replaced in place by anonymous memory, filled back and made
+ * read-only again. Pointers into the store stay valid, and the unaligned head
+ * and tail of the region stay file-backed. An explicit huge page is reserved
+ * before the old pages are unmapped, so running out of them just falls back
+ * to transparent huge pages.
+ *
+ * Parameters:
+ * - region (const WarmRegion*): A mapped index region.
+ * - mode (WarmHugePages): Transparent or explicit.
+ * - buffer (unsigned char*): WARM_HUGE_PAGE_SIZE bytes of scratch space.
+ * - explicit_pages (int*): Cleared once the hugetlb pool has run out.
+ *
+ * Returns:
+ * - int: 0 on success, -1 if a page could not be replaced and the store is no longer fully mapped.
+ */
+static int move_to_huge_pages(const WarmRegion *region, WarmHugePages mode, unsigned char *buffer,
+                              int *explicit_pages) {
+#if defined(MADV_HUGEPAGE)
+    uintptr_t mask = (uintptr_t)WARM_HUGE_PAGE_SIZE - 1;
+    uintptr_t begin = ((uintptr_t)region->start + mask) & ~mask;
+    uintptr_t end = ((uintptr_t)region->start + region->length) & ~mask;
+    for (uintptr_t page = begin; page < end; page += WARM_HUGE_PAGE_SIZE) {
+        memcpy(buffer, (const void *)page, WARM_HUGE_PAGE_SIZE);
+        void *huge = MAP_FAILED;
+#ifdef MAP_HUGETLB
+        if (mode == WARM_HUGE_PAGES_EXPLICIT && *explicit_pages) {
+            huge = mmap((void *)page, WARM_HUGE_PAGE_SIZE, PROT_READ | PROT_WRITE,
+                        MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED | MAP_HUGETLB, -1, 0);
+            if (huge == MAP_FAILED) {
+                fprintf(stderr, "Out of reserved huge pages (vm.nr_hugepages); using transparent huge pages "
+                                "for the rest\n");
+                *explicit_pages = 0;
+            }
+        }
+#endif
+        if (huge == MAP_FAILED) {
+            huge = mmap((void *)page, WARM_HUGE_PAGE_SIZE, PROT_READ | PROT_WRITE,
+                        MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED, -1, 0);
+            if (huge == MAP_FAILED) {
+                fprintf(stderr, "Can't replace store pages with huge pages: %s\n", strerror(errno));
+                return -1;
+            }
+            madvise(huge, WARM_HUGE_PAGE_SIZE, MADV_HUGEPAGE);
+        }
+        memcpy(huge, buffer, WARM_HUGE_PAGE_SIZE);
+        mprotect(huge, WARM_HUGE_PAGE_SIZE, PROT_READ);
+    }
+    return 0;
+#else
+    (void)region;
+    (void)mode;
+    (void)buffer;
+    (void)explicit_pages;
+    return 0;
+#endif
+}
+
+static int move_regions_to_huge_pages(const RegionList *list, WarmHugePages mode) {
+#if !defined(MADV_HUGEPAGE)
+    (void)list;
+    (void)mode;
+    fprintf(stderr, "Huge pages are not supported on this platform; index structures stay on normal pages\n");
+    return 0;
+#else
+    check_transparent_huge_pages();
+    unsigned char *buffer = malloc(WARM_HUGE_PAGE_SIZE);
+    if (buffer == NULL) {
+        fprintf(stderr, "Memory allocation failed for the huge page buffer!\n");
+        return 0;
+    }
+    int explicit_pages = 1;
+    int rc = 0;
+    for (size_t i = 0; rc == 0 && i < list->count; i++) {
+        const WarmRegion *region = &list->items[i];
+        if (region->index && region->mapped && !region->transient) {
+            rc = move_to_huge_pages(region, mode, buffer, &explicit_pages);
+        }
+    }
+    free(buffer);
+    return rc;
+#endif
+}
+
+// Locks one range; the first failure raises RLIMIT_MEMLOCK to its hard limit and tries once more
+static int lock_range(const unsigned char *start, size_t length, int *raised) {
+    if (mlock(start, length) == 0) {
+        return 0;
+    }
+    struct rlimit limit;
+    if (!*raised && (errno == ENOMEM || errno == EPERM) && getrlimit(RLIMIT_MEMLOCK, &limit) == 0 &&
+        limit.rlim_cur < limit.rlim_max) {
+        *raised = 1;
+        limit.rlim_cur = limit.rlim_max;
+        if (setrlimit(RLIMIT_MEMLOCK, &limit) == 0 && mlock(start, length) == 0) {
+            return 0;
+        }
+    }
+    int error = errno;
+    if (getrlimit(RLIMIT_MEMLOCK, &limit) == 0 && limit.rlim_cur != RLIM_INFINITY) {
+        fprintf(stderr, "Can't lock more of the store: %s (RLIMIT_MEMLOCK is %llu bytes, see ulimit -l)\n",
+                strerror(error), (unsigned long long)limit.rlim_cur);
+    } else {
+        fprintf(stderr, "Can't lock more of the store: %s\n", strerror(error));
+    }
+    return -1;
+}
+
+// Locks index regions, then the rest, until the budget is spent; returns the bytes locked
+static uint64_t lock_regions(const RegionList *list, uint64_t budget) {
+    uint64_t locked = 0;
+    int raised = 0;
+    for (int pass = 1; pass >= 0; pass--) {
+        for (size_t i = 0; i < list->count && locked < budget; i++) {
+            const WarmRegion *region = &list->items[i];
+            if (region->index != pass || region->transient) {
+                continue;
+            }
+            size_t length = budget - locked < region->length ? (size_t)(budget - locked) : region->length;
+            if (lock_range(region->start, length, &raised) != 0) {
+                return locked;
+            }
+            locked += length;
+        }
+    }
+    return locked;
+}
+
+/**
+ * Makes an opened store resident before it serves its first lookup.
+ *
+ * After a deploy or a reboot every index page of a mapped store is faulted in
+ * by whichever lookup first needs it, so the first few thousand lookups pay
+ * for disk reads. This does that work up front, in three optional steps:
+ * - huge pages: the index structures (flat store indexes and learned model,
+ *   packed bucket arrays, .mphf pilots, filters and delta segments) are moved
+ *   onto 2 MiB pages, so random probes into them miss the TLB far less;
+ * - prefetch: the index structures, or with WARM_PREFETCH_ALL everything, are
+ *   faulted in by a pool of threads, 16 MiB at a time, with readahead first;
+ *   an SQLite store is warmed by evenly spaced lookups instead;
+ * - mlock: up to lock_budget bytes are locked, index structures first, so
+ *   memory pressure cannot evict them again.
+ * Shards, delta segments, filters, hot sets and .mphf indexes are covered.
+ * Huge pages and locking apply to mapped stores; SQLite manages its own
+ * mapping.
+ *
+ * Parameters:
+ * - db (PwnedDB*): A handle returned by init_db().
+ * - options (const WarmupOptions*): Which steps to take.
+ * - report (WarmupReport*): Receives what was done and how long it took.
+ *
+ * Returns:
+ * - int: 0 on success (steps the system refuses are reported and skipped),
+ *   -1 if moving pages failed and the handle must not be used.
+ */
+int db_warm(PwnedDB *db, const WarmupOptions *options, WarmupReport *report) {
+    memset(report, 0, sizeof(*report));
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    RegionList list = {0};
+    collect_regions(db, options->prefetch, &list);
+    int rc = list.failed ? -1 : 0;
+
+    if (rc == 0 && options->huge_pages != WARM_HUGE_PAGES_OFF) {
+        rc = move_regions_to_huge_pages(&list, options->huge_pages);
+    }
+    if (rc == 0 && options->prefetch != WARM_PREFETCH_NONE) {
+        int threads = options->threads;
+        if (threads <= 0) {
+            long cores = sysconf(_SC_NPROCESSORS_ONLN);
+            threads = cores > 0 ? (int)cores : 1;
+        }
+        report->prefetched = prefetch_regions(&list, options->prefetch, threads);
+        report->probes = probe_sqlite(db, 0, (uint64_t)1 << 32, WARM_SQLITE_PROBES);
+    }
+    if (rc == 0 && options->lock_budget > 0) {
+        report->locked = lock_regions(&list, options->lock_budget);
+    }
+
+    for (size_t i = 0; i < list.count; i++) {
+        if (list.items[i].transient) {
+            munmap((void *)list.items[i].start, list.items[i].length);
+        }
+    }
+    free(list.items);
+    report->huge = huge_page_bytes();
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    report->seconds = (double)(end.tv_sec - start.tv_sec) + (double)(end.tv_nsec - start.tv_nsec) / 1e9;
+    return rc;
+}
+
+void warmup_print_report(FILE *out, const WarmupReport *report) {
+    fprintf(out, "Warmed the store in %.2f s: %.1f MiB prefetched", report->seconds,
+            (double)report->prefetched / (1 << 20));
+    if (report->probes > 0) {
+        fprintf(out, ", %llu B-tree probes", (unsigned long long)report->probes);
+    }
+    fprintf(out, ", %.1f MiB on huge pages, %.1f MiB locked\n", (double)report->huge / (1 << 20),
+            (double)report->locked / (1 << 20));
+}